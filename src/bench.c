@@ -0,0 +1,2109 @@
+/**
+ * Microbenchmarks of public entry points of Python bindings
+ *
+ * Results are printed as JSON, one benchmark per line. Every benchmark
+ * runs a number of samples, each sample is a batch of operations which
+ * takes at least BATCH_MIN_NS; percentiles are taken over samples.
+ * Benchmarks which process a known amount of data also report their
+ * throughput.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include <stdlib.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "python/iface.h"
+#include "bench.h"
+
+/* Minimal duration of one sample */
+#define BATCH_MIN_NS 2000000ULL
+
+/* Default count of samples */
+#define DEFAULT_SAMPLES 30
+
+/* Count of samples of cold start */
+#define COLD_START_SAMPLES 10
+
+/* Default regression threshold in percents */
+#define DEFAULT_THRESHOLD 10.0
+
+typedef struct {
+  const char *name;
+  unsigned long long iterations;
+  double ns_per_op;
+  double allocs_per_op;
+  double p50_ns, p90_ns, p99_ns;
+  size_t bytes;
+  int wrong;               /* Operation gave wrong result */
+} bench_result_t;
+
+typedef struct {
+  char name[128];
+  double p50_ns;
+} baseline_entry_t;
+
+/****
+ * Allocations counting
+ */
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void __libc_free (void *ptr);
+
+/* Count of allocations made by the whole process */
+static unsigned long long allocations = 0;
+
+void*
+malloc (size_t size)
+{
+  ++allocations;
+  return __libc_malloc (size);
+}
+
+void*
+calloc (size_t nmemb, size_t size)
+{
+  ++allocations;
+  return __libc_calloc (nmemb, size);
+}
+
+void*
+realloc (void *ptr, size_t size)
+{
+  ++allocations;
+  return __libc_realloc (ptr, size);
+}
+
+void
+free (void *ptr)
+{
+  __libc_free (ptr);
+}
+
+/* Benchmarks do not need init-tab modules */
+PY_BEGIN_INITTAB(no_modules)
+PY_END_INITTAB
+
+/****
+ * Options
+ */
+
+static int opt_samples = DEFAULT_SAMPLES;
+static double opt_threshold = DEFAULT_THRESHOLD;
+static const char *opt_baseline = NULL;
+static const char *opt_save = NULL;
+static const char *opt_filter = NULL;
+
+static baseline_entry_t *baseline = NULL;
+static int baseline_count = 0;
+static int baseline_size = 0;
+static int regressions = 0;
+static int wrong_results = 0;
+
+static FILE *output = NULL;
+static FILE *save_file = NULL;
+
+/****
+ * Helpers
+ */
+
+/**
+ * Get current monotonic time
+ *
+ * @return current time in nanoseconds
+ */
+static unsigned long long
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Compare two doubles for qsort()
+ */
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double da = *(const double*)a, db = *(const double*)b;
+
+  return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+/**
+ * Get percentile of sorted samples
+ *
+ * @param samples - sorted samples
+ * @param count - count of samples
+ * @param percentile - percentile to get (from 0 to 100)
+ * @return value of percentile
+ */
+static double
+percentile (const double *samples, int count, double percentile)
+{
+  int index = (int)(percentile / 100.0 * (count - 1) + 0.5);
+
+  return samples[MIN (MAX (index, 0), count - 1)];
+}
+
+/**
+ * Fill result's statistics from samples
+ *
+ * @param result - result to be filled
+ * @param samples - samples in nanoseconds per operation (will be sorted)
+ * @param count - count of samples
+ */
+static void
+fill_result (bench_result_t *result, double *samples, int count)
+{
+  double sum = 0;
+  int i;
+
+  for (i = 0; i < count; ++i)
+    {
+      sum += samples[i];
+    }
+
+  qsort (samples, count, sizeof (double), compare_doubles);
+
+  result->ns_per_op = sum / count;
+  result->p50_ns = percentile (samples, count, 50);
+  result->p90_ns = percentile (samples, count, 90);
+  result->p99_ns = percentile (samples, count, 99);
+}
+
+/**
+ * Redirect stdout to /dev/null to hide messages of python_init()
+ *
+ * @return descriptor of original stdout
+ */
+static int
+quiet_stdout (void)
+{
+  int saved, devnull;
+
+  fflush (stdout);
+  saved = dup (STDOUT_FILENO);
+  devnull = open ("/dev/null", O_WRONLY);
+  dup2 (devnull, STDOUT_FILENO);
+  close (devnull);
+
+  return saved;
+}
+
+/**
+ * Restore stdout redirected by quiet_stdout()
+ *
+ * @param saved - descriptor of original stdout
+ */
+static void
+restore_stdout (int saved)
+{
+  fflush (stdout);
+  dup2 (saved, STDOUT_FILENO);
+  close (saved);
+}
+
+/****
+ * Baseline
+ */
+
+/**
+ * Load baseline from file written by --save
+ *
+ * @param file_name - name of file
+ * @return zero on success, non-zero otherwise
+ */
+static int
+load_baseline (const char *file_name)
+{
+  FILE *file = fopen (file_name, "r");
+  char line[1024];
+
+  if (!file)
+    {
+      return -1;
+    }
+
+  while (fgets (line, sizeof (line), file))
+    {
+      baseline_entry_t *entry;
+      char *p50 = strstr (line, "\"p50_ns\": ");
+
+      if (baseline_count == baseline_size)
+        {
+          baseline_size = MAX (baseline_size * 2, 64);
+          baseline = realloc (baseline,
+                              sizeof (baseline_entry_t) * baseline_size);
+        }
+
+      entry = &baseline[baseline_count];
+
+      if (sscanf (line, " {\"name\": \"%127[^\"]\"", entry->name) == 1 && p50)
+        {
+          entry->p50_ns = atof (p50 + strlen ("\"p50_ns\": "));
+          ++baseline_count;
+        }
+    }
+
+  fclose (file);
+
+  return 0;
+}
+
+/**
+ * Find benchmark in baseline
+ *
+ * @param name - name of benchmark
+ * @return entry of baseline or NULL if there is no such benchmark
+ */
+static const baseline_entry_t*
+find_baseline (const char *name)
+{
+  int i;
+
+  for (i = 0; i < baseline_count; ++i)
+    {
+      if (!strcmp (baseline[i].name, name))
+        {
+          return &baseline[i];
+        }
+    }
+
+  return NULL;
+}
+
+/****
+ * Reporting
+ */
+
+/**
+ * Print result of benchmark as JSON object
+ *
+ * @param file - file to print to
+ * @param result - result to be printed
+ * @param first - is it a first benchmark?
+ */
+static void
+print_result_json (FILE *file, const bench_result_t *result, int first)
+{
+  fprintf (file, "%s  {\"name\": \"%s\", \"iterations\": %llu, "
+           "\"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, "
+           "\"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f",
+           first ? "" : ",\n", result->name, result->iterations,
+           result->ns_per_op, result->allocs_per_op,
+           result->p50_ns, result->p90_ns, result->p99_ns);
+
+  if (result->bytes)
+    {
+      /* Bytes per nanosecond are gigabytes per second */
+      fprintf (file, ", \"bytes_per_op\": %lu, \"mb_per_s\": %.1f",
+               (unsigned long)result->bytes,
+               result->bytes / result->p50_ns * 1000.0);
+    }
+}
+
+/**
+ * Report result of benchmark and compare it with baseline
+ *
+ * @param result - result to be reported
+ */
+static void
+report (const bench_result_t *result)
+{
+  static int first = 1;
+  const baseline_entry_t *base = find_baseline (result->name);
+
+  print_result_json (output, result, first);
+
+  if (base && base->p50_ns > 0)
+    {
+      double change = (result->p50_ns - base->p50_ns) / base->p50_ns * 100.0;
+
+      fprintf (output, ", \"baseline_p50_ns\": %.1f, \"change_pct\": %.1f",
+               base->p50_ns, change);
+
+      if (change > opt_threshold)
+        {
+          fprintf (output, ", \"regression\": true");
+          fprintf (stderr, "REGRESSION: %s: p50 %.1f ns -> %.1f ns "
+                   "(%+.1f%%)\n", result->name, base->p50_ns,
+                   result->p50_ns, change);
+          ++regressions;
+        }
+    }
+
+  if (result->wrong)
+    {
+      fprintf (output, ", \"wrong_result\": true");
+      fprintf (stderr, "WRONG RESULT: %s\n", result->name);
+      ++wrong_results;
+    }
+
+  fprintf (output, "}");
+
+  if (save_file)
+    {
+      print_result_json (save_file, result, first);
+      fprintf (save_file, "}");
+    }
+
+  first = 0;
+}
+
+/****
+ * Runner
+ */
+
+/**
+ * Run benchmark and report its result
+ *
+ * @param bench - benchmark to run
+ */
+static void
+run_bench (const bench_t *bench)
+{
+  bench_result_t result;
+  unsigned long long batch = 1, start, allocs = 0, i;
+  double *samples;
+  int sample;
+
+  if (opt_filter && !strstr (bench->name, opt_filter))
+    {
+      return;
+    }
+
+  memset (&result, 0, sizeof (result));
+  result.name = bench->name;
+
+  if (bench->setup)
+    {
+      bench->setup ();
+    }
+
+  /* Calibrate size of batch */
+  for (;;)
+    {
+      start = now ();
+      for (i = 0; i < batch; ++i)
+        {
+          bench->op ();
+        }
+
+      if (now () - start >= BATCH_MIN_NS || batch >= (1ULL << 30))
+        {
+          break;
+        }
+
+      batch *= 2;
+    }
+
+  samples = malloc (sizeof (double) * opt_samples);
+
+  for (sample = 0; sample < opt_samples; ++sample)
+    {
+      unsigned long long allocs_start = allocations;
+
+      start = now ();
+      for (i = 0; i < batch; ++i)
+        {
+          bench->op ();
+        }
+
+      samples[sample] = (double)(now () - start) / batch;
+      allocs += allocations - allocs_start;
+    }
+
+  /* Fast path which gives wrong result shouldn't win */
+  result.wrong = bench->check && bench->check ();
+
+  if (bench->teardown)
+    {
+      bench->teardown ();
+    }
+
+  result.iterations = batch * opt_samples;
+  result.bytes = bench->bytes ? *bench->bytes : 0;
+  result.allocs_per_op = (double)allocs / result.iterations;
+  fill_result (&result, samples, opt_samples);
+  free (samples);
+
+  report (&result);
+}
+
+/**
+ * Measure cold start of python_init() in child processes
+ *
+ * @param self - path to benchmark's executable
+ * @param name - name of benchmark
+ * @param profile - startup profile of python_init()
+ */
+static void
+run_cold_start (const char *self, const char *name, int profile)
+{
+  bench_result_t result;
+  double samples[COLD_START_SAMPLES];
+  double allocs = 0;
+  char command[4096];
+  int i, count = 0;
+
+  if (opt_filter && !strstr (name, opt_filter))
+    {
+      return;
+    }
+
+  memset (&result, 0, sizeof (result));
+  result.name = name;
+
+  snprintf (command, sizeof (command), "'%s' --cold-start-child=%d",
+            self, profile);
+
+  for (i = 0; i < COLD_START_SAMPLES; ++i)
+    {
+      FILE *child = popen (command, "r");
+      unsigned long long ns, child_allocs;
+
+      if (!child)
+        {
+          continue;
+        }
+
+      if (fscanf (child, "%llu %llu", &ns, &child_allocs) == 2)
+        {
+          samples[count++] = ns;
+          allocs += child_allocs;
+        }
+
+      pclose (child);
+    }
+
+  if (!count)
+    {
+      fprintf (stderr, "Unable to measure cold start of python_init()\n");
+      return;
+    }
+
+  result.iterations = count;
+  result.allocs_per_op = allocs / count;
+  fill_result (&result, samples, count);
+
+  report (&result);
+}
+
+/**
+ * Body of child process for measuring cold start
+ *
+ * @param argc - count of arguments
+ * @param argv - argument values
+ * @return exit code of child
+ */
+static int
+cold_start_child (int argc, char **argv)
+{
+  unsigned long long start, elapsed, allocs;
+  int saved = quiet_stdout ();
+
+  allocs = allocations;
+  start = now ();
+
+  if (python_init (argc, argv, no_modules))
+    {
+      restore_stdout (saved);
+      return EXIT_FAILURE;
+    }
+
+  elapsed = now () - start;
+  allocs = allocations - allocs;
+
+  restore_stdout (saved);
+  printf ("%llu %llu\n", elapsed, allocs);
+
+  return EXIT_SUCCESS;
+}
+
+/****
+ * Fixtures
+ */
+
+static py_script_t *script_empty = NULL;
+static py_script_t *script_small = NULL;
+static py_script_t *script_large = NULL;
+static PyObject *fixture_dict = NULL;
+static PyObject *fixture_object = NULL;
+
+PY_METHOD(bench_method)
+PY_METH_END
+
+PY_BEGIN_METHMAP(bench_methods)
+  PY_METHMAP_DEF (L"first", bench_method, METH_VARARGS, L"First method")
+  PY_METHMAP_DEF (L"second", bench_method, METH_VARARGS, L"Second method")
+  PY_METHMAP_DEF (L"third", bench_method, METH_VARARGS, L"Third method")
+  PY_METHMAP_DEF (L"fourth", bench_method, METH_VARARGS, L"Fourth method")
+PY_END_METHMAP
+
+PY_BEGIN_STATIC_METHMAP(bench_static_methods)
+  PY_STATIC_METHMAP_DEF ("first", bench_method, METH_VARARGS, "First method")
+  PY_STATIC_METHMAP_DEF ("second", bench_method, METH_VARARGS,
+                         "Second method")
+  PY_STATIC_METHMAP_DEF ("third", bench_method, METH_VARARGS, "Third method")
+  PY_STATIC_METHMAP_DEF ("fourth", bench_method, METH_VARARGS,
+                         "Fourth method")
+PY_END_STATIC_METHMAP
+
+/**
+ * Generate text of a large script
+ *
+ * @return text of script
+ * @sideeffect allocate memory for output value
+ */
+static wchar_t*
+large_script_text (void)
+{
+  size_t size = 512 * 1024, len = 0;
+  wchar_t *text = malloc (sizeof (wchar_t) * size);
+  int i;
+
+  for (i = 0; i < 2000; ++i)
+    {
+      len += swprintf (text + len, size - len,
+                       L"def func%d (a, b):\n  return a * %d + b\n"
+                       L"value%d = func%d (%d, 1)\n", i, i, i, i, i);
+    }
+
+  return text;
+}
+
+static void
+setup_fixtures (void)
+{
+  PyObject *result;
+  py_script_t *script;
+  wchar_t *text = large_script_text ();
+
+  script_empty = py_script_new_buffer (L"");
+  script_small = py_script_new_buffer (L"a = 1\nb = a + 2\nprint b\n");
+  script_large = py_script_new_buffer (text);
+
+  free (text);
+
+  script = py_script_new_buffer (L"class A:\n  pass\n"
+                                 L"A.longField = 314\n"
+                                 L"A.floatField = 3.14\n"
+                                 L"A.stringField = 'Some string field'\n");
+
+  fixture_dict = PyDict_New ();
+  PyDict_SetItemString (fixture_dict, "__builtins__",
+                        py_builtins_get_global ());
+
+  result = py_run_script_at_dict (script, fixture_dict);
+  Py_XDECREF (result);
+  py_script_free (script);
+
+  fixture_object = PyDict_GetItemString (fixture_dict, "A");
+  Py_XINCREF (fixture_object);
+}
+
+static void
+teardown_fixtures (void)
+{
+  py_script_free (script_empty);
+  py_script_free (script_small);
+  py_script_free (script_large);
+
+  Py_XDECREF (fixture_object);
+  PyDict_Clear (fixture_dict);
+  Py_DECREF (fixture_dict);
+}
+
+/* Texts for conversion benchmarks */
+enum { TEXT_ASCII, TEXT_MIXED, TEXT_CJK, TEXT_COUNT };
+
+/* Approximate size of text for conversion benchmarks in bytes */
+#define TEXT_SIZE (64 * 1024)
+
+static char *text_mbs[TEXT_COUNT];
+static wchar_t *text_wcs[TEXT_COUNT];
+static size_t text_bytes[TEXT_COUNT];
+
+/**
+ * Build text for conversion benchmark by repeating a line
+ *
+ * @param index - index of text
+ * @param line - line to be repeated
+ */
+static void
+build_text (int index, const wchar_t *line)
+{
+  size_t line_len = wcslen (line), count = 0, i;
+  wchar_t *wcs;
+
+  /* Repeat line until UTF-8 representation is large enough */
+  while (count * py_utf8_encoded_size (line, line_len) < TEXT_SIZE)
+    {
+      ++count;
+    }
+
+  wcs = malloc (sizeof (wchar_t) * (count * line_len + 1));
+  for (i = 0; i < count; ++i)
+    {
+      wmemcpy (wcs + i * line_len, line, line_len);
+    }
+  wcs[count * line_len] = 0;
+
+  text_wcs[index] = wcs;
+  text_mbs[index] = py_wcs2mbs (wcs);
+  text_bytes[index] = strlen (text_mbs[index]);
+}
+
+static void
+setup_texts (void)
+{
+  build_text (TEXT_ASCII, L"Captured line of output: value = 314, "
+                          L"status = ok\n");
+  build_text (TEXT_MIXED, L"Captured line of output: \x0437\x043d\x0430"
+                          L"\x0447\x0435\x043d\x0438\x0435 = 314, "
+                          L"caf\x00e9 status = ok\n");
+  build_text (TEXT_CJK, L"\x6355\x83b7\x7684\x8f93\x51fa\x884c\xff1a"
+                        L"\x503c\x4e3a\x4e09\x767e\x5341\x56db\x3002\n");
+
+  /* libc conversions are measured in UTF-8 locale to be comparable */
+  setlocale (LC_CTYPE, "C.UTF-8");
+}
+
+static void
+teardown_texts (void)
+{
+  int i;
+
+  for (i = 0; i < TEXT_COUNT; ++i)
+    {
+      SAFE_FREE (text_mbs[i]);
+      SAFE_FREE (text_wcs[i]);
+    }
+}
+
+static void
+setup_capture (void)
+{
+  int i;
+
+  py_tracer_truncate_buffer (PY_STDOUT);
+
+  for (i = 0; i < 64; ++i)
+    {
+      py_proc_write (PY_STDOUT, L"Captured line number %d of output\n", i);
+    }
+}
+
+static void
+teardown_capture (void)
+{
+  py_tracer_truncate_buffer (PY_STDOUT);
+}
+
+/****
+ * Operations
+ */
+
+/* Some operation failed since the last check */
+static int op_failed = 0;
+
+/**
+ * Free result of script and remember whether script failed
+ *
+ * @param result - result of script
+ */
+static void
+run_free (extpy_run_result_t *result)
+{
+  if (!result || !result->result)
+    {
+      op_failed = 1;
+    }
+
+  extpy_run_free (result);
+}
+
+/**
+ * Check that no operation failed since the last check
+ *
+ * @return non-zero if some operation failed
+ */
+static int
+check_failed (void)
+{
+  int failed = op_failed;
+
+  op_failed = 0;
+
+  return failed;
+}
+
+static void
+op_module_new (void)
+{
+  py_module_free (py_module_new (L"BenchModule", L"Benchmark module",
+                                 bench_methods));
+}
+
+static void
+op_module_new_static (void)
+{
+  py_module_free (py_module_new_static (L"BenchModule", L"Benchmark module",
+                                        bench_static_methods));
+}
+
+static void
+op_run_empty (void)
+{
+  run_free (extpy_run_script (script_empty));
+}
+
+static void
+op_run_small (void)
+{
+  run_free (extpy_run_script (script_small));
+}
+
+static void
+op_run_large (void)
+{
+  run_free (extpy_run_script (script_large));
+}
+
+static void
+op_run_large_compile (void)
+{
+  py_script_free_compiled (script_large);
+  run_free (extpy_run_script (script_large));
+}
+
+/* Values which are got by attribute benchmarks */
+static long attr_long = 0;
+static double attr_double = 0;
+static int attr_string_ok = 0;
+
+static void
+op_get_long_attr (void)
+{
+  attr_long = extpy_get_long_attr (fixture_object, L"longField");
+}
+
+static int
+check_long_attr (void)
+{
+  return attr_long != 314;
+}
+
+static void
+op_get_double_attr (void)
+{
+  attr_double = extpy_get_double_attr (fixture_object, L"floatField");
+}
+
+static int
+check_double_attr (void)
+{
+  return attr_double != 3.14;
+}
+
+static void
+op_get_string_attr (void)
+{
+  wchar_t *value = extpy_get_string_attr (fixture_object, L"stringField");
+
+  attr_string_ok = value && !wcscmp (value, L"Some string field");
+  free (value);
+}
+
+static int
+check_string_attr (void)
+{
+  return !attr_string_ok;
+}
+
+static void
+op_proc_write (void)
+{
+  py_proc_write (PY_STDOUT, L"Value: %d\n", 314);
+}
+
+static void
+op_get_buffer (void)
+{
+  free (py_tracer_get_buffer (PY_STDOUT));
+}
+
+static void
+op_dict_set_item_str (void)
+{
+  extpy_dict_set_item_str (fixture_dict, L"benchKey", PyInt_FromLong (314));
+}
+
+/* Directory with modules of import benchmarks */
+static char import_dir[] = "/tmp/pybench.XXXXXX";
+
+/* Source of module of import benchmarks */
+#define IMPORT_SOURCE "X = 1\ndef f (a):\n  return a + X\n"
+
+/**
+ * Create module of import benchmarks in temporary directory
+ *
+ * @param name - name of module
+ */
+static void
+create_import_module (const char *name)
+{
+  char path[4096];
+  FILE *stream;
+
+  strcpy (import_dir, "/tmp/pybench.XXXXXX");
+  if (!mkdtemp (import_dir))
+    {
+      return;
+    }
+
+  snprintf (path, sizeof (path), "%s/%s.py", import_dir, name);
+  stream = fopen (path, "w");
+  fputs (IMPORT_SOURCE, stream);
+  fclose (stream);
+}
+
+static void
+setup_import_path (void)
+{
+  wchar_t *dirname;
+
+  create_import_module ("bench_path_mod");
+
+  /* Directory is the last entry of sys.path, as helpers usually are */
+  MBS2WCS (dirname, import_dir);
+  py_syspath_append (dirname);
+  free (dirname);
+}
+
+static void
+setup_import_bundle (void)
+{
+  wchar_t *dirname, *archive;
+  char path[4096];
+
+  create_import_module ("bench_bundle_mod");
+
+  snprintf (path, sizeof (path), "%s.pyb", import_dir);
+  MBS2WCS (archive, path);
+  MBS2WCS (dirname, import_dir);
+
+  py_bundle_build (archive, dirname);
+  py_bundle_mount (archive);
+
+  free (archive);
+  free (dirname);
+}
+
+static void
+teardown_import (void)
+{
+  char command[4096];
+
+  snprintf (command, sizeof (command), "rm -rf '%s' '%s.pyb'",
+            import_dir, import_dir);
+  if (system (command))
+    {
+      fprintf (stderr, "Unable to remove %s\n", import_dir);
+    }
+}
+
+/**
+ * Import module and forget it, so next import is done from scratch
+ *
+ * @param name - name of module
+ */
+static void
+import_fresh (const char *name)
+{
+  PyObject *mod = PyImport_ImportModule (name);
+
+  if (mod)
+    {
+      Py_DECREF (mod);
+      PyDict_DelItemString (PyImport_GetModuleDict (), name);
+    }
+  else
+    {
+      PyErr_Clear ();
+      op_failed = 1;
+    }
+}
+
+static void
+op_import_path (void)
+{
+  import_fresh ("bench_path_mod");
+}
+
+static void
+op_import_bundle (void)
+{
+  import_fresh ("bench_bundle_mod");
+}
+
+/* Script of extpy_run_file() benchmarks */
+static wchar_t *run_file_name = NULL;
+
+static void
+setup_run_file (void)
+{
+  char path[4096];
+
+  create_import_module ("bench_run_file");
+
+  snprintf (path, sizeof (path), "%s/bench_run_file.py", import_dir);
+  MBS2WCS (run_file_name, path);
+}
+
+static void
+setup_run_file_watched (void)
+{
+  setup_run_file ();
+
+  py_set_watch (PY_WATCH_SCRIPTS);
+  py_watch_init ();
+}
+
+static void
+teardown_run_file (void)
+{
+  py_watch_done ();
+  py_set_watch (0);
+
+  SAFE_FREE (run_file_name);
+  teardown_import ();
+}
+
+static void
+op_run_file (void)
+{
+  run_free (extpy_run_file (run_file_name));
+}
+
+/* Samples of array benchmarks */
+#define SAMPLES_COUNT 65536
+static double samples[SAMPLES_COUNT];
+static Py_ssize_t samples_len = 0;
+
+/* Passing of samples to scripts the way it's done without arrays */
+static void
+op_samples_list (void)
+{
+  PyObject *list = PyList_New (SAMPLES_COUNT);
+  long i;
+
+  for (i = 0; i < SAMPLES_COUNT; ++i)
+    {
+      PyList_SET_ITEM (list, i, PyFloat_FromDouble (samples[i]));
+    }
+
+  samples_len = PyList_GET_SIZE (list);
+  Py_DECREF (list);
+}
+
+static void
+op_samples_array (void)
+{
+  PyObject *array = py_array_new_1d (samples, PY_ARRAY_FLOAT64,
+                                     SAMPLES_COUNT, PY_ARRAY_READONLY,
+                                     NULL, NULL);
+
+  samples_len = PySequence_Size (array);
+  Py_DECREF (array);
+}
+
+static int
+check_samples (void)
+{
+  return samples_len != SAMPLES_COUNT;
+}
+
+/* Sequence of bulk conversion benchmarks */
+static PyObject *convert_seq = NULL;
+
+/* Expected and converted last element and length of sequence */
+static double convert_expected = 0;
+static double convert_last = 0;
+static Py_ssize_t convert_len = 0;
+
+/**
+ * Create sequence for bulk conversion benchmarks
+ *
+ * @param expr - Python expression which creates sequence
+ */
+static void
+create_convert_seq (const char *expr)
+{
+  PyObject *dict = PyDict_New ();
+
+  PyDict_SetItemString (dict, "__builtins__", PyEval_GetBuiltins ());
+  convert_seq = PyRun_String (expr, Py_eval_input, dict, dict);
+  Py_DECREF (dict);
+}
+
+static void
+setup_float_list (void)
+{
+  create_convert_seq ("[i * 0.5 for i in xrange(4096)]");
+  convert_expected = 4095 * 0.5;
+}
+
+static void
+setup_int_list (void)
+{
+  create_convert_seq ("range(4096)");
+  convert_expected = 4095;
+}
+
+static void
+setup_float_buffer (void)
+{
+  create_convert_seq ("__import__('array').array('f', xrange(4096))");
+  convert_expected = 4095;
+}
+
+static void
+teardown_convert_seq (void)
+{
+  Py_CLEAR (convert_seq);
+}
+
+/* Conversion the way it's done without bulk converters */
+static void
+op_to_doubles_loop (void)
+{
+  Py_ssize_t i, len = PySequence_Size (convert_seq);
+  double *result = malloc (sizeof (double) * len);
+
+  for (i = 0; i < len; ++i)
+    {
+      PyObject *item = PySequence_GetItem (convert_seq, i);
+      result[i] = PyFloat_AsDouble (item);
+      Py_DECREF (item);
+    }
+
+  convert_len = len;
+  convert_last = result[len - 1];
+  free (result);
+}
+
+static void
+op_to_double_array (void)
+{
+  Py_ssize_t len;
+  double *result = extpy_to_double_array (convert_seq, &len, NULL);
+
+  convert_len = result ? len : 0;
+  convert_last = result ? result[len - 1] : 0;
+  free (result);
+}
+
+static void
+op_to_long_array (void)
+{
+  Py_ssize_t len;
+  long *result = extpy_to_long_array (convert_seq, &len, NULL);
+
+  convert_len = result ? len : 0;
+  convert_last = result ? result[len - 1] : 0;
+  free (result);
+}
+
+static int
+check_convert (void)
+{
+  return convert_len != 4096 || convert_last != convert_expected;
+}
+
+/* Objects of field access benchmarks */
+#define FIELDS_COUNT 1024
+
+typedef struct {
+  double x;
+  double y;
+} bench_point_t;
+
+PY_BEGIN_FIELDS (bench_point_fields)
+PY_FIELD_DEF (bench_point_t, x, PY_FIELD_DOUBLE, 0, NULL)
+PY_FIELD_DEF (bench_point_t, y, PY_FIELD_DOUBLE, 0, NULL)
+PY_END_FIELDS
+
+static PyObject *fields_dict = NULL;
+static PyObject *fields_code = NULL;
+static PyObject *fields_array = NULL;
+static double fields_sum = 0;
+
+/**
+ * Create namespace and code of field access benchmarks
+ *
+ * @param source - script which creates list `objs' of objects
+ */
+static void
+create_fields (const char *source)
+{
+  PyObject *result;
+
+  fields_dict = PyDict_New ();
+  PyDict_SetItemString (fields_dict, "__builtins__", PyEval_GetBuiltins ());
+
+  result = PyRun_String (source, Py_file_input, fields_dict, fields_dict);
+  Py_XDECREF (result);
+
+  fields_code = Py_CompileString ("for o in objs: o.x = o.x + o.y\n",
+                                  "<fields>", Py_file_input);
+}
+
+/* Plain class whose attributes live in instance dictionary */
+static void
+setup_fields_class (void)
+{
+  create_fields ("class Point(object):\n"
+                 "  def __init__(self, i):\n"
+                 "    self.x = float(i)\n"
+                 "    self.y = 0.5\n"
+                 "objs = [Point(i) for i in xrange(1024)]\n");
+}
+
+static void
+setup_fields_record (void)
+{
+  static PyTypeObject *type = NULL;
+  bench_point_t *points;
+  PyObject *objs;
+  long i;
+
+  if (!type)
+    {
+      type = py_record_type_new ("Point", NULL, bench_point_fields,
+                                 sizeof (bench_point_t));
+    }
+
+  fields_array = py_record_array_new (type, FIELDS_COUNT);
+  points = py_record_array_data (fields_array, NULL);
+
+  for (i = 0; i < FIELDS_COUNT; ++i)
+    {
+      points[i].x = i;
+      points[i].y = 0.5;
+    }
+
+  create_fields ("");
+
+  objs = PySequence_List (fields_array);
+  PyDict_SetItemString (fields_dict, "objs", objs);
+  Py_DECREF (objs);
+}
+
+static void
+teardown_fields (void)
+{
+  Py_CLEAR (fields_code);
+  Py_CLEAR (fields_dict);
+  Py_CLEAR (fields_array);
+}
+
+static void
+op_fields_script (void)
+{
+  PyObject *result;
+
+  result = PyEval_EvalCode ((PyCodeObject*)fields_code, fields_dict,
+                            fields_dict);
+  Py_XDECREF (result);
+}
+
+/* Every pass adds the same y to all x, so x keep their differences */
+static int
+check_fields_script (void)
+{
+  PyObject *objs = PyDict_GetItemString (fields_dict, "objs");
+  double x0, x1;
+
+  if (!objs || PySequence_Size (objs) != FIELDS_COUNT)
+    {
+      return -1;
+    }
+
+  x0 = extpy_get_double_attr (PyList_GET_ITEM (objs, 0), L"x");
+  x1 = extpy_get_double_attr (PyList_GET_ITEM (objs, 1), L"x");
+
+  return x1 - x0 != 1.0 || x0 <= 0;
+}
+
+/* Reading of fields the way host does it with plain classes */
+static void
+op_fields_getattr (void)
+{
+  PyObject *objs = PyDict_GetItemString (fields_dict, "objs");
+  volatile double sum = 0;
+  long i;
+
+  for (i = 0; i < FIELDS_COUNT; ++i)
+    {
+      sum += extpy_get_double_attr (PyList_GET_ITEM (objs, i), L"x");
+    }
+
+  fields_sum = sum;
+}
+
+static void
+op_fields_record (void)
+{
+  bench_point_t *points = py_record_array_data (fields_array, NULL);
+  volatile double sum = 0;
+  long i;
+
+  for (i = 0; i < FIELDS_COUNT; ++i)
+    {
+      sum += points[i].x;
+    }
+
+  fields_sum = sum;
+}
+
+static int
+check_fields_host (void)
+{
+  return fields_sum != FIELDS_COUNT * (FIELDS_COUNT - 1) / 2.0;
+}
+
+/* Callback of call benchmarks */
+static PyObject *call_func = NULL;
+static py_call_t *call_handle = NULL;
+static long call_result = 0;
+
+static void
+setup_call (void)
+{
+  PyObject *dict = PyDict_New (), *result;
+
+  PyDict_SetItemString (dict, "__builtins__", PyEval_GetBuiltins ());
+  result = PyRun_String ("def callback(id, value):\n"
+                         "  return id\n", Py_file_input, dict, dict);
+  Py_XDECREF (result);
+
+  call_func = PyDict_GetItemString (dict, "callback");
+  Py_XINCREF (call_func);
+  Py_DECREF (dict);
+
+  call_handle = py_call_new (call_func, 2);
+}
+
+static void
+teardown_call (void)
+{
+  py_call_free (call_handle);
+  call_handle = NULL;
+  Py_CLEAR (call_func);
+}
+
+/* Call of callback the way it's done without handles */
+static void
+op_call_macro (void)
+{
+  PyObject *result;
+
+  EXTPY_CALL_OBJECT (result, call_func, "(ld)", 314L, 2.5);
+  call_result = result ? PyInt_AsLong (result) : -1;
+  Py_XDECREF (result);
+}
+
+static void
+op_call_handle (void)
+{
+  PyObject *result;
+
+  py_call_set_long (call_handle, 0, 314);
+  py_call_set_double (call_handle, 1, 2.5);
+
+  result = py_call_invoke (call_handle);
+  call_result = result ? PyInt_AsLong (result) : -1;
+  Py_XDECREF (result);
+}
+
+static int
+check_call (void)
+{
+  return call_result != 314;
+}
+
+/* Resolution of function the way it's done without cache */
+static PyObject *resolved = NULL;
+
+static void
+op_resolve_import (void)
+{
+  PyObject *module = PyImport_ImportModule ("posixpath"), *func;
+
+  func = PyObject_GetAttrString (module, "join");
+  resolved = func;
+  Py_DECREF (func);
+  Py_DECREF (module);
+}
+
+static void
+op_resolve_cached (void)
+{
+  resolved = py_call_resolve ("posixpath", "join");
+}
+
+static int
+check_resolve (void)
+{
+  PyObject *module = PyImport_ImportModule ("posixpath"), *func;
+  int wrong;
+
+  func = PyObject_GetAttrString (module, "join");
+  wrong = func != resolved;
+  Py_DECREF (func);
+  Py_DECREF (module);
+
+  return wrong;
+}
+
+/* Records of batch benchmarks */
+#define BATCH_COUNT 1024
+
+typedef struct {
+  long id;
+  double x;
+  double y;
+} bench_item_t;
+
+PY_BEGIN_FIELDS (bench_item_fields)
+PY_FIELD_DEF (bench_item_t, id, PY_FIELD_LONG, 0, NULL)
+PY_FIELD_DEF (bench_item_t, x, PY_FIELD_DOUBLE, 0, NULL)
+PY_FIELD_DEF (bench_item_t, y, PY_FIELD_DOUBLE, 0, NULL)
+PY_END_FIELDS
+
+static bench_item_t batch_items[BATCH_COUNT];
+static double batch_scores[BATCH_COUNT];
+static PyObject *batch_func = NULL;
+
+static void
+setup_batch (void)
+{
+  PyObject *dict = PyDict_New (), *result;
+  long i;
+
+  PyDict_SetItemString (dict, "__builtins__", PyEval_GetBuiltins ());
+  result = PyRun_String ("def score(id, x, y):\n"
+                         "  return x * 0.5 + y\n", Py_file_input, dict, dict);
+  Py_XDECREF (result);
+
+  batch_func = PyDict_GetItemString (dict, "score");
+  Py_XINCREF (batch_func);
+  Py_DECREF (dict);
+
+  for (i = 0; i < BATCH_COUNT; ++i)
+    {
+      batch_items[i].id = i;
+      batch_items[i].x = i * 0.25;
+      batch_items[i].y = 1.0;
+    }
+
+  memset (batch_scores, 0, sizeof (batch_scores));
+}
+
+static void
+teardown_batch (void)
+{
+  Py_CLEAR (batch_func);
+}
+
+/* Scoring of records the way it's done without batches */
+static void
+op_batch_loop (void)
+{
+  long i;
+
+  for (i = 0; i < BATCH_COUNT; ++i)
+    {
+      PyObject *result;
+
+      EXTPY_CALL_OBJECT (result, batch_func, "(ldd)", batch_items[i].id,
+                         batch_items[i].x, batch_items[i].y);
+
+      if (result)
+        {
+          batch_scores[i] = PyFloat_AsDouble (result);
+          Py_DECREF (result);
+        }
+    }
+}
+
+static void
+op_batch_run (void)
+{
+  py_batch_t batch = {0};
+
+  batch.callable = batch_func;
+  batch.records = batch_items;
+  batch.stride = sizeof (bench_item_t);
+  batch.count = BATCH_COUNT;
+  batch.fields = bench_item_fields;
+  batch.out = batch_scores;
+  batch.out_type = PY_FIELD_DOUBLE;
+
+  py_batch_run (&batch);
+  py_batch_free_errors (&batch);
+}
+
+static int
+check_batch (void)
+{
+  long i;
+
+  for (i = 0; i < BATCH_COUNT; ++i)
+    {
+      if (batch_scores[i] != batch_items[i].x * 0.5 + batch_items[i].y)
+        {
+          return -1;
+        }
+    }
+
+  return 0;
+}
+
+/* Coroutines of scheduler benchmarks */
+#define CORO_COUNT 1024
+
+static py_sched_t *coro_sched = NULL;
+static py_coro_t *coro_waiting[CORO_COUNT];
+static long coro_waiting_count = 0;
+static long coro_next = 0;
+
+static void
+coro_proc (py_coro_t *coro, int event, PyObject *arg, void *data)
+{
+  if (event == PY_CORO_REQUEST)
+    {
+      coro_waiting[coro_waiting_count++ % CORO_COUNT] = coro;
+    }
+}
+
+static void
+setup_coro (void)
+{
+  py_script_t *script;
+  long i;
+
+  script = py_script_new_buffer (L"def main():\n"
+                                 L"  total = 0\n"
+                                 L"  while True:\n"
+                                 L"    total += yield 'data'\n");
+
+  coro_sched = py_sched_new (coro_proc, NULL);
+  coro_waiting_count = coro_next = 0;
+
+  for (i = 0; i < CORO_COUNT; ++i)
+    {
+      py_sched_spawn (coro_sched, script, "main", NULL);
+    }
+
+  py_sched_run (coro_sched);
+  py_script_free (script);
+}
+
+static void
+teardown_coro (void)
+{
+  py_sched_free (coro_sched);
+  coro_sched = NULL;
+}
+
+static void
+op_coro_resume (void)
+{
+  static PyObject *value = NULL;
+
+  if (!value)
+    {
+      value = PyInt_FromLong (1);
+    }
+
+  py_sched_resume (coro_sched, coro_waiting[coro_next++ % CORO_COUNT], value);
+  py_sched_run (coro_sched);
+}
+
+/* Every resumed coroutine should request data again */
+static int
+check_coro (void)
+{
+  return py_sched_count (coro_sched) != CORO_COUNT ||
+    coro_waiting_count != CORO_COUNT + coro_next;
+}
+
+/* Namespace and code of I/O benchmarks */
+static PyObject *io_dict = NULL;
+static PyObject *io_code = NULL;
+
+/**
+ * Create file and code of I/O benchmark
+ *
+ * @param source - script which reads file `path'
+ */
+static void
+create_io (const char *source)
+{
+  char path[4096];
+
+  create_import_module ("bench_io");
+  snprintf (path, sizeof (path), "%s/bench_io.py", import_dir);
+
+  io_dict = py_global_dictionary_new ();
+  extpy_dict_set_item_str (io_dict, L"path", PyString_FromString (path));
+
+  io_code = Py_CompileString (source, "<io>", Py_file_input);
+}
+
+/* Reading of file the way scripts do it with standard library */
+static void
+setup_io_open (void)
+{
+  create_io ("f = open(path)\n"
+             "data = f.read()\n"
+             "f.close()\n");
+}
+
+static void
+setup_io_read_file (void)
+{
+  create_io ("data = readFile(path)\n");
+}
+
+static void
+teardown_io (void)
+{
+  Py_CLEAR (io_code);
+  py_global_dictionary_free (io_dict);
+  io_dict = NULL;
+  teardown_import ();
+}
+
+static void
+op_io (void)
+{
+  PyObject *result;
+
+  result = PyEval_EvalCode ((PyCodeObject*)io_code, io_dict, io_dict);
+  Py_XDECREF (result);
+}
+
+static int
+check_io (void)
+{
+  PyObject *data = PyDict_GetItemString (io_dict, "data");
+
+  return !data || !PyString_Check (data) ||
+    strcmp (PyString_AS_STRING (data), IMPORT_SOURCE);
+}
+
+/* Events of queue benchmarks */
+#define EVENT_COUNT 1024
+
+static PyObject *event_func = NULL;
+static py_equeue_t *event_queue = NULL;
+static long event_ops = 0;
+
+static void
+setup_events (void)
+{
+  PyObject *dict = PyDict_New (), *result;
+
+  PyDict_SetItemString (dict, "__builtins__", PyEval_GetBuiltins ());
+  result = PyRun_String ("total = [0]\n"
+                         "def on_event(arg, data):\n"
+                         "  total[0] += arg\n", Py_file_input, dict, dict);
+  Py_XDECREF (result);
+
+  event_func = PyDict_GetItemString (dict, "on_event");
+  Py_XINCREF (event_func);
+  Py_DECREF (dict);
+
+  event_queue = py_equeue_new (EVENT_COUNT, 64, EVENT_COUNT, 1000000);
+  py_equeue_set_handler (event_queue, 0, event_func);
+  event_ops = 0;
+}
+
+static void
+teardown_events (void)
+{
+  py_equeue_free (event_queue);
+  event_queue = NULL;
+  Py_CLEAR (event_func);
+}
+
+/* Delivery of events the way it's done without queue: */
+/* C thread takes GIL for every event and calls handler */
+static void
+op_events_direct (void)
+{
+  long i;
+
+  Py_BEGIN_ALLOW_THREADS
+
+  for (i = 0; i < EVENT_COUNT; ++i)
+    {
+      PyGILState_STATE state = PyGILState_Ensure ();
+      PyObject *result;
+
+      EXTPY_CALL_OBJECT (result, event_func, "(ls#)", i, "payload", 7);
+      Py_XDECREF (result);
+
+      PyGILState_Release (state);
+    }
+
+  Py_END_ALLOW_THREADS
+
+  ++event_ops;
+}
+
+static void
+op_events_queue (void)
+{
+  long i;
+
+  for (i = 0; i < EVENT_COUNT; ++i)
+    {
+      py_equeue_post (event_queue, 0, i, "payload", 7);
+    }
+
+  while (py_equeue_dispatch (event_queue))
+    {
+    }
+
+  ++event_ops;
+}
+
+/* Handler sums arguments of all events */
+static int
+check_events (void)
+{
+  PyObject *total;
+
+  total = PyDict_GetItemString (PyFunction_GetGlobals (event_func), "total");
+
+  return !total || PyInt_AsLong (PyList_GET_ITEM (total, 0)) !=
+    event_ops * (EVENT_COUNT * (EVENT_COUNT - 1) / 2);
+}
+
+/* Namespace and code of memoization benchmarks */
+static PyObject *memo_dict = NULL;
+static PyObject *memo_code = NULL;
+
+/**
+ * Define function and compile calls of memoization benchmark
+ *
+ * @param decorator - decorator of function
+ */
+static void
+create_memo (const char *decorator)
+{
+  char source[1024];
+  PyObject *result;
+
+  snprintf (source, sizeof (source),
+            "%s\n"
+            "def score(n):\n"
+            "  return sum([i * i for i in xrange(n)])\n", decorator);
+
+  memo_dict = py_global_dictionary_new ();
+  result = PyRun_String (source, Py_file_input, memo_dict, memo_dict);
+  Py_XDECREF (result);
+
+  memo_code = Py_CompileString ("for i in xrange(64):\n"
+                                "  r = score(i + 32)\n", "<memo>",
+                                Py_file_input);
+}
+
+static void
+setup_memo_plain (void)
+{
+  create_memo ("");
+}
+
+static void
+setup_memo (void)
+{
+  create_memo ("@memo");
+}
+
+static void
+teardown_memo (void)
+{
+  Py_CLEAR (memo_code);
+  py_global_dictionary_free (memo_dict);
+  memo_dict = NULL;
+}
+
+static void
+op_memo (void)
+{
+  PyObject *result;
+
+  result = PyEval_EvalCode ((PyCodeObject*)memo_code, memo_dict, memo_dict);
+  Py_XDECREF (result);
+}
+
+/* The last call is score(95) */
+static int
+check_memo (void)
+{
+  PyObject *result = PyDict_GetItemString (memo_dict, "r");
+
+  return !result || PyInt_AsLong (result) != 94 * 95 * 189 / 6;
+}
+
+/* Index of text used by conversion benchmarks */
+static int text_index = TEXT_ASCII;
+
+static void
+select_ascii (void)
+{
+  text_index = TEXT_ASCII;
+}
+
+static void
+select_mixed (void)
+{
+  text_index = TEXT_MIXED;
+}
+
+static void
+select_cjk (void)
+{
+  text_index = TEXT_CJK;
+}
+
+static void
+op_mbs2wcs (void)
+{
+  free (py_mbs2wcs (text_mbs[text_index]));
+}
+
+static int
+check_mbs2wcs (void)
+{
+  wchar_t *wcs = py_mbs2wcs (text_mbs[text_index]);
+  int wrong = !wcs || wcscmp (wcs, text_wcs[text_index]);
+
+  free (wcs);
+
+  return wrong;
+}
+
+static void
+op_wcs2mbs (void)
+{
+  free (py_wcs2mbs (text_wcs[text_index]));
+}
+
+static int
+check_wcs2mbs (void)
+{
+  char *mbs = py_wcs2mbs (text_wcs[text_index]);
+  int wrong = !mbs || strcmp (mbs, text_mbs[text_index]);
+
+  free (mbs);
+
+  return wrong;
+}
+
+/* Conversion to wide-char string the way MBS2WCS used to do it */
+static void
+op_libc_mbstowcs (void)
+{
+  size_t len = text_bytes[text_index];
+  wchar_t *wcs = malloc (sizeof (wchar_t) * (len + 2));
+
+  mbstowcs (wcs, text_mbs[text_index], len + 1);
+  free (wcs);
+}
+
+static int
+check_libc_mbstowcs (void)
+{
+  size_t len = text_bytes[text_index];
+  wchar_t *wcs = malloc (sizeof (wchar_t) * (len + 2));
+  int wrong;
+
+  mbstowcs (wcs, text_mbs[text_index], len + 1);
+  wrong = wcscmp (wcs, text_wcs[text_index]);
+  free (wcs);
+
+  return wrong;
+}
+
+/* Conversion to multibyte string the way WCS2MBS used to do it */
+static void
+op_libc_wcstombs (void)
+{
+  size_t len = wcslen (text_wcs[text_index]);
+  char *mbs = malloc ((len + 1) * MB_CUR_MAX);
+
+  wcstombs (mbs, text_wcs[text_index], (len + 1) * MB_CUR_MAX);
+  free (mbs);
+}
+
+static int
+check_libc_wcstombs (void)
+{
+  size_t len = wcslen (text_wcs[text_index]);
+  char *mbs = malloc ((len + 1) * MB_CUR_MAX);
+  int wrong;
+
+  wcstombs (mbs, text_wcs[text_index], (len + 1) * MB_CUR_MAX);
+  wrong = strcmp (mbs, text_mbs[text_index]);
+  free (mbs);
+
+  return wrong;
+}
+
+static const bench_t benches[] = {
+  {"py_module_new",                  NULL, op_module_new, NULL},
+  {"py_module_new_static",           NULL, op_module_new_static, NULL},
+  {"extpy_run_script/empty",         NULL, op_run_empty, NULL, NULL,
+   check_failed},
+  {"extpy_run_script/small",         NULL, op_run_small, NULL, NULL,
+   check_failed},
+  {"extpy_run_script/large",         NULL, op_run_large, NULL, NULL,
+   check_failed},
+  {"extpy_run_script/large_compile", NULL, op_run_large_compile, NULL, NULL,
+   check_failed},
+  {"extpy_get_long_attr",            NULL, op_get_long_attr, NULL, NULL,
+   check_long_attr},
+  {"extpy_get_double_attr",          NULL, op_get_double_attr, NULL, NULL,
+   check_double_attr},
+  {"extpy_get_string_attr",          NULL, op_get_string_attr, NULL, NULL,
+   check_string_attr},
+  {"extpy_dict_set_item_str",        NULL, op_dict_set_item_str, NULL},
+  {"py_proc_write",                  NULL, op_proc_write, teardown_capture},
+  {"py_tracer_get_buffer",           setup_capture, op_get_buffer,
+   teardown_capture},
+  {"import/syspath",                 setup_import_path, op_import_path,
+   teardown_import, NULL, check_failed},
+  {"import/bundle",                  setup_import_bundle, op_import_bundle,
+   teardown_import, NULL, check_failed},
+  {"extpy_run_file/read",            setup_run_file, op_run_file,
+   teardown_run_file, NULL, check_failed},
+  {"extpy_run_file/watched",         setup_run_file_watched, op_run_file,
+   teardown_run_file, NULL, check_failed},
+  {"samples/list",                   NULL, op_samples_list, NULL, NULL,
+   check_samples},
+  {"samples/py_array_new",           NULL, op_samples_array, NULL, NULL,
+   check_samples},
+  {"to_double_array/loop",           setup_float_list, op_to_doubles_loop,
+   teardown_convert_seq, NULL, check_convert},
+  {"to_double_array/list",           setup_float_list, op_to_double_array,
+   teardown_convert_seq, NULL, check_convert},
+  {"to_double_array/buffer_f32",     setup_float_buffer, op_to_double_array,
+   teardown_convert_seq, NULL, check_convert},
+  {"to_long_array/list",             setup_int_list, op_to_long_array,
+   teardown_convert_seq, NULL, check_convert},
+  {"fields_script/class",           setup_fields_class, op_fields_script,
+   teardown_fields, NULL, check_fields_script},
+  {"fields_script/record",          setup_fields_record, op_fields_script,
+   teardown_fields, NULL, check_fields_script},
+  {"fields_host/getattr",           setup_fields_class, op_fields_getattr,
+   teardown_fields, NULL, check_fields_host},
+  {"fields_host/record",            setup_fields_record, op_fields_record,
+   teardown_fields, NULL, check_fields_host},
+  {"call/EXTPY_CALL_OBJECT",        setup_call, op_call_macro,
+   teardown_call, NULL, check_call},
+  {"call/py_call_invoke",           setup_call, op_call_handle,
+   teardown_call, NULL, check_call},
+  {"batch/loop",                    setup_batch, op_batch_loop,
+   teardown_batch, NULL, check_batch},
+  {"batch/py_batch_run",            setup_batch, op_batch_run,
+   teardown_batch, NULL, check_batch},
+  {"py_sched_resume",               setup_coro, op_coro_resume,
+   teardown_coro, NULL, check_coro},
+  {"io/open_read",                  setup_io_open, op_io, teardown_io,
+   NULL, check_io},
+  {"io/readFile",                   setup_io_read_file, op_io, teardown_io,
+   NULL, check_io},
+  {"events/direct",                 setup_events, op_events_direct,
+   teardown_events, NULL, check_events},
+  {"events/py_equeue",              setup_events, op_events_queue,
+   teardown_events, NULL, check_events},
+  {"memo/plain",                    setup_memo_plain, op_memo, teardown_memo,
+   NULL, check_memo},
+  {"memo/memo",                     setup_memo, op_memo, teardown_memo,
+   NULL, check_memo},
+  {"resolve/import",                NULL, op_resolve_import, NULL, NULL,
+   check_resolve},
+  {"resolve/py_call_resolve",       NULL, op_resolve_cached, NULL, NULL,
+   check_resolve},
+  {"py_mbs2wcs/ascii",    select_ascii, op_mbs2wcs, NULL,
+   &text_bytes[TEXT_ASCII], check_mbs2wcs},
+  {"py_mbs2wcs/mixed",    select_mixed, op_mbs2wcs, NULL,
+   &text_bytes[TEXT_MIXED], check_mbs2wcs},
+  {"py_mbs2wcs/cjk",      select_cjk, op_mbs2wcs, NULL,
+   &text_bytes[TEXT_CJK], check_mbs2wcs},
+  {"py_wcs2mbs/ascii",    select_ascii, op_wcs2mbs, NULL,
+   &text_bytes[TEXT_ASCII], check_wcs2mbs},
+  {"py_wcs2mbs/mixed",    select_mixed, op_wcs2mbs, NULL,
+   &text_bytes[TEXT_MIXED], check_wcs2mbs},
+  {"py_wcs2mbs/cjk",      select_cjk, op_wcs2mbs, NULL,
+   &text_bytes[TEXT_CJK], check_wcs2mbs},
+  {"libc_mbstowcs/ascii", select_ascii, op_libc_mbstowcs, NULL,
+   &text_bytes[TEXT_ASCII], check_libc_mbstowcs},
+  {"libc_mbstowcs/mixed", select_mixed, op_libc_mbstowcs, NULL,
+   &text_bytes[TEXT_MIXED], check_libc_mbstowcs},
+  {"libc_mbstowcs/cjk",   select_cjk, op_libc_mbstowcs, NULL,
+   &text_bytes[TEXT_CJK], check_libc_mbstowcs},
+  {"libc_wcstombs/ascii", select_ascii, op_libc_wcstombs, NULL,
+   &text_bytes[TEXT_ASCII], check_libc_wcstombs},
+  {"libc_wcstombs/mixed", select_mixed, op_libc_wcstombs, NULL,
+   &text_bytes[TEXT_MIXED], check_libc_wcstombs},
+  {"libc_wcstombs/cjk",   select_cjk, op_libc_wcstombs, NULL,
+   &text_bytes[TEXT_CJK], check_libc_wcstombs},
+  {NULL, NULL, NULL, NULL, NULL, NULL}
+};
+
+static void
+usage (const char *progname)
+{
+  fprintf (stderr,
+           "Usage: %s [options]\n"
+           "  -b, --baseline=FILE   compare results with baseline\n"
+           "  -s, --save=FILE       save results as new baseline\n"
+           "  -t, --threshold=PCT   regression threshold (default %.0f%%)\n"
+           "  -n, --samples=N       count of samples (default %d)\n"
+           "  -f, --filter=TEXT     run only benchmarks containing TEXT\n"
+           "  -o, --output=FILE     write results to FILE instead of stdout\n",
+           progname, DEFAULT_THRESHOLD, DEFAULT_SAMPLES);
+}
+
+int
+main (int argc, char **argv)
+{
+  static struct option long_options[] = {
+    {"baseline",         required_argument, NULL, 'b'},
+    {"save",             required_argument, NULL, 's'},
+    {"threshold",        required_argument, NULL, 't'},
+    {"samples",          required_argument, NULL, 'n'},
+    {"filter",           required_argument, NULL, 'f'},
+    {"output",           required_argument, NULL, 'o'},
+    {"cold-start-child", required_argument, NULL, 'C'},
+    {"help",             no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  const bench_t *bench;
+  int c, saved;
+
+  output = stdout;
+
+  while ((c = getopt_long (argc, argv, "b:s:t:n:f:o:h",
+                           long_options, NULL)) != -1)
+    {
+      switch (c)
+        {
+        case 'b': opt_baseline = optarg; break;
+        case 's': opt_save = optarg; break;
+        case 't': opt_threshold = atof (optarg); break;
+        case 'n': opt_samples = MAX (atoi (optarg), 1); break;
+        case 'f': opt_filter = optarg; break;
+        case 'o':
+          output = fopen (optarg, "w");
+          if (!output)
+            {
+              perror (optarg);
+              return EXIT_FAILURE;
+            }
+          break;
+        case 'C':
+          py_set_startup_profile (atoi (optarg));
+          return cold_start_child (argc, argv);
+        default:
+          usage (argv[0]);
+          return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+  if (opt_baseline && load_baseline (opt_baseline))
+    {
+      fprintf (stderr, "No baseline found at %s, "
+               "run with --save to create it\n", opt_baseline);
+    }
+
+  if (opt_save)
+    {
+      save_file = fopen (opt_save, "w");
+      if (!save_file)
+        {
+          perror (opt_save);
+          return EXIT_FAILURE;
+        }
+      fprintf (save_file, "{\"benchmarks\": [\n");
+    }
+
+  fprintf (output, "{\"benchmarks\": [\n");
+
+  run_cold_start (argv[0], "python_init/cold", 0);
+  run_cold_start (argv[0], "python_init/cold_fast", PY_STARTUP_FAST);
+
+  saved = quiet_stdout ();
+  if (python_init (argc, argv, no_modules))
+    {
+      restore_stdout (saved);
+      return EXIT_FAILURE;
+    }
+  restore_stdout (saved);
+
+  setup_fixtures ();
+  setup_texts ();
+
+  for (bench = benches; bench->name; ++bench)
+    {
+      run_bench (bench);
+    }
+
+  for (bench = cxx_benches; bench->name; ++bench)
+    {
+      run_bench (bench);
+    }
+
+  teardown_fixtures ();
+  teardown_texts ();
+
+  python_done ();
+
+  fprintf (output, "\n], \"regressions\": %d, \"wrong_results\": %d}\n",
+           regressions, wrong_results);
+
+  if (save_file)
+    {
+      fprintf (save_file, "\n]}\n");
+      fclose (save_file);
+    }
+
+  if (output != stdout)
+    {
+      fclose (output);
+    }
+
+  SAFE_FREE (baseline);
+
+  return regressions || wrong_results ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+/**
+ * Microbenchmarks of public entry points of Python bindings
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef _bench_h_
+#define _bench_h_
+
+#include <smartinclude.h>
+
+BEGIN_HEADER
+
+typedef struct {
+  const char *name;
+  void (*setup) (void);    /* Prepare fixtures (may be NULL) */
+  void (*op) (void);       /* Run one operation */
+  void (*teardown) (void); /* Release fixtures (may be NULL) */
+  size_t *bytes;           /* Bytes processed by operation (may be NULL) */
+  int (*check) (void);     /* Check result of operation, non-zero if it's */
+                           /* wrong (may be NULL) */
+} bench_t;
+
+/* Benchmarks of C++ layer, terminated by entry with NULL name */
+extern const bench_t cxx_benches[];
+
+END_HEADER
+
+#endif
@@ -0,0 +1,339 @@
+/**
+ * Microbenchmarks of C++ layer of Python bindings
+ *
+ * Methods bound with bind.hpp are compared with equivalent methods
+ * which parse arguments with PY_PARSE_TUPLE. Both are called through
+ * PyObject_Call(), so difference is the cost of unpacking arguments
+ * and converting results.
+ *
+ * Reference handles of ref.hpp are compared with the same sequence of
+ * calls with manual reference counting; they should not differ.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "python/bind.hpp"
+#include "bench.h"
+
+/****
+ * Methods with parsing of arguments
+ */
+
+PY_METHOD(parsed_add)
+  long a, b;
+
+  PY_PARSE_TUPLE ("ll", L"Method expects two integer arguments", &a, &b);
+
+  return PyInt_FromLong (a + b);
+PY_METH_END
+
+PY_METHOD(parsed_scale)
+  double x;
+
+  PY_PARSE_TUPLE ("d", L"Method expects one float argument", &x);
+
+  return PyFloat_FromDouble (x * 2.0);
+PY_METH_END
+
+PY_METHOD(parsed_length)
+  const char *str;
+
+  PY_PARSE_TUPLE ("s", L"Method expects one string argument", &str);
+
+  return PyInt_FromLong (strlen (str));
+PY_METH_END
+
+PY_METHOD(parsed_answer)
+  return PyInt_FromLong (42);
+PY_METH_END
+
+/****
+ * Bound methods
+ */
+
+static long
+bound_add (long a, long b)
+{
+  return a + b;
+}
+
+static double
+bound_scale (double x)
+{
+  return x * 2.0;
+}
+
+static long
+bound_length (const char *str)
+{
+  return strlen (str);
+}
+
+static long
+bound_answer (void)
+{
+  return 42;
+}
+
+PY_BEGIN_STATIC_METHMAP(cxx_methods)
+  PY_STATIC_METHMAP_DEF ("parsedAdd", parsed_add, METH_VARARGS, "Sum")
+  PY_STATIC_METHMAP_DEF ("parsedScale", parsed_scale, METH_VARARGS, "Double")
+  PY_STATIC_METHMAP_DEF ("parsedLength", parsed_length, METH_VARARGS, "Length")
+  PY_STATIC_METHMAP_DEF ("parsedAnswer", parsed_answer, METH_VARARGS, "Answer")
+  PY_METHMAP_BIND ("boundAdd", bound_add, "Sum")
+  PY_METHMAP_BIND ("boundScale", bound_scale, "Double")
+  PY_METHMAP_BIND ("boundLength", bound_length, "Length")
+  PY_METHMAP_BIND ("boundAnswer", bound_answer, "Answer")
+PY_END_STATIC_METHMAP
+
+/****
+ * Fixtures
+ */
+
+static py_module_t *module = NULL;
+static PyObject *func = NULL;
+static PyObject *args = NULL;
+static PyObject *expected = NULL;
+
+/**
+ * Prepare call of module's method
+ *
+ * @param name - name of method
+ * @param call_args - new reference to tuple of arguments
+ * @param result - new reference to expected result of call
+ */
+static void
+setup_call (const wchar_t *name, PyObject *call_args, PyObject *result)
+{
+  module = py_module_new_static (L"CxxBench", L"Benchmark of C++ layer",
+                                 cxx_methods);
+  func = extpy_get_attr_string (module->handle, name);
+  args = call_args;
+  expected = result;
+}
+
+static void
+teardown_call (void)
+{
+  Py_XDECREF (func);
+  Py_XDECREF (args);
+  Py_XDECREF (expected);
+  py_module_free (module);
+
+  func = args = expected = NULL;
+  module = NULL;
+}
+
+static void
+setup_parsed_add (void)
+{
+  setup_call (L"parsedAdd", Py_BuildValue ("(ll)", 314L, 42L),
+              PyInt_FromLong (356));
+}
+
+static void
+setup_bound_add (void)
+{
+  setup_call (L"boundAdd", Py_BuildValue ("(ll)", 314L, 42L),
+              PyInt_FromLong (356));
+}
+
+static void
+setup_parsed_scale (void)
+{
+  setup_call (L"parsedScale", Py_BuildValue ("(d)", 3.14),
+              PyFloat_FromDouble (6.28));
+}
+
+static void
+setup_bound_scale (void)
+{
+  setup_call (L"boundScale", Py_BuildValue ("(d)", 3.14),
+              PyFloat_FromDouble (6.28));
+}
+
+static void
+setup_parsed_length (void)
+{
+  setup_call (L"parsedLength", Py_BuildValue ("(s)", "Some string field"),
+              PyInt_FromLong (17));
+}
+
+static void
+setup_bound_length (void)
+{
+  setup_call (L"boundLength", Py_BuildValue ("(s)", "Some string field"),
+              PyInt_FromLong (17));
+}
+
+static void
+setup_parsed_answer (void)
+{
+  setup_call (L"parsedAnswer", PyTuple_New (0),
+              PyInt_FromLong (42));
+}
+
+static void
+setup_bound_answer (void)
+{
+  setup_call (L"boundAnswer", PyTuple_New (0),
+              PyInt_FromLong (42));
+}
+
+static PyObject *ref_object = NULL;
+static PyObject *ref_target = NULL;
+static PyObject *ref_dict = NULL;
+
+static void
+setup_refs (void)
+{
+  ref_object = PyModule_New ("RefSource");
+  ref_target = PyModule_New ("RefTarget");
+  ref_dict = PyDict_New ();
+
+  PyModule_AddIntConstant (ref_object, "longField", 314);
+}
+
+static void
+teardown_refs (void)
+{
+  Py_CLEAR (ref_object);
+  Py_CLEAR (ref_target);
+  Py_CLEAR (ref_dict);
+}
+
+/****
+ * Operations
+ */
+
+static void
+op_call (void)
+{
+  Py_XDECREF (PyObject_Call (func, args, NULL));
+}
+
+static int
+check_call (void)
+{
+  PyObject *result = PyObject_Call (func, args, NULL);
+  int wrong;
+
+  wrong = !result || PyObject_RichCompareBool (result, expected, Py_EQ) != 1;
+
+  Py_XDECREF (result);
+  PyErr_Clear ();
+
+  return wrong;
+}
+
+/**
+ * Check that value of longField is copied
+ *
+ * @param value - new reference to copied value
+ * @return non-zero if value is wrong
+ */
+static int
+check_copied (PyObject *value)
+{
+  int wrong = !value || PyInt_AsLong (value) != 314;
+
+  Py_XDECREF (value);
+  PyErr_Clear ();
+
+  return wrong;
+}
+
+static int
+check_attr_to_dict (void)
+{
+  PyObject *value = PyDict_GetItemString (ref_dict, "copy");
+
+  Py_XINCREF (value);
+
+  return check_copied (value);
+}
+
+static int
+check_copy_attr (void)
+{
+  return check_copied (PyObject_GetAttrString (ref_target, "longField"));
+}
+
+static void
+op_c_attr_to_dict (void)
+{
+  PyObject *value = extpy_get_attr_string (ref_object, L"longField");
+
+  if (value)
+    {
+      extpy_dict_set_item_str (ref_dict, (wchar_t*)L"copy", value);
+    }
+}
+
+static void
+op_cxx_attr_to_dict (void)
+{
+  py::ref value = extpy_get_attr_string (py::borrow (ref_object),
+                                         L"longField");
+
+  if (value)
+    {
+      extpy_dict_set_item_str (py::borrow (ref_dict), L"copy",
+                               std::move (value));
+    }
+}
+
+static void
+op_c_copy_attr (void)
+{
+  PyObject *value = extpy_get_attr_string (ref_object, L"longField");
+
+  if (value)
+    {
+      extpy_set_attr_string (ref_target, L"longField", value);
+      Py_DECREF (value);
+    }
+}
+
+static void
+op_cxx_copy_attr (void)
+{
+  py::ref value = extpy_get_attr_string (py::borrow (ref_object),
+                                         L"longField");
+
+  if (value)
+    {
+      extpy_set_attr_string (py::borrow (ref_target), L"longField", value);
+    }
+}
+
+extern "C" const bench_t cxx_benches[] = {
+  {"bind/parsed/add",    setup_parsed_add, op_call, teardown_call, NULL,
+   check_call},
+  {"bind/bound/add",     setup_bound_add, op_call, teardown_call, NULL,
+   check_call},
+  {"bind/parsed/scale",  setup_parsed_scale, op_call, teardown_call, NULL,
+   check_call},
+  {"bind/bound/scale",   setup_bound_scale, op_call, teardown_call, NULL,
+   check_call},
+  {"bind/parsed/length", setup_parsed_length, op_call, teardown_call, NULL,
+   check_call},
+  {"bind/bound/length",  setup_bound_length, op_call, teardown_call, NULL,
+   check_call},
+  {"bind/parsed/answer", setup_parsed_answer, op_call, teardown_call, NULL,
+   check_call},
+  {"bind/bound/answer",  setup_bound_answer, op_call, teardown_call, NULL,
+   check_call},
+  {"ref/c/attr_to_dict",   setup_refs, op_c_attr_to_dict, teardown_refs, NULL,
+   check_attr_to_dict},
+  {"ref/cxx/attr_to_dict", setup_refs, op_cxx_attr_to_dict, teardown_refs,
+   NULL, check_attr_to_dict},
+  {"ref/c/copy_attr",      setup_refs, op_c_copy_attr, teardown_refs, NULL,
+   check_copy_attr},
+  {"ref/cxx/copy_attr",    setup_refs, op_cxx_copy_attr, teardown_refs, NULL,
+   check_copy_attr},
+  {NULL, NULL, NULL, NULL, NULL, NULL}
+};
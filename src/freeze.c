@@ -0,0 +1,342 @@
+/**
+ * Build-time compiler of Python scripts into frozen modules
+ *
+ * Compiles every given script to bytecode and writes C source with
+ * marshalled code objects and a table in the format of
+ * PyImport_FrozenModules, so scripts are linked into executable and
+ * neither read nor compiled at runtime.
+ *
+ * Name of module is taken from base name of file; __init__.py gives
+ * package named after its directory. Name could be set explicitly
+ * as name=file.py (i.e. pkg.mod=pkg/mod.py).
+ *
+ * Bytecode is produced by the same Python which is linked into the
+ * bindings, so its magic always matches the runtime.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include <Python.h>
+#include <marshal.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Default name of generated table */
+#define DEFAULT_TABLE "py_frozen_scripts"
+
+/* Count of bytes per line of generated arrays */
+#define BYTES_PER_LINE 16
+
+typedef struct {
+  char *name;
+  char *path;
+  int package;
+} script_t;
+
+/**
+ * Read whole file into memory
+ *
+ * @param path - path to file
+ * @return zero-terminated content of file or NULL on error
+ * @sideeffect allocate memory for return value
+ */
+static char*
+read_file (const char *path)
+{
+  FILE *file;
+  char *buffer = NULL;
+  long size;
+
+  file = fopen (path, "rb");
+
+  if (!file)
+    {
+      return NULL;
+    }
+
+  if (!fseek (file, 0, SEEK_END) && (size = ftell (file)) >= 0 &&
+      !fseek (file, 0, SEEK_SET))
+    {
+      /* Compiler of old Pythons wants trailing newline */
+      buffer = malloc (size + 2);
+
+      if (fread (buffer, 1, size, file) != (size_t)size)
+        {
+          free (buffer);
+          buffer = NULL;
+        }
+      else
+        {
+          buffer[size] = '\n';
+          buffer[size + 1] = '\0';
+        }
+    }
+
+  fclose (file);
+
+  return buffer;
+}
+
+/**
+ * Fill script's descriptor from command line argument
+ *
+ * @param script - descriptor to fill
+ * @param arg - argument in form [name=]path
+ */
+static void
+parse_script (script_t *script, const char *arg)
+{
+  const char *eq = strchr (arg, '=');
+  char *copy, *base, *dot;
+
+  script->package = 0;
+
+  if (eq)
+    {
+      script->name = strndup (arg, eq - arg);
+      script->path = strdup (eq + 1);
+      script->package = !strcmp (basename (script->path), "__init__.py");
+      return;
+    }
+
+  script->path = strdup (arg);
+
+  copy = strdup (arg);
+  base = basename (copy);
+
+  if (!strcmp (base, "__init__.py"))
+    {
+      /* Package is named after its directory */
+      char *dir = strdup (arg);
+
+      script->name = strdup (basename (dirname (dir)));
+      script->package = 1;
+      free (dir);
+    }
+  else
+    {
+      dot = strrchr (base, '.');
+
+      if (dot)
+        {
+          *dot = '\0';
+        }
+
+      script->name = strdup (base);
+    }
+
+  free (copy);
+}
+
+/**
+ * Compile script and write its marshalled code as C array
+ *
+ * @param out - stream to write to
+ * @param script - script to compile
+ * @param index - index of script used for name of array
+ * @param size - size of marshalled code
+ * @return zero on success, non-zero otherwise
+ */
+static int
+write_script (FILE *out, const script_t *script, int index, long *size)
+{
+  PyObject *code, *data;
+  const unsigned char *bytes;
+  char *source;
+  long i;
+
+  source = read_file (script->path);
+
+  if (!source)
+    {
+      fprintf (stderr, "freeze: unable to read %s\n", script->path);
+      return -1;
+    }
+
+  code = Py_CompileString (source, script->path, Py_file_input);
+  free (source);
+
+  if (!code)
+    {
+      PyErr_Print ();
+      return -1;
+    }
+
+  data = PyMarshal_WriteObjectToString (code, Py_MARSHAL_VERSION);
+  Py_DECREF (code);
+
+  if (!data)
+    {
+      PyErr_Print ();
+      return -1;
+    }
+
+  bytes = (const unsigned char*)PyString_AS_STRING (data);
+  *size = PyString_GET_SIZE (data);
+
+  fprintf (out, "\n/* %s (%s) */\n", script->name, script->path);
+  fprintf (out, "static unsigned char frozen_%d[] = {", index);
+
+  for (i = 0; i < *size; ++i)
+    {
+      if (i % BYTES_PER_LINE == 0)
+        {
+          fprintf (out, "\n  ");
+        }
+
+      fprintf (out, "%u,", bytes[i]);
+    }
+
+  fprintf (out, "\n};\n");
+
+  Py_DECREF (data);
+
+  return 0;
+}
+
+/**
+ * Write C source with frozen scripts
+ *
+ * @param out - stream to write to
+ * @param table - name of table
+ * @param scripts - scripts to freeze
+ * @param count - count of scripts
+ * @return zero on success, non-zero otherwise
+ */
+static int
+write_source (FILE *out, const char *table, const script_t *scripts,
+              int count)
+{
+  long *sizes;
+  int i, result = 0;
+
+  sizes = calloc (count, sizeof (long));
+
+  fprintf (out, "/* Generated by freeze, do not edit */\n\n");
+  fprintf (out, "#include <Python.h>\n");
+
+  for (i = 0; i < count && !result; ++i)
+    {
+      result = write_script (out, &scripts[i], i, &sizes[i]);
+    }
+
+  if (!result)
+    {
+      fprintf (out, "\nstruct _frozen %s[] = {\n", table);
+
+      for (i = 0; i < count; ++i)
+        {
+          /* Negative size marks package */
+          fprintf (out, "  {\"%s\", frozen_%d, %s%ld},\n", scripts[i].name, i,
+                   scripts[i].package ? "-" : "", sizes[i]);
+        }
+
+      fprintf (out, "  {0, 0, 0}\n};\n");
+    }
+
+  free (sizes);
+
+  return result;
+}
+
+static void
+usage (const char *progname)
+{
+  fprintf (stderr,
+           "Usage: %s [options] [name=]script.py ...\n\n"
+           "  -o, --output=FILE   write C source to FILE (default stdout)\n"
+           "  -t, --table=NAME    name of table of frozen modules "
+           "(default " DEFAULT_TABLE ")\n",
+           progname);
+}
+
+int
+main (int argc, char **argv)
+{
+  static struct option long_options[] = {
+    {"output", required_argument, NULL, 'o'},
+    {"table",  required_argument, NULL, 't'},
+    {"help",   no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  const char *output = NULL, *table = DEFAULT_TABLE;
+  char tmp_name[4096];
+  script_t *scripts;
+  FILE *out = stdout;
+  int c, i, count, result;
+
+  while ((c = getopt_long (argc, argv, "o:t:h", long_options, NULL)) != -1)
+    {
+      switch (c)
+        {
+        case 'o': output = optarg; break;
+        case 't': table = optarg; break;
+        default:
+          usage (argv[0]);
+          return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+  count = argc - optind;
+
+  if (count <= 0)
+    {
+      usage (argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  scripts = calloc (count, sizeof (script_t));
+
+  for (i = 0; i < count; ++i)
+    {
+      parse_script (&scripts[i], argv[optind + i]);
+    }
+
+  if (output)
+    {
+      /* Incomplete source must not be left for make */
+      snprintf (tmp_name, sizeof (tmp_name), "%s.tmp", output);
+      out = fopen (tmp_name, "w");
+
+      if (!out)
+        {
+          fprintf (stderr, "freeze: unable to create %s\n", tmp_name);
+          return EXIT_FAILURE;
+        }
+    }
+
+  Py_NoSiteFlag = 1;
+  Py_Initialize ();
+
+  result = write_source (out, table, scripts, count);
+
+  Py_Finalize ();
+
+  if (output)
+    {
+      result |= fclose (out);
+
+      if (result || rename (tmp_name, output))
+        {
+          unlink (tmp_name);
+          result = -1;
+        }
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      free (scripts[i].name);
+      free (scripts[i].path);
+    }
+
+  free (scripts);
+
+  return result ? EXIT_FAILURE : EXIT_SUCCESS;
+}
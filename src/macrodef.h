@@ -53,18 +53,16 @@ BEGIN_HEADER
 #define TEST_FLAG(__flags, __f)  ((__flags) &   (__f))
 #define CLEAR_FLAG(__flags, __f) ((__flags) &= ~(__f))
 
+/* Conversions are locale-independent UTF-8 with exactly sized result, */
+/* see python/utf8.c */
 #define MBS2WCS(_res, _src) \
   { \
-    size_t len = strlen (_src); \
-    _res = malloc (sizeof (wchar_t) * (len + 2)); \
-    mbstowcs (_res, _src, len + 1); \
+    _res = py_mbs2wcs (_src); \
   }
 
 #define WCS2MBS(_res,_src) \
   { \
-    size_t len = wcslen (_src); \
-    _res = malloc ((len + 1) * MB_CUR_MAX); \
-    wcstombs ((char*)_res, _src, (len + 1) * MB_CUR_MAX); \
+    _res = py_wcs2mbs (_src); \
   }
 
 /* Length of static wide-string buffer */
@@ -1,6 +1,54 @@
+/**
+ * Test driver and load generator for Python bindings
+ *
+ * Without arguments runs ../t/main.py once and prints captured buffers.
+ * With scripts or load options runs scripts in worker processes and
+ * threads and reports throughput, latency percentiles, RSS and errors.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
 #include <stdlib.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
 #include "python/iface.h"
 
+/* Script which is run when no scripts are specified */
+#define DEFAULT_SCRIPT "../t/main.py"
+
+/* Scripts which are frozen at build time (see FROZEN_SCRIPTS) */
+extern struct _frozen py_frozen_scripts[];
+
+/* Latency histogram: values below HIST_LINEAR are counted exactly, */
+/* every next power of two is split into HIST_SUB sub-buckets */
+#define HIST_LINEAR    16
+#define HIST_SUB_BITS  3
+#define HIST_SUB       (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS   (HIST_LINEAR + (64 - 4) * HIST_SUB)
+
+typedef struct {
+  volatile unsigned long long ops;    /* Count of finished runs */
+  volatile unsigned long long errors; /* Count of failed runs */
+  volatile int done;                  /* Worker finished */
+  long peak_rss;                      /* Peak RSS of worker in kilobytes */
+  unsigned long long histogram[HIST_BUCKETS];
+} worker_stats_t;
+
+typedef struct {
+  int index;
+  worker_stats_t *stats;
+} thread_arg_t;
+
 PY_METHOD(my_method)
   PyObject *o;
   wchar_t *v;
@@ -32,22 +80,722 @@ PY_BEGIN_INITTAB(inittab_modules)
   PY_INITTAB_DEF ("Test", test_init)
 PY_END_INITTAB
 
-int
-main (int argc, char **argv)
+/****
+ * Options
+ */
+
+static long opt_repeat = 0;
+static int opt_threads = 1;
+static int opt_workers = 1;
+static double opt_duration = 0;
+static double opt_rate = 0;
+static double opt_interval = 1;
+static int opt_startup_report = 0;
+static const char *opt_warmset = NULL;
+static int opt_warmset_flags = PY_WARMSET_RECORD | PY_WARMSET_PRELOAD;
+static const char *opt_bundle = NULL;
+static const char *opt_make_bundle = NULL;
+static const char *opt_frozen = NULL;
+
+static char **scripts = NULL;
+static int scripts_count = 0;
+
+/* Arguments which are passed to python_init() */
+static int py_argc;
+static char **py_argv;
+
+/* Time when workers should stop (zero if not limited) */
+static unsigned long long deadline = 0;
+
+/****
+ * Helpers
+ */
+
+/**
+ * Get current monotonic time
+ *
+ * @return current time in nanoseconds
+ */
+static unsigned long long
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Sleep until specified moment
+ *
+ * @param moment - moment in terms of now()
+ */
+static void
+sleep_until (unsigned long long moment)
+{
+  unsigned long long current = now ();
+  struct timespec ts;
+
+  if (moment <= current)
+    {
+      return;
+    }
+
+  ts.tv_sec = (moment - current) / 1000000000ULL;
+  ts.tv_nsec = (moment - current) % 1000000000ULL;
+  nanosleep (&ts, NULL);
+}
+
+/**
+ * Get index of histogram's bucket for value
+ *
+ * @param ns - latency in nanoseconds
+ * @return index of bucket
+ */
+static int
+hist_index (unsigned long long ns)
+{
+  int exp;
+
+  if (ns < HIST_LINEAR)
+    {
+      return ns;
+    }
+
+  exp = 63 - __builtin_clzll (ns);
+
+  return HIST_LINEAR + (exp - 4) * HIST_SUB +
+    ((ns >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/**
+ * Get lowest value of histogram's bucket
+ *
+ * @param index - index of bucket
+ * @return lowest value counted by bucket
+ */
+static unsigned long long
+hist_value (int index)
+{
+  int exp, sub;
+
+  if (index < HIST_LINEAR)
+    {
+      return index;
+    }
+
+  exp = (index - HIST_LINEAR) / HIST_SUB + 4;
+  sub = (index - HIST_LINEAR) % HIST_SUB;
+
+  return (1ULL << exp) + ((unsigned long long)sub << (exp - HIST_SUB_BITS));
+}
+
+/**
+ * Get percentile of latencies from histogram
+ *
+ * @param histogram - histogram of latencies
+ * @param total - total count of values in histogram
+ * @param percentile - percentile to get (from 0 to 100)
+ * @return latency in nanoseconds
+ */
+static unsigned long long
+hist_percentile (const unsigned long long *histogram,
+                 unsigned long long total, double percentile)
+{
+  unsigned long long rank, seen = 0;
+  int i;
+
+  rank = (unsigned long long)(total * percentile / 100.0 + 0.5);
+  rank = MAX (rank, 1);
+
+  for (i = 0; i < HIST_BUCKETS; ++i)
+    {
+      seen += histogram[i];
+      if (seen >= rank)
+        {
+          return hist_value (i);
+        }
+    }
+
+  return 0;
+}
+
+/**
+ * Get resident set size of process
+ *
+ * @param pid - process identifier
+ * @return resident set size in kilobytes
+ */
+static long
+process_rss (pid_t pid)
+{
+  char file_name[64];
+  long size, resident = 0;
+  FILE *file;
+
+  snprintf (file_name, sizeof (file_name), "/proc/%d/statm", (int)pid);
+  file = fopen (file_name, "r");
+
+  if (!file)
+    {
+      return 0;
+    }
+
+  if (fscanf (file, "%ld %ld", &size, &resident) != 2)
+    {
+      resident = 0;
+    }
+
+  fclose (file);
+
+  return resident * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+/****
+ * Workers
+ */
+
+/**
+ * Body of load thread
+ *
+ * @param data - argument of thread (thread_arg_t)
+ */
+static void*
+load_thread (void *data)
+{
+  thread_arg_t *arg = data;
+  worker_stats_t *stats = arg->stats;
+  py_script_t **thread_scripts;
+  unsigned long long interval = 0, next = 0;
+  PyGILState_STATE gstate;
+  long iteration;
+  int i;
+
+  if (opt_rate > 0)
+    {
+      /* Rate is shared by all threads of all workers */
+      interval = (unsigned long long)(1e9 * opt_threads * opt_workers /
+                                      opt_rate);
+      next = now () + interval * arg->index / opt_threads;
+    }
+
+  gstate = PyGILState_Ensure ();
+
+  thread_scripts = malloc (sizeof (py_script_t*) * scripts_count);
+  for (i = 0; i < scripts_count; ++i)
+    {
+      wchar_t *file_name;
+
+      MBS2WCS (file_name, scripts[i]);
+      thread_scripts[i] = py_script_new_file (file_name);
+      free (file_name);
+    }
+
+  for (iteration = 0; !opt_repeat || iteration < opt_repeat; ++iteration)
+    {
+      if (deadline && now () >= deadline)
+        {
+          break;
+        }
+
+      for (i = 0; i < scripts_count; ++i)
+        {
+          extpy_run_result_t *result;
+          unsigned long long start, latency;
+          int failed = 1;
+
+          if (interval)
+            {
+              /* Latency is counted from the scheduled moment, so delays */
+              /* caused by slow previous runs are not hidden */
+              Py_BEGIN_ALLOW_THREADS
+              sleep_until (next);
+              Py_END_ALLOW_THREADS
+
+              start = next;
+              next += interval;
+            }
+          else
+            {
+              start = now ();
+            }
+
+          if (thread_scripts[i])
+            {
+              result = extpy_run_script (thread_scripts[i]);
+              failed = !result->result;
+              extpy_run_free (result);
+            }
+
+          latency = now () - start;
+
+          __sync_fetch_and_add (&stats->ops, 1);
+          __sync_fetch_and_add (&stats->histogram[hist_index (latency)], 1);
+
+          if (failed)
+            {
+              __sync_fetch_and_add (&stats->errors, 1);
+            }
+        }
+    }
+
+  for (i = 0; i < scripts_count; ++i)
+    {
+      py_script_free (thread_scripts[i]);
+    }
+
+  free (thread_scripts);
+
+  PyGILState_Release (gstate);
+
+  return NULL;
+}
+
+/**
+ * Body of worker process
+ *
+ * @param stats - statistics of worker in shared memory
+ * @return exit code of worker
+ */
+static int
+run_worker (worker_stats_t *stats)
+{
+  pthread_t *threads;
+  thread_arg_t *args;
+  PyThreadState *tstate;
+  struct rusage usage;
+  int i, devnull;
+
+  /* Hide messages of python_init() */
+  devnull = open ("/dev/null", O_WRONLY);
+  dup2 (devnull, STDOUT_FILENO);
+  close (devnull);
+
+  if (python_init (py_argc, py_argv, inittab_modules))
+    {
+      stats->done = 1;
+      return EXIT_FAILURE;
+    }
+
+  threads = malloc (sizeof (pthread_t) * opt_threads);
+  args = malloc (sizeof (thread_arg_t) * opt_threads);
+
+  tstate = PyEval_SaveThread ();
+
+  for (i = 0; i < opt_threads; ++i)
+    {
+      args[i].index = i;
+      args[i].stats = stats;
+      pthread_create (&threads[i], NULL, load_thread, &args[i]);
+    }
+
+  for (i = 0; i < opt_threads; ++i)
+    {
+      pthread_join (threads[i], NULL);
+    }
+
+  PyEval_RestoreThread (tstate);
+
+  python_done ();
+
+  free (threads);
+  free (args);
+
+  if (!getrusage (RUSAGE_SELF, &usage))
+    {
+      stats->peak_rss = usage.ru_maxrss;
+    }
+
+  stats->done = 1;
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Run load and report results
+ *
+ * @return exit code
+ */
+static int
+run_load (void)
+{
+  worker_stats_t *stats, total;
+  pid_t *pids;
+  unsigned long long start, last_ops = 0, last_report, elapsed;
+  double seconds;
+  long rss, peak_rss = 0, workers_rss = 0;
+  int i, alive;
+
+  stats = mmap (NULL, sizeof (worker_stats_t) * opt_workers,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (stats == MAP_FAILED)
+    {
+      perror ("mmap");
+      return EXIT_FAILURE;
+    }
+
+  memset (stats, 0, sizeof (worker_stats_t) * opt_workers);
+  pids = malloc (sizeof (pid_t) * opt_workers);
+
+  start = last_report = now ();
+  if (opt_duration > 0)
+    {
+      deadline = start + (unsigned long long)(opt_duration * 1e9);
+    }
+
+  fflush (stdout);
+
+  for (i = 0; i < opt_workers; ++i)
+    {
+      pids[i] = fork ();
+
+      if (pids[i] == 0)
+        {
+          _exit (run_worker (&stats[i]));
+        }
+      else if (pids[i] < 0)
+        {
+          perror ("fork");
+          stats[i].done = 1;
+        }
+    }
+
+  printf ("Running %d script(s) in %d worker(s) with %d thread(s) each\n",
+          scripts_count, opt_workers, opt_threads);
+
+  /* Report progress until all workers are finished */
+  do
+    {
+      unsigned long long ops = 0, errors = 0, current;
+      unsigned long long until = now () + (unsigned long long)(opt_interval *
+                                                              1e9);
+
+      alive = 0;
+      while (now () < until)
+        {
+          alive = 0;
+          for (i = 0; i < opt_workers; ++i)
+            {
+              alive += !stats[i].done;
+            }
+
+          if (!alive)
+            {
+              break;
+            }
+
+          sleep_until (MIN (until, now () + 10000000ULL));
+        }
+
+      rss = 0;
+      for (i = 0; i < opt_workers; ++i)
+        {
+          ops += stats[i].ops;
+          errors += stats[i].errors;
+          if (pids[i] > 0)
+            {
+              rss += process_rss (pids[i]);
+            }
+        }
+
+      peak_rss = MAX (peak_rss, rss);
+      current = now ();
+
+      printf ("[%8.2fs] runs: %llu (%.1f/s) errors: %llu rss: %ld KiB\n",
+              (current - start) / 1e9, ops,
+              (ops - last_ops) / MAX ((current - last_report) / 1e9, 1e-9),
+              errors, rss);
+      fflush (stdout);
+
+      last_ops = ops;
+      last_report = current;
+    }
+  while (alive);
+
+  elapsed = now () - start;
+
+  for (i = 0; i < opt_workers; ++i)
+    {
+      if (pids[i] > 0)
+        {
+          waitpid (pids[i], NULL, 0);
+        }
+    }
+
+  /* Summarize statistics of all workers */
+  memset (&total, 0, sizeof (total));
+  for (i = 0; i < opt_workers; ++i)
+    {
+      int j;
+
+      total.ops += stats[i].ops;
+      total.errors += stats[i].errors;
+      workers_rss += stats[i].peak_rss;
+      for (j = 0; j < HIST_BUCKETS; ++j)
+        {
+          total.histogram[j] += stats[i].histogram[j];
+        }
+    }
+
+  seconds = elapsed / 1e9;
+
+  printf ("\nSummary:\n");
+  printf ("  runs:       %llu\n", total.ops);
+  printf ("  errors:     %llu\n", total.errors);
+  printf ("  duration:   %.3f s\n", seconds);
+  printf ("  throughput: %.1f runs/s\n", total.ops / seconds);
+  printf ("  peak rss:   %ld KiB (sampled), %ld KiB (sum of workers)\n",
+          peak_rss, workers_rss);
+
+  if (total.ops)
+    {
+      printf ("  latency:    p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, "
+              "p99.9 %.3f ms, max %.3f ms\n",
+              hist_percentile (total.histogram, total.ops, 50) / 1e6,
+              hist_percentile (total.histogram, total.ops, 90) / 1e6,
+              hist_percentile (total.histogram, total.ops, 99) / 1e6,
+              hist_percentile (total.histogram, total.ops, 99.9) / 1e6,
+              hist_percentile (total.histogram, total.ops, 100) / 1e6);
+    }
+
+  munmap (stats, sizeof (worker_stats_t) * opt_workers);
+  free (pids);
+
+  return total.errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * Run default script once and print captured buffers
+ *
+ * @return exit code
+ */
+static int
+run_once (void)
 {
   extpy_run_result_t* result;
+  int status;
 
-  if (python_init (argc, argv, inittab_modules))
+  if (python_init (py_argc, py_argv, inittab_modules))
     {
       return EXIT_FAILURE;
     }
 
-  result = extpy_run_file (L"../t/main.py");
+  if (opt_frozen)
+    {
+      wchar_t *name;
+
+      if (!py_frozen_find (opt_frozen))
+        {
+          fprintf (stderr, "No frozen script named %s\n", opt_frozen);
+        }
+
+      MBS2WCS (name, opt_frozen);
+      result = extpy_run_frozen (name);
+      free (name);
+    }
+  else
+    {
+      result = extpy_run_file (L"" DEFAULT_SCRIPT);
+    }
+
   printf ("Buffer from stdout:\n%ls", result->stdout);
   printf ("\nBuffer from stderr:\n%ls", result->stderr);
+
+  /* Unknown frozen script or failed run */
+  status = result->result ? EXIT_SUCCESS : EXIT_FAILURE;
   extpy_run_free (result);
 
+  if (opt_startup_report)
+    {
+      py_warmset_wait ();
+      py_startup_report (stderr);
+      py_warmset_report (stderr);
+    }
+
   python_done ();
 
-  return EXIT_SUCCESS;
+  return status;
+}
+
+/**
+ * Build archive of precompiled modules from directory
+ *
+ * @param dirname - directory with modules
+ * @return exit code
+ */
+static int
+make_bundle (const char *dirname)
+{
+  wchar_t *archive, *wdirname;
+  int result;
+
+  py_set_startup_profile (PY_STARTUP_FAST);
+
+  if (python_init (py_argc, py_argv, inittab_modules))
+    {
+      return EXIT_FAILURE;
+    }
+
+  MBS2WCS (archive, opt_make_bundle);
+  MBS2WCS (wdirname, dirname);
+
+  result = py_bundle_build (archive, wdirname);
+
+  if (result)
+    {
+      fprintf (stderr, "Unable to build %s from %s\n", opt_make_bundle,
+               dirname);
+    }
+
+  free (archive);
+  free (wdirname);
+
+  python_done ();
+
+  return result ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void
+usage (const char *progname)
+{
+  fprintf (stderr,
+           "Usage: %s [options] [script.py ...]\n"
+           "Without arguments runs " DEFAULT_SCRIPT " once and prints "
+           "its output.\n\n"
+           "  -r, --repeat=N      run each script N times per thread\n"
+           "  -t, --threads=N     threads per worker (default 1)\n"
+           "  -w, --workers=N     worker processes (default 1)\n"
+           "  -d, --duration=SEC  stop after SEC seconds\n"
+           "  -R, --rate=RUNS     target total rate of runs per second\n"
+           "  -i, --interval=SEC  progress reporting interval (default 1)\n"
+           "  -F, --fast-start    skip site import, banners and eager setup\n"
+           "  -S, --startup-report  print timings of startup phases\n"
+           "  -W, --warm-set=FILE preload modules listed in FILE and "
+           "record imports to it\n"
+           "  -B, --warm-background  preload warm set in background thread\n"
+           "  -a, --bundle=FILE   import modules from archive FILE\n"
+           "  -m, --make-bundle=FILE  build archive FILE from modules of "
+           "directory\n"
+           "  -f, --frozen=NAME   run script NAME which is frozen into "
+           "executable\n"
+           "  -H, --hot-reload    reuse compiled scripts and reload them "
+           "when changed\n",
+           progname);
+}
+
+int
+main (int argc, char **argv)
+{
+  static struct option long_options[] = {
+    {"repeat",   required_argument, NULL, 'r'},
+    {"threads",  required_argument, NULL, 't'},
+    {"workers",  required_argument, NULL, 'w'},
+    {"duration", required_argument, NULL, 'd'},
+    {"rate",     required_argument, NULL, 'R'},
+    {"interval", required_argument, NULL, 'i'},
+    {"fast-start",     no_argument, NULL, 'F'},
+    {"startup-report", no_argument, NULL, 'S'},
+    {"warm-set",        required_argument, NULL, 'W'},
+    {"warm-background", no_argument,       NULL, 'B'},
+    {"bundle",          required_argument, NULL, 'a'},
+    {"make-bundle",     required_argument, NULL, 'm'},
+    {"frozen",          required_argument, NULL, 'f'},
+    {"hot-reload",      no_argument,       NULL, 'H'},
+    {"help",     no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  static char *default_scripts[] = {DEFAULT_SCRIPT};
+  int c, load = 0;
+
+  py_argc = argc;
+  py_argv = argv;
+
+  while ((c = getopt_long (argc, argv, "r:t:w:d:R:i:FSW:Ba:m:f:Hh",
+                           long_options, NULL)) != -1)
+    {
+      /* Startup options do not switch to load mode */
+      load |= !strchr ("FSWBamfH", c);
+
+      switch (c)
+        {
+        case 'r': opt_repeat = MAX (atol (optarg), 1); break;
+        case 't': opt_threads = MAX (atoi (optarg), 1); break;
+        case 'w': opt_workers = MAX (atoi (optarg), 1); break;
+        case 'd': opt_duration = atof (optarg); break;
+        case 'R': opt_rate = atof (optarg); break;
+        case 'i': opt_interval = MAX (atof (optarg), 0.01); break;
+        case 'F': py_set_startup_profile (PY_STARTUP_FAST); break;
+        case 'S': opt_startup_report = 1; break;
+        case 'W': opt_warmset = optarg; break;
+        case 'B': opt_warmset_flags |= PY_WARMSET_BACKGROUND; break;
+        case 'a': opt_bundle = optarg; break;
+        case 'm': opt_make_bundle = optarg; break;
+        case 'f': opt_frozen = optarg; break;
+        case 'H': py_set_watch (PY_WATCH_ALL); break;
+        default:
+          usage (argv[0]);
+          return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+  if (opt_warmset)
+    {
+      wchar_t *file_name;
+
+      MBS2WCS (file_name, opt_warmset);
+      py_set_warmset (file_name, opt_warmset_flags);
+      free (file_name);
+    }
+
+  py_frozen_register (py_frozen_scripts);
+
+  if (opt_make_bundle)
+    {
+      return make_bundle (optind < argc ? argv[optind] : "../t");
+    }
+
+  if (opt_bundle)
+    {
+      wchar_t *archive;
+      int result;
+
+      MBS2WCS (archive, opt_bundle);
+      result = py_bundle_mount (archive);
+      free (archive);
+
+      if (result)
+        {
+          fprintf (stderr, "Unable to mount %s\n", opt_bundle);
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (optind < argc)
+    {
+      load = 1;
+      scripts = argv + optind;
+      scripts_count = argc - optind;
+    }
+  else
+    {
+      scripts = default_scripts;
+      scripts_count = 1;
+    }
+
+  if (!load)
+    {
+      return run_once ();
+    }
+
+  if (!opt_repeat && opt_duration <= 0)
+    {
+      opt_repeat = 1;
+    }
+
+  /* Scripts are passed to python_init() as program's name only */
+  py_argc = 1;
+
+  return run_load ();
 }
@@ -0,0 +1,328 @@
+/**
+ * Scratch arena for temporaries and pools of descriptors
+ *
+ * Scratch arena is a per-thread bump-pointer allocator. Functions get
+ * a mark on entry, allocate their temporaries from the arena and release
+ * the mark on exit, which makes freeing O(1). Chunks are kept for reuse
+ * by the next run; oversized chunks are freed when the arena becomes
+ * empty.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+/* Alignment of allocations in arena */
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;  /* Size of data */
+  size_t used;  /* Used bytes of data */
+  char *data;
+} arena_chunk_t;
+
+typedef struct {
+  arena_chunk_t *first;    /* First chunk of arena */
+  arena_chunk_t *current;  /* Chunk where allocations are made */
+} arena_t;
+
+struct py_pool_chunk {
+  py_pool_chunk_t *next;
+};
+
+/* Arena of current thread */
+static __thread arena_t *thread_arena = NULL;
+
+/* Key for destroying arenas of finished threads */
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Free all chunks of arena
+ *
+ * @param data - arena to be freed
+ */
+static void
+arena_destroy (void *data)
+{
+  arena_t *arena = data;
+  arena_chunk_t *chunk, *next;
+
+  for (chunk = arena->first; chunk; chunk = next)
+    {
+      next = chunk->next;
+      free (chunk);
+    }
+
+  free (arena);
+}
+
+/**
+ * Create key for destroying arenas
+ */
+static void
+arena_key_create (void)
+{
+  pthread_key_create (&arena_key, arena_destroy);
+}
+
+/**
+ * Get arena of current thread
+ *
+ * @return arena of current thread
+ */
+static inline arena_t*
+get_arena (void)
+{
+  if (!thread_arena)
+    {
+      pthread_once (&arena_key_once, arena_key_create);
+      MALLOC_ZERO (thread_arena, sizeof (arena_t));
+      pthread_setspecific (arena_key, thread_arena);
+    }
+
+  return thread_arena;
+}
+
+/**
+ * Allocate new chunk
+ *
+ * @param size - minimal size of chunk's data
+ * @return new chunk
+ */
+static arena_chunk_t*
+chunk_new (size_t size)
+{
+  arena_chunk_t *chunk;
+  size_t header = (sizeof (arena_chunk_t) + ARENA_ALIGN - 1) &
+    ~(size_t)(ARENA_ALIGN - 1);
+
+  size = MAX (size, PY_ARENA_CHUNK_SIZE);
+  chunk = malloc (header + size);
+
+  if (!chunk)
+    {
+      return NULL;
+    }
+
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+  chunk->data = (char*)chunk + header;
+
+  return chunk;
+}
+
+/**
+ * Allocate memory from scratch arena of current thread
+ *
+ * Memory is valid until the mark which was got before allocation
+ * is released.
+ *
+ * @param size - size of memory to allocate
+ * @return pointer to allocated memory
+ */
+void*
+py_arena_alloc (size_t size)
+{
+  arena_t *arena = get_arena ();
+  arena_chunk_t *chunk = arena->current;
+  void *ptr;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (!chunk)
+    {
+      if (!arena->first)
+        {
+          arena->first = chunk_new (size);
+          if (!arena->first)
+            {
+              return NULL;
+            }
+        }
+
+      chunk = arena->current = arena->first;
+      chunk->used = 0;
+    }
+
+  /* Look for the next chunk with enough free space */
+  while (chunk->used + size > chunk->size)
+    {
+      if (!chunk->next)
+        {
+          chunk->next = chunk_new (size);
+          if (!chunk->next)
+            {
+              return NULL;
+            }
+        }
+
+      chunk = arena->current = chunk->next;
+      chunk->used = 0;
+    }
+
+  ptr = chunk->data + chunk->used;
+  chunk->used += size;
+
+  return ptr;
+}
+
+/**
+ * Get current position of scratch arena of current thread
+ *
+ * @return mark to be passed to py_arena_release()
+ */
+py_arena_mark_t
+py_arena_mark (void)
+{
+  arena_t *arena = get_arena ();
+  py_arena_mark_t mark;
+
+  mark.chunk = arena->current;
+  mark.used = arena->current ? arena->current->used : 0;
+
+  return mark;
+}
+
+/**
+ * Release all memory allocated since mark was got
+ *
+ * @param mark - mark got by py_arena_mark()
+ */
+void
+py_arena_release (py_arena_mark_t mark)
+{
+  arena_t *arena = get_arena ();
+
+  arena->current = mark.chunk;
+
+  if (mark.chunk)
+    {
+      arena->current->used = mark.used;
+    }
+  else if (arena->first)
+    {
+      /* Arena is empty, free oversized chunks */
+      arena_chunk_t *chunk = arena->first, *next;
+
+      while ((next = chunk->next))
+        {
+          if (next->size > PY_ARENA_CHUNK_SIZE)
+            {
+              chunk->next = next->next;
+              free (next);
+            }
+          else
+            {
+              chunk = next;
+            }
+        }
+    }
+}
+
+/**
+ * Allocate zeroed element from pool
+ *
+ * @param pool - pool to allocate from
+ * @return new element
+ */
+void*
+py_pool_alloc (py_pool_t *pool)
+{
+  void *ptr;
+
+  pthread_mutex_lock (&pool->mutex);
+
+  if (!pool->free_list)
+    {
+      /* Elements are placed right after the chunk's header */
+      size_t size = MAX (pool->size, sizeof (void*));
+      size_t header = (sizeof (py_pool_chunk_t) + ARENA_ALIGN - 1) &
+        ~(size_t)(ARENA_ALIGN - 1);
+      py_pool_chunk_t *chunk = malloc (header + size * pool->per_chunk);
+      long i;
+
+      if (!chunk)
+        {
+          pthread_mutex_unlock (&pool->mutex);
+          return NULL;
+        }
+
+      chunk->next = pool->chunks;
+      pool->chunks = chunk;
+
+      for (i = pool->per_chunk - 1; i >= 0; --i)
+        {
+          void **element = (void**)((char*)chunk + header + size * i);
+          *element = pool->free_list;
+          pool->free_list = element;
+        }
+    }
+
+  ptr = pool->free_list;
+  pool->free_list = *(void**)ptr;
+  pool->used++;
+
+  pthread_mutex_unlock (&pool->mutex);
+
+  memset (ptr, 0, pool->size);
+
+  return ptr;
+}
+
+/**
+ * Return element to pool
+ *
+ * @param pool - pool to return element to
+ * @param ptr - element to be returned
+ */
+void
+py_pool_free (py_pool_t *pool, void *ptr)
+{
+  if (!ptr)
+    {
+      return;
+    }
+
+  pthread_mutex_lock (&pool->mutex);
+
+  *(void**)ptr = pool->free_list;
+  pool->free_list = ptr;
+  pool->used--;
+
+  pthread_mutex_unlock (&pool->mutex);
+}
+
+/**
+ * Free all memory of pool
+ *
+ * Memory is kept if some elements are still in use.
+ *
+ * @param pool - pool to be cleared
+ */
+void
+py_pool_clear (py_pool_t *pool)
+{
+  py_pool_chunk_t *chunk, *next;
+
+  pthread_mutex_lock (&pool->mutex);
+
+  if (!pool->used)
+    {
+      for (chunk = pool->chunks; chunk; chunk = next)
+        {
+          next = chunk->next;
+          free (chunk);
+        }
+
+      pool->chunks = NULL;
+      pool->free_list = NULL;
+    }
+
+  pthread_mutex_unlock (&pool->mutex);
+}
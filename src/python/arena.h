@@ -0,0 +1,95 @@
+/**
+ * Scratch arena for temporaries and pools of descriptors
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+#include <pthread.h>
+
+/****
+ * Scratch arena
+ */
+
+/* Default size of arena's chunk */
+#define PY_ARENA_CHUNK_SIZE (64 * 1024)
+
+/* Position in scratch arena */
+typedef struct {
+  void *chunk;
+  size_t used;
+} py_arena_mark_t;
+
+/* Allocate memory from scratch arena of current thread */
+void*
+py_arena_alloc (size_t size);
+
+/* Get current position of scratch arena of current thread */
+py_arena_mark_t
+py_arena_mark (void);
+
+/* Release all memory allocated since mark was got */
+void
+py_arena_release (py_arena_mark_t mark);
+
+/* Convert wide-char string to UTF-8 string allocated in arena. */
+/* Allocation in arena is cheap, so worst case is reserved to convert */
+/* string in one pass. _res is NULL if memory couldn't be allocated */
+#define PY_SCRATCH_WCS2MBS(_res,_src) \
+  { \
+    size_t len = wcslen (_src); \
+    _res = py_arena_alloc (len * 4 + 1); \
+    if (_res) \
+      { \
+        ((char*)_res)[py_utf8_encode ((char*)_res, _src, len)] = '\0'; \
+      } \
+  }
+
+/* Convert UTF-8 string to wide-char string allocated in arena. */
+/* _res is NULL if memory couldn't be allocated */
+#define PY_SCRATCH_MBS2WCS(_res, _src) \
+  { \
+    size_t len = strlen (_src); \
+    _res = py_arena_alloc (sizeof (wchar_t) * (len + 1)); \
+    if (_res) \
+      { \
+        (_res)[py_utf8_decode (_res, _src, len)] = 0; \
+      } \
+  }
+
+/****
+ * Pools of fixed-size descriptors
+ */
+
+typedef struct py_pool_chunk py_pool_chunk_t;
+
+typedef struct {
+  size_t size;              /* Size of element */
+  long per_chunk;           /* Count of elements in chunk */
+  long used;                /* Count of allocated elements */
+  void *free_list;          /* List of free elements */
+  py_pool_chunk_t *chunks;  /* Allocated chunks */
+  pthread_mutex_t mutex;
+} py_pool_t;
+
+/* Initializer of pool for elements of specified type */
+#define PY_POOL_INIT(type) \
+  {sizeof (type), 64, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER}
+
+/* Allocate zeroed element from pool */
+void*
+py_pool_alloc (py_pool_t *pool);
+
+/* Return element to pool */
+void
+py_pool_free (py_pool_t *pool, void *ptr);
+
+/* Free all memory of pool */
+void
+py_pool_clear (py_pool_t *pool);
@@ -0,0 +1,897 @@
+/**
+ * Zero-copy exchange of arrays between host and scripts
+ *
+ * py_array_new() wraps memory which is owned by caller into object of
+ * CoreArray type. Scripts see it as a sequence of numbers (and of
+ * sub-arrays for multi-dimensional arrays) and as an object which
+ * supports buffer protocol, so memoryview, array or numpy could use
+ * the memory directly. Memory is released by caller's callback when
+ * the last reference to array (or to any of its views) is gone.
+ *
+ * py_buffer_get() is the reverse direction: it gets memory, element
+ * type, shape and strides of a buffer which is produced by script.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#include <stdint.h>
+
+/* New-style buffer protocol appeared in Python 2.6 */
+#if PY_VERSION_HEX >= 0x02060000
+#  define ARRAY_NEW_BUFFER
+#endif
+
+typedef struct array_object {
+  PyObject_HEAD
+
+  char *data;
+  int type;
+  int ndim;
+  int flags;
+  Py_ssize_t len;  /* Count of elements */
+  Py_ssize_t shape[PY_ARRAY_MAX_DIMS];
+  Py_ssize_t strides[PY_ARRAY_MAX_DIMS];
+
+  /* Release of memory, only for array which owns memory */
+  py_array_release_t release;
+  void *user_data;
+
+  /* Array which owns memory of sub-array */
+  struct array_object *base;
+} array_object_t;
+
+/* Sizes and format characters of elements by types */
+static const Py_ssize_t type_sizes[PY_ARRAY_TYPE_COUNT] = {
+  1, 1, 2, 2, 4, 4, 8, 8, 4, 8
+};
+
+static char *type_formats[PY_ARRAY_TYPE_COUNT] = {
+  "b", "B", "h", "H", "i", "I", "q", "Q", "f", "d"
+};
+
+static PyTypeObject array_type;
+static int array_type_ready = 0;
+
+/**
+ * Check whether array is stored in C order without gaps
+ *
+ * @param array - array to check
+ * @return non-zero if array is contiguous
+ */
+static int
+is_contiguous (const array_object_t *array)
+{
+  Py_ssize_t stride = type_sizes[array->type];
+  int i;
+
+  for (i = array->ndim - 1; i >= 0; --i)
+    {
+      if (array->shape[i] > 1 && array->strides[i] != stride)
+        {
+          return 0;
+        }
+
+      stride *= array->shape[i];
+    }
+
+  return 1;
+}
+
+/**
+ * Convert element of array to Python's object
+ *
+ * @param type - type of element
+ * @param ptr - pointer to element
+ * @return new Python's object
+ */
+static PyObject*
+element_get (int type, const char *ptr)
+{
+  switch (type)
+    {
+    case PY_ARRAY_INT8:    return PyInt_FromLong (*(int8_t*)ptr);
+    case PY_ARRAY_UINT8:   return PyInt_FromLong (*(uint8_t*)ptr);
+    case PY_ARRAY_INT16:   return PyInt_FromLong (*(int16_t*)ptr);
+    case PY_ARRAY_UINT16:  return PyInt_FromLong (*(uint16_t*)ptr);
+    case PY_ARRAY_INT32:   return PyInt_FromLong (*(int32_t*)ptr);
+    case PY_ARRAY_UINT32:  return PyLong_FromUnsignedLong (*(uint32_t*)ptr);
+    case PY_ARRAY_INT64:   return PyLong_FromLongLong (*(int64_t*)ptr);
+    case PY_ARRAY_UINT64:
+      return PyLong_FromUnsignedLongLong (*(uint64_t*)ptr);
+    case PY_ARRAY_FLOAT32: return PyFloat_FromDouble (*(float*)ptr);
+    case PY_ARRAY_FLOAT64: return PyFloat_FromDouble (*(double*)ptr);
+    }
+
+  PyErr_SetString (PyExc_TypeError, "unknown type of array's element");
+  return NULL;
+}
+
+/**
+ * Store Python's object as element of array
+ *
+ * @param type - type of element
+ * @param ptr - pointer to element
+ * @param value - value to store
+ * @return zero on success, non-zero otherwise
+ */
+static int
+element_set (int type, char *ptr, PyObject *value)
+{
+  static const long long min_values[] = {
+    INT8_MIN, 0, INT16_MIN, 0, INT32_MIN, 0
+  };
+  static const long long max_values[] = {
+    INT8_MAX, UINT8_MAX, INT16_MAX, UINT16_MAX, INT32_MAX, UINT32_MAX
+  };
+  long long v;
+
+  if (type == PY_ARRAY_FLOAT32 || type == PY_ARRAY_FLOAT64)
+    {
+      double d = PyFloat_AsDouble (value);
+
+      if (d == -1.0 && PyErr_Occurred ())
+        {
+          return -1;
+        }
+
+      if (type == PY_ARRAY_FLOAT32)
+        {
+          *(float*)ptr = (float)d;
+        }
+      else
+        {
+          *(double*)ptr = d;
+        }
+
+      return 0;
+    }
+
+  if (type == PY_ARRAY_UINT64)
+    {
+      unsigned long long u;
+
+      if (PyInt_Check (value) && PyInt_AS_LONG (value) < 0)
+        {
+          PyErr_Format (PyExc_OverflowError, "value %ld is out of range of "
+                        "array's element", PyInt_AS_LONG (value));
+          return -1;
+        }
+
+      u = PyInt_Check (value) ? (unsigned long long)PyInt_AS_LONG (value) :
+        PyLong_AsUnsignedLongLong (value);
+
+      if (u == (unsigned long long)-1 && PyErr_Occurred ())
+        {
+          return -1;
+        }
+
+      *(uint64_t*)ptr = u;
+      return 0;
+    }
+
+  v = PyInt_Check (value) ? PyInt_AS_LONG (value) :
+    PyLong_AsLongLong (value);
+
+  if (v == -1 && PyErr_Occurred ())
+    {
+      return -1;
+    }
+
+  if (type < PY_ARRAY_INT64 &&
+      (v < min_values[type] || v > max_values[type]))
+    {
+      PyErr_Format (PyExc_OverflowError, "value %lld is out of range of "
+                    "array's element", v);
+      return -1;
+    }
+
+  switch (type)
+    {
+    case PY_ARRAY_INT8:   *(int8_t*)ptr = (int8_t)v; break;
+    case PY_ARRAY_UINT8:  *(uint8_t*)ptr = (uint8_t)v; break;
+    case PY_ARRAY_INT16:  *(int16_t*)ptr = (int16_t)v; break;
+    case PY_ARRAY_UINT16: *(uint16_t*)ptr = (uint16_t)v; break;
+    case PY_ARRAY_INT32:  *(int32_t*)ptr = (int32_t)v; break;
+    case PY_ARRAY_UINT32: *(uint32_t*)ptr = (uint32_t)v; break;
+    case PY_ARRAY_INT64:  *(int64_t*)ptr = (int64_t)v; break;
+    }
+
+  return 0;
+}
+
+/**
+ * Create array object
+ *
+ * @return new array object or NULL on error
+ */
+static array_object_t*
+array_alloc (void *data, int type, int ndim, const Py_ssize_t *shape,
+             const Py_ssize_t *strides, int flags)
+{
+  array_object_t *array;
+  Py_ssize_t stride;
+  int i;
+
+  if (!array_type_ready)
+    {
+      if (PyType_Ready (&array_type) < 0)
+        {
+          return NULL;
+        }
+
+      array_type_ready = 1;
+    }
+
+  array = PyObject_New (array_object_t, &array_type);
+
+  if (!array)
+    {
+      return NULL;
+    }
+
+  array->data = data;
+  array->type = type;
+  array->ndim = ndim;
+  array->flags = flags;
+  array->len = 1;
+  array->release = NULL;
+  array->user_data = NULL;
+  array->base = NULL;
+
+  /* Missing strides mean array in C order */
+  stride = type_sizes[type];
+
+  for (i = ndim - 1; i >= 0; --i)
+    {
+      array->shape[i] = shape[i];
+      array->strides[i] = strides ? strides[i] : stride;
+      array->len *= shape[i];
+      stride *= shape[i];
+    }
+
+  return array;
+}
+
+static void
+array_dealloc (array_object_t *self)
+{
+  if (self->base)
+    {
+      Py_DECREF (self->base);
+    }
+  else if (self->release)
+    {
+      self->release (self->data, self->user_data);
+    }
+
+  PyObject_Del (self);
+}
+
+static Py_ssize_t
+array_length (array_object_t *self)
+{
+  return self->shape[0];
+}
+
+static PyObject*
+array_item (array_object_t *self, Py_ssize_t index)
+{
+  array_object_t *sub;
+  char *ptr;
+
+  if (index < 0 || index >= self->shape[0])
+    {
+      PyErr_SetString (PyExc_IndexError, "array index out of range");
+      return NULL;
+    }
+
+  ptr = self->data + index * self->strides[0];
+
+  if (self->ndim == 1)
+    {
+      return element_get (self->type, ptr);
+    }
+
+  /* Sub-array shares memory and keeps owner alive */
+  sub = array_alloc (ptr, self->type, self->ndim - 1, self->shape + 1,
+                     self->strides + 1, self->flags);
+
+  if (sub)
+    {
+      sub->base = self->base ? self->base : self;
+      Py_INCREF (sub->base);
+    }
+
+  return (PyObject*)sub;
+}
+
+static int
+array_ass_item (array_object_t *self, Py_ssize_t index, PyObject *value)
+{
+  if (!(self->flags & PY_ARRAY_WRITABLE))
+    {
+      PyErr_SetString (PyExc_TypeError, "array is read-only");
+      return -1;
+    }
+
+  if (!value || self->ndim != 1)
+    {
+      PyErr_SetString (PyExc_TypeError, "only elements of one-dimensional "
+                       "array could be assigned");
+      return -1;
+    }
+
+  if (index < 0 || index >= self->shape[0])
+    {
+      PyErr_SetString (PyExc_IndexError, "array assignment index out of "
+                       "range");
+      return -1;
+    }
+
+  return element_set (self->type, self->data + index * self->strides[0],
+                      value);
+}
+
+/**
+ * Convert dimension of array to list
+ *
+ * @param self - array to convert
+ * @param ptr - pointer to first element of dimension
+ * @param dim - index of dimension
+ * @return new list
+ */
+static PyObject*
+dimension_to_list (array_object_t *self, char *ptr, int dim)
+{
+  PyObject *list = PyList_New (self->shape[dim]);
+  Py_ssize_t i;
+
+  for (i = 0; list && i < self->shape[dim]; ++i)
+    {
+      PyObject *item;
+
+      if (dim == self->ndim - 1)
+        {
+          item = element_get (self->type, ptr);
+        }
+      else
+        {
+          item = dimension_to_list (self, ptr, dim + 1);
+        }
+
+      if (!item)
+        {
+          Py_CLEAR (list);
+          break;
+        }
+
+      PyList_SET_ITEM (list, i, item);
+      ptr += self->strides[dim];
+    }
+
+  return list;
+}
+
+static PyObject*
+array_tolist (array_object_t *self, PyObject *unused)
+{
+  return dimension_to_list (self, self->data, 0);
+}
+
+static PyObject*
+array_get_shape (array_object_t *self, void *closure)
+{
+  PyObject *tuple = PyTuple_New (self->ndim);
+  int i;
+
+  for (i = 0; tuple && i < self->ndim; ++i)
+    {
+      PyTuple_SET_ITEM (tuple, i, PyInt_FromSsize_t (self->shape[i]));
+    }
+
+  return tuple;
+}
+
+static PyObject*
+array_get_strides (array_object_t *self, void *closure)
+{
+  PyObject *tuple = PyTuple_New (self->ndim);
+  int i;
+
+  for (i = 0; tuple && i < self->ndim; ++i)
+    {
+      PyTuple_SET_ITEM (tuple, i, PyInt_FromSsize_t (self->strides[i]));
+    }
+
+  return tuple;
+}
+
+static PyObject*
+array_get_format (array_object_t *self, void *closure)
+{
+  return PyString_FromString (type_formats[self->type]);
+}
+
+static PyObject*
+array_get_itemsize (array_object_t *self, void *closure)
+{
+  return PyInt_FromSsize_t (type_sizes[self->type]);
+}
+
+static PyObject*
+array_get_readonly (array_object_t *self, void *closure)
+{
+  return PyBool_FromLong (!(self->flags & PY_ARRAY_WRITABLE));
+}
+
+/* Old-style buffer protocol: only contiguous arrays are single segment */
+static Py_ssize_t
+array_getreadbuf (array_object_t *self, Py_ssize_t segment, void **ptr)
+{
+  if (segment != 0 || !is_contiguous (self))
+    {
+      PyErr_SetString (PyExc_TypeError, "buffer of array is not a single "
+                       "segment");
+      return -1;
+    }
+
+  *ptr = self->data;
+
+  return self->len * type_sizes[self->type];
+}
+
+static Py_ssize_t
+array_getwritebuf (array_object_t *self, Py_ssize_t segment, void **ptr)
+{
+  if (!(self->flags & PY_ARRAY_WRITABLE))
+    {
+      PyErr_SetString (PyExc_TypeError, "array is read-only");
+      return -1;
+    }
+
+  return array_getreadbuf (self, segment, ptr);
+}
+
+static Py_ssize_t
+array_getsegcount (array_object_t *self, Py_ssize_t *lenp)
+{
+  if (lenp)
+    {
+      *lenp = self->len * type_sizes[self->type];
+    }
+
+  return 1;
+}
+
+#ifdef ARRAY_NEW_BUFFER
+static int
+array_getbuffer (array_object_t *self, Py_buffer *view, int flags)
+{
+  if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE &&
+      !(self->flags & PY_ARRAY_WRITABLE))
+    {
+      PyErr_SetString (PyExc_BufferError, "array is read-only");
+      return -1;
+    }
+
+  if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES && !is_contiguous (self))
+    {
+      PyErr_SetString (PyExc_BufferError, "array is not contiguous");
+      return -1;
+    }
+
+  view->buf = self->data;
+  view->obj = (PyObject*)self;
+  view->len = self->len * type_sizes[self->type];
+  view->readonly = !(self->flags & PY_ARRAY_WRITABLE);
+  view->itemsize = type_sizes[self->type];
+  view->format = (flags & PyBUF_FORMAT) ? type_formats[self->type] : NULL;
+  view->ndim = self->ndim;
+  view->shape = (flags & PyBUF_ND) == PyBUF_ND ? self->shape : NULL;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ?
+    self->strides : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+
+  Py_INCREF (self);
+
+  return 0;
+}
+#endif
+
+static PySequenceMethods array_as_sequence = {
+  (lenfunc)array_length,          /* sq_length */
+  0,                              /* sq_concat */
+  0,                              /* sq_repeat */
+  (ssizeargfunc)array_item,       /* sq_item */
+  0,                              /* sq_slice */
+  (ssizeobjargproc)array_ass_item /* sq_ass_item */
+};
+
+static PyBufferProcs array_as_buffer = {
+  (readbufferproc)array_getreadbuf,   /* bf_getreadbuffer */
+  (writebufferproc)array_getwritebuf, /* bf_getwritebuffer */
+  (segcountproc)array_getsegcount,    /* bf_getsegcount */
+  0,                                  /* bf_getcharbuffer */
+#ifdef ARRAY_NEW_BUFFER
+  (getbufferproc)array_getbuffer,     /* bf_getbuffer */
+  0                                   /* bf_releasebuffer */
+#endif
+};
+
+static PyMethodDef array_methods[] = {
+  {"tolist", (PyCFunction)array_tolist, METH_NOARGS,
+   "Copy elements of array to list"},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef array_getset[] = {
+  {"shape", (getter)array_get_shape, NULL, "Sizes of dimensions", NULL},
+  {"strides", (getter)array_get_strides, NULL, "Strides in bytes", NULL},
+  {"format", (getter)array_get_format, NULL, "Format of element", NULL},
+  {"itemsize", (getter)array_get_itemsize, NULL, "Size of element", NULL},
+  {"readonly", (getter)array_get_readonly, NULL, "Array is read-only", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject array_type = {
+  PyObject_HEAD_INIT (NULL)
+  0,                            /* ob_size */
+  "CoreArray",                  /* tp_name */
+  sizeof (array_object_t),      /* tp_basicsize */
+  0,                            /* tp_itemsize */
+  (destructor)array_dealloc,    /* tp_dealloc */
+  0,                            /* tp_print */
+  0,                            /* tp_getattr */
+  0,                            /* tp_setattr */
+  0,                            /* tp_compare */
+  0,                            /* tp_repr */
+  0,                            /* tp_as_number */
+  &array_as_sequence,           /* tp_as_sequence */
+  0,                            /* tp_as_mapping */
+  0,                            /* tp_hash */
+  0,                            /* tp_call */
+  0,                            /* tp_str */
+  0,                            /* tp_getattro */
+  0,                            /* tp_setattro */
+  &array_as_buffer,             /* tp_as_buffer */
+#ifdef ARRAY_NEW_BUFFER
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /* tp_flags */
+#else
+  Py_TPFLAGS_DEFAULT,           /* tp_flags */
+#endif
+  "Array which uses memory of host application", /* tp_doc */
+  0,                            /* tp_traverse */
+  0,                            /* tp_clear */
+  0,                            /* tp_richcompare */
+  0,                            /* tp_weaklistoffset */
+  0,                            /* tp_iter */
+  0,                            /* tp_iternext */
+  array_methods,                /* tp_methods */
+  0,                            /* tp_members */
+  array_getset                  /* tp_getset */
+};
+
+/**
+ * Find type of element by format character and size
+ *
+ * @param format - format character of struct module
+ * @param size - size of element
+ * @return type of element or -1 if it's not supported
+ */
+static int
+type_by_format (char format, Py_ssize_t size)
+{
+  int type;
+
+  if (format == 'f' || format == 'd')
+    {
+      type = size == 4 ? PY_ARRAY_FLOAT32 : PY_ARRAY_FLOAT64;
+    }
+  else if (format == 'c')
+    {
+      type = PY_ARRAY_UINT8;
+    }
+  else if (strchr ("bhilq", format))
+    {
+      type = PY_ARRAY_INT8;
+    }
+  else if (strchr ("BHILQ", format))
+    {
+      type = PY_ARRAY_UINT8;
+    }
+  else
+    {
+      return -1;
+    }
+
+  /* Integer types go in pairs of growing size */
+  if (type == PY_ARRAY_INT8 || type == PY_ARRAY_UINT8)
+    {
+      switch (size)
+        {
+        case 1: break;
+        case 2: type += 2; break;
+        case 4: type += 4; break;
+        case 8: type += 6; break;
+        default: return -1;
+        }
+    }
+
+  return type_sizes[type] == size ? type : -1;
+}
+
+/********
+ * User's stuff
+ */
+
+/**
+ * Get size of element of specified type
+ *
+ * @param type - type of element, PY_ARRAY_xxx
+ * @return size of element in bytes
+ */
+Py_ssize_t
+py_array_type_size (int type)
+{
+  if (type < 0 || type >= PY_ARRAY_TYPE_COUNT)
+    {
+      return 0;
+    }
+
+  return type_sizes[type];
+}
+
+/**
+ * Wrap caller-owned memory into Python object without copying
+ *
+ * @param data - memory of array
+ * @param type - type of elements, PY_ARRAY_xxx
+ * @param ndim - count of dimensions
+ * @param shape - sizes of dimensions
+ * @param strides - strides of dimensions in bytes, NULL for C order
+ * @param flags - PY_ARRAY_READONLY or PY_ARRAY_WRITABLE
+ * @param release - callback which is called when array is not used by
+ *   scripts anymore (could be NULL). Memory should stay valid until then
+ * @param user_data - user's data for callback
+ * @return new array object or NULL with set error
+ */
+PyObject*
+py_array_new (void *data, int type, int ndim, const Py_ssize_t *shape,
+              const Py_ssize_t *strides, int flags,
+              py_array_release_t release, void *user_data)
+{
+  array_object_t *array;
+
+  if (type < 0 || type >= PY_ARRAY_TYPE_COUNT || ndim < 1 ||
+      ndim > PY_ARRAY_MAX_DIMS || !shape)
+    {
+      PyErr_SetString (PyExc_ValueError, "invalid description of array");
+      return NULL;
+    }
+
+  array = array_alloc (data, type, ndim, shape, strides, flags);
+
+  if (array)
+    {
+      array->release = release;
+      array->user_data = user_data;
+    }
+
+  return (PyObject*)array;
+}
+
+/**
+ * Wrap caller-owned one-dimensional array
+ *
+ * @param data - memory of array
+ * @param type - type of elements, PY_ARRAY_xxx
+ * @param len - count of elements
+ * @param flags - PY_ARRAY_READONLY or PY_ARRAY_WRITABLE
+ * @param release - callback which is called when array is not used
+ * @param user_data - user's data for callback
+ * @return new array object or NULL with set error
+ */
+PyObject*
+py_array_new_1d (void *data, int type, Py_ssize_t len, int flags,
+                 py_array_release_t release, void *user_data)
+{
+  return py_array_new (data, type, 1, &len, NULL, flags, release,
+                       user_data);
+}
+
+/**
+ * Check whether object is array created by py_array_new()
+ *
+ * @param obj - object to check
+ * @return non-zero if object is array
+ */
+int
+py_array_check (PyObject *obj)
+{
+  return obj && array_type_ready && PyObject_TypeCheck (obj, &array_type);
+}
+
+/**
+ * Get memory of object which supports buffer protocol without copying
+ *
+ * New-style buffers give type, shape and strides. For old-style ones
+ * type is taken from typecode of array.array, other objects are
+ * treated as bytes.
+ *
+ * @param obj - object to get memory of
+ * @param buffer - descriptor to fill
+ * @param flags - PY_ARRAY_WRITABLE if memory is going to be changed
+ * @return zero on success, non-zero with set error otherwise
+ * @sideeffect object is kept alive. Use py_buffer_release() to release
+ */
+int
+py_buffer_get (PyObject *obj, py_buffer_t *buffer, int flags)
+{
+  Py_ssize_t size, itemsize = 1;
+  PyObject *typecode;
+  char format = 'B';
+  int i;
+
+  memset (buffer, 0, sizeof (py_buffer_t));
+
+#ifdef ARRAY_NEW_BUFFER
+  if (PyObject_CheckBuffer (obj))
+    {
+      Py_buffer *view = &buffer->view;
+      const char *fmt;
+
+      if (PyObject_GetBuffer (obj, view, PyBUF_STRIDES | PyBUF_FORMAT |
+                              ((flags & PY_ARRAY_WRITABLE) ?
+                                 PyBUF_WRITABLE : 0)))
+        {
+          return -1;
+        }
+
+      buffer->has_view = 1;
+
+      /* Only native byte order and single element are supported */
+      fmt = view->format ? view->format : "B";
+      fmt += (*fmt == '@' || *fmt == '=');
+      fmt += (*fmt == '1');
+
+      buffer->type = fmt[1] ? -1 : type_by_format (fmt[0], view->itemsize);
+
+      if (buffer->type < 0 || view->suboffsets ||
+          view->ndim > PY_ARRAY_MAX_DIMS)
+        {
+          PyErr_Format (PyExc_TypeError, "unsupported buffer of format %s",
+                        view->format ? view->format : "B");
+          py_buffer_release (buffer);
+          return -1;
+        }
+
+      buffer->data = view->buf;
+      buffer->readonly = view->readonly;
+      buffer->ndim = view->ndim ? view->ndim : 1;
+      buffer->len = view->len / view->itemsize;
+
+      if (!view->ndim || !view->shape)
+        {
+          buffer->shape[0] = buffer->len;
+          buffer->strides[0] = view->itemsize;
+        }
+      else
+        {
+          /* Exporter could omit strides of contiguous buffer */
+          Py_ssize_t stride = view->itemsize;
+
+          for (i = view->ndim - 1; i >= 0; --i)
+            {
+              buffer->shape[i] = view->shape[i];
+              buffer->strides[i] = view->strides ? view->strides[i] : stride;
+              stride *= view->shape[i];
+            }
+        }
+
+      return 0;
+    }
+#endif
+
+  if (flags & PY_ARRAY_WRITABLE)
+    {
+      if (PyObject_AsWriteBuffer (obj, &buffer->data, &size))
+        {
+          return -1;
+        }
+    }
+  else
+    {
+      const void *data;
+
+      if (PyObject_AsReadBuffer (obj, &data, &size))
+        {
+          return -1;
+        }
+
+      buffer->data = (void*)data;
+      buffer->readonly = 1;
+    }
+
+  /* Old-style buffer has no format, but array.array knows it */
+  typecode = PyObject_GetAttrString (obj, "typecode");
+
+  if (typecode && PyString_Check (typecode) &&
+      PyString_GET_SIZE (typecode) == 1)
+    {
+      PyObject *o_itemsize = PyObject_GetAttrString (obj, "itemsize");
+
+      format = PyString_AS_STRING (typecode)[0];
+      itemsize = o_itemsize ? PyInt_AsSsize_t (o_itemsize) : -1;
+
+      Py_XDECREF (o_itemsize);
+    }
+
+  Py_XDECREF (typecode);
+  PyErr_Clear ();
+
+  buffer->type = type_by_format (format, itemsize);
+
+  if (buffer->type < 0)
+    {
+      PyErr_Format (PyExc_TypeError, "unsupported buffer of format %c",
+                    format);
+      return -1;
+    }
+
+  buffer->ndim = 1;
+  buffer->len = size / itemsize;
+  buffer->shape[0] = buffer->len;
+  buffer->strides[0] = itemsize;
+
+  buffer->owner = obj;
+  Py_INCREF (obj);
+
+  return 0;
+}
+
+/**
+ * Release memory which was got by py_buffer_get()
+ *
+ * @param buffer - buffer to release
+ */
+void
+py_buffer_release (py_buffer_t *buffer)
+{
+#ifdef ARRAY_NEW_BUFFER
+  if (buffer->has_view)
+    {
+      PyBuffer_Release (&buffer->view);
+      buffer->has_view = 0;
+    }
+#endif
+
+  Py_CLEAR (buffer->owner);
+  buffer->data = NULL;
+}
+
+/**
+ * Get pointer to element of buffer by its indices
+ *
+ * @param buffer - buffer to get element of
+ * @param indices - index of element for each dimension
+ * @return pointer to element
+ */
+void*
+py_buffer_ptr (const py_buffer_t *buffer, const Py_ssize_t *indices)
+{
+  char *ptr = buffer->data;
+  int i;
+
+  for (i = 0; i < buffer->ndim; ++i)
+    {
+      ptr += indices[i] * buffer->strides[i];
+    }
+
+  return ptr;
+}
@@ -0,0 +1,88 @@
+/**
+ * Zero-copy exchange of arrays between host and scripts
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Max count of dimensions of array */
+#define PY_ARRAY_MAX_DIMS 8
+
+/* Types of array's elements */
+enum {
+  PY_ARRAY_INT8,
+  PY_ARRAY_UINT8,
+  PY_ARRAY_INT16,
+  PY_ARRAY_UINT16,
+  PY_ARRAY_INT32,
+  PY_ARRAY_UINT32,
+  PY_ARRAY_INT64,
+  PY_ARRAY_UINT64,
+  PY_ARRAY_FLOAT32,
+  PY_ARRAY_FLOAT64,
+
+  PY_ARRAY_TYPE_COUNT
+};
+
+/* Flags of arrays and buffers */
+enum {
+  PY_ARRAY_READONLY = 0x0000, /* Scripts could only read elements */
+  PY_ARRAY_WRITABLE = 0x0001  /* Scripts could change elements */
+};
+
+/* Called when array is not used by scripts anymore */
+typedef void (*py_array_release_t) (void *data, void *user_data);
+
+/* Memory of array which is got from Python's object */
+typedef struct {
+  void *data;
+  int type;                 /* Type of elements, PY_ARRAY_xxx */
+  int ndim;                 /* Count of dimensions */
+  Py_ssize_t len;           /* Count of elements */
+  Py_ssize_t shape[PY_ARRAY_MAX_DIMS];
+  Py_ssize_t strides[PY_ARRAY_MAX_DIMS]; /* Strides in bytes */
+  int readonly;
+
+  PyObject *owner;          /* Object which owns memory */
+#if PY_VERSION_HEX >= 0x02060000
+  Py_buffer view;           /* View of new-style buffer */
+  int has_view;
+#endif
+} py_buffer_t;
+
+/* Get size of element of specified type */
+Py_ssize_t
+py_array_type_size (int type);
+
+/* Wrap caller-owned memory into Python object without copying */
+PyObject*
+py_array_new (void *data, int type, int ndim, const Py_ssize_t *shape,
+              const Py_ssize_t *strides, int flags,
+              py_array_release_t release, void *user_data);
+
+/* Wrap caller-owned one-dimensional array */
+PyObject*
+py_array_new_1d (void *data, int type, Py_ssize_t len, int flags,
+                 py_array_release_t release, void *user_data);
+
+/* Check whether object is array created by py_array_new() */
+int
+py_array_check (PyObject *obj);
+
+/* Get memory of object which supports buffer protocol without copying */
+int
+py_buffer_get (PyObject *obj, py_buffer_t *buffer, int flags);
+
+/* Release memory which was got by py_buffer_get() */
+void
+py_buffer_release (py_buffer_t *buffer);
+
+/* Get pointer to element of buffer by its indices */
+void*
+py_buffer_ptr (const py_buffer_t *buffer, const Py_ssize_t *indices);
@@ -0,0 +1,317 @@
+/**
+ * Batch invocation of Python callables over arrays of C structures
+ *
+ * Calling a callable once per record from C pays for building of
+ * arguments, entering of the interpreter and conversion of result on
+ * each call. Batch converts fields of records into arguments of single
+ * call handle, so numeric arguments are updated in place, and stores
+ * results directly into output array.
+ *
+ * Exception of an item doesn't abort the batch: it's stored with index
+ * of record and the batch goes on with next record.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+/* Default count of calls between GIL releases */
+#define DEFAULT_CHUNK 256
+
+/**
+ * Set arguments of call from fields of record
+ *
+ * @param call - handle of call
+ * @param fields - fields of record
+ * @param record - record
+ * @return zero on success, non-zero otherwise
+ */
+static int
+set_args (py_call_t *call, const py_field_t *fields, const char *record)
+{
+  int i, res = 0;
+
+  for (i = 0; !res && fields[i].name; ++i)
+    {
+      const char *ptr = record + fields[i].offset;
+
+      switch (fields[i].type)
+        {
+        case PY_FIELD_INT:
+          res = py_call_set_long (call, i, *(const int*)ptr);
+          break;
+        case PY_FIELD_LONG:
+          res = py_call_set_long (call, i, *(const long*)ptr);
+          break;
+        case PY_FIELD_FLOAT:
+          res = py_call_set_double (call, i, *(const float*)ptr);
+          break;
+        case PY_FIELD_DOUBLE:
+          res = py_call_set_double (call, i, *(const double*)ptr);
+          break;
+        case PY_FIELD_STRING:
+          {
+            PyObject *str;
+
+            str = PyString_FromStringAndSize (ptr,
+                                              strnlen (ptr, fields[i].size));
+
+            res = str ? py_call_set_object (call, i, str) : -1;
+            Py_XDECREF (str);
+            break;
+          }
+        case PY_FIELD_OBJECT:
+          {
+            PyObject *obj = *(PyObject* const*)ptr;
+
+            res = py_call_set_object (call, i, obj ? obj : Py_None);
+            break;
+          }
+        }
+    }
+
+  return res;
+}
+
+/**
+ * Store result of call in output array
+ *
+ * @param batch - batch descriptor
+ * @param index - index of record
+ * @param result - result of call
+ * @return zero on success, non-zero otherwise
+ */
+static int
+store_result (py_batch_t *batch, Py_ssize_t index, PyObject *result)
+{
+  switch (batch->out_type)
+    {
+    case PY_FIELD_INT:
+    case PY_FIELD_LONG:
+      {
+        long v = PyInt_AsLong (result);
+
+        if (v == -1 && PyErr_Occurred ())
+          {
+            return -1;
+          }
+
+        if (batch->out_type == PY_FIELD_LONG)
+          {
+            ((long*)batch->out)[index] = v;
+          }
+        else if (v < INT_MIN || v > INT_MAX)
+          {
+            PyErr_SetString (PyExc_OverflowError, "result is out of range "
+                             "of int");
+            return -1;
+          }
+        else
+          {
+            ((int*)batch->out)[index] = (int)v;
+          }
+
+        return 0;
+      }
+
+    case PY_FIELD_FLOAT:
+    case PY_FIELD_DOUBLE:
+      {
+        double v = PyFloat_AsDouble (result);
+
+        if (v == -1.0 && PyErr_Occurred ())
+          {
+            return -1;
+          }
+
+        if (batch->out_type == PY_FIELD_FLOAT)
+          {
+            ((float*)batch->out)[index] = (float)v;
+          }
+        else
+          {
+            ((double*)batch->out)[index] = v;
+          }
+
+        return 0;
+      }
+
+    case PY_FIELD_OBJECT:
+      Py_INCREF (result);
+      ((PyObject**)batch->out)[index] = result;
+      return 0;
+    }
+
+  return 0;
+}
+
+/**
+ * Store current exception as error of item and clear it
+ *
+ * @param batch - batch descriptor
+ * @param index - index of record
+ */
+static void
+store_error (py_batch_t *batch, Py_ssize_t index)
+{
+  PyObject *type, *value, *traceback, *str = NULL;
+  py_batch_error_t *error;
+  const char *name;
+  char *message;
+
+  ++batch->failed;
+
+  if (batch->errors_count >= batch->max_errors)
+    {
+      PyErr_Clear ();
+      return;
+    }
+
+  PyErr_Fetch (&type, &value, &traceback);
+  PyErr_NormalizeException (&type, &value, &traceback);
+
+  name = PyExceptionClass_Check (type) ? PyExceptionClass_Name (type) : "?";
+  name = strrchr (name, '.') ? strrchr (name, '.') + 1 : name;
+
+  if (value)
+    {
+      str = PyObject_Str (value);
+      PyErr_Clear ();
+    }
+
+  message = malloc (strlen (name) + (str ? PyString_Size (str) : 0) + 3);
+
+  if (!message)
+    {
+      goto done;
+    }
+
+  sprintf (message, "%s: %s", name, str ? PyString_AsString (str) : "");
+
+  /* Grow storage of errors by powers of two */
+  if (!(batch->errors_count & (batch->errors_count - 1)))
+    {
+      py_batch_error_t *errors;
+
+      errors = realloc (batch->errors, sizeof (py_batch_error_t) *
+                        MAX (batch->errors_count * 2, 1));
+
+      if (!errors)
+        {
+          /* Item is counted as failed but its error isn't stored */
+          goto done;
+        }
+
+      batch->errors = errors;
+    }
+
+  error = &batch->errors[batch->errors_count++];
+  error->index = index;
+  error->message = py_mbs2wcs (message);
+
+done:
+  free (message);
+  Py_XDECREF (str);
+  Py_XDECREF (type);
+  Py_XDECREF (value);
+  Py_XDECREF (traceback);
+}
+
+/********
+ * User's stuff
+ */
+
+/**
+ * Call callable for each record of batch
+ *
+ * Results of failed items are left unchanged in output array.
+ *
+ * @param batch - batch descriptor
+ * @return zero if batch has been run (even if some items failed),
+ *   non-zero with set error if batch couldn't be started
+ */
+int
+py_batch_run (py_batch_t *batch)
+{
+  py_call_t *call;
+  Py_ssize_t i, chunk = batch->chunk > 0 ? batch->chunk : DEFAULT_CHUNK;
+  int argc = 0;
+
+  batch->failed = 0;
+  batch->errors = NULL;
+  batch->errors_count = 0;
+
+  if (batch->out && batch->out_type == PY_FIELD_STRING)
+    {
+      PyErr_SetString (PyExc_ValueError, "strings are not supported as "
+                       "results of batch");
+      return -1;
+    }
+
+  while (batch->fields[argc].name)
+    {
+      ++argc;
+    }
+
+  call = py_call_new (batch->callable, argc);
+
+  if (!call)
+    {
+      return -1;
+    }
+
+  for (i = 0; i < batch->count; ++i)
+    {
+      const char *record = (const char*)batch->records + i * batch->stride;
+      PyObject *result = NULL;
+
+      if (!set_args (call, batch->fields, record))
+        {
+          result = py_call_invoke (call);
+        }
+
+      if (!result || (batch->out && store_result (batch, i, result)))
+        {
+          store_error (batch, i);
+        }
+
+      Py_XDECREF (result);
+
+      if ((batch->flags & PY_BATCH_RELEASE_GIL) && (i + 1) % chunk == 0)
+        {
+          /* Give other threads a chance to run. Nothing is done */
+          /* while GIL is released: every call of chunk needs it. */
+          /* This is the same switch the eval loop does every */
+          /* sys.getcheckinterval() ticks, releasing the lock wakes */
+          /* a thread which waits for it. */
+          Py_BEGIN_ALLOW_THREADS
+          Py_END_ALLOW_THREADS
+        }
+    }
+
+  py_call_free (call);
+
+  return 0;
+}
+
+/**
+ * Free errors which are stored in batch
+ *
+ * @param batch - batch descriptor
+ */
+void
+py_batch_free_errors (py_batch_t *batch)
+{
+  Py_ssize_t i;
+
+  for (i = 0; i < batch->errors_count; ++i)
+    {
+      free (batch->errors[i].message);
+    }
+
+  SAFE_FREE (batch->errors);
+  batch->errors_count = 0;
+}
@@ -0,0 +1,54 @@
+/**
+ * Batch invocation of Python callables over arrays of C structures
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Flags of batches */
+enum {
+  PY_BATCH_RELEASE_GIL = 0x0001 /* Release GIL between chunks */
+};
+
+/* Error of batch's item */
+typedef struct {
+  Py_ssize_t index;   /* Index of record */
+  wchar_t *message;   /* Type and text of exception */
+} py_batch_error_t;
+
+typedef struct {
+  PyObject *callable;
+
+  /* Records which are passed to callable, one argument per field */
+  const void *records;
+  size_t stride;              /* Distance between records in bytes */
+  Py_ssize_t count;           /* Count of records */
+  const py_field_t *fields;   /* Fields which are passed as arguments */
+
+  /* Results of calls, PY_FIELD_OBJECT results are new references */
+  void *out;                  /* Array of results (could be NULL) */
+  int out_type;               /* Type of results, PY_FIELD_xxx */
+
+  Py_ssize_t chunk;           /* Count of calls between GIL releases */
+  int flags;                  /* Combination of PY_BATCH_xxx flags */
+  Py_ssize_t max_errors;      /* Max count of stored errors */
+
+  /* Filled by py_batch_run() */
+  Py_ssize_t failed;          /* Count of failed items */
+  py_batch_error_t *errors;   /* Stored errors of failed items */
+  Py_ssize_t errors_count;    /* Count of stored errors */
+} py_batch_t;
+
+/* Call callable for each record of batch */
+int
+py_batch_run (py_batch_t *batch);
+
+/* Free errors which are stored in batch */
+void
+py_batch_free_errors (py_batch_t *batch);
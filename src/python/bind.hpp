@@ -0,0 +1,600 @@
+/**
+ * Compile-time binding of typed C/C++ functions as Python methods
+ *
+ * Instead of writing PY_METHOD bodies which parse arguments with
+ * PY_PARSE_TUPLE, plain function could be bound:
+ *
+ *   static long add (long a, long b) { return a + b; }
+ *
+ *   PY_BEGIN_STATIC_METHMAP(methods)
+ *     PY_METHMAP_BIND ("add", add, "Sum of two integers")
+ *   PY_END_STATIC_METHMAP
+ *
+ * Unpacking of arguments and conversion of result are generated by
+ * templates for the function's signature, so no format string is
+ * interpreted on calls. Functions without arguments are registered as
+ * METH_NOARGS, functions with one argument as METH_O, so Python does not
+ * even build arguments' tuple for them.
+ *
+ * Supported argument types are integers, floating point numbers, bool,
+ * const char* and std::string (Python str), std::wstring (str which is
+ * decoded from UTF-8, or unicode), PyObject* and py::borrowed (borrowed
+ * reference). Result could be any of them except py::borrowed, or
+ * const wchar_t*, py::ref or void. Returned PyObject* is a new reference
+ * which is passed to Python as-is, so returning NULL with error set
+ * raises the error.
+ *
+ * To raise Python error from function with other result type, set the
+ * error and throw py::bind::error. Other C++ exceptions are converted to
+ * RuntimeError, since they must not cross Python's frames.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_BIND_HPP
+#define PYTHON_BIND_HPP
+
+#ifndef __cplusplus
+#  error "This header is for C++ sources only"
+#endif
+
+#include "iface.h"
+#include "ref.hpp"
+
+#include <cstddef>
+#include <exception>
+#include <limits>
+#include <new>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/* Bound method's function and flags */
+#define PY_BIND(func) \
+  py::bind::method<decltype (&func), &func>::call
+
+#define PY_BIND_FLAGS(func) \
+  py::bind::method<decltype (&func), &func>::flags
+
+/* Entry of methods' map for bound function */
+#define PY_METHMAP_BIND(name, func, doc) \
+  {PY_NARROW_LITERAL (name), PY_BIND (func), PY_BIND_FLAGS (func), \
+   PY_NARROW_LITERAL (doc)},
+
+namespace py {
+namespace bind {
+
+/* Thrown by bound function when Python error is already set */
+struct error {};
+
+/****
+ * Helpers
+ */
+
+/* Sequence of indices of arguments */
+template <std::size_t... I>
+struct indices {};
+
+template <std::size_t N, std::size_t... I>
+struct make_indices : make_indices<N - 1, N - 1, I...> {};
+
+template <std::size_t... I>
+struct make_indices<0, I...>
+{
+  typedef indices<I...> type;
+};
+
+/**
+ * Raise TypeError about argument of unexpected type
+ *
+ * @param obj - argument's value
+ * @param index - index of argument
+ * @param expected - name of expected type
+ * @return false, so could be returned from arg::load()
+ */
+static inline bool
+type_error (PyObject *obj, std::size_t index, const char *expected)
+{
+  PyErr_Format (PyExc_TypeError, "argument %d must be %s, not %.50s",
+                (int)index + 1, expected, obj->ob_type->tp_name);
+  return false;
+}
+
+/**
+ * Get integer value of Python object
+ *
+ * @param obj - object to get value of
+ * @param index - index of argument
+ * @param value - value of integer
+ * @return true on success, false if error is raised
+ */
+static inline bool
+load_integer (PyObject *obj, std::size_t index, long long &value)
+{
+  if (PyInt_Check (obj))
+    {
+      value = PyInt_AS_LONG (obj);
+      return true;
+    }
+
+  if (PyLong_Check (obj))
+    {
+      value = PyLong_AsLongLong (obj);
+      return value != -1 || !PyErr_Occurred ();
+    }
+
+  return type_error (obj, index, "integer");
+}
+
+/**
+ * Make Python string from wide-char string
+ *
+ * String is encoded to UTF-8 in scratch arena.
+ *
+ * @param str - string to convert
+ * @param len - length of string
+ * @return new reference to Python string or NULL with Python error set
+ */
+static inline PyObject*
+wide_to_python (const wchar_t *str, std::size_t len)
+{
+  py_arena_mark_t mark = py_arena_mark ();
+  char *buf = (char*)py_arena_alloc (len * 4 + 1);
+  PyObject *result;
+
+  if (!buf)
+    {
+      py_arena_release (mark);
+      return PyErr_NoMemory ();
+    }
+
+  result = PyString_FromStringAndSize (buf, py_utf8_encode (buf, str, len));
+  py_arena_release (mark);
+
+  return result;
+}
+
+/****
+ * Conversion of arguments
+ */
+
+/* Converter of Python object to argument of type T */
+template <typename T, typename Enable = void>
+struct arg;
+
+template <typename T>
+struct arg<T, typename std::enable_if<std::is_integral<T>::value &&
+                                      !std::is_same<T, bool>::value>::type>
+{
+  T value;
+
+  bool
+  load (PyObject *obj, std::size_t index)
+  {
+    long long result;
+
+    if (!load_integer (obj, index, result))
+      {
+        return false;
+      }
+
+    if ((std::is_signed<T>::value &&
+         (result < (long long)std::numeric_limits<T>::min () ||
+          result > (long long)std::numeric_limits<T>::max ())) ||
+        (!std::is_signed<T>::value &&
+         (result < 0 || (sizeof (T) < sizeof (long long) &&
+                         result > (long long)std::numeric_limits<T>::max ()))))
+      {
+        PyErr_Format (PyExc_OverflowError, "argument %d is out of range",
+                      (int)index + 1);
+        return false;
+      }
+
+    value = (T)result;
+    return true;
+  }
+};
+
+template <typename T>
+struct arg<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+  T value;
+
+  bool
+  load (PyObject *obj, std::size_t index)
+  {
+    if (PyFloat_Check (obj))
+      {
+        value = (T)PyFloat_AS_DOUBLE (obj);
+        return true;
+      }
+
+    if (PyInt_Check (obj))
+      {
+        value = (T)PyInt_AS_LONG (obj);
+        return true;
+      }
+
+    if (PyLong_Check (obj))
+      {
+        double result = PyLong_AsDouble (obj);
+
+        value = (T)result;
+        return result != -1.0 || !PyErr_Occurred ();
+      }
+
+    return type_error (obj, index, "float");
+  }
+};
+
+template <>
+struct arg<bool>
+{
+  bool value;
+
+  bool
+  load (PyObject *obj, std::size_t)
+  {
+    int result = PyObject_IsTrue (obj);
+
+    value = result > 0;
+    return result >= 0;
+  }
+};
+
+template <>
+struct arg<const char*>
+{
+  const char *value;
+
+  bool
+  load (PyObject *obj, std::size_t index)
+  {
+    if (!PyString_Check (obj))
+      {
+        return type_error (obj, index, "string");
+      }
+
+    value = PyString_AS_STRING (obj);
+    return true;
+  }
+};
+
+template <>
+struct arg<std::string>
+{
+  std::string value;
+
+  bool
+  load (PyObject *obj, std::size_t index)
+  {
+    if (!PyString_Check (obj))
+      {
+        return type_error (obj, index, "string");
+      }
+
+    value.assign (PyString_AS_STRING (obj), PyString_GET_SIZE (obj));
+    return true;
+  }
+};
+
+template <>
+struct arg<std::wstring>
+{
+  std::wstring value;
+
+  bool
+  load (PyObject *obj, std::size_t index)
+  {
+    if (PyString_Check (obj))
+      {
+        std::size_t len = PyString_GET_SIZE (obj);
+
+        value.resize (len);
+        value.resize (py_utf8_decode (&value[0], PyString_AS_STRING (obj),
+                                      len));
+        return true;
+      }
+
+    if (PyUnicode_Check (obj))
+      {
+        Py_ssize_t len = PyUnicode_GET_SIZE (obj);
+
+        value.resize (len);
+        len = PyUnicode_AsWideChar ((PyUnicodeObject*)obj, &value[0], len);
+        if (len < 0)
+          {
+            return false;
+          }
+
+        value.resize (len);
+        return true;
+      }
+
+    return type_error (obj, index, "string");
+  }
+};
+
+template <>
+struct arg<PyObject*>
+{
+  PyObject *value;
+
+  bool
+  load (PyObject *obj, std::size_t)
+  {
+    value = obj;
+    return true;
+  }
+};
+
+template <>
+struct arg<borrowed>
+{
+  borrowed value;
+
+  bool
+  load (PyObject *obj, std::size_t)
+  {
+    value = borrowed (obj);
+    return true;
+  }
+};
+
+/****
+ * Conversion of results
+ */
+
+/* Converter of result of type T to Python object */
+template <typename T, typename Enable = void>
+struct result;
+
+template <typename T>
+struct result<T, typename std::enable_if<std::is_integral<T>::value &&
+                                         !std::is_same<T, bool>::value>::type>
+{
+  static PyObject*
+  convert (T value)
+  {
+    if (sizeof (T) < sizeof (long) ||
+        (std::is_signed<T>::value && sizeof (T) == sizeof (long)))
+      {
+        return PyInt_FromLong ((long)value);
+      }
+
+    if (std::is_signed<T>::value)
+      {
+        return PyLong_FromLongLong ((long long)value);
+      }
+
+    if ((unsigned long long)value <=
+        (unsigned long long)std::numeric_limits<long>::max ())
+      {
+        return PyInt_FromLong ((long)value);
+      }
+
+    return PyLong_FromUnsignedLongLong ((unsigned long long)value);
+  }
+};
+
+template <typename T>
+struct result<T,
+              typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+  static PyObject*
+  convert (T value)
+  {
+    return PyFloat_FromDouble ((double)value);
+  }
+};
+
+template <>
+struct result<bool>
+{
+  static PyObject*
+  convert (bool value)
+  {
+    return PyBool_FromLong (value);
+  }
+};
+
+template <>
+struct result<const char*>
+{
+  static PyObject*
+  convert (const char *value)
+  {
+    if (!value)
+      {
+        Py_RETURN_NONE;
+      }
+
+    return PyString_FromString (value);
+  }
+};
+
+template <>
+struct result<std::string>
+{
+  static PyObject*
+  convert (const std::string &value)
+  {
+    return PyString_FromStringAndSize (value.data (), value.size ());
+  }
+};
+
+template <>
+struct result<const wchar_t*>
+{
+  static PyObject*
+  convert (const wchar_t *value)
+  {
+    if (!value)
+      {
+        Py_RETURN_NONE;
+      }
+
+    return wide_to_python (value, wcslen (value));
+  }
+};
+
+template <>
+struct result<std::wstring>
+{
+  static PyObject*
+  convert (const std::wstring &value)
+  {
+    return wide_to_python (value.data (), value.size ());
+  }
+};
+
+template <>
+struct result<PyObject*>
+{
+  static PyObject*
+  convert (PyObject *value)
+  {
+    return value;
+  }
+};
+
+template <>
+struct result<ref>
+{
+  static PyObject*
+  convert (ref &&value)
+  {
+    return value.release ();
+  }
+};
+
+/****
+ * Binding
+ */
+
+/* Call of function with unpacked arguments and conversion of result */
+template <typename R, typename... A>
+struct invoker
+{
+  template <typename Tuple, std::size_t... I>
+  static PyObject*
+  call (R (*func) (A...), Tuple &values, indices<I...>)
+  {
+    return result<typename std::decay<R>::type>::convert (
+      func (std::move (std::get<I> (values).value)...));
+  }
+};
+
+template <typename... A>
+struct invoker<void, A...>
+{
+  template <typename Tuple, std::size_t... I>
+  static PyObject*
+  call (void (*func) (A...), Tuple &values, indices<I...>)
+  {
+    func (std::move (std::get<I> (values).value)...);
+    Py_RETURN_NONE;
+  }
+};
+
+/**
+ * Load all arguments
+ *
+ * @param values - converters of arguments
+ * @param items - Python objects of arguments
+ * @return true on success, false if error is raised
+ */
+template <typename Tuple, std::size_t... I>
+static inline bool
+load_args (Tuple &values, PyObject *const *items, indices<I...>)
+{
+  bool ok = true;
+  int unused[] = {0, (ok = ok && std::get<I> (values).load (items[I], I))...};
+
+  (void)unused;
+  (void)items;
+
+  return ok;
+}
+
+/* Python method which calls function F */
+template <typename Sig, Sig F>
+struct method;
+
+template <typename R, typename... A, R (*F) (A...)>
+struct method<R (*) (A...), F>
+{
+  static const std::size_t count = sizeof... (A);
+
+  static const int flags = count == 0 ? METH_NOARGS :
+    (count == 1 ? METH_O : METH_VARARGS);
+
+  /**
+   * Implementation of Python method
+   *
+   * @param self - unused
+   * @param args - NULL, single argument or tuple of arguments
+   *   depending on flags
+   * @return result of function
+   */
+  static PyObject*
+  call (PyObject *, PyObject *args)
+  {
+    std::tuple<arg<typename std::decay<A>::type>...> values;
+    typename make_indices<count>::type seq;
+    PyObject *const *items = &args;
+
+    if (flags == METH_VARARGS)
+      {
+        if (PyTuple_GET_SIZE (args) != (Py_ssize_t)count)
+          {
+            PyErr_Format (PyExc_TypeError, "takes exactly %d arguments "
+                          "(%d given)", (int)count,
+                          (int)PyTuple_GET_SIZE (args));
+            return NULL;
+          }
+
+        items = &PyTuple_GET_ITEM (args, 0);
+      }
+
+    /* Loading of arguments allocates too, so nothing should escape */
+    /* to frames of interpreter */
+    try
+      {
+        if (!load_args (values, items, seq))
+          {
+            return NULL;
+          }
+
+        return invoker<R, A...>::call (F, values, seq);
+      }
+    catch (const error &)
+      {
+        return NULL;
+      }
+    catch (const std::bad_alloc &)
+      {
+        PyErr_NoMemory ();
+        return NULL;
+      }
+    catch (const std::exception &e)
+      {
+        PyErr_SetString (PyExc_RuntimeError, e.what ());
+        return NULL;
+      }
+    catch (...)
+      {
+        PyErr_SetString (PyExc_RuntimeError, "unknown C++ exception");
+        return NULL;
+      }
+  }
+};
+
+}
+}
+
+#endif
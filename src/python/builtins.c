@@ -16,25 +16,119 @@ static PyObject *mod_corebuilt = NULL;
 PY_METHOD(syspath_append)
   char *dirname;
   wchar_t *wdirname;
+  py_arena_mark_t mark;
 
   PY_PARSE_TUPLE ("s", L"Method expects one string argument", &dirname);
 
-  MBS2WCS (wdirname, dirname);
+  mark = py_arena_mark ();
+  PY_SCRATCH_MBS2WCS (wdirname, dirname);
 
   if (wdirname)
     {
       py_syspath_append (wdirname);
-      free (wdirname);
     }
+
+  py_arena_release (mark);
+
+  if (!wdirname)
+    {
+      return PyErr_NoMemory ();
+    }
+PY_METH_END
+
+PY_METHOD(bundle_mount)
+  char *archive;
+  wchar_t *warchive;
+  py_arena_mark_t mark;
+  int result;
+
+  PY_PARSE_TUPLE ("s", L"Method expects one string argument", &archive);
+
+  mark = py_arena_mark ();
+  PY_SCRATCH_MBS2WCS (warchive, archive);
+
+  if (!warchive)
+    {
+      py_arena_release (mark);
+      return PyErr_NoMemory ();
+    }
+
+  result = py_bundle_mount (warchive);
+  py_arena_release (mark);
+
+  if (result)
+    {
+      return extpy_return_pyobj_error (PyExc_IOError,
+                                       L"Unable to mount archive");
+    }
+PY_METH_END
+
+PY_METHOD(method_stats)
+  return py_stats_as_dict ();
+PY_METH_END
+
+PY_METHOD(reset_method_stats)
+  py_stats_reset ();
 PY_METH_END
 
-PY_BEGIN_METHMAP(methods)
-  PY_METHMAP_DEF (L"syspathAppend", syspath_append,
-                  METH_VARARGS, L"Append specified directory to system paths")
-PY_END_METHMAP
+PY_BEGIN_STATIC_METHMAP(methods)
+  PY_STATIC_METHMAP_DEF ("syspathAppend", syspath_append,
+                         METH_VARARGS,
+                         "Append specified directory to system paths")
+  PY_STATIC_METHMAP_DEF ("bundleMount", bundle_mount,
+                         METH_VARARGS, "Mount archive of precompiled modules")
+  PY_STATIC_METHMAP_DEF ("methodStats", method_stats,
+                         METH_NOARGS,
+                         "Get call statistics of registered C methods")
+  PY_STATIC_METHMAP_DEF ("resetMethodStats", reset_method_stats,
+                         METH_NOARGS,
+                         "Reset call statistics of registered C methods")
 
-PY_INITTAB_PROC(builtins_init, L"CoreBuiltins",
-                L"Module with different core built-ins", methods)
+  /* I/O which releases GIL during system calls */
+  PY_STATIC_METHMAP_DEF ("readFile", py_io_read_file,
+                         METH_VARARGS, "Read whole file or its part")
+  PY_STATIC_METHMAP_DEF ("readLines", py_io_read_lines,
+                         METH_VARARGS, "Read lines of file")
+  PY_STATIC_METHMAP_DEF ("writeFile", py_io_write_file,
+                         METH_VARARGS, "Write data to file")
+  PY_STATIC_METHMAP_DEF ("mmapFile", py_io_mmap_file,
+                         METH_VARARGS,
+                         "Map file into memory as read-only array")
+  PY_STATIC_METHMAP_DEF ("openFile", py_io_open,
+                         METH_VARARGS, "Open file and return its descriptor")
+  PY_STATIC_METHMAP_DEF ("closeFile", py_io_close,
+                         METH_VARARGS, "Close file or socket descriptor")
+  PY_STATIC_METHMAP_DEF ("readChunk", py_io_read_chunk,
+                         METH_VARARGS, "Read next chunk from descriptor")
+  PY_STATIC_METHMAP_DEF ("readInto", py_io_read_into,
+                         METH_VARARGS,
+                         "Read from descriptor into writable buffer")
+  PY_STATIC_METHMAP_DEF ("writeChunk", py_io_write,
+                         METH_VARARGS, "Write whole data to descriptor")
+  PY_STATIC_METHMAP_DEF ("socketConnect", py_io_socket_connect,
+                         METH_VARARGS, "Connect to local stream socket")
+  PY_STATIC_METHMAP_DEF ("socketSend", py_io_socket_send,
+                         METH_VARARGS, "Send whole data to socket")
+  PY_STATIC_METHMAP_DEF ("socketRecv", py_io_socket_recv,
+                         METH_VARARGS, "Receive data from socket")
+  PY_STATIC_METHMAP_DEF ("socketRecvInto", py_io_socket_recv_into,
+                         METH_VARARGS,
+                         "Receive data from socket into writable buffer")
+
+  /* Caches which are shared by all runs of scripts */
+  PY_STATIC_METHMAP_DEF ("cache", py_cache_builtin,
+                         METH_VARARGS | METH_KEYWORDS,
+                         "Get named cache which is shared by all runs")
+  PY_STATIC_METHMAP_DEF ("memo", py_cache_memo,
+                         METH_VARARGS | METH_KEYWORDS,
+                         "Make memoizing wrapper of pure function")
+  PY_STATIC_METHMAP_DEF ("cacheStats", py_cache_stats_builtin,
+                         METH_NOARGS,
+                         "Get hit rates and memory usage of caches")
+PY_END_STATIC_METHMAP
+
+PY_INITTAB_STATIC_PROC(builtins_init, L"CoreBuiltins",
+                       L"Module with different core built-ins", methods)
   PY_DEF_INT_CONST (L"TRUE", 1);
   PY_DEF_INT_CONST (L"FALSE", 0);
 PY_INITTAB_END_PROC
@@ -56,13 +150,29 @@ py_builtins_init (void)
   return 0;
 }
 
+/**
+ * Initialize builtins stuff, postponing creation of CoreBuiltins
+ *
+ * CoreBuiltins is created on its first import or on first request
+ * of local dictionary of the builtins.
+ *
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_builtins_init_lazy (void)
+{
+  global_builtins = PyEval_GetBuiltins ();
+
+  return py_module_register_lazy ("CoreBuiltins", builtins_init);
+}
+
 /**
  * Uninitialize builtins stuff
  */
 void
 py_builtins_done (void)
 {
-  Py_DECREF (mod_corebuilt);
+  Py_CLEAR (mod_corebuilt);
 }
 
 /**
@@ -79,10 +189,21 @@ py_builtins_get_global (void)
 /**
  * Return a local dictionary of the builtins
  *
- * @return dictionary of builtins
+ * @return dictionary of builtins or NULL with Python error set if
+ *   CoreBuiltins could not be imported
  */
 PyObject*
 py_builtins_get_local (void)
 {
+  if (!mod_corebuilt)
+    {
+      mod_corebuilt = PyImport_ImportModule ("CoreBuiltins");
+
+      if (!mod_corebuilt)
+        {
+          return NULL;
+        }
+    }
+
   return PyModule_GetDict (mod_corebuilt);
 }
@@ -16,6 +16,10 @@
 int
 py_builtins_init (void);
 
+/* Initialize builtins stuff, postponing creation of CoreBuiltins */
+int
+py_builtins_init_lazy (void);
+
 /* Uninitialize builtins stuff */
 void
 py_builtins_done (void);
@@ -0,0 +1,756 @@
+/**
+ * Archives of precompiled modules
+ *
+ * Archive is a single file with marshalled code objects of modules and
+ * an index, which is a hash table of modules' names. Archive is mapped
+ * into memory when it's mounted, and modules are found by the importer
+ * of iface.c with a hash lookup, so imports from archive do not touch
+ * filesystem at all.
+ *
+ * Layout of archive (all numbers are 32-bit in host's byte order):
+ *
+ *   header     magic, count of entries and buckets, magic of bytecode
+ *   entries    py_bundle_entry_t for each module
+ *   buckets    index of entry plus one, or zero for empty bucket
+ *   names      names of modules without terminators
+ *   data       marshalled code objects
+ *
+ * Buckets are addressed by hash of name with linear probing.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#include <marshal.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BUNDLE_MAGIC "PYBNDL\0\1"
+
+/* Minimal count of buckets in index */
+#define BUNDLE_MIN_BUCKETS 16
+
+typedef struct {
+  char magic[8];
+  unsigned int count;    /* Count of entries */
+  unsigned int buckets;  /* Count of buckets, power of two */
+  unsigned int pymagic;  /* Magic number of bytecode */
+  unsigned int reserved;
+} bundle_header_t;
+
+/* Mounted archive */
+typedef struct bundle {
+  char *file_name;
+
+  const unsigned char *data;
+  size_t size;
+
+  const bundle_header_t *header;
+  const py_bundle_entry_t *entries;
+  const unsigned int *buckets;
+
+  struct bundle *next;
+} bundle_t;
+
+/* Module which is collected for building of archive */
+typedef struct {
+  char *name;
+  char *path;
+  int flags;
+} build_module_t;
+
+typedef struct {
+  build_module_t *modules;
+  long count;
+  long size;
+} build_list_t;
+
+/* Mounted archives in order of mounting */
+static bundle_t *bundles = NULL;
+
+/**
+ * Calculate hash of module's name
+ *
+ * Hash is stored in archive, so it should not depend on platform.
+ *
+ * @param name - name of module
+ * @param len - length of name
+ * @return hash of name
+ */
+static unsigned int
+bundle_hash (const char *name, size_t len)
+{
+  unsigned int hash = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+    {
+      hash ^= (unsigned char)name[i];
+      hash *= 16777619U;
+    }
+
+  return hash;
+}
+
+/**
+ * Get name of module's file inside of archive
+ *
+ * @param archive - name of archive's file
+ * @param name - name of module
+ * @param flags - flags of module's entry
+ * @return name of file in scratch arena or NULL if memory couldn't be
+ *   allocated
+ */
+static char*
+module_file_name (const char *archive, const char *name, int flags)
+{
+  size_t len = strlen (archive) + strlen (name) + 32;
+  char *file_name = py_arena_alloc (len), *ptr;
+
+  if (!file_name)
+    {
+      return NULL;
+    }
+
+  snprintf (file_name, len, "%s/%s%s", archive, name,
+            (flags & PY_BUNDLE_PACKAGE) ? "/__init__.py" : ".py");
+
+  /* Dots of module's name are separators of directories */
+  for (ptr = file_name + strlen (archive) + 1; *ptr; ++ptr)
+    {
+      if (*ptr == '.' && strcmp (ptr, ".py"))
+        {
+          *ptr = '/';
+        }
+    }
+
+  return file_name;
+}
+
+/****
+ * Building
+ */
+
+/**
+ * Add module to list of building
+ *
+ * @param list - list of modules
+ * @param name - name of module
+ * @param path - path to module's source
+ * @param flags - flags of module's entry
+ */
+static void
+build_list_add (build_list_t *list, const char *name, const char *path,
+                int flags)
+{
+  build_module_t *module;
+
+  if (list->count == list->size)
+    {
+      list->size = MAX (list->size * 2, 16);
+      list->modules = realloc (list->modules,
+                               sizeof (build_module_t) * list->size);
+    }
+
+  module = &list->modules[list->count++];
+  module->name = strdup (name);
+  module->path = strdup (path);
+  module->flags = flags;
+}
+
+/**
+ * Free list of building
+ *
+ * @param list - list of modules
+ */
+static void
+build_list_free (build_list_t *list)
+{
+  long i;
+
+  for (i = 0; i < list->count; ++i)
+    {
+      free (list->modules[i].name);
+      free (list->modules[i].path);
+    }
+
+  SAFE_FREE (list->modules);
+  list->count = list->size = 0;
+}
+
+/**
+ * Collect modules and packages of directory
+ *
+ * @param list - list of modules
+ * @param dirname - name of directory
+ * @param prefix - prefix of modules' names (name of package with dot)
+ */
+static void
+scan_dir (build_list_t *list, const char *dirname, const char *prefix)
+{
+  DIR *dir = opendir (dirname);
+  struct dirent *entry;
+  struct stat st;
+  char path[4096], name[4096], init[4096 + 16];
+
+  if (!dir)
+    {
+      return;
+    }
+
+  while ((entry = readdir (dir)))
+    {
+      size_t len = strlen (entry->d_name);
+
+      if (entry->d_name[0] == '.')
+        {
+          continue;
+        }
+
+      snprintf (path, sizeof (path), "%s/%s", dirname, entry->d_name);
+
+      if (stat (path, &st))
+        {
+          continue;
+        }
+
+      if (S_ISDIR (st.st_mode))
+        {
+          /* Only packages are importable */
+          snprintf (init, sizeof (init), "%s/__init__.py", path);
+
+          if (!stat (init, &st))
+            {
+              snprintf (name, sizeof (name), "%s%s", prefix, entry->d_name);
+              build_list_add (list, name, init, PY_BUNDLE_PACKAGE);
+
+              strncat (name, ".", sizeof (name) - strlen (name) - 1);
+              scan_dir (list, path, name);
+            }
+        }
+      else if (len > 3 && !strcmp (entry->d_name + len - 3, ".py") &&
+               strcmp (entry->d_name, "__init__.py"))
+        {
+          snprintf (name, sizeof (name), "%s%.*s", prefix,
+                    (int)(len - 3), entry->d_name);
+          build_list_add (list, name, path, 0);
+        }
+    }
+
+  closedir (dir);
+}
+
+/**
+ * Compare modules by name for qsort()
+ */
+static int
+build_module_cmp (const void *a, const void *b)
+{
+  return strcmp (((const build_module_t*)a)->name,
+                 ((const build_module_t*)b)->name);
+}
+
+/**
+ * Compile module and marshal its code object
+ *
+ * @param archive - name of archive's file
+ * @param module - module to compile
+ * @return Python string with marshalled code or NULL on error
+ */
+static PyObject*
+compile_module (const char *archive, const build_module_t *module)
+{
+  FILE *stream = fopen (module->path, "r");
+  PyObject *code, *data;
+  char *source, *file_name;
+  long size;
+  py_arena_mark_t mark;
+
+  if (!stream)
+    {
+      PyErr_SetFromErrnoWithFilename (PyExc_IOError, module->path);
+      return NULL;
+    }
+
+  fseek (stream, 0, SEEK_END);
+  size = ftell (stream);
+  fseek (stream, 0, SEEK_SET);
+
+  mark = py_arena_mark ();
+  source = py_arena_alloc (size + 1);
+  file_name = module_file_name (archive, module->name, module->flags);
+
+  if (!source || !file_name)
+    {
+      fclose (stream);
+      py_arena_release (mark);
+      return PyErr_NoMemory ();
+    }
+
+  source[fread (source, 1, size, stream)] = 0;
+  fclose (stream);
+
+  code = Py_CompileString (source, file_name, Py_file_input);
+  py_arena_release (mark);
+
+  if (!code)
+    {
+      return NULL;
+    }
+
+  data = PyMarshal_WriteObjectToString (code, Py_MARSHAL_VERSION);
+  Py_DECREF (code);
+
+  return data;
+}
+
+/**
+ * Write archive to stream
+ *
+ * @param stream - stream to write to
+ * @param list - list of modules
+ * @param data - marshalled code objects of modules
+ * @return zero on success, non-zero otherwise
+ */
+static int
+write_archive (FILE *stream, const build_list_t *list, PyObject **data)
+{
+  bundle_header_t header;
+  py_bundle_entry_t *entries;
+  unsigned int *buckets, offset;
+  long i;
+  int result;
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, BUNDLE_MAGIC, sizeof (header.magic));
+  header.count = list->count;
+  header.pymagic = PyImport_GetMagicNumber ();
+
+  header.buckets = BUNDLE_MIN_BUCKETS;
+  while (header.buckets < list->count * 2)
+    {
+      header.buckets *= 2;
+    }
+
+  entries = calloc (MAX (list->count, 1), sizeof (py_bundle_entry_t));
+  buckets = calloc (header.buckets, sizeof (unsigned int));
+
+  offset = sizeof (header) + sizeof (py_bundle_entry_t) * list->count +
+    sizeof (unsigned int) * header.buckets;
+
+  for (i = 0; i < list->count; ++i)
+    {
+      const char *name = list->modules[i].name;
+      unsigned int bucket;
+
+      entries[i].name_len = strlen (name);
+      entries[i].name_offset = offset;
+      entries[i].hash = bundle_hash (name, entries[i].name_len);
+      entries[i].flags = list->modules[i].flags;
+      offset += entries[i].name_len;
+
+      bucket = entries[i].hash & (header.buckets - 1);
+      while (buckets[bucket])
+        {
+          bucket = (bucket + 1) & (header.buckets - 1);
+        }
+      buckets[bucket] = i + 1;
+    }
+
+  for (i = 0; i < list->count; ++i)
+    {
+      entries[i].data_offset = offset;
+      entries[i].data_size = PyString_GET_SIZE (data[i]);
+      offset += entries[i].data_size;
+    }
+
+  fwrite (&header, sizeof (header), 1, stream);
+  fwrite (entries, sizeof (py_bundle_entry_t), list->count, stream);
+  fwrite (buckets, sizeof (unsigned int), header.buckets, stream);
+
+  for (i = 0; i < list->count; ++i)
+    {
+      fwrite (list->modules[i].name, 1, entries[i].name_len, stream);
+    }
+
+  for (i = 0; i < list->count; ++i)
+    {
+      fwrite (PyString_AS_STRING (data[i]), 1, entries[i].data_size, stream);
+    }
+
+  result = ferror (stream);
+
+  free (entries);
+  free (buckets);
+
+  return result;
+}
+
+/**
+ * Build archive from modules and packages of directory
+ *
+ * Directory is treated as an entry of sys.path: its *.py files become
+ * top-level modules and its subdirectories with __init__.py become
+ * packages. Archive is replaced atomically.
+ *
+ * @param archive - name of archive's file
+ * @param dirname - name of directory
+ * @return zero on success, non-zero otherwise
+ * @sideeffect prints compilation errors to sys.stderr
+ */
+int
+py_bundle_build (const wchar_t *archive, const wchar_t *dirname)
+{
+  build_list_t list = {NULL, 0, 0};
+  PyObject **data;
+  char *mbarchive, *mbdirname, *tmp_name;
+  FILE *stream;
+  long i;
+  int result = 0;
+  py_arena_mark_t mark = py_arena_mark ();
+
+  PY_SCRATCH_WCS2MBS (mbarchive, archive);
+  PY_SCRATCH_WCS2MBS (mbdirname, dirname);
+
+  if (!mbarchive || !mbdirname)
+    {
+      py_arena_release (mark);
+      return -1;
+    }
+
+  scan_dir (&list, mbdirname, "");
+  qsort (list.modules, list.count, sizeof (build_module_t), build_module_cmp);
+
+  data = calloc (MAX (list.count, 1), sizeof (PyObject*));
+
+  for (i = 0; i < list.count; ++i)
+    {
+      data[i] = compile_module (mbarchive, &list.modules[i]);
+
+      if (!data[i])
+        {
+          PyErr_Print ();
+          result = -1;
+          break;
+        }
+    }
+
+  if (!result)
+    {
+      tmp_name = py_arena_alloc (strlen (mbarchive) + 32);
+
+      if (tmp_name)
+        {
+          sprintf (tmp_name, "%s.%ld", mbarchive, (long)getpid ());
+        }
+
+      stream = tmp_name ? fopen (tmp_name, "wb") : NULL;
+      result = !stream;
+
+      if (stream)
+        {
+          result = write_archive (stream, &list, data);
+          result = fclose (stream) || result;
+          result = result || rename (tmp_name, mbarchive);
+
+          if (result)
+            {
+              unlink (tmp_name);
+            }
+        }
+    }
+
+  for (i = 0; i < list.count; ++i)
+    {
+      Py_XDECREF (data[i]);
+    }
+
+  free (data);
+  build_list_free (&list);
+  py_arena_release (mark);
+
+  return result;
+}
+
+/****
+ * Mounting
+ */
+
+/**
+ * Check that tables of mapped archive are inside of it
+ *
+ * @param bundle - archive to validate
+ * @return zero if archive is valid, non-zero otherwise
+ */
+static int
+validate_bundle (bundle_t *bundle)
+{
+  const bundle_header_t *header = bundle->header;
+  size_t tables;
+  unsigned int i;
+
+  if (bundle->size < sizeof (bundle_header_t) ||
+      memcmp (header->magic, BUNDLE_MAGIC, sizeof (header->magic)) ||
+      header->pymagic != (unsigned int)PyImport_GetMagicNumber () ||
+      !header->buckets || (header->buckets & (header->buckets - 1)) ||
+      header->count >= header->buckets)
+    {
+      return -1;
+    }
+
+  tables = sizeof (bundle_header_t) +
+    sizeof (py_bundle_entry_t) * (size_t)header->count +
+    sizeof (unsigned int) * (size_t)header->buckets;
+
+  if (tables > bundle->size)
+    {
+      return -1;
+    }
+
+  for (i = 0; i < header->count; ++i)
+    {
+      const py_bundle_entry_t *entry = &bundle->entries[i];
+
+      if ((size_t)entry->name_offset + entry->name_len > bundle->size ||
+          (size_t)entry->data_offset + entry->data_size > bundle->size)
+        {
+          return -1;
+        }
+    }
+
+  for (i = 0; i < header->buckets; ++i)
+    {
+      if (bundle->buckets[i] > header->count)
+        {
+          return -1;
+        }
+    }
+
+  return 0;
+}
+
+/**
+ * Mount archive, so its modules could be imported
+ *
+ * Modules are looked up in archives in order of mounting. Archives are
+ * unmounted by python_done().
+ *
+ * @param archive - name of archive's file
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_bundle_mount (const wchar_t *archive)
+{
+  bundle_t *bundle, **last;
+  struct stat st;
+  void *data;
+  int fd;
+
+  MALLOC_ZERO (bundle, sizeof (bundle_t));
+  WCS2MBS (bundle->file_name, archive);
+
+  fd = open (bundle->file_name, O_RDONLY);
+
+  if (fd < 0 || fstat (fd, &st) || !st.st_size)
+    {
+      goto fail;
+    }
+
+  data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (data == MAP_FAILED)
+    {
+      goto fail;
+    }
+
+  close (fd);
+  fd = -1;
+
+  bundle->data = data;
+  bundle->size = st.st_size;
+  bundle->header = data;
+  bundle->entries = (const py_bundle_entry_t*)(bundle->header + 1);
+  bundle->buckets = (const unsigned int*)(bundle->entries +
+                                          bundle->header->count);
+
+  if (validate_bundle (bundle))
+    {
+      munmap (data, st.st_size);
+      goto fail;
+    }
+
+  for (last = &bundles; *last; last = &(*last)->next);
+  *last = bundle;
+
+  /* Modules of archive are found by importer of iface.c */
+  return py_module_install_importer ();
+
+fail:
+  if (fd >= 0)
+    {
+      close (fd);
+    }
+
+  free (bundle->file_name);
+  free (bundle);
+
+  return -1;
+}
+
+/**
+ * Unmount all archives
+ */
+void
+py_bundle_unmount_all (void)
+{
+  bundle_t *bundle, *next;
+
+  for (bundle = bundles; bundle; bundle = next)
+    {
+      next = bundle->next;
+      munmap ((void*)bundle->data, bundle->size);
+      free (bundle->file_name);
+      free (bundle);
+    }
+
+  bundles = NULL;
+}
+
+/**
+ * Find module in mounted archives
+ *
+ * @param name - name of module
+ * @param bundle - archive which contains module (output)
+ * @return entry of module or NULL if module is not found
+ */
+static const py_bundle_entry_t*
+find_entry (const char *name, bundle_t **bundle)
+{
+  size_t len = strlen (name);
+  unsigned int hash = bundle_hash (name, len);
+  bundle_t *cur;
+
+  for (cur = bundles; cur; cur = cur->next)
+    {
+      unsigned int mask = cur->header->buckets - 1;
+      unsigned int bucket = hash & mask, i;
+
+      for (i = 0; i <= mask && cur->buckets[bucket]; ++i)
+        {
+          const py_bundle_entry_t *entry =
+            &cur->entries[cur->buckets[bucket] - 1];
+
+          if (entry->hash == hash && entry->name_len == len &&
+              !memcmp (cur->data + entry->name_offset, name, len))
+            {
+              *bundle = cur;
+              return entry;
+            }
+
+          bucket = (bucket + 1) & mask;
+        }
+    }
+
+  return NULL;
+}
+
+/**
+ * Check whether any archive is mounted
+ *
+ * @return non-zero if there is mounted archive, zero otherwise
+ */
+int
+py_bundle_is_mounted (void)
+{
+  return bundles != NULL;
+}
+
+/**
+ * Check whether module is in one of mounted archives
+ *
+ * @param name - full name of module
+ * @return non-zero if module is found, zero otherwise
+ */
+int
+py_bundle_has_module (const char *name)
+{
+  bundle_t *bundle;
+
+  return bundles && find_entry (name, &bundle) != NULL;
+}
+
+/**
+ * Import module from mounted archive
+ *
+ * @param name - full name of module
+ * @return new reference to module or NULL with Python error set
+ */
+PyObject*
+py_bundle_load_module (const char *name)
+{
+  const py_bundle_entry_t *entry;
+  bundle_t *bundle;
+  PyObject *code, *module = NULL;
+  char *file_name;
+  py_arena_mark_t mark;
+
+  entry = find_entry (name, &bundle);
+
+  if (!entry)
+    {
+      PyErr_Format (PyExc_ImportError, "No bundled module named %s", name);
+      return NULL;
+    }
+
+  code = PyMarshal_ReadObjectFromString ((char*)bundle->data +
+                                         entry->data_offset,
+                                         entry->data_size);
+
+  if (!code)
+    {
+      return NULL;
+    }
+
+  mark = py_arena_mark ();
+  file_name = module_file_name (bundle->file_name, name, entry->flags);
+
+  if (!file_name)
+    {
+      PyErr_NoMemory ();
+      goto done;
+    }
+
+  if (entry->flags & PY_BUNDLE_PACKAGE)
+    {
+      /* Package needs __path__ before its code is executed, */
+      /* as zipimport does it points inside of archive */
+      PyObject *package = PyImport_AddModule ((char*)name), *path;
+
+      if (!package)
+        {
+          goto done;
+        }
+
+      path = Py_BuildValue ("[s#]", file_name,
+                            (int)(strrchr (file_name, '/') - file_name));
+      PyDict_SetItemString (PyModule_GetDict (package), "__path__", path);
+      Py_DECREF (path);
+    }
+
+  py_timeline_begin (name, "import");
+  module = PyImport_ExecCodeModuleEx ((char*)name, code, file_name);
+  py_timeline_end ();
+
+done:
+  py_arena_release (mark);
+  Py_DECREF (code);
+
+  return module;
+}
@@ -0,0 +1,51 @@
+/**
+ * Archives of precompiled modules
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Flags of archive's entry */
+enum {
+  PY_BUNDLE_PACKAGE = 0x0001 /* Entry is __init__ of package */
+};
+
+/* Module in archive */
+typedef struct {
+  unsigned int hash;        /* Hash of module's name */
+  unsigned int name_offset; /* Offset of module's name from archive's start */
+  unsigned int name_len;    /* Length of module's name */
+  unsigned int data_offset; /* Offset of marshalled code object */
+  unsigned int data_size;   /* Size of marshalled code object */
+  unsigned int flags;       /* Combination of PY_BUNDLE_xxx flags */
+} py_bundle_entry_t;
+
+/* Build archive from modules and packages of directory */
+int
+py_bundle_build (const wchar_t *archive, const wchar_t *dirname);
+
+/* Mount archive, so its modules could be imported */
+int
+py_bundle_mount (const wchar_t *archive);
+
+/* Unmount all archives */
+void
+py_bundle_unmount_all (void);
+
+/* Check whether any archive is mounted */
+int
+py_bundle_is_mounted (void);
+
+/* Check whether module is in one of mounted archives */
+int
+py_bundle_has_module (const char *name);
+
+/* Import module from mounted archive */
+PyObject*
+py_bundle_load_module (const char *name);
@@ -0,0 +1,1415 @@
+/**
+ * Named caches of script values which survive between runs
+ *
+ * Every run of script gets new global dictionary, so values which are
+ * computed by script are lost after run. Caches are kept by name for the
+ * whole life of interpreter, so scripts of all runs and threads which
+ * ask for the same name share the same values.
+ *
+ * Cache is bounded by estimated memory of its keys and values. The least
+ * recently used values are evicted when limit is exceeded, and values
+ * with time-to-live are dropped when they're found expired.
+ *
+ * memo() decorator of CoreBuiltins stores results of pure functions in
+ * cache. Function is identified by its code, defaults and closure, so
+ * function which is defined again by next run of script finds results
+ * of previous runs.
+ *
+ * All functions should be called with GIL held. Comparison of keys and
+ * deallocation of values could run Python code which lets other threads
+ * use cache, so entries are unlinked before they're released and lookup
+ * restarts when cache was changed during comparison.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+/* Initial count of buckets of hash table */
+#define INITIAL_BUCKETS 64
+
+/* Depth of containers which items are counted by size estimation */
+#define SIZE_DEPTH 4
+
+typedef struct entry {
+  PyObject *key;
+  PyObject *value;
+  long hash;
+  size_t size;                  /* Estimated size of entry */
+  unsigned long long expire_ns; /* Time of expiration (0 for never) */
+
+  struct entry *chain;          /* Next entry in bucket */
+  struct entry *prev;           /* More recently used entry */
+  struct entry *next;           /* Less recently used entry */
+} entry_t;
+
+struct py_cache {
+  char *name;
+  unsigned long long ttl_ns;    /* Default time-to-live (0 for never) */
+
+  entry_t **buckets;
+  long mask;
+
+  entry_t *head;                /* The most recently used entry */
+  entry_t *tail;                /* The least recently used entry */
+
+  unsigned long mutations;      /* Counter of changes of entries' links */
+
+  py_cache_stats_t stats;
+
+  struct py_cache *next;
+};
+
+/* Cache object of scripts */
+typedef struct {
+  PyObject_HEAD
+  py_cache_t *cache;
+} cache_object_t;
+
+/* Memoizing wrapper of function */
+typedef struct {
+  PyObject_HEAD
+  PyObject *func;
+  PyObject *ident;              /* Identifier of function in cache */
+  py_cache_t *cache;
+  double ttl;
+} memo_object_t;
+
+static py_cache_t *caches = NULL;
+
+static PyTypeObject cache_type;
+static PyTypeObject memo_type;
+static int types_ready = 0;
+
+/**
+ * Estimate memory used by object
+ *
+ * Items of containers are counted up to SIZE_DEPTH levels, objects
+ * which are shared by several containers are counted several times.
+ *
+ * @param obj - object to estimate
+ * @param depth - depth of object in container
+ * @return size in bytes
+ */
+static size_t
+object_size (PyObject *obj, int depth)
+{
+  PyTypeObject *type = obj->ob_type;
+  size_t size = type->tp_basicsize;
+  Py_ssize_t i;
+
+  if (type->tp_itemsize)
+    {
+      Py_ssize_t count = ((PyVarObject*)obj)->ob_size;
+      size += type->tp_itemsize * (count < 0 ? -count : count);
+    }
+
+  if (PyUnicode_Check (obj))
+    {
+      size += (PyUnicode_GET_SIZE (obj) + 1) * sizeof (Py_UNICODE);
+    }
+  else if (PyList_Check (obj))
+    {
+      size += ((PyListObject*)obj)->allocated * sizeof (PyObject*);
+    }
+  else if (PyDict_Check (obj))
+    {
+      PyDictObject *dict = (PyDictObject*)obj;
+
+      if (dict->ma_table != dict->ma_smalltable)
+        {
+          size += (dict->ma_mask + 1) * sizeof (PyDictEntry);
+        }
+    }
+
+  if (depth >= SIZE_DEPTH)
+    {
+      return size;
+    }
+
+  if (PyTuple_Check (obj))
+    {
+      for (i = 0; i < PyTuple_GET_SIZE (obj); ++i)
+        {
+          size += object_size (PyTuple_GET_ITEM (obj, i), depth + 1);
+        }
+    }
+  else if (PyList_Check (obj))
+    {
+      for (i = 0; i < PyList_GET_SIZE (obj); ++i)
+        {
+          size += object_size (PyList_GET_ITEM (obj, i), depth + 1);
+        }
+    }
+  else if (PyDict_Check (obj))
+    {
+      PyObject *key, *value;
+
+      i = 0;
+      while (PyDict_Next (obj, &i, &key, &value))
+        {
+          size += object_size (key, depth + 1) + object_size (value, depth + 1);
+        }
+    }
+
+  return size;
+}
+
+/**
+ * Convert time-to-live to nanoseconds
+ *
+ * @param cache - cache of value
+ * @param ttl - time-to-live in seconds (negative for default of cache)
+ * @return time-to-live in nanoseconds (0 for never)
+ */
+static unsigned long long
+ttl_ns (py_cache_t *cache, double ttl)
+{
+  return ttl < 0 ? cache->ttl_ns : (unsigned long long)(ttl * 1e9);
+}
+
+/**
+ * Find entry by key
+ *
+ * @param cache - cache to search in
+ * @param key - key to search
+ * @param hash - hash of key
+ * @param result - found entry or NULL
+ * @return zero on success, non-zero if comparison of keys failed
+ */
+static int
+find_entry (py_cache_t *cache, PyObject *key, long hash, entry_t **result)
+{
+  entry_t *entry;
+  unsigned long mutations;
+
+restart:
+  mutations = cache->mutations;
+
+  for (entry = cache->buckets[hash & cache->mask]; entry;
+       entry = entry->chain)
+    {
+      PyObject *entry_key = entry->key;
+      int equal;
+
+      if (entry_key == key)
+        {
+          *result = entry;
+          return 0;
+        }
+
+      if (entry->hash != hash)
+        {
+          continue;
+        }
+
+      /* Comparison could run code which changes cache */
+      Py_INCREF (entry_key);
+      equal = PyObject_RichCompareBool (entry_key, key, Py_EQ);
+      Py_DECREF (entry_key);
+
+      if (equal < 0)
+        {
+          return -1;
+        }
+
+      if (mutations != cache->mutations)
+        {
+          goto restart;
+        }
+
+      if (equal)
+        {
+          *result = entry;
+          return 0;
+        }
+    }
+
+  *result = NULL;
+  return 0;
+}
+
+/**
+ * Move entry to the beginning of LRU list
+ *
+ * @param cache - cache of entry
+ * @param entry - entry to move
+ */
+static void
+touch_entry (py_cache_t *cache, entry_t *entry)
+{
+  if (cache->head == entry)
+    {
+      return;
+    }
+
+  /* Entry isn't head, so it has previous one */
+  entry->prev->next = entry->next;
+
+  if (entry->next)
+    {
+      entry->next->prev = entry->prev;
+    }
+  else
+    {
+      cache->tail = entry->prev;
+    }
+
+  entry->prev = NULL;
+  entry->next = cache->head;
+  cache->head->prev = entry;
+  cache->head = entry;
+}
+
+/**
+ * Double count of buckets of hash table
+ *
+ * @param cache - cache to grow
+ */
+static void
+grow_buckets (py_cache_t *cache)
+{
+  long mask = cache->mask * 2 + 1, i;
+  entry_t **buckets;
+
+  MALLOC_ZERO (buckets, sizeof (entry_t*) * (mask + 1));
+
+  for (i = 0; i <= cache->mask; ++i)
+    {
+      entry_t *entry = cache->buckets[i];
+
+      while (entry)
+        {
+          entry_t *chain = entry->chain;
+
+          entry->chain = buckets[entry->hash & mask];
+          buckets[entry->hash & mask] = entry;
+
+          entry = chain;
+        }
+    }
+
+  free (cache->buckets);
+  cache->buckets = buckets;
+  cache->mask = mask;
+  ++cache->mutations;
+}
+
+/**
+ * Link new entry to cache
+ *
+ * @param cache - cache to link to
+ * @param entry - entry to link
+ */
+static void
+link_entry (py_cache_t *cache, entry_t *entry)
+{
+  entry_t **bucket;
+
+  if (cache->stats.count > cache->mask)
+    {
+      grow_buckets (cache);
+    }
+
+  bucket = &cache->buckets[entry->hash & cache->mask];
+  entry->chain = *bucket;
+  *bucket = entry;
+
+  entry->prev = NULL;
+  entry->next = cache->head;
+
+  if (cache->head)
+    {
+      cache->head->prev = entry;
+    }
+  else
+    {
+      cache->tail = entry;
+    }
+
+  cache->head = entry;
+
+  ++cache->stats.count;
+  cache->stats.bytes += entry->size;
+  ++cache->mutations;
+}
+
+/**
+ * Unlink entry from cache
+ *
+ * Entry should be released by release_entry() then.
+ *
+ * @param cache - cache of entry
+ * @param entry - entry to unlink
+ */
+static void
+unlink_entry (py_cache_t *cache, entry_t *entry)
+{
+  entry_t **link = &cache->buckets[entry->hash & cache->mask];
+
+  while (*link != entry)
+    {
+      link = &(*link)->chain;
+    }
+
+  *link = entry->chain;
+
+  if (entry->prev)
+    {
+      entry->prev->next = entry->next;
+    }
+  else
+    {
+      cache->head = entry->next;
+    }
+
+  if (entry->next)
+    {
+      entry->next->prev = entry->prev;
+    }
+  else
+    {
+      cache->tail = entry->prev;
+    }
+
+  --cache->stats.count;
+  cache->stats.bytes -= entry->size;
+  ++cache->mutations;
+}
+
+/**
+ * Release unlinked entry
+ *
+ * @param entry - entry to release
+ */
+static void
+release_entry (entry_t *entry)
+{
+  Py_DECREF (entry->key);
+  Py_DECREF (entry->value);
+  free (entry);
+}
+
+/**
+ * Evict the least recently used entries until cache fits its limit
+ *
+ * @param cache - cache to shrink
+ */
+static void
+evict (py_cache_t *cache)
+{
+  unsigned long long now = 0;
+
+  while (cache->tail && cache->stats.bytes > cache->stats.max_bytes)
+    {
+      entry_t *entry = cache->tail;
+
+      if (entry->expire_ns && !now)
+        {
+          now = py_stats_now ();
+        }
+
+      if (entry->expire_ns && entry->expire_ns <= now)
+        {
+          ++cache->stats.expirations;
+        }
+      else
+        {
+          ++cache->stats.evictions;
+        }
+
+      unlink_entry (cache, entry);
+      release_entry (entry);
+    }
+}
+
+/**
+ * Get cache by multibyte name
+ *
+ * @param name - name of cache
+ * @param max_bytes - limit of memory for new cache
+ * @param ttl - default time-to-live in seconds for new cache
+ * @return cache
+ */
+static py_cache_t*
+get_cache (const char *name, size_t max_bytes, double ttl)
+{
+  py_cache_t *cache;
+
+  for (cache = caches; cache; cache = cache->next)
+    {
+      if (!strcmp (cache->name, name))
+        {
+          return cache;
+        }
+    }
+
+  MALLOC_ZERO (cache, sizeof (py_cache_t));
+  MALLOC_ZERO (cache->buckets, sizeof (entry_t*) * INITIAL_BUCKETS);
+
+  cache->name = strdup (name);
+  cache->mask = INITIAL_BUCKETS - 1;
+  cache->ttl_ns = (unsigned long long)(MAX (ttl, 0) * 1e9);
+  cache->stats.max_bytes = max_bytes;
+
+  cache->next = caches;
+  caches = cache;
+
+  return cache;
+}
+
+/**
+ * Build dictionary with metrics of cache
+ *
+ * @param cache - cache
+ * @return new dictionary
+ */
+static PyObject*
+stats_dict (py_cache_t *cache)
+{
+  PyObject *result = PyDict_New ();
+  py_cache_stats_t *stats = &cache->stats;
+  unsigned long lookups = stats->hits + stats->misses;
+
+  extpy_dict_set_item_str (result, L"hits",
+                           PyLong_FromUnsignedLong (stats->hits));
+  extpy_dict_set_item_str (result, L"misses",
+                           PyLong_FromUnsignedLong (stats->misses));
+  extpy_dict_set_item_str (result, L"hitRate", PyFloat_FromDouble (
+                             lookups ? (double)stats->hits / lookups : 0));
+  extpy_dict_set_item_str (result, L"inserts",
+                           PyLong_FromUnsignedLong (stats->inserts));
+  extpy_dict_set_item_str (result, L"evictions",
+                           PyLong_FromUnsignedLong (stats->evictions));
+  extpy_dict_set_item_str (result, L"expirations",
+                           PyLong_FromUnsignedLong (stats->expirations));
+  extpy_dict_set_item_str (result, L"count",
+                           PyInt_FromLong (stats->count));
+  extpy_dict_set_item_str (result, L"bytes",
+                           PyLong_FromSize_t (stats->bytes));
+  extpy_dict_set_item_str (result, L"maxBytes",
+                           PyLong_FromSize_t (stats->max_bytes));
+
+  return result;
+}
+
+/**
+ * Prepare types of cache and memo objects
+ *
+ * @return zero on success, non-zero otherwise
+ */
+static int
+ready_types (void)
+{
+  if (types_ready)
+    {
+      return 0;
+    }
+
+  if (PyType_Ready (&cache_type) < 0 || PyType_Ready (&memo_type) < 0)
+    {
+      return -1;
+    }
+
+  types_ready = 1;
+
+  return 0;
+}
+
+/**
+ * Create cache object of scripts
+ *
+ * @param cache - cache to wrap
+ * @return new object or NULL on error
+ */
+static PyObject*
+cache_object_new (py_cache_t *cache)
+{
+  cache_object_t *self;
+
+  if (ready_types ())
+    {
+      return NULL;
+    }
+
+  self = PyObject_New (cache_object_t, &cache_type);
+
+  if (self)
+    {
+      self->cache = cache;
+    }
+
+  return (PyObject*)self;
+}
+
+/********
+ * Cache object
+ */
+
+static void
+cache_dealloc (cache_object_t *self)
+{
+  PyObject_Del (self);
+}
+
+static PyObject*
+cache_get (cache_object_t *self, PyObject *args)
+{
+  PyObject *key, *def = Py_None, *value;
+  int found;
+
+  if (!PyArg_ParseTuple (args, "O|O", &key, &def))
+    {
+      return NULL;
+    }
+
+  found = py_cache_lookup (self->cache, key, &value);
+
+  if (found < 0)
+    {
+      return NULL;
+    }
+
+  if (!found)
+    {
+      Py_INCREF (def);
+      return def;
+    }
+
+  return value;
+}
+
+static PyObject*
+cache_set (cache_object_t *self, PyObject *args)
+{
+  PyObject *key, *value;
+  double ttl = -1;
+
+  if (!PyArg_ParseTuple (args, "OO|d", &key, &value, &ttl))
+    {
+      return NULL;
+    }
+
+  if (py_cache_store (self->cache, key, value, ttl))
+    {
+      return NULL;
+    }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+cache_delete (cache_object_t *self, PyObject *key)
+{
+  int removed = py_cache_remove (self->cache, key);
+
+  if (removed < 0)
+    {
+      return NULL;
+    }
+
+  return PyBool_FromLong (removed);
+}
+
+static PyObject*
+cache_clear (cache_object_t *self)
+{
+  py_cache_clear (self->cache);
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+cache_stats (cache_object_t *self)
+{
+  return stats_dict (self->cache);
+}
+
+static Py_ssize_t
+cache_length (cache_object_t *self)
+{
+  return self->cache->stats.count;
+}
+
+static PyObject*
+cache_subscript (cache_object_t *self, PyObject *key)
+{
+  PyObject *value;
+  int found = py_cache_lookup (self->cache, key, &value);
+
+  if (found < 0)
+    {
+      return NULL;
+    }
+
+  if (!found)
+    {
+      PyErr_SetObject (PyExc_KeyError, key);
+      return NULL;
+    }
+
+  return value;
+}
+
+static int
+cache_ass_subscript (cache_object_t *self, PyObject *key, PyObject *value)
+{
+  int removed;
+
+  if (value)
+    {
+      return py_cache_store (self->cache, key, value, -1);
+    }
+
+  removed = py_cache_remove (self->cache, key);
+
+  if (!removed)
+    {
+      PyErr_SetObject (PyExc_KeyError, key);
+    }
+
+  return removed > 0 ? 0 : -1;
+}
+
+static PyObject*
+cache_repr (cache_object_t *self)
+{
+  return PyString_FromFormat ("<CoreCache '%s'>", self->cache->name);
+}
+
+static PyMappingMethods cache_as_mapping = {
+  (lenfunc)cache_length,                    /* mp_length */
+  (binaryfunc)cache_subscript,              /* mp_subscript */
+  (objobjargproc)cache_ass_subscript        /* mp_ass_subscript */
+};
+
+static PyMethodDef cache_methods[] = {
+  {"get", (PyCFunction)cache_get, METH_VARARGS,
+   "Get value by key or default if it isn't cached"},
+  {"set", (PyCFunction)cache_set, METH_VARARGS,
+   "Store value with optional time-to-live in seconds"},
+  {"delete", (PyCFunction)cache_delete, METH_O,
+   "Remove value by key"},
+  {"clear", (PyCFunction)cache_clear, METH_NOARGS,
+   "Remove all values"},
+  {"stats", (PyCFunction)cache_stats, METH_NOARGS,
+   "Get hit rate and memory usage of cache"},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject cache_type = {
+  PyObject_HEAD_INIT (NULL)
+  0,                            /* ob_size */
+  "CoreCache",                  /* tp_name */
+  sizeof (cache_object_t),      /* tp_basicsize */
+  0,                            /* tp_itemsize */
+  (destructor)cache_dealloc,    /* tp_dealloc */
+  0,                            /* tp_print */
+  0,                            /* tp_getattr */
+  0,                            /* tp_setattr */
+  0,                            /* tp_compare */
+  (reprfunc)cache_repr,         /* tp_repr */
+  0,                            /* tp_as_number */
+  0,                            /* tp_as_sequence */
+  &cache_as_mapping,            /* tp_as_mapping */
+  0,                            /* tp_hash */
+  0,                            /* tp_call */
+  0,                            /* tp_str */
+  0,                            /* tp_getattro */
+  0,                            /* tp_setattro */
+  0,                            /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,           /* tp_flags */
+  "Cache which is shared by all runs of scripts", /* tp_doc */
+  0,                            /* tp_traverse */
+  0,                            /* tp_clear */
+  0,                            /* tp_richcompare */
+  0,                            /* tp_weaklistoffset */
+  0,                            /* tp_iter */
+  0,                            /* tp_iternext */
+  cache_methods,                /* tp_methods */
+  0,                            /* tp_members */
+  0                             /* tp_getset */
+};
+
+/********
+ * Memo object
+ */
+
+/**
+ * Get identifier of function in cache
+ *
+ * Identifier of function is tuple of its code, defaults and closure
+ * which is stored in keys of results, so it's counted in memory of the
+ * cache and released with evicted results.
+ *
+ * @param func - memoized function
+ * @return new reference to identifier or NULL on error
+ */
+static PyObject*
+memo_ident (PyObject *func)
+{
+  PyObject *desc = NULL;
+
+  if (PyFunction_Check (func))
+    {
+      PyObject *closure = PyFunction_GET_CLOSURE (func);
+      PyObject *defaults = PyFunction_GET_DEFAULTS (func);
+      PyObject *cells = Py_None;
+      Py_ssize_t i;
+
+      if (closure)
+        {
+          cells = PyTuple_New (PyTuple_GET_SIZE (closure));
+
+          if (!cells)
+            {
+              return NULL;
+            }
+
+          for (i = 0; i < PyTuple_GET_SIZE (closure); ++i)
+            {
+              PyObject *cell = PyCell_GET (PyTuple_GET_ITEM (closure, i));
+
+              cell = cell ? cell : Py_None;
+              Py_INCREF (cell);
+              PyTuple_SET_ITEM (cells, i, cell);
+            }
+        }
+      else
+        {
+          Py_INCREF (cells);
+        }
+
+      desc = Py_BuildValue ("(OOO)", PyFunction_GET_CODE (func),
+                            defaults ? defaults : Py_None, cells);
+      Py_DECREF (cells);
+
+      if (!desc)
+        {
+          return NULL;
+        }
+
+      if (PyObject_Hash (desc) == -1)
+        {
+          /* Unhashable defaults, results are found by this function only */
+          PyErr_Clear ();
+          Py_CLEAR (desc);
+        }
+    }
+
+  if (!desc)
+    {
+      /* Other callables are identified by themselves */
+      Py_INCREF (func);
+      return func;
+    }
+
+  return desc;
+}
+
+/**
+ * Create memoizing wrapper of function
+ *
+ * @param cache - cache of results
+ * @param func - function to wrap
+ * @param ttl - time-to-live of results (negative for default of cache)
+ * @return new wrapper or NULL on error
+ */
+static PyObject*
+memo_new (py_cache_t *cache, PyObject *func, double ttl)
+{
+  memo_object_t *self;
+
+  if (!PyCallable_Check (func))
+    {
+      PyErr_SetString (PyExc_TypeError, "memo() expects callable object");
+      return NULL;
+    }
+
+  if (ready_types ())
+    {
+      return NULL;
+    }
+
+  self = PyObject_New (memo_object_t, &memo_type);
+
+  if (!self)
+    {
+      return NULL;
+    }
+
+  Py_INCREF (func);
+  self->func = func;
+  self->cache = cache;
+  self->ttl = ttl;
+  self->ident = memo_ident (func);
+
+  if (!self->ident)
+    {
+      Py_DECREF (self);
+      return NULL;
+    }
+
+  return (PyObject*)self;
+}
+
+static void
+memo_dealloc (memo_object_t *self)
+{
+  Py_XDECREF (self->func);
+  Py_XDECREF (self->ident);
+  PyObject_Del (self);
+}
+
+/**
+ * Build key of call's result
+ *
+ * @param self - memoizing wrapper
+ * @param args - positional arguments
+ * @param kw - keyword arguments (could be NULL)
+ * @return new key or NULL on error
+ */
+static PyObject*
+memo_key (memo_object_t *self, PyObject *args, PyObject *kw)
+{
+  PyObject *items, *key;
+
+  if (!kw || !PyDict_Size (kw))
+    {
+      return PyTuple_Pack (2, self->ident, args);
+    }
+
+  /* Order of keyword arguments shouldn't matter */
+  items = PyDict_Items (kw);
+
+  if (!items || PyList_Sort (items))
+    {
+      Py_XDECREF (items);
+      return NULL;
+    }
+
+  key = Py_BuildValue ("(OON)", self->ident, args, PyList_AsTuple (items));
+  Py_DECREF (items);
+
+  return key;
+}
+
+static PyObject*
+memo_call (memo_object_t *self, PyObject *args, PyObject *kw)
+{
+  PyObject *key, *result;
+  int found;
+
+  key = memo_key (self, args, kw);
+
+  if (!key)
+    {
+      return NULL;
+    }
+
+  found = py_cache_lookup (self->cache, key, &result);
+
+  if (found > 0)
+    {
+      Py_DECREF (key);
+      return result;
+    }
+
+  if (found < 0)
+    {
+      Py_DECREF (key);
+
+      if (!PyErr_ExceptionMatches (PyExc_TypeError))
+        {
+          return NULL;
+        }
+
+      /* Unhashable arguments, result can't be cached */
+      PyErr_Clear ();
+      return PyObject_Call (self->func, args, kw);
+    }
+
+  result = PyObject_Call (self->func, args, kw);
+
+  if (result && py_cache_store (self->cache, key, result, self->ttl))
+    {
+      /* Result is still valid even if it couldn't be cached */
+      PyErr_Clear ();
+    }
+
+  Py_DECREF (key);
+
+  return result;
+}
+
+static PyObject*
+memo_descr_get (PyObject *self, PyObject *obj, PyObject *type)
+{
+  if (!obj || obj == Py_None)
+    {
+      Py_INCREF (self);
+      return self;
+    }
+
+  return PyMethod_New (self, obj, type);
+}
+
+static PyObject*
+memo_get_wrapped (memo_object_t *self, void *closure)
+{
+  Py_INCREF (self->func);
+  return self->func;
+}
+
+static PyObject*
+memo_get_name (memo_object_t *self, void *closure)
+{
+  return PyObject_GetAttrString (self->func, "__name__");
+}
+
+static PyObject*
+memo_get_doc (memo_object_t *self, void *closure)
+{
+  return PyObject_GetAttrString (self->func, "__doc__");
+}
+
+static PyObject*
+memo_get_cache (memo_object_t *self, void *closure)
+{
+  return cache_object_new (self->cache);
+}
+
+static PyGetSetDef memo_getset[] = {
+  {"__wrapped__", (getter)memo_get_wrapped, NULL, "Memoized function", NULL},
+  {"__name__", (getter)memo_get_name, NULL, "Name of function", NULL},
+  {"__doc__", (getter)memo_get_doc, NULL, "Documentation of function", NULL},
+  {"cache", (getter)memo_get_cache, NULL, "Cache of results", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject memo_type = {
+  PyObject_HEAD_INIT (NULL)
+  0,                            /* ob_size */
+  "CoreMemo",                   /* tp_name */
+  sizeof (memo_object_t),       /* tp_basicsize */
+  0,                            /* tp_itemsize */
+  (destructor)memo_dealloc,     /* tp_dealloc */
+  0,                            /* tp_print */
+  0,                            /* tp_getattr */
+  0,                            /* tp_setattr */
+  0,                            /* tp_compare */
+  0,                            /* tp_repr */
+  0,                            /* tp_as_number */
+  0,                            /* tp_as_sequence */
+  0,                            /* tp_as_mapping */
+  0,                            /* tp_hash */
+  (ternaryfunc)memo_call,       /* tp_call */
+  0,                            /* tp_str */
+  0,                            /* tp_getattro */
+  0,                            /* tp_setattro */
+  0,                            /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,           /* tp_flags */
+  0,                            /* tp_doc */
+  0,                            /* tp_traverse */
+  0,                            /* tp_clear */
+  0,                            /* tp_richcompare */
+  0,                            /* tp_weaklistoffset */
+  0,                            /* tp_iter */
+  0,                            /* tp_iternext */
+  0,                            /* tp_methods */
+  0,                            /* tp_members */
+  memo_getset,                  /* tp_getset */
+  0,                            /* tp_base */
+  0,                            /* tp_dict */
+  memo_descr_get                /* tp_descr_get */
+};
+
+/**
+ * Decorator which is returned by memo() called with options
+ *
+ * @param self - tuple of cache's name and time-to-live
+ * @param func - function to wrap
+ * @return new wrapper or NULL on error
+ */
+static PyObject*
+memo_decorate (PyObject *self, PyObject *func)
+{
+  const char *name;
+  double ttl;
+
+  if (!PyArg_ParseTuple (self, "sd", &name, &ttl))
+    {
+      return NULL;
+    }
+
+  return memo_new (get_cache (name, PY_CACHE_DEFAULT_BYTES, 0), func, ttl);
+}
+
+static PyMethodDef memo_decorate_def = {
+  "memo", (PyCFunction)memo_decorate, METH_O,
+  "Make memoizing wrapper of pure function"
+};
+
+/********
+ * User's stuff
+ */
+
+/**
+ * Uninitialize caches stuff
+ *
+ * Values of all caches are released, so it should be called before
+ * finalization of interpreter.
+ */
+void
+py_cache_done (void)
+{
+  while (caches)
+    {
+      py_cache_t *cache = caches;
+
+      py_cache_clear (cache);
+
+      caches = cache->next;
+
+      free (cache->buckets);
+      free (cache->name);
+      free (cache);
+    }
+}
+
+/**
+ * Get named cache, creating it if needed
+ *
+ * Limits are applied only when cache is created, use
+ * py_cache_configure() to change them.
+ *
+ * @param name - name of cache
+ * @param max_bytes - limit of memory used by keys and values
+ * @param ttl - default time-to-live of values in seconds (0 for never)
+ * @return cache or NULL if name could not be converted to multibyte string
+ */
+py_cache_t*
+py_cache_get (const wchar_t *name, size_t max_bytes, double ttl)
+{
+  char *mbname = py_wcs2mbs (name);
+  py_cache_t *cache;
+
+  if (!mbname)
+    {
+      return NULL;
+    }
+
+  cache = get_cache (mbname, max_bytes, ttl);
+  free (mbname);
+
+  return cache;
+}
+
+/**
+ * Change limits of cache
+ *
+ * Values which don't fit new limit are evicted.
+ *
+ * @param cache - cache to configure
+ * @param max_bytes - limit of memory used by keys and values
+ * @param ttl - default time-to-live of new values in seconds
+ *   (0 for never)
+ */
+void
+py_cache_configure (py_cache_t *cache, size_t max_bytes, double ttl)
+{
+  cache->stats.max_bytes = max_bytes;
+  cache->ttl_ns = (unsigned long long)(MAX (ttl, 0) * 1e9);
+
+  evict (cache);
+}
+
+/**
+ * Find value in cache
+ *
+ * @param cache - cache to search in
+ * @param key - hashable key
+ * @param value - new reference to found value or NULL
+ * @return 1 if value is found, 0 if it isn't and -1 on error
+ */
+int
+py_cache_lookup (py_cache_t *cache, PyObject *key, PyObject **value)
+{
+  long hash = PyObject_Hash (key);
+  entry_t *entry;
+
+  *value = NULL;
+
+  if (hash == -1 || find_entry (cache, key, hash, &entry))
+    {
+      return -1;
+    }
+
+  if (entry && entry->expire_ns && entry->expire_ns <= py_stats_now ())
+    {
+      ++cache->stats.expirations;
+      unlink_entry (cache, entry);
+      release_entry (entry);
+      entry = NULL;
+    }
+
+  if (!entry)
+    {
+      ++cache->stats.misses;
+      return 0;
+    }
+
+  ++cache->stats.hits;
+  touch_entry (cache, entry);
+
+  Py_INCREF (entry->value);
+  *value = entry->value;
+
+  return 1;
+}
+
+/**
+ * Store value in cache
+ *
+ * Value which is larger than the whole cache isn't stored and replaces
+ * old value of key by nothing.
+ *
+ * @param cache - cache to store in
+ * @param key - hashable key
+ * @param value - value to store
+ * @param ttl - time-to-live in seconds (0 for never, negative for default
+ *   of cache)
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_cache_store (py_cache_t *cache, PyObject *key, PyObject *value,
+                double ttl)
+{
+  long hash = PyObject_Hash (key);
+  unsigned long long ttl_value = ttl_ns (cache, ttl);
+  PyObject *old_value = NULL;
+  entry_t *entry;
+  size_t size;
+
+  if (hash == -1 || find_entry (cache, key, hash, &entry))
+    {
+      return -1;
+    }
+
+  size = sizeof (entry_t) + object_size (key, 0) + object_size (value, 0);
+
+  if (size > cache->stats.max_bytes)
+    {
+      if (entry)
+        {
+          unlink_entry (cache, entry);
+          release_entry (entry);
+        }
+
+      return 0;
+    }
+
+  if (entry)
+    {
+      old_value = entry->value;
+
+      cache->stats.bytes += size - entry->size;
+      entry->size = size;
+      touch_entry (cache, entry);
+    }
+  else
+    {
+      MALLOC_ZERO (entry, sizeof (entry_t));
+
+      Py_INCREF (key);
+      entry->key = key;
+      entry->hash = hash;
+      entry->size = size;
+
+      link_entry (cache, entry);
+    }
+
+  Py_INCREF (value);
+  entry->value = value;
+  entry->expire_ns = ttl_value ? py_stats_now () + ttl_value : 0;
+
+  ++cache->stats.inserts;
+
+  /* Cache is consistent here, so code of old values could use it */
+  evict (cache);
+  Py_XDECREF (old_value);
+
+  return 0;
+}
+
+/**
+ * Remove value from cache
+ *
+ * @param cache - cache to remove from
+ * @param key - hashable key
+ * @return 1 if value is removed, 0 if it isn't found and -1 on error
+ */
+int
+py_cache_remove (py_cache_t *cache, PyObject *key)
+{
+  long hash = PyObject_Hash (key);
+  entry_t *entry;
+
+  if (hash == -1 || find_entry (cache, key, hash, &entry))
+    {
+      return -1;
+    }
+
+  if (!entry)
+    {
+      return 0;
+    }
+
+  unlink_entry (cache, entry);
+  release_entry (entry);
+
+  return 1;
+}
+
+/**
+ * Remove all values from cache
+ *
+ * Metrics of cache aren't reset.
+ *
+ * @param cache - cache to clear
+ */
+void
+py_cache_clear (py_cache_t *cache)
+{
+  while (cache->head)
+    {
+      entry_t *entry = cache->head;
+
+      unlink_entry (cache, entry);
+      release_entry (entry);
+    }
+}
+
+/**
+ * Get metrics of cache
+ *
+ * @param cache - cache
+ * @param stats - metrics to fill
+ */
+void
+py_cache_stats (py_cache_t *cache, py_cache_stats_t *stats)
+{
+  *stats = cache->stats;
+}
+
+/**
+ * Call procedure for metrics of each cache
+ *
+ * @param proc - procedure to call
+ * @param data - user's data for procedure
+ */
+void
+py_cache_foreach (py_cache_proc_t proc, void *data)
+{
+  py_cache_t *cache;
+
+  for (cache = caches; cache; cache = cache->next)
+    {
+      proc (cache->name, &cache->stats, data);
+    }
+}
+
+/**
+ * Get metrics of all caches as Python dictionary
+ *
+ * @return new dictionary with metrics of caches by their names
+ */
+PyObject*
+py_cache_as_dict (void)
+{
+  PyObject *result = PyDict_New ();
+  py_cache_t *cache;
+
+  for (cache = caches; cache; cache = cache->next)
+    {
+      PyObject *item = stats_dict (cache);
+
+      PyDict_SetItemString (result, cache->name, item);
+      Py_DECREF (item);
+    }
+
+  return result;
+}
+
+/**
+ * Get named cache object for scripts
+ *
+ * Script's arguments: name[, maxBytes[, ttl]]
+ */
+PyObject*
+py_cache_builtin (PyObject *self, PyObject *args, PyObject *kw)
+{
+  static char *keywords[] = {"name", "maxBytes", "ttl", NULL};
+  const char *name;
+  Py_ssize_t max_bytes = PY_CACHE_DEFAULT_BYTES;
+  double ttl = 0;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kw, "s|nd", keywords,
+                                    &name, &max_bytes, &ttl))
+    {
+      return NULL;
+    }
+
+  return cache_object_new (get_cache (name, MAX (max_bytes, 0), ttl));
+}
+
+/**
+ * Make memoizing wrapper of pure function
+ *
+ * Could be used as @memo or as @memo(cache=name, ttl=seconds).
+ *
+ * Script's arguments: [func][, cache[, ttl]]
+ */
+PyObject*
+py_cache_memo (PyObject *self, PyObject *args, PyObject *kw)
+{
+  static char *keywords[] = {"func", "cache", "ttl", NULL};
+  PyObject *func = NULL, *options, *result;
+  const char *name = PY_CACHE_MEMO_NAME;
+  double ttl = -1;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kw, "|Osd", keywords,
+                                    &func, &name, &ttl))
+    {
+      return NULL;
+    }
+
+  if (func)
+    {
+      return memo_new (get_cache (name, PY_CACHE_DEFAULT_BYTES, 0), func,
+                       ttl);
+    }
+
+  options = Py_BuildValue ("(sd)", name, ttl);
+
+  if (!options)
+    {
+      return NULL;
+    }
+
+  result = PyCFunction_New (&memo_decorate_def, options);
+  Py_DECREF (options);
+
+  return result;
+}
+
+/**
+ * Get metrics of all caches
+ */
+PyObject*
+py_cache_stats_builtin (PyObject *self, PyObject *args)
+{
+  return py_cache_as_dict ();
+}
@@ -0,0 +1,90 @@
+/**
+ * Named caches of script values which survive between runs
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Default limit of memory which is used by cache */
+#define PY_CACHE_DEFAULT_BYTES (4 * 1024 * 1024)
+
+/* Name of cache which is used by memo decorator by default */
+#define PY_CACHE_MEMO_NAME "memo"
+
+typedef struct py_cache py_cache_t;
+
+/* Metrics of cache */
+typedef struct {
+  unsigned long hits;         /* Count of found values */
+  unsigned long misses;       /* Count of missed and expired values */
+  unsigned long inserts;      /* Count of stored values */
+  unsigned long evictions;    /* Count of values dropped to fit the limit */
+  unsigned long expirations;  /* Count of values dropped by their TTL */
+
+  long count;                 /* Count of values in cache */
+  size_t bytes;               /* Estimated memory used by values */
+  size_t max_bytes;           /* Limit of memory used by values */
+} py_cache_stats_t;
+
+/* Callback for py_cache_foreach() */
+typedef void (*py_cache_proc_t) (const char *name,
+                                 const py_cache_stats_t *stats, void *data);
+
+/* Uninitialize caches stuff */
+void
+py_cache_done (void);
+
+/* Get named cache, creating it if needed */
+py_cache_t*
+py_cache_get (const wchar_t *name, size_t max_bytes, double ttl);
+
+/* Change limits of cache */
+void
+py_cache_configure (py_cache_t *cache, size_t max_bytes, double ttl);
+
+/* Find value in cache */
+int
+py_cache_lookup (py_cache_t *cache, PyObject *key, PyObject **value);
+
+/* Store value in cache */
+int
+py_cache_store (py_cache_t *cache, PyObject *key, PyObject *value,
+                double ttl);
+
+/* Remove value from cache */
+int
+py_cache_remove (py_cache_t *cache, PyObject *key);
+
+/* Remove all values from cache */
+void
+py_cache_clear (py_cache_t *cache);
+
+/* Get metrics of cache */
+void
+py_cache_stats (py_cache_t *cache, py_cache_stats_t *stats);
+
+/* Call procedure for metrics of each cache */
+void
+py_cache_foreach (py_cache_proc_t proc, void *data);
+
+/* Get metrics of all caches as Python dictionary */
+PyObject*
+py_cache_as_dict (void);
+
+/* Get named cache object for scripts */
+PyObject*
+py_cache_builtin (PyObject *self, PyObject *args, PyObject *kw);
+
+/* Make memoizing wrapper of pure function */
+PyObject*
+py_cache_memo (PyObject *self, PyObject *args, PyObject *kw);
+
+/* Get metrics of all caches */
+PyObject*
+py_cache_stats_builtin (PyObject *self, PyObject *args);
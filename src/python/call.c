@@ -0,0 +1,571 @@
+/**
+ * Reusable handles of Python callables
+ *
+ * EXTPY_CALL_OBJECT builds new argument tuple by parsing format string
+ * on each call. Handle keeps argument tuple between calls and arguments
+ * are replaced by typed setters. Tuple is reused while callee doesn't
+ * keep reference to it (i.e. when function takes *args and stores them),
+ * otherwise handle switches to a copy before next change. Integer and
+ * float arguments which are referenced only by the tuple are changed in
+ * place, so repeated calls don't allocate argument objects at all.
+ *
+ * Functions which are found by names of module and function are cached.
+ * Cache is dropped when hot reload invalidates modules, handles notice
+ * it by generation of cache and resolve their functions again.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+/* Count of buckets in cache of resolved functions */
+#define CACHE_SIZE 64
+
+typedef struct cache_entry {
+  char *module;
+  char *name;
+  unsigned long hash;
+  PyObject *func;
+
+  struct cache_entry *next;
+} cache_entry_t;
+
+static cache_entry_t *cache[CACHE_SIZE] = {0};
+
+/* Generation of cache, changed when cache is dropped */
+static unsigned long cache_generation = 0;
+
+/* Count of watcher's invalidations when cache was checked last time */
+static unsigned long seen_invalidations = 0;
+
+/**
+ * Calculate hash of names of module and function
+ *
+ * @param module - name of module
+ * @param name - name of function
+ * @return hash of names
+ */
+static unsigned long
+names_hash (const char *module, const char *name)
+{
+  unsigned long hash = 2166136261UL;
+
+  while (*module)
+    {
+      hash = (hash ^ (unsigned char)*module++) * 16777619UL;
+    }
+
+  hash = (hash ^ '.') * 16777619UL;
+
+  while (*name)
+    {
+      hash = (hash ^ (unsigned char)*name++) * 16777619UL;
+    }
+
+  return hash;
+}
+
+/**
+ * Drop all cached functions
+ */
+static void
+cache_clear (void)
+{
+  int i;
+
+  for (i = 0; i < CACHE_SIZE; ++i)
+    {
+      while (cache[i])
+        {
+          cache_entry_t *entry = cache[i];
+
+          cache[i] = entry->next;
+
+          Py_DECREF (entry->func);
+          free (entry->module);
+          free (entry->name);
+          free (entry);
+        }
+    }
+
+  ++cache_generation;
+}
+
+/**
+ * Drop cache if watcher has invalidated modules since last check
+ */
+static inline void
+cache_check (void)
+{
+  unsigned long invalidations = py_watch_invalidations ();
+
+  if (invalidations != seen_invalidations)
+    {
+      seen_invalidations = invalidations;
+      cache_clear ();
+    }
+}
+
+/**
+ * Make argument tuple of call private
+ *
+ * @param call - handle of call
+ * @return zero on success, non-zero otherwise
+ */
+static int
+unshare_args (py_call_t *call)
+{
+  PyObject *args;
+  int i;
+
+  if (call->args->ob_refcnt == 1)
+    {
+      return 0;
+    }
+
+  /* Callee has kept the tuple, it should not see changes */
+  args = PyTuple_New (call->argc);
+
+  if (!args)
+    {
+      return -1;
+    }
+
+  for (i = 0; i < call->argc; ++i)
+    {
+      PyObject *item = PyTuple_GET_ITEM (call->args, i);
+
+      Py_INCREF (item);
+      PyTuple_SET_ITEM (args, i, item);
+    }
+
+  Py_DECREF (call->args);
+  call->args = args;
+
+  return 0;
+}
+
+/**
+ * Replace argument of call
+ *
+ * @param call - handle of call
+ * @param index - index of argument
+ * @param value - new value of argument (reference is stolen)
+ * @return zero on success, non-zero otherwise
+ */
+static int
+set_arg (py_call_t *call, int index, PyObject *value)
+{
+  PyObject *old;
+
+  if (!value)
+    {
+      return -1;
+    }
+
+  if (index < 0 || index >= call->argc)
+    {
+      Py_DECREF (value);
+      PyErr_SetString (PyExc_IndexError, "argument index out of range");
+      return -1;
+    }
+
+  if (unshare_args (call))
+    {
+      Py_DECREF (value);
+      return -1;
+    }
+
+  old = PyTuple_GET_ITEM (call->args, index);
+  PyTuple_SET_ITEM (call->args, index, value);
+  Py_DECREF (old);
+
+  return 0;
+}
+
+/**
+ * Get argument which could be changed in place
+ *
+ * @param call - handle of call
+ * @param index - index of argument
+ * @param type - required exact type of argument
+ * @return argument which is referenced only by tuple or NULL
+ */
+static inline PyObject*
+private_arg (py_call_t *call, int index, PyTypeObject *type)
+{
+  PyObject *item;
+
+  if (index < 0 || index >= call->argc || call->args->ob_refcnt != 1)
+    {
+      return NULL;
+    }
+
+  item = PyTuple_GET_ITEM (call->args, index);
+
+  /* Nobody else sees object, so its immutability can't be broken */
+  if (item->ob_refcnt != 1 || item->ob_type != type)
+    {
+      return NULL;
+    }
+
+  return item;
+}
+
+/**
+ * Create handle with argument tuple filled with None
+ *
+ * @param argc - count of arguments
+ * @return new handle or NULL with set error
+ */
+static py_call_t*
+call_alloc (int argc)
+{
+  py_call_t *call;
+  int i;
+
+  if (argc < 0)
+    {
+      PyErr_SetString (PyExc_ValueError, "negative count of arguments");
+      return NULL;
+    }
+
+  MALLOC_ZERO (call, sizeof (py_call_t));
+
+  call->argc = argc;
+  call->args = PyTuple_New (argc);
+
+  if (!call->args)
+    {
+      free (call);
+      return NULL;
+    }
+
+  for (i = 0; i < argc; ++i)
+    {
+      Py_INCREF (Py_None);
+      PyTuple_SET_ITEM (call->args, i, Py_None);
+    }
+
+  return call;
+}
+
+/********
+ * User's stuff
+ */
+
+/**
+ * Find function by names of module and function using cache
+ *
+ * Module is imported if it hasn't been imported yet.
+ *
+ * @param module - name of module
+ * @param name - name of function
+ * @return borrowed reference to function or NULL with set error
+ */
+PyObject*
+py_call_resolve (const char *module, const char *name)
+{
+  cache_entry_t *entry;
+  unsigned long hash;
+  PyObject *mod, *func;
+
+  cache_check ();
+
+  hash = names_hash (module, name);
+
+  for (entry = cache[hash & (CACHE_SIZE - 1)]; entry; entry = entry->next)
+    {
+      if (entry->hash == hash && !strcmp (entry->name, name) &&
+          !strcmp (entry->module, module))
+        {
+          return entry->func;
+        }
+    }
+
+  mod = PyImport_ImportModule ((char*)module);
+
+  if (!mod)
+    {
+      return NULL;
+    }
+
+  func = PyObject_GetAttrString (mod, (char*)name);
+  Py_DECREF (mod);
+
+  if (!func)
+    {
+      return NULL;
+    }
+
+  if (!PyCallable_Check (func))
+    {
+      PyErr_Format (PyExc_TypeError, "%s.%s is not callable", module, name);
+      Py_DECREF (func);
+      return NULL;
+    }
+
+  MALLOC_ZERO (entry, sizeof (cache_entry_t));
+  entry->module = strdup (module);
+  entry->name = strdup (name);
+  entry->hash = hash;
+  entry->func = func;
+
+  entry->next = cache[hash & (CACHE_SIZE - 1)];
+  cache[hash & (CACHE_SIZE - 1)] = entry;
+
+  return func;
+}
+
+/**
+ * Drop cached functions
+ *
+ * Should be called before Py_Finalize().
+ */
+void
+py_call_done (void)
+{
+  cache_clear ();
+}
+
+/**
+ * Create handle of callable object
+ *
+ * @param callable - object to call
+ * @param argc - count of positional arguments of calls
+ * @return new handle or NULL with set error
+ */
+py_call_t*
+py_call_new (PyObject *callable, int argc)
+{
+  py_call_t *call;
+
+  if (!callable || !PyCallable_Check (callable))
+    {
+      PyErr_SetString (PyExc_TypeError, "object is not callable");
+      return NULL;
+    }
+
+  call = call_alloc (argc);
+
+  if (call)
+    {
+      call->callable = callable;
+      Py_INCREF (callable);
+    }
+
+  return call;
+}
+
+/**
+ * Create handle of function which is found by names of module and function
+ *
+ * Handle resolves function again when hot reload invalidates modules.
+ *
+ * @param module - name of module
+ * @param name - name of function
+ * @param argc - count of positional arguments of calls
+ * @return new handle or NULL with set error
+ */
+py_call_t*
+py_call_lookup (const wchar_t *module, const wchar_t *name, int argc)
+{
+  py_call_t *call;
+  PyObject *func;
+  char *mbmodule, *mbname;
+
+  if (!module || !name)
+    {
+      PyErr_SetString (PyExc_ValueError, "name of module or function "
+                       "is NULL");
+      return NULL;
+    }
+
+  mbmodule = py_wcs2mbs (module);
+  mbname = py_wcs2mbs (name);
+
+  if (!mbmodule || !mbname)
+    {
+      free (mbmodule);
+      free (mbname);
+      PyErr_NoMemory ();
+      return NULL;
+    }
+
+  func = py_call_resolve (mbmodule, mbname);
+  call = func ? py_call_new (func, argc) : NULL;
+
+  if (!call)
+    {
+      free (mbmodule);
+      free (mbname);
+      return NULL;
+    }
+
+  call->module_name = mbmodule;
+  call->func_name = mbname;
+  call->generation = cache_generation;
+
+  return call;
+}
+
+/**
+ * Free handle of callable
+ *
+ * @param call - handle to free
+ */
+void
+py_call_free (py_call_t *call)
+{
+  if (!call)
+    {
+      return;
+    }
+
+  Py_DECREF (call->callable);
+  Py_DECREF (call->args);
+
+  SAFE_FREE (call->module_name);
+  SAFE_FREE (call->func_name);
+
+  free (call);
+}
+
+/**
+ * Set argument of call to integer
+ *
+ * @param call - handle of call
+ * @param index - index of argument
+ * @param value - value of argument
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_call_set_long (py_call_t *call, int index, long value)
+{
+  PyObject *item = private_arg (call, index, &PyInt_Type);
+
+  if (item)
+    {
+      ((PyIntObject*)item)->ob_ival = value;
+      return 0;
+    }
+
+  return set_arg (call, index, PyInt_FromLong (value));
+}
+
+/**
+ * Set argument of call to floating point number
+ *
+ * @param call - handle of call
+ * @param index - index of argument
+ * @param value - value of argument
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_call_set_double (py_call_t *call, int index, double value)
+{
+  PyObject *item = private_arg (call, index, &PyFloat_Type);
+
+  if (item)
+    {
+      ((PyFloatObject*)item)->ob_fval = value;
+      return 0;
+    }
+
+  return set_arg (call, index, PyFloat_FromDouble (value));
+}
+
+/**
+ * Set argument of call to string
+ *
+ * @param call - handle of call
+ * @param index - index of argument
+ * @param value - value of argument (should not be NULL)
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_call_set_string (py_call_t *call, int index, const wchar_t *value)
+{
+  if (!value)
+    {
+      PyErr_SetString (PyExc_ValueError, "string argument is NULL");
+      return -1;
+    }
+
+  return set_arg (call, index,
+                  PyUnicode_FromWideChar (value, wcslen (value)));
+}
+
+/**
+ * Set argument of call to object
+ *
+ * @param call - handle of call
+ * @param index - index of argument
+ * @param value - value of argument (reference is not stolen)
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_call_set_object (py_call_t *call, int index, PyObject *value)
+{
+  Py_XINCREF (value);
+  return set_arg (call, index, value);
+}
+
+/**
+ * Call callable with current arguments
+ *
+ * Arguments are kept, so next call could change only some of them.
+ *
+ * @param call - handle of call
+ * @return result of call or NULL with set error
+ */
+PyObject*
+py_call_invoke (py_call_t *call)
+{
+  if (call->module_name)
+    {
+      cache_check ();
+
+      if (call->generation != cache_generation)
+        {
+          PyObject *func = py_call_resolve (call->module_name,
+                                            call->func_name);
+
+          if (!func)
+            {
+              return NULL;
+            }
+
+          Py_INCREF (func);
+          Py_DECREF (call->callable);
+          call->callable = func;
+          call->generation = cache_generation;
+        }
+    }
+
+  return PyObject_Call (call->callable, call->args, NULL);
+}
+
+/**
+ * Call callable with current arguments and drop its result
+ *
+ * @param call - handle of call
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_call_invoke_void (py_call_t *call)
+{
+  PyObject *result = py_call_invoke (call);
+
+  if (!result)
+    {
+      return -1;
+    }
+
+  Py_DECREF (result);
+
+  return 0;
+}
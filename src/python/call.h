@@ -0,0 +1,67 @@
+/**
+ * Reusable handles of Python callables
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+typedef struct {
+  PyObject *callable;
+  PyObject *args;             /* Argument tuple which is reused by calls */
+  int argc;                   /* Count of arguments */
+
+  /* Names of callable for handles created by py_call_lookup() */
+  char *module_name;
+  char *func_name;
+  unsigned long generation;   /* Generation of resolution cache */
+} py_call_t;
+
+/* Create handle of callable object */
+py_call_t*
+py_call_new (PyObject *callable, int argc);
+
+/* Create handle of function which is found by names of module and function */
+py_call_t*
+py_call_lookup (const wchar_t *module, const wchar_t *name, int argc);
+
+/* Free handle of callable */
+void
+py_call_free (py_call_t *call);
+
+/* Set argument of call to integer */
+int
+py_call_set_long (py_call_t *call, int index, long value);
+
+/* Set argument of call to floating point number */
+int
+py_call_set_double (py_call_t *call, int index, double value);
+
+/* Set argument of call to string */
+int
+py_call_set_string (py_call_t *call, int index, const wchar_t *value);
+
+/* Set argument of call to object */
+int
+py_call_set_object (py_call_t *call, int index, PyObject *value);
+
+/* Call callable with current arguments */
+PyObject*
+py_call_invoke (py_call_t *call);
+
+/* Call callable with current arguments and drop its result */
+int
+py_call_invoke_void (py_call_t *call);
+
+/* Find function by names of module and function using cache */
+PyObject*
+py_call_resolve (const char *module, const char *name);
+
+/* Drop cached functions */
+void
+py_call_done (void);
@@ -0,0 +1,864 @@
+/**
+ * Bulk conversion of Python's sequences to C arrays
+ *
+ * Lists and tuples whose elements are exact ints or floats are converted
+ * without any calls into Python's number protocol, and objects which
+ * support buffer protocol are converted directly from their memory,
+ * with SIMD conversion of the most common element types.
+ *
+ * On error exception of the same type as Python raises is set with the
+ * index of the first bad element in its message.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#include <stdint.h>
+
+#if defined (__SSE2__)
+#  include <emmintrin.h>
+#  define HAVE_SSE2
+#endif
+
+#if defined (__x86_64__) && defined (__GNUC__) && __GNUC__ >= 5
+#  include <immintrin.h>
+#  define HAVE_AVX2
+#  define AVX2_FUNC __attribute__ ((target ("avx2")))
+#endif
+
+/****
+ * Helpers
+ */
+
+#ifdef HAVE_AVX2
+/**
+ * Check if AVX2 could be used on current CPU
+ *
+ * @return non-zero if AVX2 is supported
+ */
+static inline int
+cpu_has_avx2 (void)
+{
+  static int has_avx2 = -1;
+
+  if (has_avx2 < 0)
+    {
+      __builtin_cpu_init ();
+      has_avx2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+    }
+
+  return has_avx2;
+}
+
+AVX2_FUNC static Py_ssize_t
+int32_to_double_avx2 (double *dst, const int32_t *src, Py_ssize_t len)
+{
+  Py_ssize_t i;
+
+  for (i = 0; i + 4 <= len; i += 4)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i*)(src + i));
+      _mm256_storeu_pd (dst + i, _mm256_cvtepi32_pd (v));
+    }
+
+  return i;
+}
+
+AVX2_FUNC static Py_ssize_t
+float_to_double_avx2 (double *dst, const float *src, Py_ssize_t len)
+{
+  Py_ssize_t i;
+
+  for (i = 0; i + 4 <= len; i += 4)
+    {
+      __m128 v = _mm_loadu_ps (src + i);
+      _mm256_storeu_pd (dst + i, _mm256_cvtps_pd (v));
+    }
+
+  return i;
+}
+
+AVX2_FUNC static Py_ssize_t
+int32_to_int64_avx2 (int64_t *dst, const int32_t *src, Py_ssize_t len)
+{
+  Py_ssize_t i;
+
+  for (i = 0; i + 4 <= len; i += 4)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i*)(src + i));
+      _mm256_storeu_si256 ((__m256i*)(dst + i), _mm256_cvtepi32_epi64 (v));
+    }
+
+  return i;
+}
+#endif
+
+/**
+ * Convert 32-bit integers to doubles
+ *
+ * @param dst - destination array
+ * @param src - source array
+ * @param len - count of elements
+ */
+static void
+int32_to_double (double *dst, const int32_t *src, Py_ssize_t len)
+{
+  Py_ssize_t i = 0;
+
+#ifdef HAVE_AVX2
+  if (cpu_has_avx2 ())
+    {
+      i = int32_to_double_avx2 (dst, src, len);
+    }
+#endif
+
+#ifdef HAVE_SSE2
+  for (; i + 2 <= len; i += 2)
+    {
+      __m128i v = _mm_loadl_epi64 ((const __m128i*)(src + i));
+      _mm_storeu_pd (dst + i, _mm_cvtepi32_pd (v));
+    }
+#endif
+
+  for (; i < len; ++i)
+    {
+      dst[i] = src[i];
+    }
+}
+
+/**
+ * Convert floats to doubles
+ *
+ * @param dst - destination array
+ * @param src - source array
+ * @param len - count of elements
+ */
+static void
+float_to_double (double *dst, const float *src, Py_ssize_t len)
+{
+  Py_ssize_t i = 0;
+
+#ifdef HAVE_AVX2
+  if (cpu_has_avx2 ())
+    {
+      i = float_to_double_avx2 (dst, src, len);
+    }
+#endif
+
+#ifdef HAVE_SSE2
+  for (; i + 4 <= len; i += 4)
+    {
+      __m128 v = _mm_loadu_ps (src + i);
+      _mm_storeu_pd (dst + i, _mm_cvtps_pd (v));
+      _mm_storeu_pd (dst + i + 2, _mm_cvtps_pd (_mm_movehl_ps (v, v)));
+    }
+#endif
+
+  for (; i < len; ++i)
+    {
+      dst[i] = src[i];
+    }
+}
+
+/**
+ * Sign-extend 32-bit integers to 64-bit ones
+ *
+ * @param dst - destination array
+ * @param src - source array
+ * @param len - count of elements
+ */
+static void
+int32_to_int64 (int64_t *dst, const int32_t *src, Py_ssize_t len)
+{
+  Py_ssize_t i = 0;
+
+#ifdef HAVE_AVX2
+  if (cpu_has_avx2 ())
+    {
+      i = int32_to_int64_avx2 (dst, src, len);
+    }
+#endif
+
+#ifdef HAVE_SSE2
+  for (; i + 4 <= len; i += 4)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i*)(src + i));
+      __m128i sign = _mm_srai_epi32 (v, 31);
+
+      _mm_storeu_si128 ((__m128i*)(dst + i), _mm_unpacklo_epi32 (v, sign));
+      _mm_storeu_si128 ((__m128i*)(dst + i + 2), _mm_unpackhi_epi32 (v, sign));
+    }
+#endif
+
+  for (; i < len; ++i)
+    {
+      dst[i] = src[i];
+    }
+}
+
+/**
+ * Set error of conversion of element
+ *
+ * Exception which is already set is replaced with exception of the same
+ * type with index of element in its message.
+ *
+ * @param index - index of bad element
+ * @param item - bad element
+ * @param expected - name of expected type
+ * @param bad_index - where to store index (could be NULL)
+ */
+static void
+element_error (Py_ssize_t index, PyObject *item, const char *expected,
+               Py_ssize_t *bad_index)
+{
+  if (bad_index)
+    {
+      *bad_index = index;
+    }
+
+  if (PyErr_ExceptionMatches (PyExc_OverflowError))
+    {
+      PyErr_Format (PyExc_OverflowError, "element %zd of sequence is out "
+                    "of range", index);
+    }
+  else
+    {
+      PyErr_Format (PyExc_TypeError, "element %zd of sequence is %.100s, "
+                    "%s expected", index, item->ob_type->tp_name, expected);
+    }
+}
+
+/**
+ * Convert element of sequence to long
+ *
+ * @param item - element to convert
+ * @param value - converted value
+ * @return zero on success, non-zero with set exception otherwise
+ */
+static int
+item_as_long (PyObject *item, long *value)
+{
+  if (PyInt_Check (item))
+    {
+      *value = PyInt_AS_LONG (item);
+      return 0;
+    }
+
+  if (PyLong_Check (item))
+    {
+      *value = PyLong_AsLong (item);
+      return *value == -1 && PyErr_Occurred ();
+    }
+
+  /* Floats are not silently truncated */
+  PyErr_SetNone (PyExc_TypeError);
+
+  return -1;
+}
+
+/**
+ * Convert element of sequence to double
+ *
+ * @param item - element to convert
+ * @param value - converted value
+ * @return zero on success, non-zero with set exception otherwise
+ */
+static int
+item_as_double (PyObject *item, double *value)
+{
+  if (PyFloat_Check (item))
+    {
+      *value = PyFloat_AS_DOUBLE (item);
+      return 0;
+    }
+
+  if (PyInt_Check (item))
+    {
+      *value = (double)PyInt_AS_LONG (item);
+      return 0;
+    }
+
+  if (PyLong_Check (item))
+    {
+      *value = PyLong_AsDouble (item);
+      return *value == -1.0 && PyErr_Occurred ();
+    }
+
+  PyErr_SetNone (PyExc_TypeError);
+
+  return -1;
+}
+
+/**
+ * Check whether object supports any of buffer protocols
+ *
+ * @param obj - object to check
+ * @return non-zero if object supports buffer protocol
+ */
+static int
+has_buffer (PyObject *obj)
+{
+  PyBufferProcs *procs = obj->ob_type->tp_as_buffer;
+
+#if PY_VERSION_HEX >= 0x02060000
+  if (PyObject_CheckBuffer (obj))
+    {
+      return 1;
+    }
+#endif
+
+  return procs && procs->bf_getreadbuffer;
+}
+
+/**
+ * Get memory of one-dimensional contiguous buffer
+ *
+ * @param obj - object to get memory of
+ * @param buffer - descriptor to fill
+ * @return non-zero if object is such buffer
+ */
+static int
+get_flat_buffer (PyObject *obj, py_buffer_t *buffer)
+{
+  /* Strings are sequences of characters rather than of numbers */
+  if (PyString_Check (obj) || PyUnicode_Check (obj) ||
+      PyList_Check (obj) || PyTuple_Check (obj))
+    {
+      return 0;
+    }
+
+  if (!has_buffer (obj))
+    {
+      return 0;
+    }
+
+  if (py_buffer_get (obj, buffer, PY_ARRAY_READONLY))
+    {
+      PyErr_Clear ();
+      return 0;
+    }
+
+  if (buffer->ndim != 1 ||
+      buffer->strides[0] != py_array_type_size (buffer->type))
+    {
+      py_buffer_release (buffer);
+      return 0;
+    }
+
+  return 1;
+}
+
+/**
+ * Convert buffer to array of longs
+ *
+ * @param buffer - buffer to convert
+ * @param dst - destination array
+ * @param bad_index - where to store index of bad element (could be NULL)
+ * @return zero on success, non-zero with set exception otherwise
+ */
+static int
+buffer_to_longs (const py_buffer_t *buffer, long *dst, Py_ssize_t *bad_index)
+{
+  Py_ssize_t i, len = buffer->len;
+  const void *src = buffer->data;
+
+  switch (buffer->type)
+    {
+    case PY_ARRAY_INT32:
+      if (sizeof (long) == 8)
+        {
+          int32_to_int64 ((int64_t*)dst, src, len);
+        }
+      else
+        {
+          memcpy (dst, src, len * sizeof (long));
+        }
+      return 0;
+    case PY_ARRAY_INT64:
+      if (sizeof (long) == 8)
+        {
+          memcpy (dst, src, len * sizeof (long));
+          return 0;
+        }
+      break;
+    case PY_ARRAY_INT8:
+      for (i = 0; i < len; ++i) dst[i] = ((const int8_t*)src)[i];
+      return 0;
+    case PY_ARRAY_UINT8:
+      for (i = 0; i < len; ++i) dst[i] = ((const uint8_t*)src)[i];
+      return 0;
+    case PY_ARRAY_INT16:
+      for (i = 0; i < len; ++i) dst[i] = ((const int16_t*)src)[i];
+      return 0;
+    case PY_ARRAY_UINT16:
+      for (i = 0; i < len; ++i) dst[i] = ((const uint16_t*)src)[i];
+      return 0;
+    case PY_ARRAY_UINT32:
+      if (sizeof (long) == 8)
+        {
+          for (i = 0; i < len; ++i) dst[i] = ((const uint32_t*)src)[i];
+          return 0;
+        }
+      break;
+    case PY_ARRAY_FLOAT32:
+    case PY_ARRAY_FLOAT64:
+      if (bad_index && len)
+        {
+          *bad_index = 0;
+        }
+
+      PyErr_SetString (PyExc_TypeError, "buffer of floats could not be "
+                       "converted to integers");
+      return -1;
+    }
+
+  /* Values which could not fit long are checked one by one */
+  for (i = 0; i < len; ++i)
+    {
+      uint64_t v = buffer->type == PY_ARRAY_INT64 ?
+        (uint64_t)((const int64_t*)src)[i] :
+        buffer->type == PY_ARRAY_UINT32 ? ((const uint32_t*)src)[i] :
+        ((const uint64_t*)src)[i];
+
+      if ((buffer->type == PY_ARRAY_INT64 &&
+           (int64_t)v != (long)(int64_t)v) ||
+          (buffer->type != PY_ARRAY_INT64 && v > (uint64_t)LONG_MAX))
+        {
+          if (bad_index)
+            {
+              *bad_index = i;
+            }
+
+          PyErr_Format (PyExc_OverflowError, "element %zd of sequence is "
+                        "out of range of long", i);
+          return -1;
+        }
+
+      dst[i] = (long)v;
+    }
+
+  return 0;
+}
+
+/**
+ * Convert buffer to array of doubles
+ *
+ * @param buffer - buffer to convert
+ * @param dst - destination array
+ */
+static void
+buffer_to_doubles (const py_buffer_t *buffer, double *dst)
+{
+  Py_ssize_t i, len = buffer->len;
+  const void *src = buffer->data;
+
+  switch (buffer->type)
+    {
+    case PY_ARRAY_FLOAT64:
+      memcpy (dst, src, len * sizeof (double));
+      break;
+    case PY_ARRAY_FLOAT32:
+      float_to_double (dst, src, len);
+      break;
+    case PY_ARRAY_INT32:
+      int32_to_double (dst, src, len);
+      break;
+    case PY_ARRAY_INT8:
+      for (i = 0; i < len; ++i) dst[i] = ((const int8_t*)src)[i];
+      break;
+    case PY_ARRAY_UINT8:
+      for (i = 0; i < len; ++i) dst[i] = ((const uint8_t*)src)[i];
+      break;
+    case PY_ARRAY_INT16:
+      for (i = 0; i < len; ++i) dst[i] = ((const int16_t*)src)[i];
+      break;
+    case PY_ARRAY_UINT16:
+      for (i = 0; i < len; ++i) dst[i] = ((const uint16_t*)src)[i];
+      break;
+    case PY_ARRAY_UINT32:
+      for (i = 0; i < len; ++i) dst[i] = ((const uint32_t*)src)[i];
+      break;
+    case PY_ARRAY_INT64:
+      for (i = 0; i < len; ++i) dst[i] = ((const int64_t*)src)[i];
+      break;
+    case PY_ARRAY_UINT64:
+      for (i = 0; i < len; ++i) dst[i] = ((const uint64_t*)src)[i];
+      break;
+    }
+}
+
+/**
+ * Get count of characters of string element
+ *
+ * @param item - element of sequence
+ * @return count of characters or -1 if element is not a string
+ */
+static Py_ssize_t
+string_len (PyObject *item)
+{
+  if (PyString_Check (item))
+    {
+      return py_utf8_decoded_len (PyString_AS_STRING (item),
+                                  PyString_GET_SIZE (item));
+    }
+
+  if (PyUnicode_Check (item))
+    {
+      return PyUnicode_GET_SIZE (item);
+    }
+
+  return -1;
+}
+
+/****
+ * User's stuff
+ */
+
+/**
+ * Convert sequence or buffer to array of longs
+ *
+ * @param obj - list, tuple, any other sequence or buffer of integers
+ * @param len - count of elements in result
+ * @param bad_index - index of first bad element or -1 if object itself
+ *   is not a sequence (could be NULL)
+ * @return array of values or NULL with set exception
+ * @sideeffect allocate memory for output value
+ */
+long*
+extpy_to_long_array (PyObject *obj, Py_ssize_t *len, Py_ssize_t *bad_index)
+{
+  PyObject *seq, **items;
+  py_buffer_t buffer;
+  Py_ssize_t i, count;
+  long *result;
+
+  if (bad_index)
+    {
+      *bad_index = -1;
+    }
+
+  if (get_flat_buffer (obj, &buffer))
+    {
+      result = malloc (sizeof (long) * MAX (buffer.len, 1));
+
+      if (!result)
+        {
+          PyErr_NoMemory ();
+        }
+      else if (buffer_to_longs (&buffer, result, bad_index))
+        {
+          SAFE_FREE (result);
+        }
+      else
+        {
+          *len = buffer.len;
+        }
+
+      py_buffer_release (&buffer);
+
+      return result;
+    }
+
+  seq = PySequence_Fast (obj, "object is not a sequence");
+
+  if (!seq)
+    {
+      return NULL;
+    }
+
+  count = PySequence_Fast_GET_SIZE (seq);
+  items = PySequence_Fast_ITEMS (seq);
+  result = malloc (sizeof (long) * MAX (count, 1));
+
+  if (!result)
+    {
+      Py_DECREF (seq);
+      PyErr_NoMemory ();
+      return NULL;
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      if (PyInt_CheckExact (items[i]))
+        {
+          result[i] = PyInt_AS_LONG (items[i]);
+        }
+      else if (item_as_long (items[i], &result[i]))
+        {
+          element_error (i, items[i], "int", bad_index);
+          SAFE_FREE (result);
+          break;
+        }
+    }
+
+  Py_DECREF (seq);
+
+  if (result)
+    {
+      *len = count;
+    }
+
+  return result;
+}
+
+/**
+ * Convert sequence or buffer to array of doubles
+ *
+ * @param obj - list, tuple, any other sequence or buffer of numbers
+ * @param len - count of elements in result
+ * @param bad_index - index of first bad element or -1 if object itself
+ *   is not a sequence (could be NULL)
+ * @return array of values or NULL with set exception
+ * @sideeffect allocate memory for output value
+ */
+double*
+extpy_to_double_array (PyObject *obj, Py_ssize_t *len, Py_ssize_t *bad_index)
+{
+  PyObject *seq, **items;
+  py_buffer_t buffer;
+  Py_ssize_t i, count;
+  double *result;
+
+  if (bad_index)
+    {
+      *bad_index = -1;
+    }
+
+  if (get_flat_buffer (obj, &buffer))
+    {
+      result = malloc (sizeof (double) * MAX (buffer.len, 1));
+
+      if (!result)
+        {
+          PyErr_NoMemory ();
+        }
+      else
+        {
+          buffer_to_doubles (&buffer, result);
+          *len = buffer.len;
+        }
+
+      py_buffer_release (&buffer);
+
+      return result;
+    }
+
+  seq = PySequence_Fast (obj, "object is not a sequence");
+
+  if (!seq)
+    {
+      return NULL;
+    }
+
+  count = PySequence_Fast_GET_SIZE (seq);
+  items = PySequence_Fast_ITEMS (seq);
+  result = malloc (sizeof (double) * MAX (count, 1));
+
+  if (!result)
+    {
+      Py_DECREF (seq);
+      PyErr_NoMemory ();
+      return NULL;
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      if (PyFloat_CheckExact (items[i]))
+        {
+          result[i] = PyFloat_AS_DOUBLE (items[i]);
+        }
+      else if (item_as_double (items[i], &result[i]))
+        {
+          element_error (i, items[i], "float", bad_index);
+          SAFE_FREE (result);
+          break;
+        }
+    }
+
+  Py_DECREF (seq);
+
+  if (result)
+    {
+      *len = count;
+    }
+
+  return result;
+}
+
+/**
+ * Convert sequence of strings to packed array of wide-char strings
+ *
+ * Pointers and characters of all strings are stored in a single block,
+ * so result is freed with single free(). Array of pointers is terminated
+ * with NULL.
+ *
+ * @param obj - list, tuple or any other sequence of str or unicode
+ * @param len - count of strings in result
+ * @param bad_index - index of first bad element or -1 if object itself
+ *   is not a sequence (could be NULL)
+ * @return array of strings or NULL with set exception
+ * @sideeffect allocate memory for output value
+ */
+wchar_t**
+extpy_to_string_array (PyObject *obj, Py_ssize_t *len, Py_ssize_t *bad_index)
+{
+  PyObject *seq, **items;
+  Py_ssize_t i, count, chars = 0;
+  wchar_t **result, *ptr;
+
+  if (bad_index)
+    {
+      *bad_index = -1;
+    }
+
+  seq = PySequence_Fast (obj, "object is not a sequence");
+
+  if (!seq)
+    {
+      return NULL;
+    }
+
+  count = PySequence_Fast_GET_SIZE (seq);
+  items = PySequence_Fast_ITEMS (seq);
+
+  /* Size of block is known before any string is decoded */
+  for (i = 0; i < count; ++i)
+    {
+      Py_ssize_t item_len = string_len (items[i]);
+
+      if (item_len < 0)
+        {
+          PyErr_SetNone (PyExc_TypeError);
+          element_error (i, items[i], "str", bad_index);
+          Py_DECREF (seq);
+          return NULL;
+        }
+
+      chars += item_len + 1;
+    }
+
+  result = malloc (sizeof (wchar_t*) * (count + 1) +
+                   sizeof (wchar_t) * chars);
+
+  if (!result)
+    {
+      Py_DECREF (seq);
+      PyErr_NoMemory ();
+      return NULL;
+    }
+
+  ptr = (wchar_t*)(result + count + 1);
+
+  for (i = 0; i < count; ++i)
+    {
+      PyObject *item = items[i];
+      Py_ssize_t item_len;
+
+      if (PyString_Check (item))
+        {
+          item_len = py_utf8_decode (ptr, PyString_AS_STRING (item),
+                                     PyString_GET_SIZE (item));
+        }
+      else
+        {
+          item_len = PyUnicode_AsWideChar ((PyUnicodeObject*)item, ptr,
+                                           PyUnicode_GET_SIZE (item));
+        }
+
+      ptr[item_len] = 0;
+      result[i] = ptr;
+      ptr += item_len + 1;
+    }
+
+  result[count] = NULL;
+  *len = count;
+
+  Py_DECREF (seq);
+
+  return result;
+}
+
+/**
+ * Get long-array object's attribute
+ *
+ * @param obj - object to get attribute's value of
+ * @param attr_name - name of attribute
+ * @param len - count of elements in result
+ * @return array of values or NULL with set exception
+ * @sideeffect allocate memory for output value
+ */
+long*
+extpy_get_long_array_attr (PyObject *obj, const wchar_t *attr_name,
+                           Py_ssize_t *len)
+{
+  PyObject *field = extpy_get_attr_string (obj, attr_name);
+  long *result;
+
+  if (!field)
+    {
+      return NULL;
+    }
+
+  result = extpy_to_long_array (field, len, NULL);
+  Py_DECREF (field);
+
+  return result;
+}
+
+/**
+ * Get double-array object's attribute
+ *
+ * @param obj - object to get attribute's value of
+ * @param attr_name - name of attribute
+ * @param len - count of elements in result
+ * @return array of values or NULL with set exception
+ * @sideeffect allocate memory for output value
+ */
+double*
+extpy_get_double_array_attr (PyObject *obj, const wchar_t *attr_name,
+                             Py_ssize_t *len)
+{
+  PyObject *field = extpy_get_attr_string (obj, attr_name);
+  double *result;
+
+  if (!field)
+    {
+      return NULL;
+    }
+
+  result = extpy_to_double_array (field, len, NULL);
+  Py_DECREF (field);
+
+  return result;
+}
+
+/**
+ * Get string-array object's attribute
+ *
+ * @param obj - object to get attribute's value of
+ * @param attr_name - name of attribute
+ * @param len - count of strings in result
+ * @return packed array of strings or NULL with set exception
+ * @sideeffect allocate memory for output value
+ */
+wchar_t**
+extpy_get_string_array_attr (PyObject *obj, const wchar_t *attr_name,
+                             Py_ssize_t *len)
+{
+  PyObject *field = extpy_get_attr_string (obj, attr_name);
+  wchar_t **result;
+
+  if (!field)
+    {
+      return NULL;
+    }
+
+  result = extpy_to_string_array (field, len, NULL);
+  Py_DECREF (field);
+
+  return result;
+}
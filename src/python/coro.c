@@ -0,0 +1,584 @@
+/**
+ * Coroutine scripts which are resumed by host
+ *
+ * Script defines generator function which is started as coroutine by
+ * py_sched_spawn(). Values which are yielded by coroutine are requests
+ * to the host:
+ *
+ *   yield None    - let other coroutines run and continue
+ *   yield seconds - sleep for given number of seconds (at most a year,
+ *                   coroutine fails if number is not finite)
+ *   yield request - anything else is passed to scheduler's callback and
+ *                   coroutine waits until host calls py_sched_resume()
+ *                   with value which becomes result of the yield
+ *
+ * All coroutines of scheduler run on the thread which calls
+ * py_sched_run(), so thousands of suspended scripts don't need own
+ * threads. Sleeping coroutines are kept in binary heap by wake time.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#include <math.h>
+
+/* Longest sleep, longer ones are clamped to it (one year) */
+#define MAX_SLEEP_SECONDS (365.0 * 24 * 3600)
+
+/* States of coroutine */
+enum {
+  CORO_READY,
+  CORO_SLEEPING,
+  CORO_WAITING,
+  CORO_RUNNING
+};
+
+struct py_coro {
+  PyObject *gen;              /* Generator of coroutine */
+  PyObject *dict;             /* Global dictionary of script */
+  void *user_data;
+
+  int state;
+  PyObject *value;            /* Value to send on resume (NULL for None) */
+  unsigned long long wake_ns; /* Wake time of sleeping coroutine */
+
+  struct py_coro *next_ready; /* Next coroutine in ready queue */
+  struct py_coro *prev;       /* Previous coroutine of scheduler */
+  struct py_coro *next;       /* Next coroutine of scheduler */
+};
+
+struct py_sched {
+  py_coro_proc_t proc;
+  void *data;
+
+  py_coro_t *coros;           /* All coroutines */
+  long count;
+
+  py_coro_t *ready_head;      /* Queue of ready coroutines */
+  py_coro_t *ready_tail;
+
+  py_coro_t **heap;           /* Sleeping coroutines ordered by wake time */
+  long heap_count;
+  long heap_size;
+
+  PyObject *send_name;        /* Interned name of generator's send() */
+};
+
+/**
+ * Put coroutine to the end of ready queue
+ *
+ * @param sched - scheduler
+ * @param coro - coroutine to put
+ */
+static void
+ready_push (py_sched_t *sched, py_coro_t *coro)
+{
+  coro->state = CORO_READY;
+  coro->next_ready = NULL;
+
+  if (sched->ready_tail)
+    {
+      sched->ready_tail->next_ready = coro;
+    }
+  else
+    {
+      sched->ready_head = coro;
+    }
+
+  sched->ready_tail = coro;
+}
+
+/**
+ * Take coroutine from the beginning of ready queue
+ *
+ * @param sched - scheduler
+ * @return first ready coroutine
+ */
+static py_coro_t*
+ready_pop (py_sched_t *sched)
+{
+  py_coro_t *coro = sched->ready_head;
+
+  sched->ready_head = coro->next_ready;
+
+  if (!sched->ready_head)
+    {
+      sched->ready_tail = NULL;
+    }
+
+  return coro;
+}
+
+/**
+ * Put sleeping coroutine to heap
+ *
+ * @param sched - scheduler
+ * @param coro - coroutine to put
+ */
+static void
+heap_push (py_sched_t *sched, py_coro_t *coro)
+{
+  long index = sched->heap_count++;
+
+  if (sched->heap_count > sched->heap_size)
+    {
+      sched->heap_size = MAX (sched->heap_size * 2, 16);
+      sched->heap = realloc (sched->heap,
+                             sizeof (py_coro_t*) * sched->heap_size);
+    }
+
+  /* Sift up */
+  while (index > 0)
+    {
+      long parent = (index - 1) / 2;
+
+      if (sched->heap[parent]->wake_ns <= coro->wake_ns)
+        {
+          break;
+        }
+
+      sched->heap[index] = sched->heap[parent];
+      index = parent;
+    }
+
+  sched->heap[index] = coro;
+}
+
+/**
+ * Take coroutine with the earliest wake time from heap
+ *
+ * @param sched - scheduler
+ * @return coroutine which should be woken first
+ */
+static py_coro_t*
+heap_pop (py_sched_t *sched)
+{
+  py_coro_t *result = sched->heap[0], *last;
+  long index = 0, count = --sched->heap_count;
+
+  if (!count)
+    {
+      return result;
+    }
+
+  last = sched->heap[count];
+
+  /* Sift down */
+  for (;;)
+    {
+      long child = index * 2 + 1;
+
+      if (child >= count)
+        {
+          break;
+        }
+
+      if (child + 1 < count &&
+          sched->heap[child + 1]->wake_ns < sched->heap[child]->wake_ns)
+        {
+          ++child;
+        }
+
+      if (last->wake_ns <= sched->heap[child]->wake_ns)
+        {
+          break;
+        }
+
+      sched->heap[index] = sched->heap[child];
+      index = child;
+    }
+
+  sched->heap[index] = last;
+
+  return result;
+}
+
+/**
+ * Free coroutine
+ *
+ * @param sched - scheduler of coroutine
+ * @param coro - coroutine to free
+ */
+static void
+free_coro (py_sched_t *sched, py_coro_t *coro)
+{
+  if (coro->prev)
+    {
+      coro->prev->next = coro->next;
+    }
+  else
+    {
+      sched->coros = coro->next;
+    }
+
+  if (coro->next)
+    {
+      coro->next->prev = coro->prev;
+    }
+
+  --sched->count;
+
+  /* Generator is closed by its deallocation */
+  Py_XDECREF (coro->gen);
+  Py_XDECREF (coro->value);
+
+  if (coro->dict)
+    {
+      py_global_dictionary_free (coro->dict);
+    }
+
+  free (coro);
+}
+
+/**
+ * Handle value which has been yielded by coroutine
+ *
+ * Coroutine which yields NaN, infinity or number which is not
+ * convertible to float fails.
+ *
+ * @param sched - scheduler
+ * @param coro - coroutine which yielded value
+ * @param request - yielded value
+ */
+static void
+handle_request (py_sched_t *sched, py_coro_t *coro, PyObject *request)
+{
+  if (request == Py_None)
+    {
+      ready_push (sched, coro);
+    }
+  else if (PyInt_Check (request) || PyLong_Check (request) ||
+           PyFloat_Check (request))
+    {
+      double seconds = PyFloat_AsDouble (request);
+
+      if ((seconds == -1.0 && PyErr_Occurred ()) || !isfinite (seconds))
+        {
+          if (!PyErr_Occurred ())
+            {
+              PyErr_SetString (PyExc_ValueError, "coroutine yielded "
+                               "non-finite time of sleep");
+            }
+
+          PyErr_Print ();
+          sched->proc (coro, PY_CORO_FAILED, NULL, sched->data);
+          free_coro (sched, coro);
+          return;
+        }
+
+      seconds = MIN (MAX (seconds, 0), MAX_SLEEP_SECONDS);
+
+      coro->state = CORO_SLEEPING;
+      coro->wake_ns = py_stats_now () +
+        (unsigned long long)(seconds * 1e9);
+
+      heap_push (sched, coro);
+    }
+  else
+    {
+      coro->state = CORO_WAITING;
+      sched->proc (coro, PY_CORO_REQUEST, request, sched->data);
+    }
+}
+
+/**
+ * Run coroutine until its next yield
+ *
+ * @param sched - scheduler
+ * @param coro - coroutine to run
+ */
+static void
+step (py_sched_t *sched, py_coro_t *coro)
+{
+  PyObject *value = coro->value, *request;
+
+  coro->value = NULL;
+  coro->state = CORO_RUNNING;
+
+  if (!value)
+    {
+      request = coro->gen->ob_type->tp_iternext (coro->gen);
+    }
+  else
+    {
+      request = PyObject_CallMethodObjArgs (coro->gen, sched->send_name,
+                                            value, NULL);
+      Py_DECREF (value);
+    }
+
+  if (request)
+    {
+      handle_request (sched, coro, request);
+      Py_DECREF (request);
+      return;
+    }
+
+  if (!PyErr_Occurred () || PyErr_ExceptionMatches (PyExc_StopIteration))
+    {
+      PyErr_Clear ();
+      sched->proc (coro, PY_CORO_DONE, Py_None, sched->data);
+    }
+  else
+    {
+      PyErr_Print ();
+      sched->proc (coro, PY_CORO_FAILED, NULL, sched->data);
+    }
+
+  free_coro (sched, coro);
+}
+
+/********
+ * User's stuff
+ */
+
+/**
+ * Create scheduler of coroutines
+ *
+ * @param proc - callback for events of coroutines
+ * @param data - user's data for callback
+ * @return new scheduler
+ */
+py_sched_t*
+py_sched_new (py_coro_proc_t proc, void *data)
+{
+  py_sched_t *sched;
+
+  MALLOC_ZERO (sched, sizeof (py_sched_t));
+
+  sched->proc = proc;
+  sched->data = data;
+  sched->send_name = PyString_InternFromString ("send");
+
+  return sched;
+}
+
+/**
+ * Free scheduler and all its coroutines
+ *
+ * Generators of unfinished coroutines are closed, so their `finally'
+ * blocks are executed.
+ *
+ * @param sched - scheduler to free
+ */
+void
+py_sched_free (py_sched_t *sched)
+{
+  if (!sched)
+    {
+      return;
+    }
+
+  while (sched->coros)
+    {
+      free_coro (sched, sched->coros);
+    }
+
+  Py_XDECREF (sched->send_name);
+  SAFE_FREE (sched->heap);
+  free (sched);
+}
+
+/**
+ * Run script and start coroutine from its generator function
+ *
+ * Script runs in its own global dictionary, then generator function
+ * with name `entry' is called without arguments. Coroutine is ready
+ * to run by next py_sched_run().
+ *
+ * @param sched - scheduler
+ * @param script - script which defines generator function
+ * @param entry - name of generator function
+ * @param user_data - user's data of coroutine
+ * @return new coroutine or NULL if script or function failed
+ */
+py_coro_t*
+py_sched_spawn (py_sched_t *sched, py_script_t *script, const char *entry,
+                void *user_data)
+{
+  py_coro_t *coro;
+  PyObject *dict, *result, *func, *gen = NULL;
+
+  dict = py_global_dictionary_new ();
+
+  if (!dict)
+    {
+      PyErr_Print ();
+      return NULL;
+    }
+
+  result = py_run_script_at_dict (script, dict);
+
+  if (!result)
+    {
+      py_global_dictionary_free (dict);
+      return NULL;
+    }
+
+  Py_DECREF (result);
+
+  func = PyDict_GetItemString (dict, (char*)entry);
+
+  if (!func)
+    {
+      PyErr_Format (PyExc_NameError, "coroutine script doesn't define %s",
+                    entry);
+    }
+  else
+    {
+      gen = PyObject_CallObject (func, NULL);
+
+      if (gen && !PyGen_Check (gen))
+        {
+          PyErr_Format (PyExc_TypeError, "%s is not a generator function",
+                        entry);
+          Py_CLEAR (gen);
+        }
+    }
+
+  if (!gen)
+    {
+      PyErr_Print ();
+      py_global_dictionary_free (dict);
+      return NULL;
+    }
+
+  MALLOC_ZERO (coro, sizeof (py_coro_t));
+  coro->gen = gen;
+  coro->dict = dict;
+  coro->user_data = user_data;
+
+  coro->next = sched->coros;
+
+  if (sched->coros)
+    {
+      sched->coros->prev = coro;
+    }
+
+  sched->coros = coro;
+  ++sched->count;
+
+  ready_push (sched, coro);
+
+  return coro;
+}
+
+/**
+ * Resume coroutine which waits for data
+ *
+ * Coroutine is run by next py_sched_run() and `value' becomes result of
+ * its yield expression.
+ *
+ * @param sched - scheduler
+ * @param coro - coroutine which has sent PY_CORO_REQUEST
+ * @param value - value for coroutine (NULL for None)
+ * @return zero on success, non-zero if coroutine doesn't wait for data
+ */
+int
+py_sched_resume (py_sched_t *sched, py_coro_t *coro, PyObject *value)
+{
+  if (coro->state != CORO_WAITING)
+    {
+      return -1;
+    }
+
+  Py_XINCREF (value);
+  coro->value = value;
+
+  ready_push (sched, coro);
+
+  return 0;
+}
+
+/**
+ * Run ready coroutines and coroutines whose sleep has expired
+ *
+ * Coroutines which become ready while this function works are run by
+ * its next call, so coroutines which yield None don't starve the host.
+ *
+ * @param sched - scheduler
+ * @return count of alive coroutines
+ */
+long
+py_sched_run (py_sched_t *sched)
+{
+  unsigned long long now = py_stats_now ();
+  py_coro_t *last;
+
+  while (sched->heap_count && sched->heap[0]->wake_ns <= now)
+    {
+      ready_push (sched, heap_pop (sched));
+    }
+
+  last = sched->ready_tail;
+
+  while (last)
+    {
+      py_coro_t *coro = ready_pop (sched);
+      int is_last = coro == last;
+
+      /* Coroutine could be freed by step */
+      step (sched, coro);
+
+      if (is_last)
+        {
+          break;
+        }
+    }
+
+  return sched->count;
+}
+
+/**
+ * Get time until next coroutine should be run
+ *
+ * @param sched - scheduler
+ * @return time in nanoseconds, zero if there are ready coroutines and
+ *   -1 if all coroutines wait for data
+ */
+long long
+py_sched_timeout (py_sched_t *sched)
+{
+  unsigned long long now;
+
+  if (sched->ready_head)
+    {
+      return 0;
+    }
+
+  if (!sched->heap_count)
+    {
+      return -1;
+    }
+
+  now = py_stats_now ();
+
+  return sched->heap[0]->wake_ns > now ? sched->heap[0]->wake_ns - now : 0;
+}
+
+/**
+ * Get count of alive coroutines
+ *
+ * @param sched - scheduler
+ * @return count of coroutines
+ */
+long
+py_sched_count (py_sched_t *sched)
+{
+  return sched->count;
+}
+
+/**
+ * Get user's data of coroutine
+ *
+ * @param coro - coroutine
+ * @return user's data which was passed to py_sched_spawn()
+ */
+void*
+py_coro_user_data (py_coro_t *coro)
+{
+  return coro->user_data;
+}
@@ -0,0 +1,64 @@
+/**
+ * Coroutine scripts which are resumed by host
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Events of coroutines which are passed to scheduler's callback */
+enum {
+  PY_CORO_REQUEST, /* Coroutine waits for py_sched_resume() */
+  PY_CORO_DONE,    /* Coroutine has finished */
+  PY_CORO_FAILED   /* Coroutine has raised an exception */
+};
+
+typedef struct py_coro py_coro_t;
+typedef struct py_sched py_sched_t;
+
+/*
+ * Callback of scheduler
+ *
+ * For PY_CORO_REQUEST arg is the yielded request. Coroutine is freed after
+ * PY_CORO_DONE and PY_CORO_FAILED events.
+ */
+typedef void (*py_coro_proc_t) (py_coro_t *coro, int event, PyObject *arg,
+                                void *data);
+
+/* Create scheduler of coroutines */
+py_sched_t*
+py_sched_new (py_coro_proc_t proc, void *data);
+
+/* Free scheduler and all its coroutines */
+void
+py_sched_free (py_sched_t *sched);
+
+/* Run script and start coroutine from its generator function */
+py_coro_t*
+py_sched_spawn (py_sched_t *sched, py_script_t *script, const char *entry,
+                void *user_data);
+
+/* Resume coroutine which waits for data */
+int
+py_sched_resume (py_sched_t *sched, py_coro_t *coro, PyObject *value);
+
+/* Run ready coroutines and coroutines whose sleep has expired */
+long
+py_sched_run (py_sched_t *sched);
+
+/* Get time until next coroutine should be run */
+long long
+py_sched_timeout (py_sched_t *sched);
+
+/* Get count of alive coroutines */
+long
+py_sched_count (py_sched_t *sched);
+
+/* Get user's data of coroutine */
+void*
+py_coro_user_data (py_coro_t *coro);
@@ -0,0 +1,542 @@
+/**
+ * Queue of events which are posted by C threads to scripts
+ *
+ * Producer threads post events without taking GIL or any lock. Queue is
+ * a ring of slots which are allocated when queue is created: producer
+ * claims slot with a single compare-and-swap, copies event into it and
+ * publishes it by slot's sequence number. Posting never allocates, and
+ * when all slots are taken event is rejected and counted, so producers
+ * see backpressure instead of growing memory. Thread which owns
+ * interpreter drains queue in batches and calls handler of each event's
+ * type.
+ *
+ * Consumer is woken through a pipe only when queue becomes non-empty
+ * or when batch is full, so producers make no system calls while
+ * consumer is busy. py_equeue_run() dispatches batch when it's full or
+ * when the oldest event has waited for max latency.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+
+/* Slot of ring, data of event is stored right after it */
+typedef struct {
+  /* Equals to position of slot when it's free for producer and to */
+  /* position plus one when it holds published event */
+  volatile unsigned long seq;
+
+  int type;
+  long arg;
+  unsigned long long post_ns; /* Time of posting */
+
+  size_t size;                /* Size of data */
+  int has_data;               /* Zero if event has no data */
+} slot_t;
+
+struct py_equeue {
+  char *slots;                /* Ring of slots */
+  size_t slot_size;           /* Size of slot with its data */
+  unsigned long mask;         /* Count of slots minus one */
+  size_t max_data;            /* Max size of data of event */
+
+  volatile unsigned long enqueue_pos; /* Next slot for producers */
+  unsigned long dequeue_pos;          /* Next slot for consumer */
+
+  long batch_size;
+  unsigned long long max_latency_ns;
+
+  py_call_t *handlers[PY_EQUEUE_MAX_TYPES];
+
+  int wake[2];                /* Pipe which wakes consumer */
+
+  /* Metrics */
+  volatile unsigned long posted;
+  volatile unsigned long dispatched;
+  volatile unsigned long overflows;
+  volatile long max_depth;
+  unsigned long failed;
+  unsigned long dropped;
+  unsigned long batches;
+  unsigned long long max_latency;
+  unsigned long long total_latency;
+};
+
+/**
+ * Get slot by position
+ *
+ * @param queue - queue of slot
+ * @param pos - position of slot
+ * @return slot
+ */
+static inline slot_t*
+slot_at (py_equeue_t *queue, unsigned long pos)
+{
+  return (slot_t*)(queue->slots + (pos & queue->mask) * queue->slot_size);
+}
+
+/**
+ * Get the oldest published event without taking it
+ *
+ * Could return NULL while queue isn't empty, when producer has claimed
+ * slot but hasn't published its event yet.
+ *
+ * @param queue - queue to look into
+ * @return slot of the oldest event or NULL
+ */
+static slot_t*
+peek (py_equeue_t *queue)
+{
+  slot_t *slot = slot_at (queue, queue->dequeue_pos);
+
+  if (slot->seq != queue->dequeue_pos + 1)
+    {
+      return NULL;
+    }
+
+  /* Fields of event are read after its sequence number */
+  __sync_synchronize ();
+
+  return slot;
+}
+
+/**
+ * Return slot of taken event to producers
+ *
+ * @param queue - queue of slot
+ * @param slot - slot which is returned by peek()
+ */
+static void
+release (py_equeue_t *queue, slot_t *slot)
+{
+  /* Event should be read before slot is reused */
+  __sync_synchronize ();
+  slot->seq = queue->dequeue_pos + queue->mask + 1;
+  ++queue->dequeue_pos;
+}
+
+/**
+ * Get count of events in queue
+ *
+ * @param queue - queue
+ * @return count of posted but not dispatched events
+ */
+static inline long
+depth (py_equeue_t *queue)
+{
+  return (long)(queue->posted - queue->dispatched);
+}
+
+/**
+ * Call handler of event and free its slot
+ *
+ * Slot is returned to producers before handler is called.
+ *
+ * @param queue - queue of event
+ * @param slot - slot of event to dispatch
+ */
+static void
+dispatch_event (py_equeue_t *queue, slot_t *slot)
+{
+  py_call_t *handler = queue->handlers[slot->type];
+  long arg = slot->arg;
+  PyObject *data;
+
+  if (!handler)
+    {
+      release (queue, slot);
+      ++queue->dropped;
+      return;
+    }
+
+  if (slot->has_data)
+    {
+      data = PyString_FromStringAndSize ((char*)(slot + 1), slot->size);
+    }
+  else
+    {
+      data = Py_None;
+      Py_INCREF (data);
+    }
+
+  release (queue, slot);
+
+  if (!data || py_call_set_long (handler, 0, arg) ||
+      py_call_set_object (handler, 1, data) || py_call_invoke_void (handler))
+    {
+      PyErr_Print ();
+      ++queue->failed;
+    }
+
+  Py_XDECREF (data);
+}
+
+/********
+ * User's stuff
+ */
+
+/**
+ * Create queue of events
+ *
+ * @param capacity - count of slots, rounded up to power of two (at
+ *   least two)
+ * @param max_data - max size of data of event
+ * @param batch_size - max count of events which are dispatched at once
+ * @param max_latency_ns - max time which event waits for its batch in
+ *   py_equeue_run()
+ * @return new queue or NULL if memory or pipe couldn't be allocated
+ */
+py_equeue_t*
+py_equeue_new (long capacity, size_t max_data, long batch_size,
+               unsigned long long max_latency_ns)
+{
+  py_equeue_t *queue;
+  unsigned long i, count = 2;
+
+  /* Sequence numbers of single slot couldn't tell free slot from busy */
+  while (count < (unsigned long)MAX (capacity, 2))
+    {
+      count <<= 1;
+    }
+
+  MALLOC_ZERO (queue, sizeof (py_equeue_t));
+
+  /* Slots are aligned, so their sequence numbers are */
+  queue->slot_size = (sizeof (slot_t) + max_data + sizeof (long) - 1) &
+    ~(sizeof (long) - 1);
+  queue->slots = malloc (queue->slot_size * count);
+
+  if (!queue->slots || pipe (queue->wake))
+    {
+      free (queue->slots);
+      free (queue);
+      return NULL;
+    }
+
+  queue->mask = count - 1;
+
+  for (i = 0; i < count; ++i)
+    {
+      slot_at (queue, i)->seq = i;
+    }
+
+  fcntl (queue->wake[0], F_SETFL, O_NONBLOCK);
+  fcntl (queue->wake[1], F_SETFL, O_NONBLOCK);
+
+  queue->max_data = max_data;
+  queue->batch_size = MAX (batch_size, 1);
+  queue->max_latency_ns = max_latency_ns;
+
+  return queue;
+}
+
+/**
+ * Free queue and drop its pending events
+ *
+ * Producers should be stopped before.
+ *
+ * @param queue - queue to free
+ */
+void
+py_equeue_free (py_equeue_t *queue)
+{
+  int i;
+
+  if (!queue)
+    {
+      return;
+    }
+
+  for (i = 0; i < PY_EQUEUE_MAX_TYPES; ++i)
+    {
+      py_call_free (queue->handlers[i]);
+    }
+
+  close (queue->wake[0]);
+  close (queue->wake[1]);
+
+  free (queue->slots);
+  free (queue);
+}
+
+/**
+ * Set handler of events of given type
+ *
+ * Handler is called with event's integer argument and its data (string
+ * or None).
+ *
+ * @param queue - queue of events
+ * @param type - type of events
+ * @param handler - callable object (NULL to drop events of this type)
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_equeue_set_handler (py_equeue_t *queue, int type, PyObject *handler)
+{
+  py_call_t *call = NULL;
+
+  if (type < 0 || type >= PY_EQUEUE_MAX_TYPES)
+    {
+      PyErr_SetString (PyExc_ValueError, "type of event is out of range");
+      return -1;
+    }
+
+  if (handler)
+    {
+      call = py_call_new (handler, 2);
+
+      if (!call)
+        {
+          return -1;
+        }
+    }
+
+  py_call_free (queue->handlers[type]);
+  queue->handlers[type] = call;
+
+  return 0;
+}
+
+/**
+ * Post event to queue from any thread
+ *
+ * Doesn't need GIL, never blocks and never allocates memory.
+ *
+ * @param queue - queue of events
+ * @param type - type of event
+ * @param arg - integer argument of event
+ * @param data - data of event which is copied (could be NULL)
+ * @param size - size of data
+ * @return PY_EQUEUE_OK on success, PY_EQUEUE_FULL if all slots are
+ *   taken and PY_EQUEUE_INVALID if type or size of data is wrong
+ */
+int
+py_equeue_post (py_equeue_t *queue, int type, long arg,
+                const void *data, size_t size)
+{
+  unsigned long pos = queue->enqueue_pos, prev;
+  slot_t *slot;
+  long count, max;
+
+  if (type < 0 || type >= PY_EQUEUE_MAX_TYPES ||
+      (data && size > queue->max_data))
+    {
+      return PY_EQUEUE_INVALID;
+    }
+
+  /* Claim slot at enqueue position */
+  for (;;)
+    {
+      long diff;
+
+      slot = slot_at (queue, pos);
+      diff = (long)(slot->seq - pos);
+
+      if (!diff)
+        {
+          prev = __sync_val_compare_and_swap (&queue->enqueue_pos, pos,
+                                              pos + 1);
+
+          if (prev == pos)
+            {
+              break;
+            }
+
+          pos = prev;
+        }
+      else if (diff < 0)
+        {
+          /* Consumer hasn't freed this slot since previous round */
+          __sync_add_and_fetch (&queue->overflows, 1);
+          return PY_EQUEUE_FULL;
+        }
+      else
+        {
+          /* Slot has been claimed by another producer */
+          pos = queue->enqueue_pos;
+        }
+    }
+
+  slot->type = type;
+  slot->arg = arg;
+  slot->post_ns = py_stats_now ();
+  slot->size = data ? size : 0;
+  slot->has_data = data != NULL;
+
+  if (data)
+    {
+      memcpy (slot + 1, data, size);
+    }
+
+  /* Fields of event should be visible before it's published */
+  __sync_synchronize ();
+  slot->seq = pos + 1;
+
+  count = (long)(__sync_add_and_fetch (&queue->posted, 1) -
+                 queue->dispatched);
+
+  for (max = queue->max_depth; count > max;
+       max = queue->max_depth)
+    {
+      if (__sync_bool_compare_and_swap (&queue->max_depth, max, count))
+        {
+          break;
+        }
+    }
+
+  /* Consumer needs to know about first event and about full batch */
+  if (count == 1 || count == queue->batch_size)
+    {
+      char c = 0;
+
+      if (write (queue->wake[1], &c, 1) < 0)
+        {
+          /* Pipe is full, so consumer will be woken anyway */
+        }
+    }
+
+  return PY_EQUEUE_OK;
+}
+
+/**
+ * Dispatch batch of pending events to handlers
+ *
+ * Should be called with GIL held by thread which owns queue.
+ *
+ * @param queue - queue of events
+ * @return count of dispatched events
+ */
+long
+py_equeue_dispatch (py_equeue_t *queue)
+{
+  slot_t *slot;
+  long count = 0;
+
+  while (count < queue->batch_size && (slot = peek (queue)))
+    {
+      /* Handlers of previous events of batch delay this one too */
+      unsigned long long now = py_stats_now ();
+      unsigned long long latency = now > slot->post_ns ?
+        now - slot->post_ns : 0;
+
+      queue->total_latency += latency;
+      queue->max_latency = MAX (queue->max_latency, latency);
+
+      dispatch_event (queue, slot);
+
+      ++count;
+    }
+
+  if (count)
+    {
+      __sync_add_and_fetch (&queue->dispatched, count);
+      ++queue->batches;
+    }
+
+  return count;
+}
+
+/**
+ * Wait until batch is ready and dispatch it
+ *
+ * Batch is ready when it's full or when the oldest event has waited for
+ * max latency of queue. GIL is released while waiting.
+ *
+ * @param queue - queue of events
+ * @param timeout_ns - max time to wait (negative to wait forever)
+ * @return count of dispatched events
+ */
+long
+py_equeue_run (py_equeue_t *queue, long long timeout_ns)
+{
+  unsigned long long start = py_stats_now ();
+
+  for (;;)
+    {
+      unsigned long long now = py_stats_now ();
+      long long wait_ns = -1;
+      slot_t *oldest = peek (queue);
+      char buf[256];
+      int res;
+
+      if (oldest)
+        {
+          unsigned long long age = now > oldest->post_ns ?
+            now - oldest->post_ns : 0;
+
+          if (depth (queue) >= queue->batch_size ||
+              age >= queue->max_latency_ns)
+            {
+              break;
+            }
+
+          wait_ns = queue->max_latency_ns - age;
+        }
+      else if (depth (queue) > 0)
+        {
+          /* Producer hasn't published its event yet and its wake up */
+          /* could be already consumed, so don't wait for pipe too long */
+          wait_ns = 1000000;
+        }
+
+      if (timeout_ns >= 0)
+        {
+          long long left = timeout_ns - (long long)(now - start);
+
+          if (left <= 0)
+            {
+              break;
+            }
+
+          wait_ns = wait_ns < 0 ? left : MIN (wait_ns, left);
+        }
+
+      Py_BEGIN_ALLOW_THREADS
+      {
+        struct pollfd pfd = {queue->wake[0], POLLIN, 0};
+
+        /* Round up, so the wait doesn't end right before deadline */
+        res = poll (&pfd, 1, wait_ns < 0 ? -1 :
+                    (int)MIN ((wait_ns + 999999) / 1000000, 0x7fffffff));
+
+        if (res > 0)
+          {
+            while (read (queue->wake[0], buf, sizeof (buf)) > 0)
+              {
+              }
+          }
+      }
+      Py_END_ALLOW_THREADS
+    }
+
+  return py_equeue_dispatch (queue);
+}
+
+/**
+ * Get metrics of queue
+ *
+ * @param queue - queue of events
+ * @param stats - metrics to fill
+ */
+void
+py_equeue_stats (py_equeue_t *queue, py_equeue_stats_t *stats)
+{
+  stats->posted = queue->posted;
+  stats->overflows = queue->overflows;
+  stats->dispatched = queue->dispatched;
+  stats->failed = queue->failed;
+  stats->dropped = queue->dropped;
+  stats->batches = queue->batches;
+  stats->depth = depth (queue);
+  stats->max_depth = queue->max_depth;
+  stats->capacity = queue->mask + 1;
+  stats->max_latency_ns = queue->max_latency;
+  stats->total_latency_ns = queue->total_latency;
+}
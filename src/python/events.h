@@ -0,0 +1,71 @@
+/**
+ * Queue of events which are posted by C threads to scripts
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Max count of types of events */
+#define PY_EQUEUE_MAX_TYPES 64
+
+typedef struct py_equeue py_equeue_t;
+
+/* Results of py_equeue_post() */
+enum {
+  PY_EQUEUE_OK,      /* Event is queued */
+  PY_EQUEUE_FULL,    /* All slots are taken, event is rejected */
+  PY_EQUEUE_INVALID  /* Type is out of range or data doesn't fit slot */
+};
+
+/* Metrics of queue */
+typedef struct {
+  unsigned long posted;           /* Count of posted events */
+  unsigned long overflows;        /* Count of events rejected by full queue */
+  unsigned long dispatched;       /* Count of dispatched events */
+  unsigned long failed;           /* Count of handlers which raised error */
+  unsigned long dropped;          /* Count of events without handler */
+  unsigned long batches;          /* Count of dispatched batches */
+
+  long depth;                     /* Count of events in queue */
+  long max_depth;                 /* Max count of events in queue */
+  long capacity;                  /* Count of slots of queue */
+
+  unsigned long long max_latency_ns;   /* Max time from post to dispatch */
+  unsigned long long total_latency_ns; /* Sum of times from post to dispatch */
+} py_equeue_stats_t;
+
+/* Create queue of events */
+py_equeue_t*
+py_equeue_new (long capacity, size_t max_data, long batch_size,
+               unsigned long long max_latency_ns);
+
+/* Free queue and drop its pending events */
+void
+py_equeue_free (py_equeue_t *queue);
+
+/* Set handler of events of given type */
+int
+py_equeue_set_handler (py_equeue_t *queue, int type, PyObject *handler);
+
+/* Post event to queue from any thread */
+int
+py_equeue_post (py_equeue_t *queue, int type, long arg,
+                const void *data, size_t size);
+
+/* Dispatch batch of pending events to handlers */
+long
+py_equeue_dispatch (py_equeue_t *queue);
+
+/* Wait until batch is ready and dispatch it */
+long
+py_equeue_run (py_equeue_t *queue, long long timeout_ns);
+
+/* Get metrics of queue */
+void
+py_equeue_stats (py_equeue_t *queue, py_equeue_stats_t *stats);
@@ -10,6 +10,9 @@
 #include "iface.h"
 #include <wchar.h>
 
+/* Pool of running results' descriptors */
+static py_pool_t result_pool = PY_POOL_INIT (extpy_run_result_t);
+
 #define _GET_FIELD_VALUE(err_val, check_cond, cast) \
   PyObject *field; \
    \
@@ -27,6 +30,7 @@
  \
   if (!(check_cond)) \
     { \
+      Py_DECREF (field); \
       return err_val; \
     } \
   \
@@ -51,15 +55,22 @@ fill_result_outputs (extpy_run_result_t *result)
  * @return error object to return
  */
 PyObject*
-extpy_return_pyobj_error (PyObject *type, wchar_t *error_msg)
+extpy_return_pyobj_error (PyObject *type, const wchar_t *error_msg)
 {
   char *mbmsg;
+  py_arena_mark_t mark = py_arena_mark ();
+
+  PY_SCRATCH_WCS2MBS (mbmsg, error_msg);
 
-  WCS2MBS (mbmsg, error_msg);
+  if (!mbmsg)
+    {
+      py_arena_release (mark);
+      return PyErr_NoMemory ();
+    }
 
   PyErr_SetString (type, mbmsg);
 
-  free (mbmsg);
+  py_arena_release (mark);
 
   return NULL;
 }
@@ -72,18 +83,29 @@ extpy_return_pyobj_error (PyObject *type, wchar_t *error_msg)
  * @param dict - dictionary to operate on
  * @param key - dictionary's key
  * @param value - value to set
+ * @return zero on success, -1 with Python error set otherwise
  */
 int
 extpy_dict_set_item_str (PyObject *dict, wchar_t *key, PyObject *value)
 {
   char *mbkey;
+  int ret;
+  py_arena_mark_t mark = py_arena_mark ();
 
-  WCS2MBS (mbkey, key);
+  PY_SCRATCH_WCS2MBS (mbkey, key);
 
   /* Add value to dictionary */
-  int ret = PyDict_SetItemString (dict, mbkey, value);
+  if (mbkey)
+    {
+      ret = PyDict_SetItemString (dict, mbkey, value);
+    }
+  else
+    {
+      PyErr_NoMemory ();
+      ret = -1;
+    }
 
-  free (mbkey);
+  py_arena_release (mark);
 
   /* Delete original */
   Py_DECREF (value);
@@ -103,7 +125,7 @@ extpy_run_file (wchar_t *filename)
 {
   extpy_run_result_t *result;
 
-  MALLOC_ZERO (result, sizeof (extpy_run_result_t));
+  result = py_pool_alloc (&result_pool);
 
   py_tracer_truncate_buffer (PY_STDOUT);
   py_tracer_truncate_buffer (PY_STDERR);
@@ -125,7 +147,7 @@ extpy_run_script (py_script_t *script)
 {
   extpy_run_result_t *result;
 
-  MALLOC_ZERO (result, sizeof (extpy_run_result_t));
+  result = py_pool_alloc (&result_pool);
 
   py_tracer_truncate_buffer (PY_STDOUT);
   py_tracer_truncate_buffer (PY_STDERR);
@@ -135,6 +157,28 @@ extpy_run_script (py_script_t *script)
   return result;
 }
 
+/**
+ * Run python script which is frozen into executable
+ *
+ * @param name - name of frozen module
+ * @return run result
+ * @sideeffect allocate memory for output value. USe extpy_run_free() to free
+ */
+extpy_run_result_t*
+extpy_run_frozen (const wchar_t *name)
+{
+  extpy_run_result_t *result;
+
+  result = py_pool_alloc (&result_pool);
+
+  py_tracer_truncate_buffer (PY_STDOUT);
+  py_tracer_truncate_buffer (PY_STDERR);
+  result->result = py_run_frozen (name);
+  fill_result_outputs (result);
+
+  return result;
+}
+
 /**
  * Free running results
  *
@@ -155,7 +199,7 @@ extpy_run_free (extpy_run_result_t* result)
 
   SAFE_FREE (result->stdout);
   SAFE_FREE (result->stderr);
-  SAFE_FREE (result);
+  py_pool_free (&result_pool, result);
 }
 
 /****
@@ -174,22 +218,25 @@ extpy_get_attr_string (PyObject *obj, const wchar_t *attr_name)
 {
   char *mbname;
   PyObject *result;
+  py_arena_mark_t mark;
 
   if (!obj || !attr_name)
     {
       return NULL;
     }
 
-  WCS2MBS (mbname, attr_name);
+  mark = py_arena_mark ();
+  PY_SCRATCH_WCS2MBS (mbname, attr_name);
 
   if (!mbname)
     {
+      py_arena_release (mark);
       return NULL;
     }
 
   result = PyObject_GetAttrString (obj, mbname);
 
-  free (mbname);
+  py_arena_release (mark);
 
   return result;
 }
@@ -206,22 +253,25 @@ extpy_set_attr_string (PyObject *obj, const wchar_t *attr_name, PyObject *val)
 {
   char *mbname;
   int result;
+  py_arena_mark_t mark;
 
   if (!obj || !attr_name)
     {
       return -1;
     }
 
-  WCS2MBS (mbname, attr_name);
+  mark = py_arena_mark ();
+  PY_SCRATCH_WCS2MBS (mbname, attr_name);
 
   if (!mbname)
     {
+      py_arena_release (mark);
       return -1;
     }
 
   result = PyObject_SetAttrString (obj, mbname, val);
 
-  free (mbname);
+  py_arena_release (mark);
 
   return result;
 }
@@ -238,22 +288,25 @@ extpy_has_attr_string (PyObject *obj, const wchar_t *attr_name)
 {
   char *mbname;
   int result;
+  py_arena_mark_t mark;
 
   if (!obj || !attr_name)
     {
       return 0;
     }
 
-  WCS2MBS (mbname, attr_name);
+  mark = py_arena_mark ();
+  PY_SCRATCH_WCS2MBS (mbname, attr_name);
 
   if (!mbname)
     {
+      py_arena_release (mark);
       return 0;
     }
 
   result = PyObject_HasAttrString (obj, mbname);
 
-  free (mbname);
+  py_arena_release (mark);
 
   return result;
 }
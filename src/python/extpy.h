@@ -38,7 +38,7 @@ typedef struct {
 
 /* Create error object for return */
 PyObject*
-extpy_return_pyobj_error (PyObject *type, wchar_t *error_msg);
+extpy_return_pyobj_error (PyObject *type, const wchar_t *error_msg);
 
 /* Set dictionary key's value without causing memory leaks */
 int
@@ -52,6 +52,10 @@ extpy_run_file (wchar_t *filename);
 extpy_run_result_t*
 extpy_run_script (py_script_t *script);
 
+/* Run frozen python script */
+extpy_run_result_t*
+extpy_run_frozen (const wchar_t *name);
+
 /* Free running results */
 void
 extpy_run_free (extpy_run_result_t* result);
@@ -83,3 +87,34 @@ extpy_get_double_attr (PyObject *obj, const wchar_t *attr_name);
 /* Get string-value object's attribute */
 wchar_t*
 extpy_get_string_attr (PyObject *obj, const wchar_t *attr_name);
+
+/****
+ * Bulk conversion of sequences
+ */
+
+/* Convert sequence or buffer to array of longs */
+long*
+extpy_to_long_array (PyObject *obj, Py_ssize_t *len, Py_ssize_t *bad_index);
+
+/* Convert sequence or buffer to array of doubles */
+double*
+extpy_to_double_array (PyObject *obj, Py_ssize_t *len, Py_ssize_t *bad_index);
+
+/* Convert sequence of strings to packed array of wide-char strings */
+wchar_t**
+extpy_to_string_array (PyObject *obj, Py_ssize_t *len, Py_ssize_t *bad_index);
+
+/* Get long-array object's attribute */
+long*
+extpy_get_long_array_attr (PyObject *obj, const wchar_t *attr_name,
+                           Py_ssize_t *len);
+
+/* Get double-array object's attribute */
+double*
+extpy_get_double_array_attr (PyObject *obj, const wchar_t *attr_name,
+                             Py_ssize_t *len);
+
+/* Get string-array object's attribute */
+wchar_t**
+extpy_get_string_array_attr (PyObject *obj, const wchar_t *attr_name,
+                             Py_ssize_t *len);
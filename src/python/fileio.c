@@ -0,0 +1,982 @@
+/**
+ * File and socket I/O built-ins which release GIL
+ *
+ * Functions of CoreBuiltins which work with files and local sockets.
+ * Blocking system calls are made with released GIL, so other threads
+ * run scripts while one script waits for I/O.
+ *
+ * Data is read directly into memory of result strings, which aren't
+ * visible to other threads yet. Buffers of scripts are used directly
+ * only when their memory can't move while GIL is released: views of
+ * new-style buffer protocol lock their exporters, strings are immutable
+ * and arrays of py_array_new() never reallocate. Memory of other
+ * old-style buffers (e.g. array.array) could be reallocated by another
+ * thread, so data is copied to private memory while GIL is held.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#  define MSG_NOSIGNAL 0
+#endif
+
+/* Size of chunks of files whose size is unknown */
+#define READ_CHUNK 65536
+
+/**
+ * Get contiguous memory of buffer
+ *
+ * @param obj - object which supports buffer protocol
+ * @param buffer - descriptor to fill
+ * @param flags - PY_ARRAY_WRITABLE if memory is going to be changed
+ * @param size - size of memory in bytes
+ * @return zero on success, non-zero with set error otherwise
+ */
+static int
+get_bytes (PyObject *obj, py_buffer_t *buffer, int flags, Py_ssize_t *size)
+{
+  Py_ssize_t itemsize, stride;
+  int i;
+
+  if (py_buffer_get (obj, buffer, flags))
+    {
+      return -1;
+    }
+
+  itemsize = py_array_type_size (buffer->type);
+  stride = itemsize;
+
+  for (i = buffer->ndim - 1; i >= 0; --i)
+    {
+      if (buffer->shape[i] > 1 && buffer->strides[i] != stride)
+        {
+          PyErr_SetString (PyExc_ValueError, "buffer should be contiguous");
+          py_buffer_release (buffer);
+          return -1;
+        }
+
+      stride *= buffer->shape[i];
+    }
+
+  *size = buffer->len * itemsize;
+
+  return 0;
+}
+
+/**
+ * Check whether memory of buffer stays in place while GIL is released
+ *
+ * @param obj - object which buffer is got from
+ * @param buffer - buffer of object
+ * @return non-zero if memory can't be moved or freed by other threads
+ */
+static int
+is_pinned (PyObject *obj, const py_buffer_t *buffer)
+{
+#if PY_VERSION_HEX >= 0x02060000
+  if (buffer->has_view)
+    {
+      return 1;
+    }
+#endif
+
+  return PyString_CheckExact (obj) || py_array_check (obj);
+}
+
+/**
+ * Get data to be written with released GIL
+ *
+ * @param obj - object which buffer is got from
+ * @param buffer - buffer of object
+ * @param size - size of data
+ * @param copy - private copy of data which should be freed after write,
+ *   NULL if buffer is used directly (output)
+ * @return pointer to data or NULL with set error
+ */
+static const char*
+pinned_data (PyObject *obj, const py_buffer_t *buffer, Py_ssize_t size,
+             char **copy)
+{
+  *copy = NULL;
+
+  if (is_pinned (obj, buffer))
+    {
+      return buffer->data;
+    }
+
+  *copy = malloc (MAX (size, 1));
+
+  if (!*copy)
+    {
+      PyErr_NoMemory ();
+      return NULL;
+    }
+
+  memcpy (*copy, buffer->data, size);
+
+  return *copy;
+}
+
+/**
+ * Read or receive data into writable buffer of script
+ *
+ * Single read() or recv() is made. If memory of buffer could move while
+ * GIL is released, data is received to private memory and copied to
+ * buffer, which is got again, after GIL is taken back.
+ *
+ * @param args - script's arguments: fd, buffer[, size]
+ * @param is_socket - use recv() instead of read()
+ * @return count of read bytes or NULL with set error
+ */
+static PyObject*
+read_into (PyObject *args, int is_socket)
+{
+  PyObject *obj;
+  py_buffer_t buffer;
+  Py_ssize_t size, limit = -1, n;
+  char *data, *copy = NULL;
+  int fd, pinned, err;
+
+  if (!PyArg_ParseTuple (args, "iO|n", &fd, &obj, &limit) ||
+      get_bytes (obj, &buffer, PY_ARRAY_WRITABLE, &size))
+    {
+      return NULL;
+    }
+
+  if (limit >= 0)
+    {
+      size = MIN (size, limit);
+    }
+
+  pinned = is_pinned (obj, &buffer);
+  data = buffer.data;
+
+  if (!pinned)
+    {
+      py_buffer_release (&buffer);
+      data = copy = malloc (MAX (size, 1));
+
+      if (!copy)
+        {
+          return PyErr_NoMemory ();
+        }
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  do
+    {
+      n = is_socket ? recv (fd, data, size, 0) : read (fd, data, size);
+    }
+  while (n < 0 && errno == EINTR);
+  err = errno;
+  Py_END_ALLOW_THREADS
+
+  if (pinned)
+    {
+      py_buffer_release (&buffer);
+    }
+  else if (n > 0)
+    {
+      Py_ssize_t new_size;
+
+      if (get_bytes (obj, &buffer, PY_ARRAY_WRITABLE, &new_size))
+        {
+          free (copy);
+          return NULL;
+        }
+
+      if (new_size < n)
+        {
+          py_buffer_release (&buffer);
+          free (copy);
+          PyErr_SetString (PyExc_ValueError, "buffer has been shrunk "
+                           "while data was read");
+          return NULL;
+        }
+
+      memcpy (buffer.data, copy, n);
+      py_buffer_release (&buffer);
+    }
+
+  free (copy);
+
+  if (n < 0)
+    {
+      errno = err;
+      return PyErr_SetFromErrno (PyExc_IOError);
+    }
+
+  return PyInt_FromSsize_t (n);
+}
+
+/**
+ * Read from descriptor until buffer is full or end of file
+ *
+ * Should be called with released GIL.
+ *
+ * @param fd - descriptor to read from
+ * @param data - buffer to read to
+ * @param size - size of buffer
+ * @param offset - offset in file or -1 to read from current position
+ * @return count of read bytes or -1 on error
+ */
+static Py_ssize_t
+read_full (int fd, char *data, Py_ssize_t size, off_t offset)
+{
+  Py_ssize_t total = 0;
+
+  while (total < size)
+    {
+      ssize_t n = offset < 0 ? read (fd, data + total, size - total) :
+        pread (fd, data + total, size - total, offset + total);
+
+      if (n < 0 && errno == EINTR)
+        {
+          continue;
+        }
+
+      if (n < 0)
+        {
+          return -1;
+        }
+
+      if (!n)
+        {
+          break;
+        }
+
+      total += n;
+    }
+
+  return total;
+}
+
+/**
+ * Write whole data to descriptor
+ *
+ * Should be called with released GIL.
+ *
+ * @param fd - descriptor to write to
+ * @param data - data to write
+ * @param size - size of data
+ * @param is_socket - use send() instead of write()
+ * @return count of written bytes or -1 on error
+ */
+static Py_ssize_t
+write_full (int fd, const char *data, Py_ssize_t size, int is_socket)
+{
+  Py_ssize_t total = 0;
+
+  while (total < size)
+    {
+      ssize_t n = is_socket ?
+        send (fd, data + total, size - total, MSG_NOSIGNAL) :
+        write (fd, data + total, size - total);
+
+      if (n < 0 && errno == EINTR)
+        {
+          continue;
+        }
+
+      if (n < 0)
+        {
+          return -1;
+        }
+
+      total += n;
+    }
+
+  return total;
+}
+
+/**
+ * Read file of unknown size in chunks
+ *
+ * @param fd - descriptor of file
+ * @param size - max count of bytes to read (negative to read whole file)
+ * @return string with read data or NULL with set error
+ */
+static PyObject*
+read_unsized (int fd, Py_ssize_t size)
+{
+  PyObject *result;
+  char *data = NULL;
+  Py_ssize_t len = 0, alloc = 0, n = 0;
+  int no_memory = 0;
+
+  Py_BEGIN_ALLOW_THREADS
+  for (;;)
+    {
+      Py_ssize_t chunk = READ_CHUNK;
+
+      if (size >= 0)
+        {
+          chunk = MIN (chunk, size - len);
+        }
+
+      if (!chunk)
+        {
+          break;
+        }
+
+      if (len + chunk > alloc)
+        {
+          char *new_data;
+
+          alloc = MAX (alloc * 2, len + chunk);
+          new_data = realloc (data, alloc);
+
+          if (!new_data)
+            {
+              free (data);
+              data = NULL;
+              no_memory = 1;
+              break;
+            }
+
+          data = new_data;
+        }
+
+      n = read_full (fd, data + len, chunk, -1);
+
+      if (n <= 0)
+        {
+          break;
+        }
+
+      len += n;
+    }
+  Py_END_ALLOW_THREADS
+
+  if (no_memory)
+    {
+      return PyErr_NoMemory ();
+    }
+
+  if (n < 0)
+    {
+      free (data);
+      return PyErr_SetFromErrno (PyExc_IOError);
+    }
+
+  result = PyString_FromStringAndSize (data, len);
+  free (data);
+
+  return result;
+}
+
+/**
+ * Read file or its part
+ *
+ * @param path - name of file
+ * @param offset - offset to start reading from
+ * @param size - max count of bytes to read (negative to read whole file)
+ * @return string with read data or NULL with set error
+ */
+static PyObject*
+read_path (const char *path, Py_ssize_t offset, Py_ssize_t size)
+{
+  PyObject *result;
+  struct stat st;
+  Py_ssize_t n = 0;
+  int fd, res = -1;
+
+  Py_BEGIN_ALLOW_THREADS
+  fd = open (path, O_RDONLY);
+
+  if (fd >= 0)
+    {
+      res = fstat (fd, &st);
+    }
+  Py_END_ALLOW_THREADS
+
+  if (fd < 0 || res < 0)
+    {
+      if (fd >= 0)
+        {
+          int err = errno;
+
+          close (fd);
+          errno = err;
+        }
+
+      return PyErr_SetFromErrnoWithFilename (PyExc_IOError, (char*)path);
+    }
+
+  /* Sizes of pipes and files of procfs are not known beforehand */
+  if (!S_ISREG (st.st_mode) || !st.st_size)
+    {
+      if (offset > 0)
+        {
+          lseek (fd, offset, SEEK_SET);
+        }
+
+      result = read_unsized (fd, size);
+      close (fd);
+
+      return result;
+    }
+
+  offset = MIN (offset, st.st_size);
+
+  if (size < 0 || size > st.st_size - offset)
+    {
+      size = st.st_size - offset;
+    }
+
+  result = PyString_FromStringAndSize (NULL, size);
+
+  if (result)
+    {
+      /* String is not visible to other threads yet */
+      Py_BEGIN_ALLOW_THREADS
+      n = read_full (fd, PyString_AS_STRING (result), size, offset);
+      Py_END_ALLOW_THREADS
+
+      if (n < 0)
+        {
+          Py_CLEAR (result);
+          PyErr_SetFromErrnoWithFilename (PyExc_IOError, (char*)path);
+        }
+      else if (n < size)
+        {
+          /* File has been truncated meanwhile */
+          _PyString_Resize (&result, n);
+        }
+    }
+
+  close (fd);
+
+  return result;
+}
+
+/**
+ * Release mapping of file
+ *
+ * @param data - mapped memory
+ * @param user_data - size of mapping
+ */
+static void
+unmap_file (void *data, void *user_data)
+{
+  munmap (data, (size_t)user_data);
+}
+
+/********
+ * User's stuff
+ */
+
+/**
+ * Read whole file or its part
+ *
+ * Script's arguments: path[, offset[, size]]
+ */
+PyObject*
+py_io_read_file (PyObject *self, PyObject *args)
+{
+  const char *path;
+  Py_ssize_t offset = 0, size = -1;
+
+  if (!PyArg_ParseTuple (args, "s|nn", &path, &offset, &size))
+    {
+      return NULL;
+    }
+
+  return read_path (path, MAX (offset, 0), size);
+}
+
+/**
+ * Read lines of file
+ *
+ * Lines keep their terminators, like file.readlines() does.
+ *
+ * Script's arguments: path
+ */
+PyObject*
+py_io_read_lines (PyObject *self, PyObject *args)
+{
+  const char *path;
+  PyObject *data, *result;
+
+  if (!PyArg_ParseTuple (args, "s", &path))
+    {
+      return NULL;
+    }
+
+  data = read_path (path, 0, -1);
+
+  if (!data)
+    {
+      return NULL;
+    }
+
+  result = PyObject_CallMethod (data, "splitlines", "i", 1);
+  Py_DECREF (data);
+
+  return result;
+}
+
+/**
+ * Write data to file
+ *
+ * Script's arguments: path, data[, append]
+ * Returns count of written bytes.
+ */
+PyObject*
+py_io_write_file (PyObject *self, PyObject *args)
+{
+  const char *path;
+  PyObject *data;
+  py_buffer_t buffer;
+  Py_ssize_t size, n = -1;
+  const char *bytes;
+  char *copy;
+  int append = 0, fd, err;
+
+  if (!PyArg_ParseTuple (args, "sO|i", &path, &data, &append) ||
+      get_bytes (data, &buffer, PY_ARRAY_READONLY, &size))
+    {
+      return NULL;
+    }
+
+  bytes = pinned_data (data, &buffer, size, &copy);
+
+  if (!bytes)
+    {
+      py_buffer_release (&buffer);
+      return NULL;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  fd = open (path, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0666);
+
+  if (fd >= 0)
+    {
+      n = write_full (fd, bytes, size, 0);
+
+      if (close (fd) < 0)
+        {
+          n = -1;
+        }
+    }
+  err = errno;
+  Py_END_ALLOW_THREADS
+
+  py_buffer_release (&buffer);
+  free (copy);
+
+  if (n < 0)
+    {
+      errno = err;
+      return PyErr_SetFromErrnoWithFilename (PyExc_IOError, (char*)path);
+    }
+
+  return PyInt_FromSsize_t (n);
+}
+
+/**
+ * Map file into memory and return read-only array of bytes
+ *
+ * Pages are read by kernel on access, file is unmapped when array is
+ * not used anymore.
+ *
+ * Script's arguments: path
+ */
+PyObject*
+py_io_mmap_file (PyObject *self, PyObject *args)
+{
+  static char empty;
+  const char *path;
+  struct stat st;
+  void *data = MAP_FAILED;
+  int fd;
+
+  if (!PyArg_ParseTuple (args, "s", &path))
+    {
+      return NULL;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  fd = open (path, O_RDONLY);
+
+  if (fd >= 0)
+    {
+      if (!fstat (fd, &st))
+        {
+          data = st.st_size ? mmap (NULL, st.st_size, PROT_READ, MAP_SHARED,
+                                    fd, 0) : &empty;
+        }
+
+      close (fd);
+    }
+  Py_END_ALLOW_THREADS
+
+  if (data == MAP_FAILED)
+    {
+      return PyErr_SetFromErrnoWithFilename (PyExc_IOError, (char*)path);
+    }
+
+  if (!st.st_size)
+    {
+      return py_array_new_1d (data, PY_ARRAY_UINT8, 0, PY_ARRAY_READONLY,
+                              NULL, NULL);
+    }
+
+  return py_array_new_1d (data, PY_ARRAY_UINT8, st.st_size,
+                          PY_ARRAY_READONLY, unmap_file,
+                          (void*)(size_t)st.st_size);
+}
+
+/**
+ * Open file and return its descriptor
+ *
+ * Script's arguments: path[, mode]
+ * Mode is combination of `r', `w', `a' and `+' like for open().
+ */
+PyObject*
+py_io_open (PyObject *self, PyObject *args)
+{
+  const char *path, *mode = "r";
+  int flags, fd;
+
+  if (!PyArg_ParseTuple (args, "s|s", &path, &mode))
+    {
+      return NULL;
+    }
+
+  switch (mode[0])
+    {
+    case 'r': flags = O_RDONLY; break;
+    case 'w': flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+    case 'a': flags = O_WRONLY | O_CREAT | O_APPEND; break;
+    default:
+      PyErr_Format (PyExc_ValueError, "invalid mode %s", mode);
+      return NULL;
+    }
+
+  if (strchr (mode, '+'))
+    {
+      flags = (flags & ~O_WRONLY) | O_RDWR;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  fd = open (path, flags, 0666);
+  Py_END_ALLOW_THREADS
+
+  if (fd < 0)
+    {
+      return PyErr_SetFromErrnoWithFilename (PyExc_IOError, (char*)path);
+    }
+
+  return PyInt_FromLong (fd);
+}
+
+/**
+ * Close file or socket descriptor
+ *
+ * Script's arguments: fd
+ */
+PyObject*
+py_io_close (PyObject *self, PyObject *args)
+{
+  int fd, res;
+
+  if (!PyArg_ParseTuple (args, "i", &fd))
+    {
+      return NULL;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  res = close (fd);
+  Py_END_ALLOW_THREADS
+
+  if (res < 0)
+    {
+      return PyErr_SetFromErrno (PyExc_IOError);
+    }
+
+  Py_RETURN_NONE;
+}
+
+/**
+ * Read next chunk from descriptor
+ *
+ * Single read() is made, so result could be shorter than requested.
+ * Empty string is returned at end of file.
+ *
+ * Script's arguments: fd, size
+ */
+PyObject*
+py_io_read_chunk (PyObject *self, PyObject *args)
+{
+  PyObject *result;
+  Py_ssize_t size, n;
+  int fd;
+
+  if (!PyArg_ParseTuple (args, "in", &fd, &size))
+    {
+      return NULL;
+    }
+
+  result = PyString_FromStringAndSize (NULL, MAX (size, 0));
+
+  if (!result)
+    {
+      return NULL;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  do
+    {
+      n = read (fd, PyString_AS_STRING (result), MAX (size, 0));
+    }
+  while (n < 0 && errno == EINTR);
+  Py_END_ALLOW_THREADS
+
+  if (n < 0)
+    {
+      Py_DECREF (result);
+      return PyErr_SetFromErrno (PyExc_IOError);
+    }
+
+  if (n < size)
+    {
+      _PyString_Resize (&result, n);
+    }
+
+  return result;
+}
+
+/**
+ * Read from descriptor into preallocated writable buffer
+ *
+ * Single read() is made. Returns count of read bytes, zero at end of file.
+ *
+ * Script's arguments: fd, buffer[, size]
+ */
+PyObject*
+py_io_read_into (PyObject *self, PyObject *args)
+{
+  return read_into (args, 0);
+}
+
+/**
+ * Write whole data to descriptor
+ *
+ * Script's arguments: fd, data
+ * Returns count of written bytes.
+ */
+PyObject*
+py_io_write (PyObject *self, PyObject *args)
+{
+  PyObject *obj;
+  py_buffer_t buffer;
+  Py_ssize_t size, n;
+  const char *bytes;
+  char *copy;
+  int fd, err;
+
+  if (!PyArg_ParseTuple (args, "iO", &fd, &obj) ||
+      get_bytes (obj, &buffer, PY_ARRAY_READONLY, &size))
+    {
+      return NULL;
+    }
+
+  bytes = pinned_data (obj, &buffer, size, &copy);
+
+  if (!bytes)
+    {
+      py_buffer_release (&buffer);
+      return NULL;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  n = write_full (fd, bytes, size, 0);
+  err = errno;
+  Py_END_ALLOW_THREADS
+
+  py_buffer_release (&buffer);
+  free (copy);
+
+  if (n < 0)
+    {
+      errno = err;
+      return PyErr_SetFromErrno (PyExc_IOError);
+    }
+
+  return PyInt_FromSsize_t (n);
+}
+
+/**
+ * Connect to local (AF_UNIX) stream socket
+ *
+ * Script's arguments: path
+ * Returns descriptor of socket.
+ */
+PyObject*
+py_io_socket_connect (PyObject *self, PyObject *args)
+{
+  struct sockaddr_un addr;
+  const char *path;
+  int fd, res = -1;
+
+  if (!PyArg_ParseTuple (args, "s", &path))
+    {
+      return NULL;
+    }
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+      PyErr_SetString (PyExc_ValueError, "path of socket is too long");
+      return NULL;
+    }
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+
+  Py_BEGIN_ALLOW_THREADS
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd >= 0)
+    {
+      res = connect (fd, (struct sockaddr*)&addr, sizeof (addr));
+
+      if (res < 0)
+        {
+          int err = errno;
+
+          close (fd);
+          errno = err;
+        }
+    }
+  Py_END_ALLOW_THREADS
+
+  if (fd < 0 || res < 0)
+    {
+      return PyErr_SetFromErrnoWithFilename (PyExc_IOError, (char*)path);
+    }
+
+  return PyInt_FromLong (fd);
+}
+
+/**
+ * Send whole data to socket
+ *
+ * Script's arguments: fd, data
+ * Returns count of sent bytes.
+ */
+PyObject*
+py_io_socket_send (PyObject *self, PyObject *args)
+{
+  PyObject *obj;
+  py_buffer_t buffer;
+  Py_ssize_t size, n;
+  const char *bytes;
+  char *copy;
+  int fd, err;
+
+  if (!PyArg_ParseTuple (args, "iO", &fd, &obj) ||
+      get_bytes (obj, &buffer, PY_ARRAY_READONLY, &size))
+    {
+      return NULL;
+    }
+
+  bytes = pinned_data (obj, &buffer, size, &copy);
+
+  if (!bytes)
+    {
+      py_buffer_release (&buffer);
+      return NULL;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  n = write_full (fd, bytes, size, 1);
+  err = errno;
+  Py_END_ALLOW_THREADS
+
+  py_buffer_release (&buffer);
+  free (copy);
+
+  if (n < 0)
+    {
+      errno = err;
+      return PyErr_SetFromErrno (PyExc_IOError);
+    }
+
+  return PyInt_FromSsize_t (n);
+}
+
+/**
+ * Receive data from socket
+ *
+ * Single recv() is made. Empty string is returned when peer has closed
+ * connection.
+ *
+ * Script's arguments: fd, size
+ */
+PyObject*
+py_io_socket_recv (PyObject *self, PyObject *args)
+{
+  PyObject *result;
+  Py_ssize_t size, n;
+  int fd;
+
+  if (!PyArg_ParseTuple (args, "in", &fd, &size))
+    {
+      return NULL;
+    }
+
+  result = PyString_FromStringAndSize (NULL, MAX (size, 0));
+
+  if (!result)
+    {
+      return NULL;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  do
+    {
+      n = recv (fd, PyString_AS_STRING (result), MAX (size, 0), 0);
+    }
+  while (n < 0 && errno == EINTR);
+  Py_END_ALLOW_THREADS
+
+  if (n < 0)
+    {
+      Py_DECREF (result);
+      return PyErr_SetFromErrno (PyExc_IOError);
+    }
+
+  if (n < size)
+    {
+      _PyString_Resize (&result, n);
+    }
+
+  return result;
+}
+
+/**
+ * Receive data from socket into preallocated writable buffer
+ *
+ * Script's arguments: fd, buffer[, size]
+ * Returns count of received bytes.
+ */
+PyObject*
+py_io_socket_recv_into (PyObject *self, PyObject *args)
+{
+  return read_into (args, 1);
+}
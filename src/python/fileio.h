@@ -0,0 +1,64 @@
+/**
+ * File and socket I/O built-ins which release GIL
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Read whole file or its part */
+PyObject*
+py_io_read_file (PyObject *self, PyObject *args);
+
+/* Read lines of file */
+PyObject*
+py_io_read_lines (PyObject *self, PyObject *args);
+
+/* Write data to file */
+PyObject*
+py_io_write_file (PyObject *self, PyObject *args);
+
+/* Map file into memory and return read-only array of bytes */
+PyObject*
+py_io_mmap_file (PyObject *self, PyObject *args);
+
+/* Open file and return its descriptor */
+PyObject*
+py_io_open (PyObject *self, PyObject *args);
+
+/* Close file or socket descriptor */
+PyObject*
+py_io_close (PyObject *self, PyObject *args);
+
+/* Read next chunk from descriptor */
+PyObject*
+py_io_read_chunk (PyObject *self, PyObject *args);
+
+/* Read from descriptor into preallocated writable buffer */
+PyObject*
+py_io_read_into (PyObject *self, PyObject *args);
+
+/* Write whole data to descriptor */
+PyObject*
+py_io_write (PyObject *self, PyObject *args);
+
+/* Connect to local (AF_UNIX) stream socket */
+PyObject*
+py_io_socket_connect (PyObject *self, PyObject *args);
+
+/* Send whole data to socket */
+PyObject*
+py_io_socket_send (PyObject *self, PyObject *args);
+
+/* Receive data from socket */
+PyObject*
+py_io_socket_recv (PyObject *self, PyObject *args);
+
+/* Receive data from socket into preallocated writable buffer */
+PyObject*
+py_io_socket_recv_into (PyObject *self, PyObject *args);
@@ -0,0 +1,224 @@
+/**
+ * Scripts and modules which are frozen into executable
+ *
+ * Tables of frozen modules are generated at build time by freeze tool
+ * (see FROZEN_SCRIPTS in src/Makefile.in) and contain marshalled code
+ * objects. Registered tables are merged in front of Python's own
+ * PyImport_FrozenModules, so frozen modules are imported by Python's
+ * importer without searching of sys.path, and frozen scripts are run
+ * without reading and compiling of source.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#include <marshal.h>
+
+/* Table which was set before first registration */
+static struct _frozen *original_modules = NULL;
+
+/* Merged table which is currently set to PyImport_FrozenModules */
+static struct _frozen *merged_modules = NULL;
+
+/**
+ * Count entries of table of frozen modules
+ *
+ * @param table - table to count entries of
+ * @return count of entries without terminator
+ */
+static long
+count_frozen (const struct _frozen *table)
+{
+  long count = 0;
+
+  while (table && table[count].name)
+    {
+      ++count;
+    }
+
+  return count;
+}
+
+/**
+ * Register table of frozen modules which is generated by freeze tool
+ *
+ * Could be called before python_init() or with acquired GIL. Modules
+ * of table hide modules with the same names from tables which were
+ * registered earlier. Registration survives python_done().
+ *
+ * @param table - table terminated by entry with NULL name. Table is
+ *   not copied and should stay valid until it's unregistered
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_frozen_register (const struct _frozen *table)
+{
+  struct _frozen *merged;
+  long count, current;
+
+  if (!table)
+    {
+      return -1;
+    }
+
+  if (!merged_modules)
+    {
+      original_modules = PyImport_FrozenModules;
+    }
+
+  count = count_frozen (table);
+  current = count_frozen (PyImport_FrozenModules);
+
+  merged = malloc (sizeof (struct _frozen) * (count + current + 1));
+
+  if (!merged)
+    {
+      return -1;
+    }
+
+  memcpy (merged, table, sizeof (struct _frozen) * count);
+  memcpy (merged + count, PyImport_FrozenModules,
+          sizeof (struct _frozen) * current);
+  memset (merged + count + current, 0, sizeof (struct _frozen));
+
+  PyImport_FrozenModules = merged;
+
+  SAFE_FREE (merged_modules);
+  merged_modules = merged;
+
+  return 0;
+}
+
+/**
+ * Unregister all registered tables
+ */
+void
+py_frozen_unregister_all (void)
+{
+  if (!merged_modules)
+    {
+      return;
+    }
+
+  PyImport_FrozenModules = original_modules;
+  original_modules = NULL;
+
+  SAFE_FREE (merged_modules);
+}
+
+/**
+ * Find frozen module by name
+ *
+ * @param name - full name of module
+ * @return entry of frozen module or NULL if it is not found
+ */
+const struct _frozen*
+py_frozen_find (const char *name)
+{
+  const struct _frozen *entry;
+
+  if (!name || !PyImport_FrozenModules)
+    {
+      return NULL;
+    }
+
+  for (entry = PyImport_FrozenModules; entry->name; ++entry)
+    {
+      if (!strcmp (entry->name, name))
+        {
+          return entry;
+        }
+    }
+
+  return NULL;
+}
+
+/**
+ * Load code object of frozen module
+ *
+ * @param name - full name of module
+ * @return code object or NULL with set ImportError
+ * @sideeffect allocate memory for return value
+ */
+PyObject*
+py_frozen_get_code (const char *name)
+{
+  const struct _frozen *entry = py_frozen_find (name);
+  PyObject *code;
+
+  if (!entry || !entry->code)
+    {
+      PyErr_Format (PyExc_ImportError, "No such frozen object named %.200s",
+                    name ? name : "");
+      return NULL;
+    }
+
+  /* Negative size marks package */
+  code = PyMarshal_ReadObjectFromString ((char*)entry->code,
+                                         abs (entry->size));
+
+  if (code && !PyCode_Check (code))
+    {
+      Py_DECREF (code);
+      PyErr_Format (PyExc_TypeError, "frozen object %.200s is not a code "
+                    "object", name);
+      return NULL;
+    }
+
+  return code;
+}
+
+/**
+ * Run frozen script at specified dictionary
+ *
+ * @param name - name of frozen module
+ * @param dict - dictionary to run on
+ * @return Python eval's result
+ */
+PyObject*
+py_run_frozen_at_dict (const wchar_t *name, PyObject *dict)
+{
+  py_script_t *script;
+  PyObject *result;
+
+  script = py_script_new_frozen (name);
+
+  if (!script)
+    {
+      return NULL;
+    }
+
+  result = py_run_script_at_dict (script, dict);
+  py_script_free (script);
+
+  return result;
+}
+
+/**
+ * Run frozen script
+ *
+ * @param name - name of frozen module
+ * @return Python eval's result
+ */
+PyObject*
+py_run_frozen (const wchar_t *name)
+{
+  py_script_t *script;
+  PyObject *result;
+
+  script = py_script_new_frozen (name);
+
+  if (!script)
+    {
+      return NULL;
+    }
+
+  result = py_run_script (script);
+  py_script_free (script);
+
+  return result;
+}
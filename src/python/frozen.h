@@ -0,0 +1,36 @@
+/**
+ * Scripts and modules which are frozen into executable
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Register table of frozen modules which is generated by freeze tool */
+int
+py_frozen_register (const struct _frozen *table);
+
+/* Unregister all registered tables */
+void
+py_frozen_unregister_all (void);
+
+/* Find frozen module by name */
+const struct _frozen*
+py_frozen_find (const char *name);
+
+/* Load code object of frozen module */
+PyObject*
+py_frozen_get_code (const char *name);
+
+/* Run frozen script at specified dictionary */
+PyObject*
+py_run_frozen_at_dict (const wchar_t *name, PyObject *dict);
+
+/* Run frozen script */
+PyObject*
+py_run_frozen (const wchar_t *name);
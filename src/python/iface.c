@@ -19,30 +19,85 @@
 /* Program's name (argv[0]) */
 static wchar_t *progname = NULL;
 
-/* List of created modules */
+/* Initial count of buckets in hash tables of modules */
+#define REGISTRY_MIN_SIZE 64
+
+/* Module which is initialized on first import */
+typedef struct lazy_module {
+  char *name;
+  unsigned long hash;
+  void (*init) (void);   /* Procedure which creates module */
+
+  struct lazy_module *next;
+} lazy_module_t;
+
+/* Hash table of created modules */
 static py_module_t **modules = NULL;
-static long modules_count = 0;
+static unsigned long modules_size = 0;
+static unsigned long modules_count = 0;
+
+/* Hash table of modules which are initialized on first import */
+static lazy_module_t **lazy_modules = NULL;
+static unsigned long lazy_size = 0;
+static unsigned long lazy_count = 0;
+
+/* Importer which initializes lazy modules (NULL if not installed) */
+static PyObject *lazy_importer = NULL;
+
+/* Instrumentation of methods of new modules */
+static int instrumentation = 0;
+
+/* Startup profile and phases which are postponed until first run */
+static int startup_profile = 0;
+static int deferred_phases = 0;
+
+/* Timings of startup phases */
+static py_startup_phase_t startup_phases[PY_PHASE_COUNT] = {
+  {"initialize", PY_PHASE_SKIPPED, 0},
+  {"syspath",    PY_PHASE_SKIPPED, 0},
+  {"site",       PY_PHASE_SKIPPED, 0},
+  {"tracer",     PY_PHASE_SKIPPED, 0},
+  {"builtins",   PY_PHASE_SKIPPED, 0},
+  {"warmset",    PY_PHASE_SKIPPED, 0}
+};
+
+/* Pools of descriptors */
+static py_pool_t module_pool = PY_POOL_INIT (py_module_t);
+static py_pool_t script_pool = PY_POOL_INIT (py_script_t);
 
 /**
- * Converts internal method's definition to Python method definition
- *
- * @param def - definitions to be converted
- * @return Python method's definitions
+ * Free list of converted methods' definitions
  */
 static void
-convert_method_def (py_method_def_t def, PyMethodDef *result)
+free_methods_list (PyMethodDef *list)
 {
-  WCS2MBS (result->ml_name, def.name);
-  result->ml_meth  = def.meth;
-  result->ml_flags = def.flags;
-  WCS2MBS (result->ml_doc, def.doc);
+  long i = 0;
+
+  if (!list)
+    {
+      return;
+    }
+
+  while (list[i].ml_name)
+    {
+      free ((char*)list[i].ml_name);
+
+      if (list[i].ml_doc)
+        {
+          free ((char*)list[i].ml_doc);
+        }
+
+      ++i;
+    }
+
+  SAFE_FREE (list);
 }
 
 /**
  * Convert list of internal method's definition to Python method definition
  *
  * @param list - list of definitions to be converted
- * @return list of converted definitions
+ * @return list of converted definitions, NULL if memory is exhausted
  * @sideeffect allocate memory for output value. Use free_methods_list to free
  */
 static PyMethodDef*
@@ -59,35 +114,237 @@ convert_methods_list (py_method_def_t *list)
 
   MALLOC_ZERO (out_list, sizeof (PyMethodDef) * (count + 1));
 
+  if (!out_list)
+    {
+      return NULL;
+    }
+
   for (i = 0; i < count; ++i)
     {
-      convert_method_def (list[i], &out_list[i]);
+      PyMethodDef *def = &out_list[i];
+
+      WCS2MBS (def->ml_name, list[i].name);
+      def->ml_meth  = list[i].meth;
+      def->ml_flags = list[i].flags;
+
+      if (list[i].doc)
+        {
+          WCS2MBS (def->ml_doc, list[i].doc);
+        }
+
+      if (!def->ml_name || (list[i].doc && !def->ml_doc))
+        {
+          /* Terminate list at failed entry, so it could be freed */
+          free ((char*)def->ml_name);
+          def->ml_name = NULL;
+          free_methods_list (out_list);
+          return NULL;
+        }
     }
 
   return out_list;
 }
 
 /**
- * Free list of converted methods' definitions
+ * Call wrapped method with recording of instrumentation data
+ *
+ * @param self - Python object of wrapper
+ * @param args - arguments of method
+ * @return result of wrapped method
+ */
+static PyObject*
+wrapped_method_call (PyObject *self, PyObject *args)
+{
+  py_method_wrapper_t *wrapper = PyCObject_AsVoidPtr (self);
+  PyObject *result;
+  unsigned long long start = 0;
+
+  if (wrapper->stats)
+    {
+      start = py_stats_now ();
+    }
+
+  py_timeline_begin (wrapper->full_name, "native");
+  result = wrapper->meth (NULL, args);
+  py_timeline_end ();
+
+  if (wrapper->stats)
+    {
+      py_stats_record (wrapper->stats, py_stats_now () - start, !result);
+    }
+
+  return result;
+}
+
+/**
+ * Call wrapped method with keywords with recording of instrumentation data
+ *
+ * @param self - Python object of wrapper
+ * @param args - arguments of method
+ * @param kw - keyword arguments of method
+ * @return result of wrapped method
+ */
+static PyObject*
+wrapped_method_call_kw (PyObject *self, PyObject *args, PyObject *kw)
+{
+  py_method_wrapper_t *wrapper = PyCObject_AsVoidPtr (self);
+  PyObject *result;
+  unsigned long long start = 0;
+
+  if (wrapper->stats)
+    {
+      start = py_stats_now ();
+    }
+
+  py_timeline_begin (wrapper->full_name, "native");
+  result = ((PyCFunctionWithKeywords)wrapper->meth) (NULL, args, kw);
+  py_timeline_end ();
+
+  if (wrapper->stats)
+    {
+      py_stats_record (wrapper->stats, py_stats_now () - start, !result);
+    }
+
+  return result;
+}
+
+/**
+ * Free instrumentation wrappers of module's methods
+ *
+ * @param module - module which wrappers will be freed
  */
 static void
-free_methods_list (PyMethodDef *list)
+free_wrapped_methods (py_module_t *module)
 {
-  long i = 0;
+  long i;
 
-  while (list[i].ml_name)
+  if (!module->wrappers)
     {
-      free ((char*)list[i].ml_name);
+      return;
+    }
 
-      if (list[i].ml_doc)
+  for (i = 0; i < module->wrappers_count; ++i)
+    {
+      SAFE_FREE (module->wrappers[i].full_name);
+    }
+
+  SAFE_FREE (module->wrappers);
+  module->wrappers_count = 0;
+}
+
+/**
+ * Add instrumented methods to module
+ *
+ * Each method is added as a function object which calls a wrapper,
+ * and the wrapper calls the original implementation.
+ *
+ * @param module - module to add methods to
+ * @param mbname - name of module
+ * @return zero on success, non-zero with Python error set otherwise
+ */
+static int
+add_wrapped_methods (py_module_t *module, const char *mbname)
+{
+  PyMethodDef *def;
+  PyObject *modname;
+  long i, count = 0;
+
+  while (module->methods[count].ml_name)
+    {
+      ++count;
+    }
+
+  module->wrappers = calloc (count + 1, sizeof (py_method_wrapper_t));
+
+  if (!module->wrappers)
+    {
+      PyErr_NoMemory ();
+      return -1;
+    }
+
+  module->wrappers_count = count;
+
+  modname = PyString_FromString (mbname);
+
+  if (!modname)
+    {
+      free_wrapped_methods (module);
+      return -1;
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      py_method_wrapper_t *wrapper = &module->wrappers[i];
+      PyObject *self, *func = NULL;
+
+      def = &module->methods[i];
+
+      wrapper->def = *def;
+      wrapper->meth = def->ml_meth;
+
+      if (def->ml_flags & METH_KEYWORDS)
         {
-          free ((char*)list[i].ml_doc);
+          wrapper->def.ml_meth = (PyCFunction)wrapped_method_call_kw;
+        }
+      else
+        {
+          wrapper->def.ml_meth = wrapped_method_call;
         }
 
-      ++i;
-      }
+      wrapper->full_name = malloc (strlen (mbname) +
+                                   strlen (def->ml_name) + 2);
 
-  SAFE_FREE (list);
+      if (!wrapper->full_name)
+        {
+          PyErr_NoMemory ();
+          break;
+        }
+
+      sprintf (wrapper->full_name, "%s.%s", mbname, def->ml_name);
+
+      if (instrumentation & PY_INSTRUMENT_STATS)
+        {
+          wrapper->stats = py_stats_register (wrapper->full_name);
+        }
+
+      self = PyCObject_FromVoidPtr (wrapper, NULL);
+
+      if (self)
+        {
+          func = PyCFunction_NewEx (&wrapper->def, self, modname);
+          Py_DECREF (self);
+        }
+
+      if (!func || PyDict_SetItemString (module->dict, def->ml_name, func))
+        {
+          Py_XDECREF (func);
+          break;
+        }
+
+      Py_DECREF (func);
+    }
+
+  Py_DECREF (modname);
+
+  if (i < count)
+    {
+      PyObject *type, *value, *traceback;
+
+      /* Functions which are already added refer to freed wrappers */
+      PyErr_Fetch (&type, &value, &traceback);
+
+      while (i--)
+        {
+          PyDict_DelItemString (module->dict, module->methods[i].ml_name);
+        }
+
+      PyErr_Restore (type, value, traceback);
+
+      free_wrapped_methods (module);
+      return -1;
+    }
+
+  return 0;
 }
 
 /**
@@ -135,8 +392,15 @@ syspath_append (wchar_t *dirname)
   PyObject *mod_sys = NULL, *dict = NULL, *path = NULL, *dir = NULL;
   short ok = 1;
   char *mbdirname;
+  py_arena_mark_t mark = py_arena_mark ();
 
-  WCS2MBS (mbdirname, dirname);
+  PY_SCRATCH_WCS2MBS (mbdirname, dirname);
+
+  if (!mbdirname)
+    {
+      py_arena_release (mark);
+      return;
+    }
 
   mod_sys = PyImport_ImportModule ("sys"); /* new ref */
 
@@ -158,7 +422,7 @@ syspath_append (wchar_t *dirname)
 
 
   dir = PyString_FromString (mbdirname);
-  free (mbdirname);
+  py_arena_release (mark);
 
   if (ok && PySequence_Contains (path, dir) == 0)
     {
@@ -181,13 +445,10 @@ syspath_append (wchar_t *dirname)
 
 /**
  * Initialize system paths
- *
- * @param first_time - is functions calls for the first time?
  */
 static void
-init_syspath (int first_time)
+init_syspath (void)
 {
-  PyObject *mod;
   wchar_t *last;
   long n;
 
@@ -209,17 +470,36 @@ init_syspath (int first_time)
       /* append to module search path */
       syspath_append (execdir);
     }
-  else
+  else if (!(startup_profile & PY_STARTUP_QUIET))
     {
       printf( "Warning: could not determine argv[0] path\n" );
     }
+}
+
+/**
+ * Check whether installed Python's library is available
+ *
+ * @param first_time - is functions calls for the first time?
+ */
+static void
+probe_site (int first_time)
+{
+  PyObject *mod;
+  int verbose = !(startup_profile & PY_STARTUP_QUIET);
+
+  if (verbose)
+    {
+      printf ("Checking for installed Python... ");
+    }
 
-  printf ("Checking for installed Python... ");
   mod = PyImport_ImportModule ("site");
 
   if (mod)
     {
-      printf("got it!\n");
+      if (verbose)
+        {
+          printf("got it!\n");
+        }
       Py_DECREF (mod);
     }
   else
@@ -227,7 +507,7 @@ init_syspath (int first_time)
       /* import 'site' failed */
       PyErr_Clear (  );
 
-      if (first_time)
+      if (first_time && verbose)
         {
           printf ("No installed Python found.\n");
           printf ("Only built-in modules are available. "
@@ -250,254 +530,977 @@ init_syspath (int first_time)
 }
 
 /**
- * Create a new Python dictionary object
+ * Finish timing of startup phase
+ *
+ * @param phase - phase which is finished
+ * @param start - moment when phase was started
+ * @param state - new state of phase
+ */
+static void
+phase_done (int phase, unsigned long long start, int state)
+{
+  startup_phases[phase].ns = py_stats_now () - start;
+  startup_phases[phase].state = state;
+}
+
+/**
+ * Do startup phases which were deferred until first run
+ */
+static void
+finish_startup (void)
+{
+  unsigned long long start;
+
+  if (!deferred_phases)
+    {
+      return;
+    }
+
+  if (deferred_phases & PY_STARTUP_LAZY_TRACER)
+    {
+      start = py_stats_now ();
+      py_tracer_init ();
+      phase_done (PY_PHASE_TRACER, start, PY_PHASE_DONE_LAZILY);
+    }
+
+  if (deferred_phases & PY_STARTUP_LAZY_BUILTINS)
+    {
+      start = py_stats_now ();
+
+      /* Failure is reported here, dictionaries of scripts */
+      /* retry the import */
+      if (!py_builtins_get_local ())
+        {
+          PyErr_Print ();
+        }
+
+      phase_done (PY_PHASE_BUILTINS, start, PY_PHASE_DONE_LAZILY);
+    }
+
+  deferred_phases = 0;
+}
+
+/**
+ * Create a new Python dictionary object
+ *
+ * @return Python dictionary object or NULL with Python error set
+ * @sideeffect allocate memory for output value
+ */
+static PyObject*
+create_global_dictionary (void)
+{
+  PyObject *dict, *local;
+
+  finish_startup ();
+
+  local = py_builtins_get_local ();
+
+  if (!local)
+    {
+      return NULL;
+    }
+
+  dict = PyDict_New ();
+  PyDict_SetItemString (dict, "__builtins__", py_builtins_get_global ());
+  extpy_dict_set_item_str (dict, L"__name__",
+                           PyString_FromString ( "__main__" ));
+
+  PyDict_Merge (dict, local, 0);
+
+  return dict;
+}
+
+/**
+ * Delete a given Python dictionary object
+ *
+ * @param dict - dictionary to b ereleased
+ */
+static void
+release_global_dictionary (PyObject *dict)
+{
+  PyDict_Clear (dict);
+
+  /* Release dictionary */
+  Py_DECREF (dict);
+}
+
+/**
+ * Calculate hash of module's name
+ *
+ * @param name - name of module
+ * @return hash of name
+ */
+static unsigned long
+name_hash (const char *name)
+{
+  /* FNV-1a */
+  unsigned long hash = 2166136261UL;
+
+  while (*name)
+    {
+      hash = (hash ^ (unsigned char)*name++) * 16777619UL;
+    }
+
+  return hash;
+}
+
+/**
+ * Grow hash table of created modules if it's too dense
+ */
+static void
+grow_modules (void)
+{
+  unsigned long i, size = MAX (modules_size * 2, REGISTRY_MIN_SIZE);
+  py_module_t **table, *module, *next;
+
+  if (modules_count < modules_size)
+    {
+      return;
+    }
+
+  table = calloc (size, sizeof (py_module_t*));
+
+  for (i = 0; i < modules_size; ++i)
+    {
+      for (module = modules[i]; module; module = next)
+        {
+          next = module->hash_next;
+          module->hash_next = table[module->hash & (size - 1)];
+          table[module->hash & (size - 1)] = module;
+        }
+    }
+
+  free (modules);
+  modules = table;
+  modules_size = size;
+}
+
+/**
+ * Register module in hash table
+ *
+ * Newer module with the same name shadows the older one for lookups.
+ *
+ * @param module - module to be registered
+ * @param mbname - name of module
+ */
+static void
+register_module (py_module_t *module, const char *mbname)
+{
+  py_module_t **bucket;
+
+  grow_modules ();
+
+  module->hash = name_hash (mbname);
+  bucket = &modules[module->hash & (modules_size - 1)];
+  module->hash_next = *bucket;
+  *bucket = module;
+
+  ++modules_count;
+}
+
+/**
+ * Unregister module from hash table
+ *
+ * @param module - module to be unregistered
+ */
+static void
+unregister_module (py_module_t *module)
+{
+  py_module_t **link;
+
+  if (!modules)
+    {
+      return;
+    }
+
+  link = &modules[module->hash & (modules_size - 1)];
+
+  while (*link && *link != module)
+    {
+      link = &(*link)->hash_next;
+    }
+
+  if (*link)
+    {
+      *link = module->hash_next;
+      --modules_count;
+    }
+}
+
+/**
+ * Unregister all modules from hash table
+ */
+static void
+unregister_all_modules (void)
+{
+  unsigned long i;
+
+  for (i = 0; i < modules_size; ++i)
+    {
+      while (modules[i])
+        {
+          py_module_free (modules[i]);
+        }
+    }
+
+  SAFE_FREE (modules);
+  modules_size = modules_count = 0;
+}
+
+/**
+ * Find module which is initialized on first import
+ *
+ * @param mbname - name of module
+ * @return descriptor of lazy module or NULL if there is no such module
+ */
+static lazy_module_t*
+find_lazy_module (const char *mbname)
+{
+  unsigned long hash = name_hash (mbname);
+  lazy_module_t *lazy;
+
+  if (!lazy_modules)
+    {
+      return NULL;
+    }
+
+  for (lazy = lazy_modules[hash & (lazy_size - 1)]; lazy; lazy = lazy->next)
+    {
+      if (lazy->hash == hash && !strcmp (lazy->name, mbname))
+        {
+          return lazy;
+        }
+    }
+
+  return NULL;
+}
+
+/**
+ * Grow hash table of lazy modules if it's too dense
+ */
+static void
+grow_lazy_modules (void)
+{
+  unsigned long i, size = MAX (lazy_size * 2, REGISTRY_MIN_SIZE);
+  lazy_module_t **table, *lazy, *next;
+
+  if (lazy_count < lazy_size)
+    {
+      return;
+    }
+
+  table = calloc (size, sizeof (lazy_module_t*));
+
+  for (i = 0; i < lazy_size; ++i)
+    {
+      for (lazy = lazy_modules[i]; lazy; lazy = next)
+        {
+          next = lazy->next;
+          lazy->next = table[lazy->hash & (size - 1)];
+          table[lazy->hash & (size - 1)] = lazy;
+        }
+    }
+
+  free (lazy_modules);
+  lazy_modules = table;
+  lazy_size = size;
+}
+
+/**
+ * Free all lazy modules
+ */
+static void
+free_lazy_modules (void)
+{
+  unsigned long i;
+  lazy_module_t *lazy, *next;
+
+  for (i = 0; i < lazy_size; ++i)
+    {
+      for (lazy = lazy_modules[i]; lazy; lazy = next)
+        {
+          next = lazy->next;
+          free (lazy->name);
+          free (lazy);
+        }
+    }
+
+  SAFE_FREE (lazy_modules);
+  lazy_size = lazy_count = 0;
+}
+
+/****
+ * Importer of lazy and bundled modules
+ */
+
+/* Importer's find_module(fullname, path=None) */
+PY_METHOD(lazy_find_module)
+  const char *name;
+  PyObject *path = NULL;
+  lazy_module_t *lazy;
+
+  if (!PyArg_ParseTuple (__args, "s|O", &name, &path))
+    {
+      return NULL;
+    }
+
+  lazy = find_lazy_module (name);
+
+  if ((lazy || py_bundle_has_module (name)) && lazy_importer)
+    {
+      Py_INCREF (lazy_importer);
+      return lazy_importer;
+    }
+PY_METH_END
+
+/* Importer's load_module(fullname) */
+PY_METHOD(lazy_load_module)
+  const char *name;
+  lazy_module_t *lazy;
+  PyObject *module;
+
+  if (!PyArg_ParseTuple (__args, "s", &name))
+    {
+      return NULL;
+    }
+
+  lazy = find_lazy_module (name);
+
+  if (!lazy)
+    {
+      return py_bundle_load_module (name);
+    }
+
+  module = PyDict_GetItemString (PyImport_GetModuleDict (), name);
+
+  if (!module)
+    {
+      py_timeline_begin (name, "init");
+      lazy->init ();
+      py_timeline_end ();
+
+      if (PyErr_Occurred ())
+        {
+          return NULL;
+        }
+
+      module = PyDict_GetItemString (PyImport_GetModuleDict (), name);
+
+      if (!module)
+        {
+          PyErr_Format (PyExc_ImportError,
+                        "Initialization of %s did not create module", name);
+          return NULL;
+        }
+    }
+
+  Py_INCREF (module);
+  return module;
+PY_METH_END
+
+PY_BEGIN_STATIC_METHMAP(lazy_importer_methods)
+  PY_STATIC_METHMAP_DEF ("find_module", lazy_find_module,
+                         METH_VARARGS, "Find lazy or bundled module")
+  PY_STATIC_METHMAP_DEF ("load_module", lazy_load_module,
+                         METH_VARARGS, "Initialize lazy or bundled module")
+PY_END_STATIC_METHMAP
+
+/**
+ * Install importer of lazy and bundled modules to sys.meta_path
+ *
+ * Importer is called by Python for every module which is not imported
+ * yet, so it's installed only when there is lazy module or mounted
+ * archive to find.
+ *
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_module_install_importer (void)
+{
+  PyObject *meta_path, *dict;
+  PyMethodDef *def;
+
+  if (lazy_importer || !Py_IsInitialized ())
+    {
+      return 0;
+    }
+
+  if (!lazy_count && !py_bundle_is_mounted ())
+    {
+      return 0;
+    }
+
+  meta_path = PySys_GetObject ("meta_path");
+
+  if (!meta_path || !PyList_Check (meta_path))
+    {
+      return -1;
+    }
+
+  /* Importer is not added to sys.modules, it's reachable */
+  /* from sys.meta_path only */
+  lazy_importer = PyModule_New ("CoreLazyImporter");
+  dict = PyModule_GetDict (lazy_importer);
+
+  for (def = lazy_importer_methods; def->ml_name; ++def)
+    {
+      PyObject *func = PyCFunction_NewEx (def, NULL, NULL);
+
+      PyDict_SetItemString (dict, def->ml_name, func);
+      Py_DECREF (func);
+    }
+
+  return PyList_Append (meta_path, lazy_importer);
+}
+
+/**
+ * Uninstall importer of lazy and bundled modules
+ */
+static void
+uninstall_lazy_importer (void)
+{
+  Py_CLEAR (lazy_importer);
+}
+
+/****
+ * Common Python methods
+ */
+
+/**
+ * Initialize Python sub-system
+ *
+ * @param argc - count of arguments
+ * @param argv - argument values
+ * @param inittab_module - list of init-tab modules
+ * @return zero on success, non-zero otherwise
+ */
+int
+python_init (int argc, char **argv, struct _inittab *inittab_modules)
+{
+  int count = 3;
+  const char *version;
+  char *blank_ptr;
+
+  static int argc_copy = 0;
+  static char **argv_copy = NULL;
+  int first_time = argc;
+  unsigned long long start;
+  int i;
+
+  if (first_time)
+    {
+      argc_copy = argc;
+      argv_copy = argv;
+
+      MBS2WCS (progname, argv[0]);
+    }
+
+  Py_SetProgramName (PROGRAM_NAME);
+
+  /* Print python version */
+  if (!(startup_profile & PY_STARTUP_QUIET))
+    {
+      version = Py_GetVersion ();
+      blank_ptr = strchr (version, ' ');
+
+      if (blank_ptr)
+        {
+          count = blank_ptr - version;
+        }
+
+      printf ("Compiled with Python version %.*s.\n", count, version);
+    }
+
+  /* Initialize the TOP-LEVEL modules */
+  PyImport_ExtendInittab (inittab_modules);
+
+  for (i = 0; i < PY_PHASE_COUNT; ++i)
+    {
+      startup_phases[i].state = PY_PHASE_SKIPPED;
+      startup_phases[i].ns = 0;
+    }
+
+  /* Site module is imported by probe_site() instead of Py_Initialize(), */
+  /* so its cost is reported as separate phase */
+  Py_NoSiteFlag = 1;
+
+  start = py_stats_now ();
+  Py_Initialize ();
+
+  if (py_module_install_importer ())
+    {
+      return -1;
+    }
+
+  PySys_SetArgv (argc_copy, argv_copy);
+
+  /* Initialize thread support */
+  PyEval_InitThreads ();
+  phase_done (PY_PHASE_INITIALIZE, start, PY_PHASE_DONE);
+
+  start = py_stats_now ();
+  init_syspath ();
+  phase_done (PY_PHASE_SYSPATH, start, PY_PHASE_DONE);
+
+  if (!(startup_profile & PY_STARTUP_NO_SITE))
+    {
+      start = py_stats_now ();
+      probe_site (first_time);
+      phase_done (PY_PHASE_SITE, start, PY_PHASE_DONE);
+    }
+
+  deferred_phases = startup_profile & (PY_STARTUP_LAZY_TRACER |
+                                       PY_STARTUP_LAZY_BUILTINS);
+
+  if (deferred_phases & PY_STARTUP_LAZY_TRACER)
+    {
+      startup_phases[PY_PHASE_TRACER].state = PY_PHASE_DEFERRED;
+    }
+  else
+    {
+      start = py_stats_now ();
+
+      if (py_tracer_init ())
+        {
+          return -1;
+        }
+
+      phase_done (PY_PHASE_TRACER, start, PY_PHASE_DONE);
+    }
+
+  start = py_stats_now ();
+
+  if (deferred_phases & PY_STARTUP_LAZY_BUILTINS)
+    {
+      py_builtins_init_lazy ();
+      startup_phases[PY_PHASE_BUILTINS].state = PY_PHASE_DEFERRED;
+    }
+  else
+    {
+      py_builtins_init ();
+      phase_done (PY_PHASE_BUILTINS, start, PY_PHASE_DONE);
+    }
+
+  if (py_get_warmset ())
+    {
+      start = py_stats_now ();
+
+      if (py_warmset_init ())
+        {
+          return -1;
+        }
+
+      phase_done (PY_PHASE_WARMSET, start,
+                  (py_get_warmset () & PY_WARMSET_BACKGROUND) ?
+                    PY_PHASE_BACKGROUND : PY_PHASE_DONE);
+    }
+
+  if (py_watch_init ())
+    {
+      return -1;
+    }
+
+  return 0;
+}
+
+/**
+ * Finalize Python sub-system
+ */
+void
+python_done (void)
+{
+  py_timeline_stop ();
+  py_warmset_done ();
+  py_watch_done ();
+  py_call_done ();
+  py_cache_done ();
+  py_builtins_done ();
+  py_tracer_done ();
+
+  unregister_all_modules ();
+  uninstall_lazy_importer ();
+
+  /* End python */
+  Py_Finalize ();
+
+  free_lazy_modules ();
+  py_bundle_unmount_all ();
+  py_record_types_free ();
+
+  py_pool_clear (&module_pool);
+  py_pool_clear (&script_pool);
+
+  SAFE_FREE (progname);
+}
+
+/****
+ * Python's modules
+ */
+
+/**
+ * Create new Python module
+ *
+ * Names and documentation of methods are converted to multi-byte
+ * strings, which are owned by module's descriptor.
+ *
+ * @param name - name of module
+ * @param descr - module's description
+ * @param methods - module's methods
+ * @return descriptor of new module, NULL if memory is exhausted
+ * @sideeffect allocate memory for output value. Use py_module_free to free
+ */
+py_module_t*
+py_module_new (const wchar_t *name, const wchar_t *descr,
+               py_method_def_t *methods)
+{
+  py_module_t *module;
+  PyMethodDef *methods_list = convert_methods_list (methods);
+
+  if (!methods_list)
+    {
+      return NULL;
+    }
+
+  module = py_module_new_static (name, descr, methods_list);
+
+  if (!module)
+    {
+      free_methods_list (methods_list);
+      return NULL;
+    }
+
+  module->conv_methods = methods_list;
+
+  return module;
+}
+
+/**
+ * Create new Python module from static map of methods
+ *
+ * @param name - name of module
+ * @param descr - module's description
+ * @param methods - module's methods, which are used by Python as-is and
+ *   should not be freed while module is alive
+ * @return descriptor of new module, NULL with Python error set if module
+ *   or its instrumentation wrappers could not be created
+ * @sideeffect allocate memory for output value. Use py_module_free to free
+ */
+py_module_t*
+py_module_new_static (const wchar_t *name, const wchar_t *descr,
+                      PyMethodDef *methods)
+{
+  py_module_t *module;
+  char *mbname, *mbdescr;
+  py_arena_mark_t mark = py_arena_mark ();
+
+  module = py_pool_alloc (&module_pool);
+
+  PY_SCRATCH_WCS2MBS (mbname,  name);
+  PY_SCRATCH_WCS2MBS (mbdescr, descr);
+
+  if (!mbname || !mbdescr)
+    {
+      py_arena_release (mark);
+      py_pool_free (&module_pool, module);
+      PyErr_NoMemory ();
+      return NULL;
+    }
+
+  module->name = wcsdup (name);
+  module->descr = wcsdup (descr);
+  module->methods = methods;
+
+  if (instrumentation)
+    {
+      module->handle = Py_InitModule3 (mbname, NULL, mbdescr);
+
+      if (module->handle)
+        {
+          module->dict = PyModule_GetDict (module->handle);
+
+          if (add_wrapped_methods (module, mbname))
+            {
+              PyObject *type, *value, *traceback;
+
+              /* Don't leave module without methods importable */
+              PyErr_Fetch (&type, &value, &traceback);
+              PyDict_DelItemString (PyImport_GetModuleDict (), mbname);
+              PyErr_Restore (type, value, traceback);
+
+              module->handle = NULL;
+            }
+        }
+    }
+  else
+    {
+      module->handle = Py_InitModule3 (mbname, methods, mbdescr);
+
+      if (module->handle)
+        {
+          module->dict = PyModule_GetDict (module->handle);
+        }
+    }
+
+  if (!module->handle)
+    {
+      py_arena_release (mark);
+      SAFE_FREE (module->name);
+      SAFE_FREE (module->descr);
+      py_pool_free (&module_pool, module);
+      return NULL;
+    }
+
+  /* Py_InitModule3() returns borrowed reference, but descriptor */
+  /* owns the module until py_module_free() */
+  Py_INCREF (module->handle);
+
+  register_module (module, mbname);
+
+  py_arena_release (mark);
+
+  return module;
+}
+
+/**
+ * Free Python module
+ *
+ * @param nodule - module to be freed
+ */
+void
+py_module_free (py_module_t *module)
+{
+  if (!module)
+    {
+      return;
+    }
+
+  unregister_module (module);
+
+  free_wrapped_methods (module);
+  Py_DECREF (module->handle);
+  free_methods_list (module->conv_methods);
+
+  SAFE_FREE (module->name);
+  SAFE_FREE (module->descr);
+
+  py_pool_free (&module_pool, module);
+}
+
+/**
+ * Set instrumentation flags for modules created after this call
+ *
+ * @param flags - combination of PY_INSTRUMENT_xxx flags
+ */
+void
+py_set_instrumentation (int flags)
+{
+  instrumentation = flags;
+}
+
+/**
+ * Get instrumentation flags
  *
- * @return Python dictionary object
- * @sideeffect allocate memory for output value
+ * @return combination of PY_INSTRUMENT_xxx flags
  */
-static PyObject*
-create_global_dictionary (void)
+int
+py_get_instrumentation (void)
 {
-  PyObject *dict = PyDict_New ();
-
-  PyDict_SetItemString (dict, "__builtins__", py_builtins_get_global ());
-  extpy_dict_set_item_str (dict, L"__name__",
-                           PyString_FromString ( "__main__" ));
-
-  PyDict_Merge (dict, py_builtins_get_local (), 0);
-
-  return dict;
+  return instrumentation;
 }
 
 /**
- * Delete a given Python dictionary object
+ * Set startup profile for next calls of python_init()
  *
- * @param dict - dictionary to b ereleased
+ * @param flags - combination of PY_STARTUP_xxx flags
  */
-static void
-release_global_dictionary (PyObject *dict)
+void
+py_set_startup_profile (int flags)
 {
-  PyDict_Clear (dict);
-
-  /* Release dictionary */
-  Py_DECREF (dict);
+  startup_profile = flags;
 }
 
 /**
- * Register module in list
+ * Get startup profile
  *
- * @param module - module to be registered
+ * @return combination of PY_STARTUP_xxx flags
  */
-static void
-register_module (py_module_t *module)
+int
+py_get_startup_profile (void)
 {
-  modules = realloc (modules, (modules_count + 1) * sizeof (py_module_t*));
-  modules[modules_count++] = module;
+  return startup_profile;
 }
 
 /**
- * Unregister module from list
+ * Get timing of startup phase
  *
- * @param module - module to be unregistered
+ * Timings are reset by each call of python_init(). Time of deferred
+ * phase is filled in when the phase is done by first run.
+ *
+ * @param phase - phase of startup (PY_PHASE_xxx)
+ * @return timing of phase or NULL if phase is unknown
  */
-static void
-unregister_module (py_module_t *module)
+const py_startup_phase_t*
+py_startup_phase (int phase)
 {
-  long i;
-  int found = 0;
-
-  for (i = 0; i < modules_count; ++i)
+  if (phase < 0 || phase >= PY_PHASE_COUNT)
     {
-      if (modules[i] == module)
-        {
-          found = 1;
-          break;
-        }
+      return NULL;
     }
 
-  if (found)
-    {
-      /* Shift modules */
-      if (i < modules_count - 1)
-        {
-          modules[i] = modules[modules_count - 1];
-        }
-
-      --modules_count;
-      if (!modules_count)
-        {
-          free (modules);
-          modules = NULL;
-        }
-      else
-        {
-          modules = realloc (modules, modules_count * sizeof (py_module_t*));
-        }
-    }
+  return &startup_phases[phase];
 }
 
 /**
- * Unregister all modules from list
+ * Print timings of startup phases
+ *
+ * @param stream - stream to print to
  */
-static void
-unregister_all_modules (void)
+void
+py_startup_report (FILE *stream)
 {
-  while (modules)
+  static const char *states[] = {"skipped", "deferred", "", "on first run",
+                                 "in background"};
+  unsigned long long total = 0;
+  int i;
+
+  fprintf (stream, "Startup phases:\n");
+
+  for (i = 0; i < PY_PHASE_COUNT; ++i)
     {
-      py_module_free (modules[0]);
+      const py_startup_phase_t *phase = &startup_phases[i];
+
+      if (phase->state == PY_PHASE_DONE)
+        {
+          total += phase->ns;
+        }
+
+      fprintf (stream, "  %-12s %10.3f ms  %s\n", phase->name,
+               phase->ns / 1e6, states[phase->state]);
     }
-}
 
-/****
- * Common Python methods
- */
+  fprintf (stream, "  %-12s %10.3f ms\n", "total", total / 1e6);
+}
 
 /**
- * Initialize Python sub-system
+ * Register module which is initialized on its first import
  *
- * @param argc - count of arguments
- * @param argv - argument values
- * @param inittab_module - list of init-tab modules
+ * Could be called before and after python_init(). Registering module
+ * with the same name again replaces its init procedure.
+ *
+ * @param name - name of module
+ * @param init - procedure which creates module with py_module_new()
  * @return zero on success, non-zero otherwise
  */
 int
-python_init (int argc, char **argv, struct _inittab *inittab_modules)
+py_module_register_lazy (const char *name, void (*init) (void))
 {
-  int count = 3;
-  const char *version;
-  char *blank_ptr;
-
-  static int argc_copy = 0;
-  static char **argv_copy = NULL;
-  int first_time = argc;
-
-  if (first_time)
-    {
-      argc_copy = argc;
-      argv_copy = argv;
-
-      MBS2WCS (progname, argv[0]);
-    }
-
-  Py_SetProgramName (PROGRAM_NAME);
+  lazy_module_t *lazy = find_lazy_module (name), **bucket;
 
-  /* Print python version */
-  version = Py_GetVersion ();
-  blank_ptr = strchr (version, ' ');
-
-  if (blank_ptr)
+  if (lazy)
     {
-      count = blank_ptr - version;
+      lazy->init = init;
+      return 0;
     }
 
-  printf ("Compiled with Python version %.*s.\n", count, version);
-
-
-  /* Initialize the TOP-LEVEL modules */
-  PyImport_ExtendInittab (inittab_modules);
+  grow_lazy_modules ();
 
-  Py_Initialize ();
+  MALLOC_ZERO (lazy, sizeof (lazy_module_t));
+  lazy->name = strdup (name);
+  lazy->hash = name_hash (name);
+  lazy->init = init;
 
-  PySys_SetArgv (argc_copy, argv_copy);
+  bucket = &lazy_modules[lazy->hash & (lazy_size - 1)];
+  lazy->next = *bucket;
+  *bucket = lazy;
+  ++lazy_count;
 
-  /* Initialize thread support */
-  PyEval_InitThreads ();
+  return py_module_install_importer ();
+}
 
-  init_syspath (first_time);
+/**
+ * Find created module by name
+ *
+ * @param name - name of module
+ * @return descriptor of module or NULL if module is not created yet
+ */
+py_module_t*
+py_module_lookup (const wchar_t *name)
+{
+  py_arena_mark_t mark = py_arena_mark ();
+  py_module_t *module = NULL;
+  unsigned long hash;
+  char *mbname;
 
-  if (py_tracer_init ())
+  if (!modules)
     {
-      return -1;
+      return NULL;
     }
 
-  if (!py_builtins_init ())
+  PY_SCRATCH_WCS2MBS (mbname, name);
+
+  if (!mbname)
     {
+      py_arena_release (mark);
+      return NULL;
     }
 
-  return 0;
-}
-
-/**
- * Finalize Python sub-system
- */
-void
-python_done (void)
-{
-  py_builtins_done ();
-  py_tracer_done ();
+  hash = name_hash (mbname);
 
-  unregister_all_modules ();
+  for (module = modules[hash & (modules_size - 1)]; module;
+       module = module->hash_next)
+    {
+      if (module->hash == hash && !wcscmp (module->name, name))
+        {
+          break;
+        }
+    }
 
-  /* End python */
-  Py_Finalize ();
+  py_arena_release (mark);
 
-  SAFE_FREE (progname);
+  return module;
 }
 
-/****
- * Python's modules
- */
-
 /**
- * Create new Python module
+ * Get module by name, importing it if it's not created yet
  *
  * @param name - name of module
- * @param descr - module's description
- * @param methods - module's methods
- * @return descriptor of new module
- * @sideeffect allocate memory for output value. Use py_module_free to free
+ * @return descriptor of module or NULL if there is no such module
  */
 py_module_t*
-py_module_new (const wchar_t *name, const wchar_t *descr,
-               py_method_def_t *methods)
+py_module_import (const wchar_t *name)
 {
-  py_module_t *module;
-  char *mbname, *mbdescr;
-  PyMethodDef *methods_list;
-
-  methods_list = convert_methods_list (methods);
-
-  MALLOC_ZERO (module, sizeof (py_module_t));
+  py_module_t *module = py_module_lookup (name);
+  py_arena_mark_t mark;
+  PyObject *handle;
+  char *mbname;
 
-  WCS2MBS (mbname,  name);
-  WCS2MBS (mbdescr, descr);
+  if (module)
+    {
+      return module;
+    }
 
-  module->name = wcsdup (name);
-  module->descr = wcsdup (descr);
-  module->handle = Py_InitModule3 (mbname, methods_list, mbdescr);
-  module->dict = PyModule_GetDict (module->handle);
-  module->conv_methods = methods_list;
+  mark = py_arena_mark ();
+  PY_SCRATCH_WCS2MBS (mbname, name);
 
-  SAFE_FREE (mbname);
-  SAFE_FREE (mbdescr);
+  if (!mbname)
+    {
+      py_arena_release (mark);
+      return NULL;
+    }
 
-  register_module (module);
+  handle = PyImport_ImportModule (mbname);
 
-  return module;
-}
+  py_arena_release (mark);
 
-/**
- * Free Python module
- *
- * @param nodule - module to be freed
- */
-void
-py_module_free (py_module_t *module)
-{
-  if (!module)
+  if (!handle)
     {
-      return;
+      PyErr_Clear ();
+      return NULL;
     }
 
-  unregister_module (module);
-
-  free_methods_list (module->conv_methods);
-  Py_DECREF (module->handle);
-
-  SAFE_FREE (module->name);
-  SAFE_FREE (module->descr);
+  Py_DECREF (handle);
 
-  SAFE_FREE (module);
+  return py_module_lookup (name);
 }
 
 /**
@@ -512,7 +1515,7 @@ py_script_new_buffer (const wchar_t *buffer)
 {
   py_script_t *script;
 
-  MALLOC_ZERO (script, sizeof (py_script_t));
+  script = py_pool_alloc (&script_pool);
 
   script->script = wcsdup (buffer);
 
@@ -534,17 +1537,19 @@ py_script_new_file (const wchar_t *file_name)
   py_script_t *script;
   wchar_t *wcbuf;
   FILE *file;
+  py_arena_mark_t mark = py_arena_mark ();
 
-  WCS2MBS (mbfn, file_name);
+  PY_SCRATCH_WCS2MBS (mbfn, file_name);
 
   if (!mbfn)
     {
+      py_arena_release (mark);
       return NULL;
     }
 
   if (stat (mbfn, &st))
     {
-      free (mbfn);
+      py_arena_release (mark);
       return NULL;
     }
 
@@ -552,30 +1557,93 @@ py_script_new_file (const wchar_t *file_name)
 
   if (!file)
     {
-      free (mbfn);
+      py_arena_release (mark);
+      return NULL;
+    }
+
+  buffer = py_arena_alloc (sizeof (char) * (st.st_size + 1));
+
+  if (!buffer)
+    {
+      fclose (file);
+      py_arena_release (mark);
       return NULL;
     }
 
-  buffer = malloc (sizeof (char) * (st.st_size + 1));
   fread (buffer, sizeof (char), st.st_size / sizeof (char), file);
   buffer[st.st_size] = '\0';
   fclose (file);
 
-  MBS2WCS (wcbuf, buffer);
+  PY_SCRATCH_MBS2WCS (wcbuf, buffer);
 
   if (!wcbuf)
     {
-      free (buffer);
-      free (mbfn);
+      py_arena_release (mark);
       return NULL;
     }
 
   script = py_script_new_buffer (wcbuf);
   script->file_name = wcsdup (file_name);
 
-  free (buffer);
-  free (wcbuf);
-  free (mbfn);
+  py_arena_release (mark);
+
+  return script;
+}
+
+/**
+ * Create script from frozen module
+ *
+ * Script is created already compiled, so there is no source text.
+ *
+ * @param name - name of frozen module
+ * @return new script's descriptor or NULL if module is not found
+ * @sideeffect allocate memory for return value. Use py_script_free() to free
+ */
+py_script_t*
+py_script_new_frozen (const wchar_t *name)
+{
+  PyObject *code;
+  py_script_t *script;
+  wchar_t *file_name;
+  char *mbname;
+  py_arena_mark_t mark;
+
+  /* Error of lookup is reported to captured stderr */
+  finish_startup ();
+
+  mark = py_arena_mark ();
+  PY_SCRATCH_WCS2MBS (mbname, name);
+
+  if (!mbname)
+    {
+      py_arena_release (mark);
+      return NULL;
+    }
+
+  code = py_frozen_get_code (mbname);
+
+  py_arena_release (mark);
+
+  if (!code)
+    {
+      PyErr_Print ();
+      return NULL;
+    }
+
+  script = py_pool_alloc (&script_pool);
+  script->compiled = code;
+
+  /* __file__ of frozen script is the file it was frozen from */
+  mark = py_arena_mark ();
+  PY_SCRATCH_MBS2WCS (file_name,
+                      PyString_AsString (((PyCodeObject*)code)->co_filename));
+
+  if (file_name)
+    {
+      script->file_name = wcsdup (file_name);
+    }
+
+  py_arena_release (mark);
 
   return script;
 }
@@ -597,7 +1665,8 @@ py_script_free (py_script_t *script)
 
   SAFE_FREE (script->file_name);
   SAFE_FREE (script->script);
-  SAFE_FREE (script);
+
+  py_pool_free (&script_pool, script);
 }
 
 /**
@@ -625,19 +1694,31 @@ py_script_free_compiled (py_script_t *script)
 PyObject*
 py_run_script_at_dict (py_script_t *script, PyObject *dict)
 {
-  char *mbfn = NULL;
   PyObject *result;
   char *filename = "";
+  py_arena_mark_t mark;
 
   if (!script)
     {
       return NULL;
     }
 
+  finish_startup ();
+
+  /* Changed modules are imported again by this run */
+  py_watch_sync ();
+
+  mark = py_arena_mark ();
+
   if (script->file_name)
     {
-      WCS2MBS (mbfn, script->file_name);
-      filename = mbfn;
+      PY_SCRATCH_WCS2MBS (filename, script->file_name);
+
+      if (!filename)
+        {
+          py_arena_release (mark);
+          return PyErr_NoMemory ();
+        }
     }
 
   /* Compile script */
@@ -645,16 +1726,21 @@ py_run_script_at_dict (py_script_t *script, PyObject *dict)
     {
       char *mbscript;
 
-      WCS2MBS (mbscript, script->script);
+      PY_SCRATCH_WCS2MBS (mbscript, script->script);
+
+      if (!mbscript)
+        {
+          py_arena_release (mark);
+          return PyErr_NoMemory ();
+        }
 
       script->compiled = Py_CompileString (mbscript, filename, Py_file_input);
-      free (mbscript);
 
       if (PyErr_Occurred ())
         {
           /* Compilation error occurred */
           PyErr_Print ();
-          SAFE_FREE (mbfn);
+          py_arena_release (mark);
           py_script_free_compiled (script);
           return NULL;
         }
@@ -663,7 +1749,8 @@ py_run_script_at_dict (py_script_t *script, PyObject *dict)
   extpy_dict_set_item_str (dict, L"__file__",
                            PyString_FromString (filename));
 
-  SAFE_FREE (mbfn);
+  /* Temporaries are not needed while the script runs */
+  py_arena_release (mark);
 
   PyErr_Clear ();
   result = PyEval_EvalCode ((PyCodeObject*)script->compiled, dict, dict);
@@ -688,6 +1775,12 @@ py_run_script (py_script_t *script)
   PyObject *dict = create_global_dictionary ();
   PyObject *result;
 
+  if (!dict)
+    {
+      PyErr_Print ();
+      return NULL;
+    }
+
   result = py_run_script_at_dict (script, dict);
 
   release_global_dictionary (dict);
@@ -705,9 +1798,21 @@ py_run_script (py_script_t *script)
 PyObject*
 py_run_file_at_dict (const wchar_t *file_name, PyObject *dict)
 {
+  py_cached_script_t *cached;
   py_script_t *script;
   PyObject *result;
 
+  /* Compiled script is reused while its file is not changed */
+  cached = py_watch_acquire_script (file_name);
+
+  if (cached)
+    {
+      result = py_run_script_at_dict (cached->script, dict);
+      py_watch_release_script (cached);
+
+      return result;
+    }
+
   script = py_script_new_file (file_name);
 
   if (!script)
@@ -715,7 +1820,7 @@ py_run_file_at_dict (const wchar_t *file_name, PyObject *dict)
       return NULL;
     }
 
-  result = py_run_script (script);
+  result = py_run_script_at_dict (script, dict);
   py_script_free (script);
 
   return result;
@@ -733,6 +1838,12 @@ py_run_file (const wchar_t *file_name)
   PyObject *dict = create_global_dictionary ();
   PyObject *result;
 
+  if (!dict)
+    {
+      PyErr_Print ();
+      return NULL;
+    }
+
   result = py_run_file_at_dict (file_name, dict);
 
   release_global_dictionary (dict);
@@ -740,6 +1851,31 @@ py_run_file (const wchar_t *file_name)
   return result;
 }
 
+/**
+ * Create global dictionary for running of scripts
+ *
+ * @return new dictionary or NULL with Python error set
+ */
+PyObject*
+py_global_dictionary_new (void)
+{
+  return create_global_dictionary ();
+}
+
+/**
+ * Release global dictionary
+ *
+ * Dictionary is cleared to break cycles between it and functions
+ * which are defined by script.
+ *
+ * @param dict - dictionary to release
+ */
+void
+py_global_dictionary_free (PyObject *dict)
+{
+  release_global_dictionary (dict);
+}
+
 /****
  * Other helpers
  */
@@ -757,17 +1893,25 @@ py_module_add_int_constant (py_module_t *module, wchar_t *name, long value)
 {
   char *mbname;
   int res;
-
-  WCS2MBS (mbname, name);
+  py_arena_mark_t mark;
 
   if (!name)
     {
       return -1;
     }
 
+  mark = py_arena_mark ();
+  PY_SCRATCH_WCS2MBS (mbname, name);
+
+  if (!mbname)
+    {
+      py_arena_release (mark);
+      return -1;
+    }
+
   res = PyModule_AddIntConstant (module->handle, mbname, value);
 
-  free (mbname);
+  py_arena_release (mark);
 
   return res;
 }
@@ -34,6 +34,23 @@ BEGIN_HEADER
   {NULL, NULL, 0, NULL} \
 };
 
+/* Static maps of methods are passed to Python as-is, so names and */
+/* documentation are narrow-char literals and nothing is converted */
+/* when module is created. Use them with py_module_new_static(). */
+#define PY_BEGIN_STATIC_METHMAP(map_name) \
+  static PyMethodDef map_name[] = {
+
+#define PY_STATIC_METHMAP_DEF(name, meth, flag, doc) \
+  {PY_NARROW_LITERAL (name), (PyCFunction)(meth), flag, \
+   PY_NARROW_LITERAL (doc)},
+
+/* Fail compilation if wide-char literal is passed instead of narrow one */
+#define PY_NARROW_LITERAL(str) \
+  ((str) + 0 * sizeof (char[sizeof (*(str)) == 1 ? 1 : -1]))
+
+#define PY_END_STATIC_METHMAP \
+  PY_END_METHMAP
+
 #define PY_METHOD_FORWARD(name) \
   static PyObject* \
   name (PyObject *__self, PyObject *__args);
@@ -64,7 +81,21 @@ BEGIN_HEADER
 #define PY_INITTAB_PROC(proc_name, module_name, doc, methods) \
   static void \
   proc_name (void) { \
-    py_module_t *__module = py_module_new (module_name, doc, methods);
+    py_module_t *__module = py_module_new (module_name, doc, methods); \
+    if (!__module) \
+      { \
+        return; \
+      }
+
+#define PY_INITTAB_STATIC_PROC(proc_name, module_name, doc, methods) \
+  static void \
+  proc_name (void) { \
+    py_module_t *__module = py_module_new_static (module_name, doc, \
+                                                  methods); \
+    if (!__module) \
+      { \
+        return; \
+      }
 
 #define PY_INITTAB_END_PROC \
   }
@@ -88,6 +119,59 @@ python_init (int argc, char **argv, struct _inittab *inittab_modules);
 void
 python_done (void);
 
+/* Flags of startup profile */
+enum {
+  PY_STARTUP_NO_SITE       = 0x0001, /* Do not import site module */
+  PY_STARTUP_QUIET         = 0x0002, /* Do not print banner and probes */
+  PY_STARTUP_LAZY_TRACER   = 0x0004, /* Capture output from first run */
+  PY_STARTUP_LAZY_BUILTINS = 0x0008, /* Create CoreBuiltins on first use */
+
+  PY_STARTUP_FAST          = 0x000f  /* All of the above */
+};
+
+/* Phases of startup */
+enum {
+  PY_PHASE_INITIALIZE, /* Py_Initialize() and threads support */
+  PY_PHASE_SYSPATH,    /* Appending program's directory to sys.path */
+  PY_PHASE_SITE,       /* Probe of site module */
+  PY_PHASE_TRACER,     /* Capturing of stdout and stderr */
+  PY_PHASE_BUILTINS,   /* Creation of CoreBuiltins */
+  PY_PHASE_WARMSET,    /* Preloading of warm set */
+
+  PY_PHASE_COUNT
+};
+
+/* States of startup phase */
+enum {
+  PY_PHASE_SKIPPED,     /* Phase is not needed by profile */
+  PY_PHASE_DEFERRED,    /* Phase is postponed until first run */
+  PY_PHASE_DONE,        /* Phase is done by python_init() */
+  PY_PHASE_DONE_LAZILY, /* Deferred phase is done by first run */
+  PY_PHASE_BACKGROUND   /* Phase is started in background */
+};
+
+typedef struct {
+  const char *name;
+  int state;
+  unsigned long long ns; /* Time spent in phase */
+} py_startup_phase_t;
+
+/* Set startup profile for next calls of python_init() */
+void
+py_set_startup_profile (int flags);
+
+/* Get startup profile */
+int
+py_get_startup_profile (void);
+
+/* Get timing of startup phase */
+const py_startup_phase_t*
+py_startup_phase (int phase);
+
+/* Print timings of startup phases */
+void
+py_startup_report (FILE *stream);
+
 /****
  * Python's modules
  */
@@ -101,24 +185,76 @@ typedef struct {
 } py_method_def_t;
 
 typedef struct {
+  PyMethodDef def;  /* Definition which is passed to Python */
+  PyCFunction meth; /* Wrapped implementation of method */
+  char *full_name;  /* Name of method in form Module.method */
+
+  struct py_stats *stats; /* Statistics of calls (NULL if not collected) */
+} py_method_wrapper_t;
+
+typedef struct py_module {
   wchar_t *name;  /* Module's name */
   wchar_t *descr; /* Module's description */
 
   PyObject *handle; /* Python handle of module */
   PyObject *dict;   /* Module's dictionary */
 
-  PyMethodDef *conv_methods; /* Module's initial methods */
+  PyMethodDef *methods; /* Module's initial methods */
+  PyMethodDef *conv_methods; /* Methods converted from wide-char map */
+
+  /* Instrumentation wrappers of methods (NULL if not instrumented) */
+  py_method_wrapper_t *wrappers;
+  long wrappers_count;
+
+  /* Registry of modules */
+  unsigned long hash;           /* Hash of module's name */
+  struct py_module *hash_next;  /* Next module in registry's bucket */
 } py_module_t;
 
+/* Flags of instrumentation of registered C methods */
+enum {
+  PY_INSTRUMENT_TIMELINE = 0x0001, /* Record calls to the timeline */
+  PY_INSTRUMENT_STATS    = 0x0002  /* Collect counters and latencies */
+};
+
 /* Create new Python module */
 py_module_t*
 py_module_new (const wchar_t *name, const wchar_t *descr,
                py_method_def_t *methods);
 
+/* Create new Python module from static map of methods */
+py_module_t*
+py_module_new_static (const wchar_t *name, const wchar_t *descr,
+                      PyMethodDef *methods);
+
 /* Free Python module */
 void
 py_module_free (py_module_t *module);
 
+/* Set instrumentation flags for modules created after this call */
+void
+py_set_instrumentation (int flags);
+
+/* Get instrumentation flags */
+int
+py_get_instrumentation (void);
+
+/* Register module which is initialized on its first import */
+int
+py_module_register_lazy (const char *name, void (*init) (void));
+
+/* Install importer of lazy and bundled modules if there are any */
+int
+py_module_install_importer (void);
+
+/* Find created module by name */
+py_module_t*
+py_module_lookup (const wchar_t *name);
+
+/* Get module by name, importing it if it's not created yet */
+py_module_t*
+py_module_import (const wchar_t *name);
+
 /****
  * Scripts
  */
@@ -137,6 +273,10 @@ py_script_new_buffer (const wchar_t *buffer);
 py_script_t*
 py_script_new_file (const wchar_t *file_name);
 
+/* Create script from frozen module */
+py_script_t*
+py_script_new_frozen (const wchar_t *name);
+
 /* Free Python script */
 void
 py_script_free (py_script_t *scrint);
@@ -165,6 +305,14 @@ py_run_file_at_dict (const wchar_t *file_name, PyObject *dict);
 PyObject*
 py_run_file (const wchar_t *file_name);
 
+/* Create global dictionary for running of scripts */
+PyObject*
+py_global_dictionary_new (void);
+
+/* Release global dictionary */
+void
+py_global_dictionary_free (PyObject *dict);
+
 /****
  * Other helpers
  */
@@ -181,10 +329,26 @@ py_syspath_append (wchar_t *dirname);
  * Extensions
  */
 
+#include "utf8.h"
+#include "arena.h"
 #include "tracer.h"
 #include "extpy.h"
 #include "proc.h"
 #include "builtins.h"
+#include "timeline.h"
+#include "stats.h"
+#include "warmset.h"
+#include "bundle.h"
+#include "frozen.h"
+#include "watch.h"
+#include "array.h"
+#include "record.h"
+#include "call.h"
+#include "batch.h"
+#include "coro.h"
+#include "fileio.h"
+#include "events.h"
+#include "cache.h"
 
 END_HEADER
 
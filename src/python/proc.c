@@ -23,6 +23,7 @@ py_proc_write (int stream, const wchar_t *format, ...)
   PyObject *mod_sys, *dict_sys, *io, *write, *result = NULL;
   wchar_t buffer[4096];
   char *mbbuf;
+  py_arena_mark_t mark;
 
   mod_sys = PyImport_ImportModule ("sys");
   dict_sys = PyModule_GetDict (mod_sys);
@@ -40,10 +41,12 @@ py_proc_write (int stream, const wchar_t *format, ...)
       return -1;
     }
 
-  WCS2MBS (mbbuf, buffer);
+  mark = py_arena_mark ();
+  PY_SCRATCH_WCS2MBS (mbbuf, buffer);
 
   if (!mbbuf)
     {
+      py_arena_release (mark);
       Py_DECREF (mod_sys);
       Py_DECREF (write);
       return -1;
@@ -59,7 +62,7 @@ py_proc_write (int stream, const wchar_t *format, ...)
   Py_DECREF (write);
   Py_DECREF (mod_sys);
 
-  free (mbbuf);
+  py_arena_release (mark);
 
   return result != NULL;
 }
@@ -0,0 +1,786 @@
+/**
+ * Record types whose fields are stored in C structures
+ *
+ * py_record_type_new() creates a type from a table of descriptors of
+ * fields of a C structure. Instances of the type keep the structure
+ * inline right after the object's header, so C code accesses fields
+ * directly and scripts access them through getset descriptors of the
+ * type, without instance dictionary. Attribute access compares interned
+ * name with interned names of fields before generic lookup, so common
+ * `record.field' doesn't walk dictionaries of type and its bases.
+ *
+ * Array of records keeps structures in a single contiguous block.
+ * Items of array are records which point into the block and keep the
+ * array alive.
+ *
+ * Records don't participate in cyclic garbage collection, so cycles
+ * through fields of PY_FIELD_OBJECT type are not collected.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+/* Alignment of structure inside of record */
+#define RECORD_ALIGN 16
+
+#define ALIGN_UP(size) \
+  (((size) + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1))
+
+/* Record type */
+typedef struct record_type {
+  PyTypeObject type;        /* Should be first, type is used as Python's one */
+
+  const py_field_t *fields;
+  size_t struct_size;       /* Size of structure */
+  size_t data_offset;       /* Offset of inline structure in record */
+  PyGetSetDef *getset;
+  PyObject **names;         /* Interned names of fields */
+  long count;               /* Count of fields */
+
+  struct record_type *next; /* Next created record type */
+} record_type_t;
+
+/* Record */
+typedef struct {
+  PyObject_HEAD
+
+  char *data;      /* Structure of record */
+  PyObject *owner; /* Array which owns structure (NULL for inline one) */
+} record_object_t;
+
+/* Array of records */
+typedef struct {
+  PyObject_HEAD
+
+  record_type_t *type;
+  char *block;     /* Structures of records */
+  Py_ssize_t count;
+} record_array_t;
+
+/* All created record types */
+static record_type_t *record_types = NULL;
+
+static PyTypeObject record_array_type;
+static int record_array_ready = 0;
+
+/**
+ * Release references which are stored in structure
+ *
+ * @param type - type of record
+ * @param data - structure of record
+ */
+static void
+clear_fields (record_type_t *type, char *data)
+{
+  const py_field_t *field;
+
+  for (field = type->fields; field->name; ++field)
+    {
+      if (field->type == PY_FIELD_OBJECT)
+        {
+          Py_CLEAR (*(PyObject**)(data + field->offset));
+        }
+    }
+}
+
+/**
+ * Get value of field
+ *
+ * @param self - record
+ * @param field - descriptor of field
+ * @return value of field
+ */
+static PyObject*
+field_get (record_object_t *self, const py_field_t *field)
+{
+  char *ptr = self->data + field->offset;
+
+  switch (field->type)
+    {
+    case PY_FIELD_INT:    return PyInt_FromLong (*(int*)ptr);
+    case PY_FIELD_LONG:   return PyInt_FromLong (*(long*)ptr);
+    case PY_FIELD_FLOAT:  return PyFloat_FromDouble (*(float*)ptr);
+    case PY_FIELD_DOUBLE: return PyFloat_FromDouble (*(double*)ptr);
+    case PY_FIELD_STRING:
+      return PyString_FromStringAndSize (ptr, strnlen (ptr, field->size));
+    case PY_FIELD_OBJECT:
+      {
+        PyObject *value = *(PyObject**)ptr;
+
+        value = value ? value : Py_None;
+        Py_INCREF (value);
+
+        return value;
+      }
+    }
+
+  PyErr_SetString (PyExc_TypeError, "unknown type of record's field");
+  return NULL;
+}
+
+/**
+ * Set value of field
+ *
+ * @param self - record
+ * @param value - new value
+ * @param field - descriptor of field
+ * @return zero on success, non-zero otherwise
+ */
+static int
+field_set (record_object_t *self, PyObject *value, const py_field_t *field)
+{
+  char *ptr = self->data + field->offset;
+
+  if (field->flags & PY_FIELD_READONLY)
+    {
+      PyErr_Format (PyExc_AttributeError, "field %s is read-only",
+                    field->name);
+      return -1;
+    }
+
+  if (!value)
+    {
+      PyErr_Format (PyExc_TypeError, "field %s could not be deleted",
+                    field->name);
+      return -1;
+    }
+
+  switch (field->type)
+    {
+    case PY_FIELD_INT:
+    case PY_FIELD_LONG:
+      {
+        long v = PyInt_AsLong (value);
+
+        if (v == -1 && PyErr_Occurred ())
+          {
+            return -1;
+          }
+
+        if (field->type == PY_FIELD_LONG)
+          {
+            *(long*)ptr = v;
+          }
+        else if (v < INT_MIN || v > INT_MAX)
+          {
+            PyErr_Format (PyExc_OverflowError, "value is out of range of "
+                          "field %s", field->name);
+            return -1;
+          }
+        else
+          {
+            *(int*)ptr = (int)v;
+          }
+
+        return 0;
+      }
+
+    case PY_FIELD_FLOAT:
+    case PY_FIELD_DOUBLE:
+      {
+        double v = PyFloat_AsDouble (value);
+
+        if (v == -1.0 && PyErr_Occurred ())
+          {
+            return -1;
+          }
+
+        if (field->type == PY_FIELD_FLOAT)
+          {
+            *(float*)ptr = (float)v;
+          }
+        else
+          {
+            *(double*)ptr = v;
+          }
+
+        return 0;
+      }
+
+    case PY_FIELD_STRING:
+      {
+        PyObject *str = value;
+        Py_ssize_t len;
+
+        if (PyUnicode_Check (value))
+          {
+            str = PyUnicode_AsUTF8String (value);
+
+            if (!str)
+              {
+                return -1;
+              }
+          }
+        else if (!PyString_Check (value))
+          {
+            PyErr_Format (PyExc_TypeError, "field %s expects string",
+                          field->name);
+            return -1;
+          }
+        else
+          {
+            Py_INCREF (str);
+          }
+
+        len = PyString_GET_SIZE (str);
+
+        /* Terminator is not needed when string fills the field */
+        if ((size_t)len > field->size)
+          {
+            PyErr_Format (PyExc_ValueError, "string is too long for field %s",
+                          field->name);
+            Py_DECREF (str);
+            return -1;
+          }
+
+        memcpy (ptr, PyString_AS_STRING (str), len);
+        memset (ptr + len, 0, field->size - len);
+        Py_DECREF (str);
+
+        return 0;
+      }
+
+    case PY_FIELD_OBJECT:
+      {
+        PyObject *old = *(PyObject**)ptr;
+
+        Py_INCREF (value);
+        *(PyObject**)ptr = value;
+        Py_XDECREF (old);
+
+        return 0;
+      }
+    }
+
+  PyErr_SetString (PyExc_TypeError, "unknown type of record's field");
+  return -1;
+}
+
+/**
+ * Create record which points to structure of array
+ *
+ * @param type - type of record
+ * @param data - structure of record
+ * @param owner - array which owns structure
+ * @return new record
+ */
+static PyObject*
+record_view (record_type_t *type, char *data, PyObject *owner)
+{
+  record_object_t *record;
+
+  record = (record_object_t*)type->type.tp_alloc ((PyTypeObject*)type, 0);
+
+  if (record)
+    {
+      record->data = data;
+      record->owner = owner;
+      Py_INCREF (owner);
+    }
+
+  return (PyObject*)record;
+}
+
+static PyObject*
+record_tp_new (PyTypeObject *type, PyObject *args, PyObject *kw)
+{
+  record_object_t *record;
+
+  record = (record_object_t*)type->tp_alloc (type, 0);
+
+  if (record)
+    {
+      /* Allocator zeroes the whole object, including structure */
+      record->data = (char*)record + ((record_type_t*)type)->data_offset;
+    }
+
+  return (PyObject*)record;
+}
+
+static int
+record_tp_init (record_object_t *self, PyObject *args, PyObject *kw)
+{
+  PyObject *key, *value;
+  Py_ssize_t pos = 0;
+
+  if (PyTuple_GET_SIZE (args))
+    {
+      PyErr_SetString (PyExc_TypeError, "fields of record are set by "
+                       "keyword arguments only");
+      return -1;
+    }
+
+  while (kw && PyDict_Next (kw, &pos, &key, &value))
+    {
+      if (PyObject_SetAttr ((PyObject*)self, key, value))
+        {
+          return -1;
+        }
+    }
+
+  return 0;
+}
+
+/**
+ * Find field by interned name
+ *
+ * @param self - record
+ * @param name - name of attribute
+ * @return descriptor of field or NULL if name is not interned name of field
+ */
+static inline const py_field_t*
+find_field (record_object_t *self, PyObject *name)
+{
+  record_type_t *type = (record_type_t*)self->ob_type;
+  long i;
+
+  for (i = 0; i < type->count; ++i)
+    {
+      if (type->names[i] == name)
+        {
+          return &type->fields[i];
+        }
+    }
+
+  return NULL;
+}
+
+static PyObject*
+record_getattro (record_object_t *self, PyObject *name)
+{
+  const py_field_t *field = find_field (self, name);
+
+  if (field)
+    {
+      return field_get (self, field);
+    }
+
+  return PyObject_GenericGetAttr ((PyObject*)self, name);
+}
+
+static int
+record_setattro (record_object_t *self, PyObject *name, PyObject *value)
+{
+  const py_field_t *field = find_field (self, name);
+
+  if (field)
+    {
+      return field_set (self, value, field);
+    }
+
+  return PyObject_GenericSetAttr ((PyObject*)self, name, value);
+}
+
+static void
+record_dealloc (record_object_t *self)
+{
+  if (self->owner)
+    {
+      Py_DECREF (self->owner);
+    }
+  else
+    {
+      clear_fields ((record_type_t*)self->ob_type, self->data);
+    }
+
+  self->ob_type->tp_free ((PyObject*)self);
+}
+
+static PyObject*
+record_repr (record_object_t *self)
+{
+  record_type_t *type = (record_type_t*)self->ob_type;
+  const py_field_t *field;
+  PyObject *result;
+
+  result = PyString_FromFormat ("%s(", type->type.tp_name);
+
+  for (field = type->fields; result && field->name; ++field)
+    {
+      PyObject *value = field_get (self, field), *repr;
+
+      repr = value ? PyObject_Repr (value) : NULL;
+      Py_XDECREF (value);
+
+      if (!repr)
+        {
+          Py_CLEAR (result);
+          break;
+        }
+
+      PyString_ConcatAndDel (&result, PyString_FromFormat (
+                               "%s%s=%s", field == type->fields ? "" : ", ",
+                               field->name, PyString_AS_STRING (repr)));
+      Py_DECREF (repr);
+    }
+
+  if (result)
+    {
+      PyString_ConcatAndDel (&result, PyString_FromString (")"));
+    }
+
+  return result;
+}
+
+static void
+record_array_dealloc (record_array_t *self)
+{
+  Py_ssize_t i;
+
+  for (i = 0; i < self->count; ++i)
+    {
+      clear_fields (self->type, self->block + i * self->type->struct_size);
+    }
+
+  free (self->block);
+  Py_DECREF (self->type);
+
+  PyObject_Del (self);
+}
+
+static Py_ssize_t
+record_array_length (record_array_t *self)
+{
+  return self->count;
+}
+
+static PyObject*
+record_array_item (record_array_t *self, Py_ssize_t index)
+{
+  if (index < 0 || index >= self->count)
+    {
+      PyErr_SetString (PyExc_IndexError, "record index out of range");
+      return NULL;
+    }
+
+  return record_view (self->type, self->block +
+                      index * self->type->struct_size, (PyObject*)self);
+}
+
+static PySequenceMethods record_array_as_sequence = {
+  (lenfunc)record_array_length,    /* sq_length */
+  0,                               /* sq_concat */
+  0,                               /* sq_repeat */
+  (ssizeargfunc)record_array_item, /* sq_item */
+};
+
+static PyTypeObject record_array_type = {
+  PyObject_HEAD_INIT (NULL)
+  0,                                  /* ob_size */
+  "CoreRecordArray",                  /* tp_name */
+  sizeof (record_array_t),            /* tp_basicsize */
+  0,                                  /* tp_itemsize */
+  (destructor)record_array_dealloc,   /* tp_dealloc */
+  0,                                  /* tp_print */
+  0,                                  /* tp_getattr */
+  0,                                  /* tp_setattr */
+  0,                                  /* tp_compare */
+  0,                                  /* tp_repr */
+  0,                                  /* tp_as_number */
+  &record_array_as_sequence,          /* tp_as_sequence */
+  0,                                  /* tp_as_mapping */
+  0,                                  /* tp_hash */
+  0,                                  /* tp_call */
+  0,                                  /* tp_str */
+  0,                                  /* tp_getattro */
+  0,                                  /* tp_setattro */
+  0,                                  /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                 /* tp_flags */
+  "Array of records stored in contiguous block" /* tp_doc */
+};
+
+/**
+ * Free memory of record type
+ *
+ * References to interned names are not released, type is freed after
+ * interpreter is finalized.
+ *
+ * @param type - type to free
+ */
+static void
+free_type (record_type_t *type)
+{
+  free ((char*)type->type.tp_name);
+  free ((char*)type->type.tp_doc);
+  free (type->getset);
+  free (type->names);
+  free (type);
+}
+
+/**
+ * Check that size of field matches its type
+ *
+ * @param field - descriptor of field
+ * @param struct_size - size of structure
+ * @return zero on success, non-zero with set TypeError otherwise
+ */
+static int
+check_field (const py_field_t *field, size_t struct_size)
+{
+  size_t size;
+
+  switch (field->type)
+    {
+    case PY_FIELD_INT:    size = sizeof (int);       break;
+    case PY_FIELD_LONG:   size = sizeof (long);      break;
+    case PY_FIELD_FLOAT:  size = sizeof (float);     break;
+    case PY_FIELD_DOUBLE: size = sizeof (double);    break;
+    case PY_FIELD_OBJECT: size = sizeof (PyObject*); break;
+    case PY_FIELD_STRING: size = MAX (field->size, 1); break;
+    default:
+      PyErr_Format (PyExc_TypeError, "field %s has unknown type",
+                    field->name);
+      return -1;
+    }
+
+  if (field->size != size)
+    {
+      PyErr_Format (PyExc_TypeError, "size of field %s is %lu, but its "
+                    "type needs %lu", field->name,
+                    (unsigned long)field->size, (unsigned long)size);
+      return -1;
+    }
+
+  if (field->offset + field->size > struct_size)
+    {
+      PyErr_Format (PyExc_TypeError, "field %s is out of structure",
+                    field->name);
+      return -1;
+    }
+
+  return 0;
+}
+
+/********
+ * User's stuff
+ */
+
+/**
+ * Create record type from descriptors of fields of structure
+ *
+ * @param name - name of type
+ * @param doc - documentation of type
+ * @param fields - descriptors of fields terminated by entry with NULL name.
+ *   Table is used as-is and should not be freed while type is alive
+ * @param struct_size - size of structure
+ * @return new type or NULL with set error. TypeError is set if size of
+ *   field does not match its type
+ */
+PyTypeObject*
+py_record_type_new (const char *name, const char *doc,
+                    const py_field_t *fields, size_t struct_size)
+{
+  record_type_t *type;
+  PyTypeObject *tp;
+  long i, count = 0;
+
+  while (fields[count].name)
+    {
+      if (check_field (&fields[count], struct_size))
+        {
+          return NULL;
+        }
+
+      ++count;
+    }
+
+  MALLOC_ZERO (type, sizeof (record_type_t));
+  MALLOC_ZERO (type->getset, sizeof (PyGetSetDef) * (count + 1));
+  MALLOC_ZERO (type->names, sizeof (PyObject*) * (count + 1));
+
+  type->fields = fields;
+  type->count = count;
+  type->struct_size = ALIGN_UP (MAX (struct_size, 1));
+  type->data_offset = ALIGN_UP (sizeof (record_object_t));
+
+  for (i = 0; i < count; ++i)
+    {
+      type->getset[i].name = (char*)fields[i].name;
+      type->getset[i].get = (getter)field_get;
+      type->getset[i].set = (setter)field_set;
+      type->getset[i].doc = (char*)fields[i].doc;
+      type->getset[i].closure = (void*)&fields[i];
+      type->names[i] = PyString_InternFromString (fields[i].name);
+    }
+
+  tp = &type->type;
+  tp->ob_refcnt = 1;
+  tp->ob_type = &PyType_Type;
+  tp->tp_name = strdup (name);
+  tp->tp_doc = doc ? strdup (doc) : NULL;
+  tp->tp_basicsize = type->data_offset + type->struct_size;
+  tp->tp_flags = Py_TPFLAGS_DEFAULT;
+  tp->tp_dealloc = (destructor)record_dealloc;
+  tp->tp_repr = (reprfunc)record_repr;
+  tp->tp_getattro = (getattrofunc)record_getattro;
+  tp->tp_setattro = (setattrofunc)record_setattro;
+  tp->tp_getset = type->getset;
+  tp->tp_new = record_tp_new;
+  tp->tp_init = (initproc)record_tp_init;
+
+  if (PyType_Ready (tp) < 0)
+    {
+      free_type (type);
+      return NULL;
+    }
+
+  type->next = record_types;
+  record_types = type;
+
+  return tp;
+}
+
+/**
+ * Free all record types
+ *
+ * Should be called after Py_Finalize(), when there are no records.
+ */
+void
+py_record_types_free (void)
+{
+  while (record_types)
+    {
+      record_type_t *type = record_types;
+
+      record_types = type->next;
+
+      free_type (type);
+    }
+
+  record_array_ready = 0;
+}
+
+/**
+ * Check whether object is record
+ *
+ * @param obj - object to check
+ * @return non-zero if object is record
+ */
+int
+py_record_check (PyObject *obj)
+{
+  return obj && obj->ob_type->tp_dealloc == (destructor)record_dealloc;
+}
+
+/**
+ * Create record with zeroed structure
+ *
+ * @param type - record type
+ * @return new record or NULL with set error
+ */
+PyObject*
+py_record_new (PyTypeObject *type)
+{
+  return record_tp_new (type, NULL, NULL);
+}
+
+/**
+ * Get structure of record
+ *
+ * @param record - record to get structure of
+ * @return pointer to structure
+ */
+void*
+py_record_data (PyObject *record)
+{
+  return ((record_object_t*)record)->data;
+}
+
+/**
+ * Create array of records which are stored in contiguous block
+ *
+ * Structures in block are placed with stride equal to size of structure
+ * aligned to 16 bytes.
+ *
+ * @param type - record type
+ * @param count - count of records
+ * @return new array or NULL with set error
+ */
+PyObject*
+py_record_array_new (PyTypeObject *type, Py_ssize_t count)
+{
+  record_array_t *array;
+  record_type_t *rtype = (record_type_t*)type;
+
+  if (count < 0)
+    {
+      PyErr_SetString (PyExc_ValueError, "count of records is negative");
+      return NULL;
+    }
+
+  if (!record_array_ready)
+    {
+      if (PyType_Ready (&record_array_type) < 0)
+        {
+          return NULL;
+        }
+
+      record_array_ready = 1;
+    }
+
+  array = PyObject_New (record_array_t, &record_array_type);
+
+  if (!array)
+    {
+      return NULL;
+    }
+
+  array->block = calloc (MAX (count, 1), rtype->struct_size);
+
+  if (!array->block)
+    {
+      array->count = 0;
+      array->type = rtype;
+      Py_INCREF (type);
+      Py_DECREF (array);
+      return PyErr_NoMemory ();
+    }
+
+  array->type = rtype;
+  array->count = count;
+  Py_INCREF (type);
+
+  return (PyObject*)array;
+}
+
+/**
+ * Get block of structures of array of records
+ *
+ * @param array - array of records
+ * @param count - count of records (could be NULL)
+ * @return pointer to first structure
+ */
+void*
+py_record_array_data (PyObject *array, Py_ssize_t *count)
+{
+  record_array_t *self = (record_array_t*)array;
+
+  if (count)
+    {
+      *count = self->count;
+    }
+
+  return self->block;
+}
+
+/**
+ * Add type to module
+ *
+ * @param module - module to add type to
+ * @param type - type to add
+ * @return -1 on error, 0 on success.
+ */
+int
+py_module_add_type (py_module_t *module, PyTypeObject *type)
+{
+  const char *name = strrchr (type->tp_name, '.');
+
+  Py_INCREF (type);
+
+  return PyModule_AddObject (module->handle, name ? name + 1 : type->tp_name,
+                             (PyObject*)type);
+}
@@ -0,0 +1,88 @@
+/**
+ * Record types whose fields are stored in C structures
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Types of record's fields */
+enum {
+  PY_FIELD_INT,    /* int */
+  PY_FIELD_LONG,   /* long */
+  PY_FIELD_FLOAT,  /* float */
+  PY_FIELD_DOUBLE, /* double */
+  PY_FIELD_STRING, /* char[N], UTF-8 string which is stored inline */
+  PY_FIELD_OBJECT  /* PyObject*, owned reference or NULL */
+};
+
+/* Flags of record's fields */
+enum {
+  PY_FIELD_READONLY = 0x0001 /* Scripts could only read field */
+};
+
+/* Descriptor of record's field */
+typedef struct {
+  const char *name;
+  int type;          /* Type of field, PY_FIELD_xxx */
+  size_t offset;     /* Offset of field in structure */
+  size_t size;       /* Size of field */
+  int flags;         /* Combination of PY_FIELD_xxx flags */
+  const char *doc;
+} py_field_t;
+
+#define PY_BEGIN_FIELDS(name) \
+  static const py_field_t name[] = {
+
+#define PY_FIELD_DEF(struct_type, field, type, flags, doc) \
+  {#field, type, offsetof (struct_type, field), \
+   sizeof (((struct_type*)0)->field), flags, doc},
+
+#define PY_END_FIELDS \
+    {NULL, 0, 0, 0, 0, NULL} \
+  };
+
+#define PY_DEF_TYPE(type) \
+  py_module_add_type (__module, type);
+
+/* Get structure of record */
+#define PY_RECORD_DATA(record, struct_type) \
+  ((struct_type*)py_record_data (record))
+
+/* Create record type from descriptors of fields of structure */
+PyTypeObject*
+py_record_type_new (const char *name, const char *doc,
+                    const py_field_t *fields, size_t struct_size);
+
+/* Free all record types */
+void
+py_record_types_free (void);
+
+/* Check whether object is record */
+int
+py_record_check (PyObject *obj);
+
+/* Create record with zeroed structure */
+PyObject*
+py_record_new (PyTypeObject *type);
+
+/* Get structure of record */
+void*
+py_record_data (PyObject *record);
+
+/* Create array of records which are stored in contiguous block */
+PyObject*
+py_record_array_new (PyTypeObject *type, Py_ssize_t count);
+
+/* Get block of structures of array of records */
+void*
+py_record_array_data (PyObject *array, Py_ssize_t *count);
+
+/* Add type to module */
+int
+py_module_add_type (py_module_t *module, PyTypeObject *type);
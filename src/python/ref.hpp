@@ -0,0 +1,291 @@
+/**
+ * Reference handles of Python objects for C++
+ *
+ * py::ref owns a strong reference and is move-only, so transferring
+ * ownership is a pointer move instead of Py_INCREF/Py_DECREF pair, and
+ * reference is released exactly once when handle goes out of scope.
+ * py::borrowed is a plain non-owning view, which is passed where C API
+ * borrows the reference.
+ *
+ * Both handles are a single pointer and all their methods are inline,
+ * so code which uses them compiles to the same calls as hand-written C.
+ *
+ * Overloads of extpy_* helpers taking and returning handles follow
+ * ownership rules of the C functions: functions returning new reference
+ * return py::ref, and functions which steal a reference take py::ref
+ * by rvalue.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_REF_HPP
+#define PYTHON_REF_HPP
+
+#ifndef __cplusplus
+#  error "This header is for C++ sources only"
+#endif
+
+#include "iface.h"
+
+#include <cstdlib>
+#include <memory>
+
+namespace py {
+
+class ref;
+
+/* Non-owning view of Python object */
+class borrowed
+{
+public:
+  borrowed () noexcept : ptr (NULL) {}
+  explicit borrowed (PyObject *obj) noexcept : ptr (obj) {}
+  inline borrowed (const ref &obj) noexcept;
+
+  PyObject*
+  get () const noexcept
+  {
+    return ptr;
+  }
+
+  explicit
+  operator bool () const noexcept
+  {
+    return ptr != NULL;
+  }
+
+private:
+  PyObject *ptr;
+};
+
+/* Owned strong reference to Python object */
+class ref
+{
+public:
+  ref () noexcept : ptr (NULL) {}
+
+  ref (ref &&other) noexcept : ptr (other.ptr)
+  {
+    other.ptr = NULL;
+  }
+
+  ref (const ref &) = delete;
+
+  ~ref ()
+  {
+    Py_XDECREF (ptr);
+  }
+
+  ref&
+  operator = (ref &&other) noexcept
+  {
+    PyObject *old = ptr;
+
+    ptr = other.ptr;
+    other.ptr = NULL;
+    Py_XDECREF (old);
+
+    return *this;
+  }
+
+  ref& operator = (const ref &) = delete;
+
+  /**
+   * Take ownership of new reference
+   *
+   * @param obj - new reference (may be NULL)
+   * @return handle which owns the reference
+   */
+  static ref
+  steal (PyObject *obj) noexcept
+  {
+    return ref (obj);
+  }
+
+  /**
+   * Get own reference to borrowed object
+   *
+   * @param obj - borrowed reference (may be NULL)
+   * @return handle which owns new reference
+   */
+  static ref
+  incref (borrowed obj) noexcept
+  {
+    Py_XINCREF (obj.get ());
+    return ref (obj.get ());
+  }
+
+  /* Explicit copy, which costs Py_INCREF */
+  ref
+  copy () const noexcept
+  {
+    return incref (borrowed (ptr));
+  }
+
+  PyObject*
+  get () const noexcept
+  {
+    return ptr;
+  }
+
+  /**
+   * Give up ownership without decrementing reference counter
+   *
+   * @return new reference which should be released by caller
+   */
+  PyObject*
+  release () noexcept
+  {
+    PyObject *obj = ptr;
+
+    ptr = NULL;
+    return obj;
+  }
+
+  /* Release reference and forget object */
+  void
+  reset () noexcept
+  {
+    Py_CLEAR (ptr);
+  }
+
+  explicit
+  operator bool () const noexcept
+  {
+    return ptr != NULL;
+  }
+
+private:
+  explicit ref (PyObject *obj) noexcept : ptr (obj) {}
+
+  PyObject *ptr;
+};
+
+inline
+borrowed::borrowed (const ref &obj) noexcept : ptr (obj.get ())
+{
+}
+
+/* Take ownership of new reference */
+static inline ref
+steal (PyObject *obj) noexcept
+{
+  return ref::steal (obj);
+}
+
+/* View of borrowed reference */
+static inline borrowed
+borrow (PyObject *obj) noexcept
+{
+  return borrowed (obj);
+}
+
+/* Deleter of memory allocated with malloc() */
+struct free_deleter
+{
+  void
+  operator () (void *ptr) const noexcept
+  {
+    free (ptr);
+  }
+};
+
+/* Deleter of results of running */
+struct run_deleter
+{
+  void
+  operator () (extpy_run_result_t *result) const noexcept
+  {
+    extpy_run_free (result);
+  }
+};
+
+/* Owned string allocated by the library */
+typedef std::unique_ptr<wchar_t, free_deleter> wstring_ptr;
+
+/* Owned result of running */
+typedef std::unique_ptr<extpy_run_result_t, run_deleter> run_result;
+
+/* Run python file */
+static inline run_result
+run_file (const wchar_t *filename)
+{
+  return run_result (extpy_run_file ((wchar_t*)filename));
+}
+
+/* Run python script */
+static inline run_result
+run_script (py_script_t *script)
+{
+  return run_result (extpy_run_script (script));
+}
+
+}
+
+/****
+ * Overloads of extpy helpers
+ */
+
+/* Set dictionary key's value, reference of value is moved to dictionary */
+static inline int
+extpy_dict_set_item_str (py::borrowed dict, const wchar_t *key,
+                         py::ref &&value)
+{
+  return extpy_dict_set_item_str (dict.get (), (wchar_t*)key,
+                                  value.release ());
+}
+
+/* Retrieve an attribute from object */
+static inline py::ref
+extpy_get_attr_string (py::borrowed obj, const wchar_t *attr_name)
+{
+  return py::steal (extpy_get_attr_string (obj.get (), attr_name));
+}
+
+/* Set the value of an attribute */
+static inline int
+extpy_set_attr_string (py::borrowed obj, const wchar_t *attr_name,
+                       py::borrowed val)
+{
+  return extpy_set_attr_string (obj.get (), attr_name, val.get ());
+}
+
+/* Check if object has specified attribute */
+static inline int
+extpy_has_attr_string (py::borrowed obj, const wchar_t *attr_name)
+{
+  return extpy_has_attr_string (obj.get (), attr_name);
+}
+
+/* Get long-value object's attribute */
+static inline long
+extpy_get_long_attr (py::borrowed obj, const wchar_t *attr_name)
+{
+  return extpy_get_long_attr (obj.get (), attr_name);
+}
+
+/* Get double-value object's attribute */
+static inline double
+extpy_get_double_attr (py::borrowed obj, const wchar_t *attr_name)
+{
+  return extpy_get_double_attr (obj.get (), attr_name);
+}
+
+/* Get string-value object's attribute */
+static inline py::wstring_ptr
+extpy_get_string_attr (py::borrowed obj, const wchar_t *attr_name)
+{
+  return py::wstring_ptr (extpy_get_string_attr (obj.get (), attr_name));
+}
+
+/* Run script in specified dictionary */
+static inline py::ref
+py_run_script_at_dict (py_script_t *script, py::borrowed dict)
+{
+  return py::steal (py_run_script_at_dict (script, dict.get ()));
+}
+
+#endif
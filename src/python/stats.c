@@ -0,0 +1,328 @@
+/**
+ * Call counters and latency histograms of registered C methods
+ *
+ * Statistics are updated by wrappers of methods which are called with
+ * the GIL held, so no additional locking is needed.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#include <time.h>
+
+/* List of registered methods' statistics */
+static py_stats_t *stats_list = NULL;
+
+/**
+ * Get index of histogram's bucket for latency
+ *
+ * @param ns - latency in nanoseconds
+ * @return index of bucket
+ */
+static inline int
+bucket_index (unsigned long long ns)
+{
+  int index;
+
+  if (!ns)
+    {
+      return 0;
+    }
+
+  index = 63 - __builtin_clzll (ns);
+
+  return MIN (index, PY_STATS_BUCKETS - 1);
+}
+
+/**
+ * Initialize statistics stuff
+ *
+ * Should be called before python_init() to get methods of all
+ * modules created by py_module_new() instrumented.
+ *
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_stats_init (void)
+{
+  py_set_instrumentation (py_get_instrumentation () | PY_INSTRUMENT_STATS);
+
+  return 0;
+}
+
+/**
+ * Uninitialize statistics stuff
+ *
+ * Should be called after python_done().
+ */
+void
+py_stats_done (void)
+{
+  py_stats_t *stats, *next;
+
+  for (stats = stats_list; stats; stats = next)
+    {
+      next = stats->next;
+      free (stats->name);
+      free (stats);
+    }
+
+  stats_list = NULL;
+
+  py_set_instrumentation (py_get_instrumentation () & ~PY_INSTRUMENT_STATS);
+}
+
+/**
+ * Get current monotonic time
+ *
+ * @return current time in nanoseconds
+ */
+unsigned long long
+py_stats_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Register method for collecting statistics
+ *
+ * If method with such name is already registered, its statistics
+ * will be shared.
+ *
+ * @param name - name of method in form Module.method
+ * @return statistics of method or NULL if memory is exhausted
+ */
+py_stats_t*
+py_stats_register (const char *name)
+{
+  py_stats_t *stats;
+
+  for (stats = stats_list; stats; stats = stats->next)
+    {
+      if (!strcmp (stats->name, name))
+        {
+          return stats;
+        }
+    }
+
+  stats = calloc (1, sizeof (py_stats_t));
+
+  if (!stats)
+    {
+      return NULL;
+    }
+
+  stats->name = strdup (name);
+
+  if (!stats->name)
+    {
+      free (stats);
+      return NULL;
+    }
+
+  stats->next = stats_list;
+  stats_list = stats;
+
+  return stats;
+}
+
+/**
+ * Record a call of method
+ *
+ * @param stats - statistics of method
+ * @param ns - latency of call in nanoseconds
+ * @param failed - non-zero if call raised an error
+ */
+void
+py_stats_record (py_stats_t *stats, unsigned long long ns, int failed)
+{
+  if (!stats->calls || ns < stats->min_ns)
+    {
+      stats->min_ns = ns;
+    }
+
+  if (ns > stats->max_ns)
+    {
+      stats->max_ns = ns;
+    }
+
+  stats->calls++;
+  stats->total_ns += ns;
+  stats->histogram[bucket_index (ns)]++;
+
+  if (failed)
+    {
+      stats->errors++;
+    }
+}
+
+/**
+ * Get statistics of method
+ *
+ * @param name - name of method in form Module.method
+ * @return statistics of method or NULL if method is not registered
+ */
+const py_stats_t*
+py_stats_lookup (const wchar_t *name)
+{
+  py_stats_t *stats;
+  char *mbname;
+  py_arena_mark_t mark = py_arena_mark ();
+
+  PY_SCRATCH_WCS2MBS (mbname, name);
+
+  if (!mbname)
+    {
+      py_arena_release (mark);
+      return NULL;
+    }
+
+  for (stats = stats_list; stats; stats = stats->next)
+    {
+      if (!strcmp (stats->name, mbname))
+        {
+          break;
+        }
+    }
+
+  py_arena_release (mark);
+
+  return stats;
+}
+
+/**
+ * Call procedure for statistics of each method
+ *
+ * @param proc - procedure to be called
+ * @param data - user's data passed to procedure
+ */
+void
+py_stats_foreach (py_stats_proc_t proc, void *data)
+{
+  py_stats_t *stats;
+
+  for (stats = stats_list; stats; stats = stats->next)
+    {
+      proc (stats, data);
+    }
+}
+
+/**
+ * Estimate latency percentile from histogram
+ *
+ * Latency is interpolated linearly inside of bucket.
+ *
+ * @param stats - statistics of method
+ * @param percentile - percentile to estimate (from 0 to 100)
+ * @return estimated latency in nanoseconds
+ */
+unsigned long long
+py_stats_percentile (const py_stats_t *stats, double percentile)
+{
+  double rank, seen = 0;
+  int i;
+
+  if (!stats->calls)
+    {
+      return 0;
+    }
+
+  rank = stats->calls * MIN (MAX (percentile, 0.0), 100.0) / 100.0;
+
+  for (i = 0; i < PY_STATS_BUCKETS; ++i)
+    {
+      unsigned long long count = stats->histogram[i];
+
+      if (count && seen + count >= rank)
+        {
+          double low = i ? (double)(1ULL << i) : 0.0;
+          double high = (double)(1ULL << (i + 1));
+          double ns = low + (high - low) * (rank - seen) / count;
+
+          return MIN (MAX ((unsigned long long)ns, stats->min_ns),
+                      stats->max_ns);
+        }
+
+      seen += count;
+    }
+
+  return stats->max_ns;
+}
+
+/**
+ * Reset statistics of all methods
+ */
+void
+py_stats_reset (void)
+{
+  py_stats_t *stats;
+
+  for (stats = stats_list; stats; stats = stats->next)
+    {
+      stats->calls = 0;
+      stats->errors = 0;
+      stats->total_ns = 0;
+      stats->min_ns = 0;
+      stats->max_ns = 0;
+      memset (stats->histogram, 0, sizeof (stats->histogram));
+    }
+}
+
+/**
+ * Get statistics of all methods as Python dictionary
+ *
+ * Keys of dictionary are names of methods, values are dictionaries
+ * with counters, percentiles and histogram of latencies.
+ *
+ * @return new reference to dictionary
+ */
+PyObject*
+py_stats_as_dict (void)
+{
+  PyObject *result = PyDict_New ();
+  py_stats_t *stats;
+
+  for (stats = stats_list; stats; stats = stats->next)
+    {
+      PyObject *item = PyDict_New (), *histogram;
+      int i;
+
+      histogram = PyList_New (PY_STATS_BUCKETS);
+      for (i = 0; i < PY_STATS_BUCKETS; ++i)
+        {
+          PyList_SET_ITEM (histogram, i,
+                           PyLong_FromUnsignedLongLong (stats->histogram[i]));
+        }
+
+      extpy_dict_set_item_str (item, L"calls",
+                               PyLong_FromUnsignedLongLong (stats->calls));
+      extpy_dict_set_item_str (item, L"errors",
+                               PyLong_FromUnsignedLongLong (stats->errors));
+      extpy_dict_set_item_str (item, L"totalNs",
+                               PyLong_FromUnsignedLongLong (stats->total_ns));
+      extpy_dict_set_item_str (item, L"minNs",
+                               PyLong_FromUnsignedLongLong (stats->min_ns));
+      extpy_dict_set_item_str (item, L"maxNs",
+                               PyLong_FromUnsignedLongLong (stats->max_ns));
+      extpy_dict_set_item_str (item, L"p50", PyLong_FromUnsignedLongLong (
+                                 py_stats_percentile (stats, 50)));
+      extpy_dict_set_item_str (item, L"p90", PyLong_FromUnsignedLongLong (
+                                 py_stats_percentile (stats, 90)));
+      extpy_dict_set_item_str (item, L"p99", PyLong_FromUnsignedLongLong (
+                                 py_stats_percentile (stats, 99)));
+      extpy_dict_set_item_str (item, L"histogram", histogram);
+
+      PyDict_SetItemString (result, stats->name, item);
+      Py_DECREF (item);
+    }
+
+  return result;
+}
@@ -0,0 +1,73 @@
+/**
+ * Call counters and latency histograms of registered C methods
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Count of buckets in latency histogram. Bucket N counts calls which */
+/* took from 2^N to 2^(N+1)-1 nanoseconds */
+#define PY_STATS_BUCKETS 40
+
+typedef struct py_stats {
+  char *name;  /* Name of method in form Module.method */
+
+  unsigned long long calls;    /* Count of calls */
+  unsigned long long errors;   /* Count of calls which raised an error */
+  unsigned long long total_ns; /* Total time spent in method */
+  unsigned long long min_ns;   /* Minimal latency */
+  unsigned long long max_ns;   /* Maximal latency */
+
+  unsigned long long histogram[PY_STATS_BUCKETS];
+
+  struct py_stats *next;
+} py_stats_t;
+
+/* Callback for py_stats_foreach() */
+typedef void (*py_stats_proc_t) (const py_stats_t *stats, void *data);
+
+/* Initialize statistics stuff */
+int
+py_stats_init (void);
+
+/* Uninitialize statistics stuff */
+void
+py_stats_done (void);
+
+/* Get current monotonic time in nanoseconds */
+unsigned long long
+py_stats_now (void);
+
+/* Register method for collecting statistics */
+py_stats_t*
+py_stats_register (const char *name);
+
+/* Record a call of method */
+void
+py_stats_record (py_stats_t *stats, unsigned long long ns, int failed);
+
+/* Get statistics of method */
+const py_stats_t*
+py_stats_lookup (const wchar_t *name);
+
+/* Call procedure for statistics of each method */
+void
+py_stats_foreach (py_stats_proc_t proc, void *data);
+
+/* Estimate latency percentile from histogram */
+unsigned long long
+py_stats_percentile (const py_stats_t *stats, double percentile);
+
+/* Reset statistics of all methods */
+void
+py_stats_reset (void);
+
+/* Get statistics of all methods as Python dictionary */
+PyObject*
+py_stats_as_dict (void);
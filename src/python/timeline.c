@@ -0,0 +1,512 @@
+/**
+ * Timeline tracing of Python calls and registered C methods
+ *
+ * Events are stored in per-thread buffers which are allocated once
+ * per thread, so recording of an event never allocates memory.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#include <frameobject.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Phases of events */
+#define PHASE_BEGIN 'B'
+#define PHASE_END   'E'
+
+typedef struct {
+  unsigned long long ts; /* Nanoseconds since timeline's origin */
+  char phase;            /* PHASE_BEGIN or PHASE_END */
+  const char *category;  /* Category of event (static string) */
+  char name[PY_TIMELINE_NAME_LEN];
+} timeline_event_t;
+
+typedef struct timeline_buffer {
+  long tid;      /* Sequential number of thread */
+  long count;    /* Count of recorded events */
+  long capacity; /* Count of preallocated events */
+  long open;     /* Count of recorded but not closed regions */
+  long skipping; /* Depth of regions which are being dropped */
+  long dropped;  /* Count of dropped events */
+
+  timeline_event_t *events;
+  struct timeline_buffer *next;
+} timeline_buffer_t;
+
+/* Count of events in per-thread buffers (zero if not initialized) */
+static long events_per_thread = 0;
+
+/* Is recording active? */
+static volatile int active = 0;
+
+/* Time of timeline's initialization */
+static unsigned long long time_origin = 0;
+
+/* List of all threads' buffers */
+static timeline_buffer_t *buffers = NULL;
+static long buffers_count = 0;
+static long generation = 0;
+static pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Buffer of current thread */
+static __thread timeline_buffer_t *thread_buffer = NULL;
+static __thread long thread_generation = -1;
+
+/**
+ * Get current monotonic time
+ *
+ * @return current time in nanoseconds
+ */
+static inline unsigned long long
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Get buffer of current thread
+ *
+ * @return buffer of current thread or NULL if it couldn't be allocated
+ */
+static timeline_buffer_t*
+get_thread_buffer (void)
+{
+  timeline_buffer_t *buf;
+
+  if (thread_buffer && thread_generation == generation)
+    {
+      return thread_buffer;
+    }
+
+  MALLOC_ZERO (buf, sizeof (timeline_buffer_t));
+  buf->events = malloc (sizeof (timeline_event_t) * events_per_thread);
+
+  if (!buf->events)
+    {
+      free (buf);
+      return NULL;
+    }
+
+  buf->capacity = events_per_thread;
+
+  pthread_mutex_lock (&buffers_mutex);
+  buf->tid = ++buffers_count;
+  buf->next = buffers;
+  buffers = buf;
+  thread_generation = generation;
+  pthread_mutex_unlock (&buffers_mutex);
+
+  thread_buffer = buf;
+
+  return buf;
+}
+
+/**
+ * Free all threads' buffers
+ */
+static void
+free_buffers (void)
+{
+  timeline_buffer_t *buf, *next;
+
+  pthread_mutex_lock (&buffers_mutex);
+
+  for (buf = buffers; buf; buf = next)
+    {
+      next = buf->next;
+      free (buf->events);
+      free (buf);
+    }
+
+  buffers = NULL;
+  buffers_count = 0;
+
+  /* Invalidate pointers to buffers stored by threads */
+  ++generation;
+
+  pthread_mutex_unlock (&buffers_mutex);
+}
+
+/**
+ * Profiling function for Python interpreter
+ *
+ * Calls of C functions are not recorded here: methods of modules created
+ * by py_module_new() are recorded by their wrappers.
+ */
+static int
+profile_func (PyObject *obj, PyFrameObject *frame, int what, PyObject *arg)
+{
+  switch (what)
+    {
+    case PyTrace_CALL:
+      py_timeline_begin (PyString_AsString (frame->f_code->co_name),
+                         "python");
+      break;
+
+    case PyTrace_RETURN:
+      py_timeline_end ();
+      break;
+    }
+
+  return 0;
+}
+
+/**
+ * Set profiling function for all threads of interpreter
+ *
+ * @param func - profiling function or NULL to remove it
+ */
+static void
+set_profile_all_threads (Py_tracefunc func)
+{
+  PyThreadState *tstate;
+
+  tstate = PyInterpreterState_ThreadHead (PyThreadState_Get ()->interp);
+
+  while (tstate)
+    {
+      tstate->c_profilefunc = func;
+      tstate->c_profileobj = NULL;
+      tstate->use_tracing = (func != NULL) || (tstate->c_tracefunc != NULL);
+
+      tstate = PyThreadState_Next (tstate);
+    }
+}
+
+/**
+ * Write string as JSON string literal
+ *
+ * @param file - file to write to
+ * @param str - string to be written
+ */
+static void
+write_json_string (FILE *file, const char *str)
+{
+  fputc ('"', file);
+
+  while (*str)
+    {
+      if (*str == '"' || *str == '\\')
+        {
+          fputc ('\\', file);
+          fputc (*str, file);
+        }
+      else if ((unsigned char)*str < 0x20)
+        {
+          fprintf (file, "\\u%04x", (unsigned char)*str);
+        }
+      else
+        {
+          fputc (*str, file);
+        }
+
+      ++str;
+    }
+
+  fputc ('"', file);
+}
+
+/**
+ * Initialize timeline stuff
+ *
+ * Should be called before python_init() to get methods of all
+ * modules created by py_module_new() recorded.
+ *
+ * @param events - count of events in per-thread buffer
+ *   (zero or negative for default count)
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_timeline_init (long events)
+{
+  if (events_per_thread)
+    {
+      /* Already initialized */
+      return 0;
+    }
+
+  events_per_thread = events > 0 ? events : PY_TIMELINE_DEFAULT_EVENTS;
+  time_origin = now ();
+
+  py_set_instrumentation (py_get_instrumentation () | PY_INSTRUMENT_TIMELINE);
+
+  return 0;
+}
+
+/**
+ * Uninitialize timeline stuff
+ */
+void
+py_timeline_done (void)
+{
+  py_timeline_stop ();
+
+  free_buffers ();
+  events_per_thread = 0;
+
+  py_set_instrumentation (py_get_instrumentation () & ~PY_INSTRUMENT_TIMELINE);
+}
+
+/**
+ * Start recording of events
+ *
+ * Profiling function is installed to all threads which exist at the
+ * moment of call. Should be called with the GIL held.
+ *
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_timeline_start (void)
+{
+  if (!events_per_thread)
+    {
+      py_timeline_init (0);
+    }
+
+  active = 1;
+  set_profile_all_threads (profile_func);
+
+  return 0;
+}
+
+/**
+ * Stop recording of events
+ */
+void
+py_timeline_stop (void)
+{
+  if (!active)
+    {
+      return;
+    }
+
+  active = 0;
+
+  if (Py_IsInitialized ())
+    {
+      set_profile_all_threads (NULL);
+    }
+}
+
+/**
+ * Check if events are being recorded
+ *
+ * @return non-zero if recording is active, zero otherwise
+ */
+int
+py_timeline_active (void)
+{
+  return active;
+}
+
+/**
+ * Discard all recorded events
+ *
+ * Should not be called while other threads are recording events.
+ */
+void
+py_timeline_reset (void)
+{
+  timeline_buffer_t *buf;
+
+  pthread_mutex_lock (&buffers_mutex);
+
+  for (buf = buffers; buf; buf = buf->next)
+    {
+      buf->count = 0;
+      buf->open = 0;
+      buf->skipping = 0;
+      buf->dropped = 0;
+    }
+
+  pthread_mutex_unlock (&buffers_mutex);
+}
+
+/**
+ * Record entering of a named region
+ *
+ * Space for the matching leaving event is reserved, so regions which
+ * are recorded are always closed.
+ *
+ * @param name - name of region (truncated to PY_TIMELINE_NAME_LEN-1)
+ * @param category - category of region (should be a static string)
+ */
+void
+py_timeline_begin (const char *name, const char *category)
+{
+  timeline_buffer_t *buf;
+  timeline_event_t *event;
+
+  if (!active)
+    {
+      return;
+    }
+
+  buf = get_thread_buffer ();
+
+  if (!buf)
+    {
+      return;
+    }
+
+  if (buf->skipping || buf->count + buf->open + 2 > buf->capacity)
+    {
+      buf->skipping++;
+      buf->dropped++;
+      return;
+    }
+
+  event = &buf->events[buf->count++];
+  event->ts = now () - time_origin;
+  event->phase = PHASE_BEGIN;
+  event->category = category;
+
+  strncpy (event->name, name ? name : "", PY_TIMELINE_NAME_LEN - 1);
+  event->name[PY_TIMELINE_NAME_LEN - 1] = '\0';
+
+  buf->open++;
+}
+
+/**
+ * Record leaving of a named region
+ */
+void
+py_timeline_end (void)
+{
+  timeline_buffer_t *buf;
+  timeline_event_t *event;
+
+  if (!active)
+    {
+      return;
+    }
+
+  buf = get_thread_buffer ();
+
+  if (!buf)
+    {
+      return;
+    }
+
+  if (buf->skipping)
+    {
+      buf->skipping--;
+      buf->dropped++;
+      return;
+    }
+
+  if (!buf->open)
+    {
+      /* Region was entered before recording started */
+      return;
+    }
+
+  event = &buf->events[buf->count++];
+  event->ts = now () - time_origin;
+  event->phase = PHASE_END;
+  event->category = NULL;
+  event->name[0] = '\0';
+
+  buf->open--;
+}
+
+/**
+ * Get count of events dropped because of buffers overflow
+ *
+ * @return count of dropped events
+ */
+long
+py_timeline_dropped (void)
+{
+  timeline_buffer_t *buf;
+  long dropped = 0;
+
+  pthread_mutex_lock (&buffers_mutex);
+
+  for (buf = buffers; buf; buf = buf->next)
+    {
+      dropped += buf->dropped;
+    }
+
+  pthread_mutex_unlock (&buffers_mutex);
+
+  return dropped;
+}
+
+/**
+ * Write recorded events as Chrome trace-event JSON
+ *
+ * Should not be called while other threads are recording events.
+ *
+ * @param file_name - name of file to write events to
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_timeline_dump (const wchar_t *file_name)
+{
+  char *mbfn;
+  FILE *file;
+  timeline_buffer_t *buf;
+  long i, pid = getpid ();
+  int first = 1;
+
+  WCS2MBS (mbfn, file_name);
+
+  if (!mbfn)
+    {
+      return -1;
+    }
+
+  file = fopen (mbfn, "w");
+  free (mbfn);
+
+  if (!file)
+    {
+      return -1;
+    }
+
+  fprintf (file, "{\"traceEvents\":[");
+
+  pthread_mutex_lock (&buffers_mutex);
+
+  for (buf = buffers; buf; buf = buf->next)
+    {
+      for (i = 0; i < buf->count; ++i)
+        {
+          timeline_event_t *event = &buf->events[i];
+
+          fprintf (file, "%s\n{", first ? "" : ",");
+
+          if (event->phase == PHASE_BEGIN)
+            {
+              fprintf (file, "\"name\":");
+              write_json_string (file, event->name);
+              fprintf (file, ",\"cat\":\"%s\",", event->category);
+            }
+
+          fprintf (file, "\"ph\":\"%c\",\"ts\":%llu.%03llu,"
+                   "\"pid\":%ld,\"tid\":%ld}",
+                   event->phase, event->ts / 1000, event->ts % 1000,
+                   pid, buf->tid);
+
+          first = 0;
+        }
+    }
+
+  pthread_mutex_unlock (&buffers_mutex);
+
+  fprintf (file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+  return fclose (file) ? -1 : 0;
+}
@@ -0,0 +1,58 @@
+/**
+ * Timeline tracing of Python calls and registered C methods
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Default count of events in per-thread buffer */
+#define PY_TIMELINE_DEFAULT_EVENTS 65536
+
+/* Maximal length of event's name (including terminating zero) */
+#define PY_TIMELINE_NAME_LEN 64
+
+/* Initialize timeline stuff */
+int
+py_timeline_init (long events_per_thread);
+
+/* Uninitialize timeline stuff */
+void
+py_timeline_done (void);
+
+/* Start recording of events */
+int
+py_timeline_start (void);
+
+/* Stop recording of events */
+void
+py_timeline_stop (void);
+
+/* Check if events are being recorded */
+int
+py_timeline_active (void);
+
+/* Discard all recorded events */
+void
+py_timeline_reset (void);
+
+/* Record entering of a named region */
+void
+py_timeline_begin (const char *name, const char *category);
+
+/* Record leaving of a named region */
+void
+py_timeline_end (void);
+
+/* Get count of events dropped because of buffers overflow */
+long
+py_timeline_dropped (void);
+
+/* Write recorded events as Chrome trace-event JSON */
+int
+py_timeline_dump (const wchar_t *file_name);
@@ -32,12 +32,15 @@ py_tracer_init (void)
 
   stringio_class = PyDict_GetItemString (dict_stringio, "StringIO");
 
+  /* Original streams are kept alive until py_tracer_done() */
   o_stdout = PyInstance_New (stringio_class, NULL, NULL);
   s_stdout = PyDict_GetItemString (dict_sys, "stdout");
+  Py_XINCREF (s_stdout);
   PyDict_SetItemString (dict_sys, "stdout", o_stdout);
 
   o_stderr = PyInstance_New (stringio_class, NULL, NULL);
   s_stderr = PyDict_GetItemString (dict_sys, "stderr");
+  Py_XINCREF (s_stderr);
   PyDict_SetItemString (dict_sys, "stderr", o_stderr);
 
   Py_DECREF (mod_sys);
@@ -59,16 +62,18 @@ py_tracer_done (void)
 
   if (s_stdout)
     {
-      PyDict_SetItemString (dict_sys, "stdout", s_stderr);
+      PyDict_SetItemString (dict_sys, "stdout", s_stdout);
+      Py_DECREF (s_stdout);
       Py_DECREF (o_stdout);
-      s_stdout = NULL;
+      s_stdout = o_stdout = NULL;
     }
 
   if (s_stderr)
     {
       PyDict_SetItemString (dict_sys, "stderr", s_stderr);
+      Py_DECREF (s_stderr);
       Py_DECREF (o_stderr);
-      s_stderr = NULL;
+      s_stderr = o_stderr = NULL;
     }
 
   Py_DECREF (mod_sys);
@@ -86,6 +91,12 @@ py_tracer_truncate_buffer (int type)
 {
   PyObject *mod_sys, *dict_sys, *stream, *truncate;
 
+  /* Nothing is captured until tracer is installed */
+  if (!o_stdout)
+    {
+      return;
+    }
+
   mod_sys = PyImport_ImportModule ("sys");
   dict_sys = PyModule_GetDict (mod_sys);
 
@@ -121,6 +132,11 @@ py_tracer_get_buffer (int type)
   PyObject *result;
   wchar_t *wcs = NULL;
 
+  if (!o_stdout)
+    {
+      return NULL;
+    }
+
   mod_sys = PyImport_ImportModule ("sys");
   dict_sys = PyModule_GetDict (mod_sys);
 
@@ -0,0 +1,675 @@
+/**
+ * Locale-independent UTF-8 conversion of strings
+ *
+ * Most of strings passed through bindings are plain ASCII (names of
+ * attributes, keys, captured output), so both directions start with
+ * a vectorized ASCII loop and fall back to the scalar codec only for
+ * non-ASCII characters. Wide-char strings are expected to hold UCS-4,
+ * as wchar_t does on GNU/Linux.
+ *
+ * Malformed sequences and invalid code points are replaced with
+ * PY_UTF8_REPLACEMENT, so sizes computed by py_utf8_encoded_size() and
+ * py_utf8_decoded_len() always match output of encoder and decoder.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#if defined (__SSE2__)
+#  include <emmintrin.h>
+#  define HAVE_SSE2
+#endif
+
+#if defined (__x86_64__) && defined (__GNUC__) && __GNUC__ >= 5
+#  include <immintrin.h>
+#  define HAVE_AVX2
+#  define AVX2_FUNC __attribute__ ((target ("avx2")))
+#endif
+
+/****
+ * Helpers
+ */
+
+#ifdef HAVE_AVX2
+/**
+ * Check if AVX2 could be used on current CPU
+ *
+ * @return non-zero if AVX2 is supported
+ */
+static inline int
+cpu_has_avx2 (void)
+{
+  static int has_avx2 = -1;
+
+  if (has_avx2 < 0)
+    {
+      __builtin_cpu_init ();
+      has_avx2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+    }
+
+  return has_avx2;
+}
+#endif
+
+/**
+ * Get count of bytes needed to encode character
+ *
+ * @param wc - character to encode
+ * @return count of bytes
+ */
+static inline size_t
+encoded_char_size (unsigned int wc)
+{
+  if (wc < 0x80)
+    {
+      return 1;
+    }
+  else if (wc < 0x800)
+    {
+      return 2;
+    }
+  else if (wc < 0x10000 || wc > 0x10FFFF)
+    {
+      /* Surrogates and out-of-range values are replaced */
+      return 3;
+    }
+
+  return 4;
+}
+
+/**
+ * Encode non-ASCII character
+ *
+ * @param dst - buffer to encode to
+ * @param wc - character to encode
+ * @return count of written bytes
+ */
+static inline size_t
+encode_char (unsigned char *dst, unsigned int wc)
+{
+  if ((wc >= 0xD800 && wc <= 0xDFFF) || wc > 0x10FFFF)
+    {
+      wc = PY_UTF8_REPLACEMENT;
+    }
+
+  if (wc < 0x80)
+    {
+      dst[0] = wc;
+      return 1;
+    }
+  else if (wc < 0x800)
+    {
+      dst[0] = 0xC0 | (wc >> 6);
+      dst[1] = 0x80 | (wc & 0x3F);
+      return 2;
+    }
+  else if (wc < 0x10000)
+    {
+      dst[0] = 0xE0 | (wc >> 12);
+      dst[1] = 0x80 | ((wc >> 6) & 0x3F);
+      dst[2] = 0x80 | (wc & 0x3F);
+      return 3;
+    }
+
+  dst[0] = 0xF0 | (wc >> 18);
+  dst[1] = 0x80 | ((wc >> 12) & 0x3F);
+  dst[2] = 0x80 | ((wc >> 6) & 0x3F);
+  dst[3] = 0x80 | (wc & 0x3F);
+
+  return 4;
+}
+
+/**
+ * Decode one character from UTF-8 sequence
+ *
+ * Overlong forms, surrogates and truncated sequences are decoded as
+ * PY_UTF8_REPLACEMENT consuming one byte.
+ *
+ * @param src - sequence to decode
+ * @param len - count of available bytes
+ * @param wc - decoded character
+ * @return count of consumed bytes
+ */
+static inline size_t
+decode_char (const unsigned char *src, size_t len, unsigned int *wc)
+{
+  unsigned char c = src[0];
+  unsigned char low = 0x80, high = 0xBF;
+  size_t count, i;
+  unsigned int result;
+
+  if (c < 0x80)
+    {
+      *wc = c;
+      return 1;
+    }
+  else if (c >= 0xC2 && c <= 0xDF)
+    {
+      count = 2;
+      result = c & 0x1F;
+    }
+  else if (c >= 0xE0 && c <= 0xEF)
+    {
+      count = 3;
+      result = c & 0x0F;
+      low = c == 0xE0 ? 0xA0 : 0x80;
+      high = c == 0xED ? 0x9F : 0xBF;
+    }
+  else if (c >= 0xF0 && c <= 0xF4)
+    {
+      count = 4;
+      result = c & 0x07;
+      low = c == 0xF0 ? 0x90 : 0x80;
+      high = c == 0xF4 ? 0x8F : 0xBF;
+    }
+  else
+    {
+      *wc = PY_UTF8_REPLACEMENT;
+      return 1;
+    }
+
+  if (len < count || src[1] < low || src[1] > high)
+    {
+      *wc = PY_UTF8_REPLACEMENT;
+      return 1;
+    }
+
+  for (i = 1; i < count; ++i)
+    {
+      if ((src[i] & 0xC0) != 0x80)
+        {
+          *wc = PY_UTF8_REPLACEMENT;
+          return 1;
+        }
+
+      result = (result << 6) | (src[i] & 0x3F);
+    }
+
+  *wc = result;
+
+  return count;
+}
+
+/****
+ * ASCII fast paths
+ */
+
+#ifdef HAVE_AVX2
+AVX2_FUNC static size_t
+ascii_prefix_avx2 (const unsigned char *src, size_t len)
+{
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i*)(src + i));
+      unsigned int mask = _mm256_movemask_epi8 (v);
+
+      if (mask)
+        {
+          return i + __builtin_ctz (mask);
+        }
+    }
+
+  return i;
+}
+
+AVX2_FUNC static size_t
+widen_ascii_avx2 (wchar_t *dst, const unsigned char *src, size_t len)
+{
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i*)(src + i));
+      int j;
+
+      if (_mm256_movemask_epi8 (v))
+        {
+          break;
+        }
+
+      for (j = 0; j < 32; j += 8)
+        {
+          __m128i bytes = _mm_loadl_epi64 ((const __m128i*)(src + i + j));
+          _mm256_storeu_si256 ((__m256i*)(dst + i + j),
+                               _mm256_cvtepu8_epi32 (bytes));
+        }
+    }
+
+  return i;
+}
+
+AVX2_FUNC static size_t
+narrow_ascii_avx2 (unsigned char *dst, const wchar_t *src, size_t len)
+{
+  const __m256i order = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7);
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32)
+    {
+      __m256i a = _mm256_loadu_si256 ((const __m256i*)(src + i));
+      __m256i b = _mm256_loadu_si256 ((const __m256i*)(src + i + 8));
+      __m256i c = _mm256_loadu_si256 ((const __m256i*)(src + i + 16));
+      __m256i d = _mm256_loadu_si256 ((const __m256i*)(src + i + 24));
+      __m256i any = _mm256_or_si256 (_mm256_or_si256 (a, b),
+                                     _mm256_or_si256 (c, d));
+      __m256i packed;
+
+      if (!_mm256_testz_si256 (any, _mm256_set1_epi32 (~0x7F)))
+        {
+          break;
+        }
+
+      /* Packing works inside of 128-bit lanes, so restore order after it */
+      packed = _mm256_packus_epi16 (_mm256_packs_epi32 (a, b),
+                                    _mm256_packs_epi32 (c, d));
+      packed = _mm256_permutevar8x32_epi32 (packed, order);
+
+      if (dst)
+        {
+          _mm256_storeu_si256 ((__m256i*)(dst + i), packed);
+        }
+    }
+
+  return i;
+}
+#endif
+
+/**
+ * Get length of leading ASCII run of bytes with SIMD
+ */
+static inline size_t
+ascii_prefix_simd (const unsigned char *src, size_t len)
+{
+  size_t i = 0;
+
+#ifdef HAVE_AVX2
+  if (cpu_has_avx2 ())
+    {
+      i = ascii_prefix_avx2 (src, len);
+      if (i + 32 <= len)
+        {
+          return i;
+        }
+    }
+#endif
+
+#ifdef HAVE_SSE2
+  for (; i + 16 <= len; i += 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i*)(src + i));
+      int mask = _mm_movemask_epi8 (v);
+
+      if (mask)
+        {
+          return i + __builtin_ctz (mask);
+        }
+    }
+#endif
+
+  return i;
+}
+
+/**
+ * Widen leading ASCII run of bytes to wide-chars with SIMD
+ *
+ * @return count of processed characters (may be less than ASCII run)
+ */
+static inline size_t
+widen_ascii_simd (wchar_t *dst, const unsigned char *src, size_t len)
+{
+  size_t i = 0;
+
+#ifdef HAVE_AVX2
+  if (cpu_has_avx2 ())
+    {
+      i = widen_ascii_avx2 (dst, src, len);
+    }
+#endif
+
+#ifdef HAVE_SSE2
+  {
+    const __m128i zero = _mm_setzero_si128 ();
+
+    for (; i + 16 <= len; i += 16)
+      {
+        __m128i v = _mm_loadu_si128 ((const __m128i*)(src + i));
+        __m128i lo, hi;
+
+        if (_mm_movemask_epi8 (v))
+          {
+            break;
+          }
+
+        lo = _mm_unpacklo_epi8 (v, zero);
+        hi = _mm_unpackhi_epi8 (v, zero);
+
+        _mm_storeu_si128 ((__m128i*)(dst + i), _mm_unpacklo_epi16 (lo, zero));
+        _mm_storeu_si128 ((__m128i*)(dst + i + 4),
+                          _mm_unpackhi_epi16 (lo, zero));
+        _mm_storeu_si128 ((__m128i*)(dst + i + 8),
+                          _mm_unpacklo_epi16 (hi, zero));
+        _mm_storeu_si128 ((__m128i*)(dst + i + 12),
+                          _mm_unpackhi_epi16 (hi, zero));
+      }
+  }
+#endif
+
+  return i;
+}
+
+/**
+ * Narrow leading ASCII run of wide-chars to bytes with SIMD
+ *
+ * @param dst - buffer to narrow to (NULL to scan only)
+ * @return count of processed characters (may be less than ASCII run)
+ */
+static inline size_t
+narrow_ascii_simd (unsigned char *dst, const wchar_t *src, size_t len)
+{
+  size_t i = 0;
+
+#ifdef HAVE_AVX2
+  if (cpu_has_avx2 ())
+    {
+      i = narrow_ascii_avx2 (dst, src, len);
+    }
+#endif
+
+#ifdef HAVE_SSE2
+  {
+    const __m128i zero = _mm_setzero_si128 ();
+
+    for (; i + 16 <= len; i += 16)
+      {
+        __m128i a = _mm_loadu_si128 ((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128 ((const __m128i*)(src + i + 4));
+        __m128i c = _mm_loadu_si128 ((const __m128i*)(src + i + 8));
+        __m128i d = _mm_loadu_si128 ((const __m128i*)(src + i + 12));
+        __m128i any = _mm_or_si128 (_mm_or_si128 (a, b), _mm_or_si128 (c, d));
+
+        /* Logical shift also rejects negative values */
+        any = _mm_cmpeq_epi32 (_mm_srli_epi32 (any, 7), zero);
+        if (_mm_movemask_epi8 (any) != 0xFFFF)
+          {
+            break;
+          }
+
+        if (dst)
+          {
+            _mm_storeu_si128 ((__m128i*)(dst + i),
+                              _mm_packus_epi16 (_mm_packs_epi32 (a, b),
+                                                _mm_packs_epi32 (c, d)));
+          }
+      }
+  }
+#endif
+
+  return i;
+}
+
+/**
+ * Widen leading ASCII run of bytes to wide-chars
+ *
+ * @return length of ASCII run
+ */
+static inline size_t
+widen_ascii (wchar_t *dst, const unsigned char *src, size_t len)
+{
+  size_t i = widen_ascii_simd (dst, src, len);
+
+  for (; i < len && src[i] < 0x80; ++i)
+    {
+      dst[i] = src[i];
+    }
+
+  return i;
+}
+
+/**
+ * Narrow leading ASCII run of wide-chars to bytes
+ *
+ * @param dst - buffer to narrow to (NULL to scan only)
+ * @return length of ASCII run
+ */
+static inline size_t
+narrow_ascii (unsigned char *dst, const wchar_t *src, size_t len)
+{
+  size_t i = narrow_ascii_simd (dst, src, len);
+
+  for (; i < len && (unsigned int)src[i] < 0x80; ++i)
+    {
+      if (dst)
+        {
+          dst[i] = src[i];
+        }
+    }
+
+  return i;
+}
+
+/****
+ * User's backend
+ */
+
+/**
+ * Get length of leading ASCII run of multibyte string
+ *
+ * @param src - string to scan
+ * @param len - length of string in bytes
+ * @return count of leading ASCII characters
+ */
+size_t
+py_ascii_prefix (const char *src, size_t len)
+{
+  const unsigned char *s = (const unsigned char*)src;
+  size_t i = ascii_prefix_simd (s, len);
+
+  while (i < len && s[i] < 0x80)
+    {
+      ++i;
+    }
+
+  return i;
+}
+
+/**
+ * Get length of leading ASCII run of wide-char string
+ *
+ * @param src - string to scan
+ * @param len - length of string in characters
+ * @return count of leading ASCII characters
+ */
+size_t
+py_ascii_prefix_wcs (const wchar_t *src, size_t len)
+{
+  return narrow_ascii (NULL, src, len);
+}
+
+/**
+ * Get count of bytes needed to encode wide-char string
+ *
+ * @param src - string to encode
+ * @param len - length of string in characters
+ * @return count of bytes without trailing zero
+ */
+size_t
+py_utf8_encoded_size (const wchar_t *src, size_t len)
+{
+  size_t i = 0, size = 0;
+
+  while (i < len)
+    {
+      size_t ascii = narrow_ascii (NULL, src + i, len - i);
+
+      i += ascii;
+      size += ascii;
+
+      for (; i < len && (unsigned int)src[i] >= 0x80; ++i)
+        {
+          size += encoded_char_size (src[i]);
+        }
+    }
+
+  return size;
+}
+
+/**
+ * Get count of characters needed to decode UTF-8 string
+ *
+ * @param src - string to decode
+ * @param len - length of string in bytes
+ * @return count of characters without trailing zero
+ */
+size_t
+py_utf8_decoded_len (const char *src, size_t len)
+{
+  const unsigned char *s = (const unsigned char*)src;
+  size_t i = 0, count = 0;
+
+  while (i < len)
+    {
+      size_t ascii = py_ascii_prefix (src + i, len - i);
+
+      i += ascii;
+      count += ascii;
+
+      while (i < len && s[i] >= 0x80)
+        {
+          unsigned int wc;
+
+          i += decode_char (s + i, len - i, &wc);
+          ++count;
+        }
+    }
+
+  return count;
+}
+
+/**
+ * Encode wide-char string to UTF-8
+ *
+ * @param dst - buffer of at least py_utf8_encoded_size() bytes
+ * @param src - string to encode
+ * @param len - length of string in characters
+ * @return count of written bytes (trailing zero is not written)
+ */
+size_t
+py_utf8_encode (char *dst, const wchar_t *src, size_t len)
+{
+  unsigned char *d = (unsigned char*)dst;
+  size_t i = 0, size = 0;
+
+  while (i < len)
+    {
+      size_t ascii = narrow_ascii (d + size, src + i, len - i);
+
+      i += ascii;
+      size += ascii;
+
+      for (; i < len && (unsigned int)src[i] >= 0x80; ++i)
+        {
+          size += encode_char (d + size, src[i]);
+        }
+    }
+
+  return size;
+}
+
+/**
+ * Decode UTF-8 string to wide-char string
+ *
+ * @param dst - buffer of at least py_utf8_decoded_len() characters
+ * @param src - string to decode
+ * @param len - length of string in bytes
+ * @return count of written characters (trailing zero is not written)
+ */
+size_t
+py_utf8_decode (wchar_t *dst, const char *src, size_t len)
+{
+  const unsigned char *s = (const unsigned char*)src;
+  size_t i = 0, count = 0;
+
+  while (i < len)
+    {
+      size_t ascii = widen_ascii (dst + count, s + i, len - i);
+
+      i += ascii;
+      count += ascii;
+
+      while (i < len && s[i] >= 0x80)
+        {
+          unsigned int wc;
+
+          i += decode_char (s + i, len - i, &wc);
+          dst[count++] = wc;
+        }
+    }
+
+  return count;
+}
+
+/**
+ * Convert wide-char string to UTF-8 string
+ *
+ * @param src - string to convert
+ * @return converted string
+ * @sideeffect allocate memory for output value
+ */
+char*
+py_wcs2mbs (const wchar_t *src)
+{
+  size_t len = wcslen (src);
+  char *result = malloc (py_utf8_encoded_size (src, len) + 1);
+
+  if (!result)
+    {
+      return NULL;
+    }
+
+  result[py_utf8_encode (result, src, len)] = '\0';
+
+  return result;
+}
+
+/**
+ * Convert UTF-8 string to wide-char string
+ *
+ * Every byte is decoded to at most one character, so string is decoded
+ * in one pass to buffer of bytes' count and shrunk when it was not
+ * an ASCII string.
+ *
+ * @param src - string to convert
+ * @return converted string
+ * @sideeffect allocate memory for output value
+ */
+wchar_t*
+py_mbs2wcs (const char *src)
+{
+  size_t len = strlen (src), count;
+  wchar_t *result = malloc (sizeof (wchar_t) * (len + 1)), *shrunk;
+
+  if (!result)
+    {
+      return NULL;
+    }
+
+  count = py_utf8_decode (result, src, len);
+  result[count] = 0;
+
+  if (count < len)
+    {
+      shrunk = realloc (result, sizeof (wchar_t) * (count + 1));
+      if (shrunk)
+        {
+          result = shrunk;
+        }
+    }
+
+  return result;
+}
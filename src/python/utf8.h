@@ -0,0 +1,47 @@
+/**
+ * Locale-independent UTF-8 conversion of strings
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Character which replaces malformed sequences and invalid code points */
+#define PY_UTF8_REPLACEMENT 0xFFFD
+
+/* Get length of leading ASCII run of multibyte string */
+size_t
+py_ascii_prefix (const char *src, size_t len);
+
+/* Get length of leading ASCII run of wide-char string */
+size_t
+py_ascii_prefix_wcs (const wchar_t *src, size_t len);
+
+/* Get count of bytes needed to encode wide-char string */
+size_t
+py_utf8_encoded_size (const wchar_t *src, size_t len);
+
+/* Get count of characters needed to decode UTF-8 string */
+size_t
+py_utf8_decoded_len (const char *src, size_t len);
+
+/* Encode wide-char string to UTF-8 */
+size_t
+py_utf8_encode (char *dst, const wchar_t *src, size_t len);
+
+/* Decode UTF-8 string to wide-char string */
+size_t
+py_utf8_decode (wchar_t *dst, const char *src, size_t len);
+
+/* Convert wide-char string to newly allocated UTF-8 string */
+char*
+py_wcs2mbs (const wchar_t *src);
+
+/* Convert UTF-8 string to newly allocated wide-char string */
+wchar_t*
+py_mbs2wcs (const char *src);
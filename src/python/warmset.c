@@ -0,0 +1,582 @@
+/**
+ * Warm set of modules which are imported by workload
+ *
+ * While recording, __import__ of the builtins is replaced with a hook
+ * which remembers every module that appears in sys.modules and how long
+ * its import took. The list is saved to a text file with one module per
+ * line in order of import, so on next start modules can be imported
+ * before the first script needs them.
+ *
+ * Hook and preloading run with the GIL held, so no additional locking
+ * of the list is needed.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+/* Max length of line in file of warm set */
+#define LINE_LEN 1024
+
+/* File of warm set and its flags */
+static wchar_t *warmset_file = NULL;
+static int warmset_flags = 0;
+
+/* Imported modules in order of import */
+static py_warmset_entry_t *entries = NULL;
+static long entries_count = 0;
+static long entries_size = 0;
+
+/* Modules to be preloaded */
+static char **preload_names = NULL;
+static long preload_count = 0;
+
+/* Original __import__ of the builtins (NULL if hook is not installed) */
+static PyObject *orig_import = NULL;
+
+/* Time spent in imports nested into current one of the thread */
+static __thread unsigned long long nested_ns = 0;
+
+/* Background preloading */
+static pthread_t preload_thread;
+static int preload_started = 0;
+static volatile int preload_stop = 0;
+
+/**
+ * Find entry of module
+ *
+ * @param name - name of module
+ * @return entry of module or NULL if module is not in warm set
+ */
+static py_warmset_entry_t*
+find_entry (const char *name)
+{
+  long i;
+
+  for (i = 0; i < entries_count; ++i)
+    {
+      if (!strcmp (entries[i].name, name))
+        {
+          return &entries[i];
+        }
+    }
+
+  return NULL;
+}
+
+/**
+ * Add module to warm set
+ *
+ * @param name - name of module
+ * @return entry of module
+ */
+static py_warmset_entry_t*
+add_entry (const char *name)
+{
+  py_warmset_entry_t *entry = find_entry (name);
+
+  if (entry)
+    {
+      return entry;
+    }
+
+  if (entries_count == entries_size)
+    {
+      entries_size = MAX (entries_size * 2, 16);
+      entries = realloc (entries, sizeof (py_warmset_entry_t) * entries_size);
+    }
+
+  entry = &entries[entries_count++];
+  memset (entry, 0, sizeof (py_warmset_entry_t));
+  entry->name = strdup (name);
+
+  return entry;
+}
+
+/**
+ * Free all entries of warm set
+ */
+static void
+free_entries (void)
+{
+  long i;
+
+  for (i = 0; i < entries_count; ++i)
+    {
+      free (entries[i].name);
+    }
+
+  SAFE_FREE (entries);
+  entries_count = entries_size = 0;
+}
+
+/**
+ * Import module with recording of import time
+ *
+ * @param self - not used
+ * @param args - arguments of __import__
+ * @param kw - keyword arguments of __import__
+ * @return imported module
+ */
+static PyObject*
+import_hook (PyObject *self, PyObject *args, PyObject *kw)
+{
+  PyObject *modules = PyImport_GetModuleDict (), *result, *name_obj;
+  unsigned long long outer_ns, start, elapsed;
+  const char *name;
+
+  name_obj = PyTuple_Size (args) > 0 ? PyTuple_GET_ITEM (args, 0) : NULL;
+
+  /* Only imports which create new modules are interesting */
+  if (!name_obj || !PyString_Check (name_obj) ||
+      !PyString_GET_SIZE (name_obj) ||
+      PyDict_GetItem (modules, name_obj))
+    {
+      return PyObject_Call (orig_import, args, kw);
+    }
+
+  name = PyString_AS_STRING (name_obj);
+
+  outer_ns = nested_ns;
+  nested_ns = 0;
+
+  start = py_stats_now ();
+  result = PyObject_Call (orig_import, args, kw);
+  elapsed = py_stats_now () - start;
+
+  /* Name may be relative to package, such imports are not recorded */
+  if (result && PyDict_GetItem (modules, name_obj))
+    {
+      py_warmset_entry_t *entry = add_entry (name);
+
+      entry->self_ns = elapsed - MIN (nested_ns, elapsed);
+      entry->total_ns = elapsed;
+    }
+
+  nested_ns = outer_ns + elapsed;
+
+  return result;
+}
+
+static PyMethodDef import_hook_def = {
+  "__import__", (PyCFunction)import_hook, METH_VARARGS | METH_KEYWORDS,
+  "Import module with recording of import time"
+};
+
+/**
+ * Replace __import__ of the builtins with recording hook
+ */
+static void
+install_hook (void)
+{
+  PyObject *builtins = PyEval_GetBuiltins (), *hook;
+
+  if (orig_import)
+    {
+      return;
+    }
+
+  orig_import = PyDict_GetItemString (builtins, "__import__");
+  if (!orig_import)
+    {
+      return;
+    }
+
+  Py_INCREF (orig_import);
+
+  hook = PyCFunction_NewEx (&import_hook_def, NULL, NULL);
+  PyDict_SetItemString (builtins, "__import__", hook);
+  Py_DECREF (hook);
+}
+
+/**
+ * Restore original __import__ of the builtins
+ */
+static void
+remove_hook (void)
+{
+  if (!orig_import)
+    {
+      return;
+    }
+
+  PyDict_SetItemString (PyEval_GetBuiltins (), "__import__", orig_import);
+  Py_CLEAR (orig_import);
+}
+
+/**
+ * Free list of modules to be preloaded
+ */
+static void
+free_preload_names (void)
+{
+  long i;
+
+  for (i = 0; i < preload_count; ++i)
+    {
+      free (preload_names[i]);
+    }
+
+  SAFE_FREE (preload_names);
+  preload_count = 0;
+}
+
+/**
+ * Read list of modules to be preloaded
+ *
+ * @param file_name - name of file with warm set
+ * @return zero on success, non-zero otherwise
+ */
+static int
+load_preload_names (const wchar_t *file_name)
+{
+  FILE *stream;
+  char *mbfile_name, line[LINE_LEN], name[LINE_LEN];
+  long size = 0;
+  py_arena_mark_t mark = py_arena_mark ();
+
+  PY_SCRATCH_WCS2MBS (mbfile_name, file_name);
+  stream = mbfile_name ? fopen (mbfile_name, "r") : NULL;
+  py_arena_release (mark);
+
+  if (!stream)
+    {
+      return -1;
+    }
+
+  while (fgets (line, sizeof (line), stream))
+    {
+      if (line[0] == '#' || sscanf (line, "%1023s", name) != 1)
+        {
+          continue;
+        }
+
+      if (preload_count == size)
+        {
+          size = MAX (size * 2, 16);
+          preload_names = realloc (preload_names, sizeof (char*) * size);
+        }
+
+      preload_names[preload_count++] = strdup (name);
+    }
+
+  fclose (stream);
+
+  return 0;
+}
+
+/**
+ * Import module of warm set
+ *
+ * @param name - name of module
+ */
+static void
+preload_module (const char *name)
+{
+  unsigned long long outer_ns = nested_ns, start, elapsed;
+  py_warmset_entry_t *entry;
+  PyObject *mod;
+
+  nested_ns = 0;
+
+  start = py_stats_now ();
+  mod = PyImport_ImportModule (name);
+  elapsed = py_stats_now () - start;
+
+  entry = add_entry (name);
+  entry->preloaded = 1;
+
+  /* Entry is already filled in if import was recorded by hook */
+  if (!entry->total_ns)
+    {
+      entry->self_ns = elapsed - MIN (nested_ns, elapsed);
+      entry->total_ns = elapsed;
+    }
+
+  nested_ns = outer_ns;
+
+  if (mod)
+    {
+      Py_DECREF (mod);
+    }
+  else
+    {
+      entry->failed = 1;
+      PyErr_Clear ();
+    }
+}
+
+/**
+ * Import modules of warm set
+ */
+static void
+preload_modules (void)
+{
+  long i;
+
+  for (i = 0; i < preload_count && !preload_stop; ++i)
+    {
+      preload_module (preload_names[i]);
+
+      /* Give scripts of main thread a chance to run */
+      Py_BEGIN_ALLOW_THREADS
+      Py_END_ALLOW_THREADS
+    }
+}
+
+/**
+ * Body of background preloading thread
+ *
+ * @param arg - not used
+ * @return NULL
+ */
+static void*
+preload_thread_proc (void *arg)
+{
+  PyGILState_STATE state = PyGILState_Ensure ();
+
+  preload_modules ();
+
+  PyGILState_Release (state);
+
+  return NULL;
+}
+
+/**
+ * Set file of warm set and its flags for next calls of python_init()
+ *
+ * @param file_name - name of file with warm set (NULL to disable)
+ * @param flags - combination of PY_WARMSET_xxx flags
+ */
+void
+py_set_warmset (const wchar_t *file_name, int flags)
+{
+  SAFE_FREE (warmset_file);
+
+  if (file_name)
+    {
+      warmset_file = wcsdup (file_name);
+    }
+
+  warmset_flags = file_name ? flags : 0;
+}
+
+/**
+ * Get flags of warm set
+ *
+ * @return combination of PY_WARMSET_xxx flags (zero if disabled)
+ */
+int
+py_get_warmset (void)
+{
+  return warmset_flags;
+}
+
+/**
+ * Initialize warm set stuff
+ *
+ * Should be called with the GIL held after thread support is initialized.
+ *
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_warmset_init (void)
+{
+  if (!warmset_flags)
+    {
+      return 0;
+    }
+
+  preload_stop = 0;
+
+  if (warmset_flags & PY_WARMSET_RECORD)
+    {
+      install_hook ();
+    }
+
+  /* Missing file means that warm set is not recorded yet */
+  if (!(warmset_flags & PY_WARMSET_PRELOAD) ||
+      load_preload_names (warmset_file))
+    {
+      return 0;
+    }
+
+  if (warmset_flags & PY_WARMSET_BACKGROUND)
+    {
+      long i;
+
+      /* threading takes thread which imports it for the main one */
+      for (i = 0; i < preload_count; ++i)
+        {
+          if (!strcmp (preload_names[i], "threading"))
+            {
+              preload_module (preload_names[i]);
+            }
+        }
+
+      if (pthread_create (&preload_thread, NULL, preload_thread_proc, NULL))
+        {
+          return -1;
+        }
+
+      preload_started = 1;
+    }
+  else
+    {
+      preload_modules ();
+    }
+
+  return 0;
+}
+
+/**
+ * Wait for background preloading
+ *
+ * Should be called with the GIL held.
+ */
+void
+py_warmset_wait (void)
+{
+  if (!preload_started)
+    {
+      return;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  pthread_join (preload_thread, NULL);
+  Py_END_ALLOW_THREADS
+
+  preload_started = 0;
+}
+
+/**
+ * Uninitialize warm set stuff
+ *
+ * Stops preloading and saves recorded warm set.
+ */
+void
+py_warmset_done (void)
+{
+  preload_stop = 1;
+  py_warmset_wait ();
+
+  if (warmset_flags & PY_WARMSET_RECORD)
+    {
+      py_warmset_save (warmset_file);
+    }
+
+  remove_hook ();
+  free_preload_names ();
+  free_entries ();
+  nested_ns = 0;
+}
+
+/**
+ * Save warm set to file
+ *
+ * File is replaced atomically, so concurrent workers do not corrupt it.
+ *
+ * @param file_name - name of file
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_warmset_save (const wchar_t *file_name)
+{
+  FILE *stream;
+  char *mbfile_name, *tmp_name;
+  long i;
+  int result = 0;
+  py_arena_mark_t mark = py_arena_mark ();
+
+  PY_SCRATCH_WCS2MBS (mbfile_name, file_name);
+
+  tmp_name = mbfile_name ? py_arena_alloc (strlen (mbfile_name) + 32) : NULL;
+
+  if (!tmp_name)
+    {
+      py_arena_release (mark);
+      return -1;
+    }
+
+  sprintf (tmp_name, "%s.%ld", mbfile_name, (long)getpid ());
+
+  stream = fopen (tmp_name, "w");
+  if (!stream)
+    {
+      py_arena_release (mark);
+      return -1;
+    }
+
+  fprintf (stream, "# Warm set: module and self time of import in ns\n");
+
+  for (i = 0; i < entries_count; ++i)
+    {
+      if (!entries[i].failed)
+        {
+          fprintf (stream, "%s %llu\n", entries[i].name, entries[i].self_ns);
+        }
+    }
+
+  if (fclose (stream) || rename (tmp_name, mbfile_name))
+    {
+      unlink (tmp_name);
+      result = -1;
+    }
+
+  py_arena_release (mark);
+
+  return result;
+}
+
+/**
+ * Call procedure for each imported module of warm set
+ *
+ * @param proc - procedure to be called
+ * @param data - user's data which is passed to procedure
+ */
+void
+py_warmset_foreach (py_warmset_proc_t proc, void *data)
+{
+  long i;
+
+  for (i = 0; i < entries_count; ++i)
+    {
+      proc (&entries[i], data);
+    }
+}
+
+/**
+ * Print per-module import times
+ *
+ * @param stream - stream to print to
+ */
+void
+py_warmset_report (FILE *stream)
+{
+  unsigned long long total = 0;
+  long i;
+
+  fprintf (stream, "Imports of warm set:\n");
+  fprintf (stream, "  %10s %10s  %s\n", "self ms", "total ms", "module");
+
+  for (i = 0; i < entries_count; ++i)
+    {
+      const py_warmset_entry_t *entry = &entries[i];
+
+      total += entry->self_ns;
+
+      fprintf (stream, "  %10.3f %10.3f  %s%s\n", entry->self_ns / 1e6,
+               entry->total_ns / 1e6, entry->name,
+               entry->failed ? " (failed)" :
+                 (entry->preloaded ? " (preloaded)" : ""));
+    }
+
+  fprintf (stream, "  %10.3f %10s  total of %ld module(s)\n", total / 1e6, "",
+           entries_count);
+}
@@ -0,0 +1,64 @@
+/**
+ * Warm set of modules which are imported by workload
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Flags of warm set */
+enum {
+  PY_WARMSET_RECORD     = 0x0001, /* Record imports and save on python_done() */
+  PY_WARMSET_PRELOAD    = 0x0002, /* Import saved modules in python_init() */
+  PY_WARMSET_BACKGROUND = 0x0004  /* Preload from background thread */
+};
+
+typedef struct {
+  char *name;
+
+  unsigned long long self_ns;  /* Time of import without nested imports */
+  unsigned long long total_ns; /* Time of import with nested imports */
+  int preloaded;               /* Module is imported by preloading */
+  int failed;                  /* Import raised an error */
+} py_warmset_entry_t;
+
+/* Callback for py_warmset_foreach() */
+typedef void (*py_warmset_proc_t) (const py_warmset_entry_t *entry,
+                                   void *data);
+
+/* Set file of warm set and its flags for next calls of python_init() */
+void
+py_set_warmset (const wchar_t *file_name, int flags);
+
+/* Get flags of warm set */
+int
+py_get_warmset (void);
+
+/* Initialize warm set stuff */
+int
+py_warmset_init (void);
+
+/* Uninitialize warm set stuff */
+void
+py_warmset_done (void);
+
+/* Wait for background preloading */
+void
+py_warmset_wait (void);
+
+/* Save warm set to file */
+int
+py_warmset_save (const wchar_t *file_name);
+
+/* Call procedure for each imported module of warm set */
+void
+py_warmset_foreach (py_warmset_proc_t proc, void *data);
+
+/* Print per-module import times */
+void
+py_warmset_report (FILE *stream);
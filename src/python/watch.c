@@ -0,0 +1,904 @@
+/**
+ * Hot reload of changed scripts and modules
+ *
+ * Watcher thread waits for inotify events of directories of run
+ * scripts and of sys.path entries, and queues changed .py files. The
+ * queue is applied with the GIL held by the next run: compiled scripts
+ * of changed files are dropped from cache and changed modules are
+ * removed from sys.modules, so they are compiled or imported again.
+ *
+ * Runs only check a counter of queued changes, so cached scripts are
+ * run without stat calls and polling.
+ *
+ * Directories of sys.path which are inside of sys.prefix are not watched,
+ * since standard library is not expected to change while running.
+ * Packages are watched recursively.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include "iface.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+/* Events which mean that content of file is changed */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+                      IN_DELETE)
+
+/* Minimal count of buckets in cache of scripts */
+#define CACHE_MIN_SIZE 64
+
+/* Max depth of watched packages */
+#define MAX_PACKAGE_DEPTH 16
+
+/* Watched directory */
+typedef struct {
+  int wd;         /* Descriptor of inotify watch */
+  char *dirname;  /* Resolved path of directory */
+} watch_dir_t;
+
+/* Flags of watcher */
+static int watch_flags = 0;
+
+/* Watcher thread and descriptors it waits on */
+static pthread_t watch_thread;
+static int watch_started = 0;
+static int inotify_fd = -1;
+static int stop_pipe[2] = {-1, -1};
+
+/* Watched directories (accessed from watcher thread) */
+static watch_dir_t *dirs = NULL;
+static long dirs_count = 0;
+static long dirs_size = 0;
+static pthread_mutex_t dirs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Changed files which are not applied yet */
+static char **pending = NULL;
+static long pending_size = 0;
+static volatile long pending_count = 0;
+static pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Hash table of cached scripts (accessed with the GIL held) */
+static py_cached_script_t **cache = NULL;
+static unsigned long cache_size = 0;
+static unsigned long cache_count = 0;
+
+/* Count of invalidated scripts and modules */
+static unsigned long invalidations = 0;
+
+/**
+ * Calculate hash of file name
+ *
+ * @param file_name - name of file
+ * @return hash of name
+ */
+static unsigned long
+name_hash (const wchar_t *file_name)
+{
+  unsigned long hash = 2166136261UL;
+
+  while (*file_name)
+    {
+      hash ^= (unsigned long)*file_name++;
+      hash *= 16777619UL;
+    }
+
+  return hash;
+}
+
+/**
+ * Resolve path of file whose directory exists
+ *
+ * File itself could be already removed, so only directory is resolved.
+ *
+ * @param path - path to file
+ * @return resolved path or NULL if directory doesn't exist
+ * @sideeffect allocate memory for return value
+ */
+static char*
+resolve_file (const char *path)
+{
+  char *dir_copy = strdup (path), *base_copy = strdup (path);
+  char real[PATH_MAX], *result = NULL;
+
+  if (realpath (dirname (dir_copy), real))
+    {
+      const char *base = basename (base_copy);
+
+      result = malloc (strlen (real) + strlen (base) + 2);
+      sprintf (result, "%s/%s", real, base);
+    }
+
+  free (dir_copy);
+  free (base_copy);
+
+  return result;
+}
+
+/**
+ * Check whether file name is name of Python's source
+ *
+ * @param name - name of file
+ * @return non-zero if name ends with .py
+ */
+static int
+is_source (const char *name)
+{
+  size_t len = strlen (name);
+
+  return len > 3 && !strcmp (name + len - 3, ".py");
+}
+
+/**
+ * Add inotify watch of directory
+ *
+ * @param dirname - name of directory
+ * @return zero on success, non-zero otherwise
+ */
+static int
+add_watch (const char *dirname)
+{
+  char real[PATH_MAX];
+  long i;
+  int wd;
+
+  if (inotify_fd < 0 || !realpath (dirname, real))
+    {
+      return -1;
+    }
+
+  pthread_mutex_lock (&dirs_mutex);
+
+  /* Watch of the same directory has the same descriptor */
+  wd = inotify_add_watch (inotify_fd, real, WATCH_EVENTS | IN_ONLYDIR);
+
+  if (wd < 0)
+    {
+      pthread_mutex_unlock (&dirs_mutex);
+      return -1;
+    }
+
+  for (i = 0; i < dirs_count; ++i)
+    {
+      if (dirs[i].wd == wd)
+        {
+          pthread_mutex_unlock (&dirs_mutex);
+          return 0;
+        }
+    }
+
+  if (dirs_count == dirs_size)
+    {
+      dirs_size = MAX (dirs_size * 2, 16);
+      dirs = realloc (dirs, sizeof (watch_dir_t) * dirs_size);
+    }
+
+  dirs[dirs_count].wd = wd;
+  dirs[dirs_count].dirname = strdup (real);
+  ++dirs_count;
+
+  pthread_mutex_unlock (&dirs_mutex);
+
+  return 0;
+}
+
+/**
+ * Add watches of directory and of packages inside of it
+ *
+ * @param dirname - name of directory
+ * @param depth - depth of directory
+ */
+static void
+add_watch_recursive (const char *dirname, int depth)
+{
+  struct dirent *entry;
+  DIR *dir;
+
+  if (add_watch (dirname) || depth >= MAX_PACKAGE_DEPTH)
+    {
+      return;
+    }
+
+  dir = opendir (dirname);
+
+  if (!dir)
+    {
+      return;
+    }
+
+  while ((entry = readdir (dir)))
+    {
+      char path[PATH_MAX], init[PATH_MAX + 16];
+      struct stat st;
+
+      if (entry->d_name[0] == '.')
+        {
+          continue;
+        }
+
+      snprintf (path, sizeof (path), "%s/%s", dirname, entry->d_name);
+      snprintf (init, sizeof (init), "%s/__init__.py", path);
+
+      if (!stat (init, &st))
+        {
+          add_watch_recursive (path, depth + 1);
+        }
+    }
+
+  closedir (dir);
+}
+
+/**
+ * Check whether path is inside of directory
+ *
+ * @param path - resolved path
+ * @param dirname - directory, which is resolved by this function
+ * @return non-zero if path is inside of directory
+ */
+static int
+is_inside (const char *path, const char *dirname)
+{
+  char real[PATH_MAX];
+  size_t len;
+
+  if (!dirname || !realpath (dirname, real))
+    {
+      return 0;
+    }
+
+  len = strlen (real);
+
+  return !strncmp (path, real, len) && (!path[len] || path[len] == '/');
+}
+
+/**
+ * Watch entries of sys.path which are not part of Python's installation
+ */
+static void
+watch_syspath (void)
+{
+  PyObject *path = PySys_GetObject ("path"); /* borrowed ref */
+  char *prefix = Py_GetPrefix (), *exec_prefix = Py_GetExecPrefix ();
+  Py_ssize_t i;
+
+  if (!path || !PyList_Check (path))
+    {
+      return;
+    }
+
+  for (i = 0; i < PyList_GET_SIZE (path); ++i)
+    {
+      PyObject *item = PyList_GET_ITEM (path, i);
+      const char *dirname;
+      char real[PATH_MAX];
+
+      if (!PyString_Check (item))
+        {
+          continue;
+        }
+
+      dirname = PyString_AS_STRING (item);
+
+      if (!*dirname)
+        {
+          dirname = ".";
+        }
+
+      if (!realpath (dirname, real) || is_inside (real, prefix) ||
+          is_inside (real, exec_prefix))
+        {
+          continue;
+        }
+
+      add_watch_recursive (real, 0);
+    }
+}
+
+/**
+ * Queue changed file
+ *
+ * @param path - resolved path of file
+ */
+static void
+queue_change (char *path)
+{
+  pthread_mutex_lock (&pending_mutex);
+
+  if (pending_count == pending_size)
+    {
+      pending_size = MAX (pending_size * 2, 16);
+      pending = realloc (pending, sizeof (char*) * pending_size);
+    }
+
+  pending[pending_count] = path;
+
+  /* Counter is read without lock by runs, so it's updated last */
+  __sync_synchronize ();
+  ++pending_count;
+
+  pthread_mutex_unlock (&pending_mutex);
+}
+
+/**
+ * Handle single inotify event
+ *
+ * @param event - event to handle
+ */
+static void
+handle_event (const struct inotify_event *event)
+{
+  char *path = NULL;
+  long i;
+
+  pthread_mutex_lock (&dirs_mutex);
+
+  for (i = 0; i < dirs_count; ++i)
+    {
+      if (dirs[i].wd != event->wd)
+        {
+          continue;
+        }
+
+      if (event->mask & IN_IGNORED)
+        {
+          /* Directory is removed */
+          free (dirs[i].dirname);
+          dirs[i] = dirs[--dirs_count];
+        }
+      else if (event->len && is_source (event->name))
+        {
+          path = malloc (strlen (dirs[i].dirname) + strlen (event->name) + 2);
+          sprintf (path, "%s/%s", dirs[i].dirname, event->name);
+        }
+
+      break;
+    }
+
+  pthread_mutex_unlock (&dirs_mutex);
+
+  if (path)
+    {
+      queue_change (path);
+    }
+}
+
+/**
+ * Wait for inotify events and queue changed files
+ *
+ * @param arg - not used
+ * @return NULL
+ */
+static void*
+watch_thread_proc (void *arg)
+{
+  char buffer[sizeof (struct inotify_event) + NAME_MAX + 1]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  struct pollfd fds[2];
+
+  fds[0].fd = inotify_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = stop_pipe[0];
+  fds[1].events = POLLIN;
+
+  for (;;)
+    {
+      ssize_t len;
+      char *ptr;
+
+      if (poll (fds, 2, -1) < 0)
+        {
+          continue;
+        }
+
+      if (fds[1].revents)
+        {
+          break;
+        }
+
+      len = read (inotify_fd, buffer, sizeof (buffer));
+
+      for (ptr = buffer; len > 0 && ptr < buffer + len; )
+        {
+          const struct inotify_event *event = (struct inotify_event*)ptr;
+
+          handle_event (event);
+          ptr += sizeof (struct inotify_event) + event->len;
+        }
+    }
+
+  return NULL;
+}
+
+/**
+ * Free cached script
+ *
+ * @param cached - script to free
+ */
+static void
+free_cached (py_cached_script_t *cached)
+{
+  py_script_free (cached->script);
+  free (cached->real_name);
+  free (cached);
+}
+
+/**
+ * Drop compiled scripts of changed file from cache
+ *
+ * @param path - resolved path of changed file
+ */
+static void
+invalidate_scripts (const char *path)
+{
+  unsigned long i;
+
+  for (i = 0; i < cache_size; ++i)
+    {
+      py_cached_script_t **link = &cache[i];
+
+      while (*link)
+        {
+          py_cached_script_t *cached = *link;
+
+          if (!cached->real_name || strcmp (cached->real_name, path))
+            {
+              link = &cached->next;
+              continue;
+            }
+
+          *link = cached->next;
+          --cache_count;
+          ++invalidations;
+
+          /* Script which is running now is freed when it's released */
+          cached->stale = 1;
+
+          if (!cached->refs)
+            {
+              free_cached (cached);
+            }
+        }
+    }
+}
+
+/**
+ * Remove modules of changed file from sys.modules
+ *
+ * @param path - resolved path of changed file
+ */
+static void
+invalidate_modules (const char *path)
+{
+  PyObject *modules = PyImport_GetModuleDict (), *key, *value, *stale;
+  const char *base = strrchr (path, '/') + 1;
+  size_t base_len = strlen (base);
+  Py_ssize_t pos = 0, i;
+
+  stale = PyList_New (0);
+
+  while (PyDict_Next (modules, &pos, &key, &value))
+    {
+      PyObject *file;
+      const char *file_name, *file_base;
+      char *resolved;
+      size_t len;
+
+      if (!PyModule_Check (value))
+        {
+          continue;
+        }
+
+      file = PyDict_GetItemString (PyModule_GetDict (value), "__file__");
+
+      if (!file || !PyString_Check (file))
+        {
+          continue;
+        }
+
+      /* Compare names of files first, so only candidates are resolved */
+      file_name = PyString_AS_STRING (file);
+      file_base = strrchr (file_name, '/');
+      file_base = file_base ? file_base + 1 : file_name;
+      len = strlen (file_base);
+
+      /* Module could be loaded from .pyc or .pyo of changed source */
+      if (len == base_len + 1 && (file_base[len - 1] == 'c' ||
+                                  file_base[len - 1] == 'o'))
+        {
+          --len;
+        }
+
+      if (len != base_len || strncmp (file_base, base, len))
+        {
+          continue;
+        }
+
+      resolved = resolve_file (file_name);
+
+      if (resolved && !strcmp (resolved, path))
+        {
+          PyList_Append (stale, key);
+        }
+
+      SAFE_FREE (resolved);
+    }
+
+  for (i = 0; i < PyList_GET_SIZE (stale); ++i)
+    {
+      PyDict_DelItem (modules, PyList_GET_ITEM (stale, i));
+      ++invalidations;
+    }
+
+  Py_DECREF (stale);
+}
+
+/**
+ * Put script to cache
+ *
+ * @param cached - script to put
+ */
+static void
+cache_insert (py_cached_script_t *cached)
+{
+  unsigned long index;
+
+  if (cache_count >= cache_size / 2)
+    {
+      unsigned long new_size = MAX (cache_size * 2, CACHE_MIN_SIZE), i;
+      py_cached_script_t **new_cache;
+
+      new_cache = calloc (new_size, sizeof (py_cached_script_t*));
+
+      for (i = 0; i < cache_size; ++i)
+        {
+          while (cache[i])
+            {
+              py_cached_script_t *item = cache[i];
+
+              cache[i] = item->next;
+              index = item->hash & (new_size - 1);
+              item->next = new_cache[index];
+              new_cache[index] = item;
+            }
+        }
+
+      free (cache);
+      cache = new_cache;
+      cache_size = new_size;
+    }
+
+  index = cached->hash & (cache_size - 1);
+  cached->next = cache[index];
+  cache[index] = cached;
+  ++cache_count;
+}
+
+/**
+ * Free all cached scripts
+ */
+static void
+free_cache (void)
+{
+  unsigned long i;
+
+  for (i = 0; i < cache_size; ++i)
+    {
+      while (cache[i])
+        {
+          py_cached_script_t *cached = cache[i];
+
+          cache[i] = cached->next;
+          free_cached (cached);
+        }
+    }
+
+  SAFE_FREE (cache);
+  cache_size = cache_count = 0;
+}
+
+/********
+ * User's stuff
+ */
+
+/**
+ * Set flags of watcher for next calls of python_init()
+ *
+ * @param flags - combination of PY_WATCH_xxx flags, zero disables watcher
+ */
+void
+py_set_watch (int flags)
+{
+  watch_flags = flags;
+}
+
+/**
+ * Get flags of watcher
+ *
+ * @return combination of PY_WATCH_xxx flags
+ */
+int
+py_get_watch (void)
+{
+  return watch_flags;
+}
+
+/**
+ * Start watching of script directories and sys.path
+ *
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_watch_init (void)
+{
+  if (!watch_flags || watch_started)
+    {
+      return 0;
+    }
+
+  inotify_fd = inotify_init ();
+
+  if (inotify_fd < 0)
+    {
+      return -1;
+    }
+
+  if (pipe (stop_pipe))
+    {
+      close (inotify_fd);
+      inotify_fd = -1;
+      return -1;
+    }
+
+  fcntl (inotify_fd, F_SETFL, O_NONBLOCK);
+
+  if (watch_flags & PY_WATCH_MODULES)
+    {
+      watch_syspath ();
+    }
+
+  if (pthread_create (&watch_thread, NULL, watch_thread_proc, NULL))
+    {
+      py_watch_done ();
+      return -1;
+    }
+
+  watch_started = 1;
+
+  return 0;
+}
+
+/**
+ * Stop watching and free cached scripts
+ */
+void
+py_watch_done (void)
+{
+  long i;
+
+  if (watch_started)
+    {
+      if (write (stop_pipe[1], "", 1) == 1)
+        {
+          pthread_join (watch_thread, NULL);
+        }
+
+      watch_started = 0;
+    }
+
+  if (inotify_fd >= 0)
+    {
+      close (inotify_fd);
+      close (stop_pipe[0]);
+      close (stop_pipe[1]);
+      inotify_fd = stop_pipe[0] = stop_pipe[1] = -1;
+    }
+
+  for (i = 0; i < dirs_count; ++i)
+    {
+      free (dirs[i].dirname);
+    }
+
+  SAFE_FREE (dirs);
+  dirs_count = dirs_size = 0;
+
+  for (i = 0; i < pending_count; ++i)
+    {
+      free (pending[i]);
+    }
+
+  SAFE_FREE (pending);
+  pending_count = pending_size = 0;
+
+  free_cache ();
+}
+
+/**
+ * Watch directory for changes of scripts and modules
+ *
+ * @param dirname - name of directory. Packages inside of it are watched too
+ * @return zero on success, non-zero otherwise
+ */
+int
+py_watch_add_dir (const wchar_t *dirname)
+{
+  char *mbdirname;
+  py_arena_mark_t mark = py_arena_mark ();
+
+  PY_SCRATCH_WCS2MBS (mbdirname, dirname);
+
+  if (!mbdirname || add_watch (mbdirname))
+    {
+      py_arena_release (mark);
+      return -1;
+    }
+
+  add_watch_recursive (mbdirname, 0);
+
+  py_arena_release (mark);
+
+  return 0;
+}
+
+/**
+ * Apply invalidations which were collected by watcher
+ *
+ * Should be called with the GIL held. It's called by runs of scripts,
+ * so usually there's no need to call it directly.
+ */
+void
+py_watch_sync (void)
+{
+  char **changes;
+  long i, count;
+
+  if (!pending_count)
+    {
+      return;
+    }
+
+  pthread_mutex_lock (&pending_mutex);
+
+  changes = pending;
+  count = pending_count;
+  pending = NULL;
+  pending_count = pending_size = 0;
+
+  pthread_mutex_unlock (&pending_mutex);
+
+  for (i = 0; i < count; ++i)
+    {
+      invalidate_scripts (changes[i]);
+
+      if (watch_flags & PY_WATCH_MODULES)
+        {
+          invalidate_modules (changes[i]);
+        }
+
+      free (changes[i]);
+    }
+
+  free (changes);
+}
+
+/**
+ * Get cached compiled script of file
+ *
+ * Script is read from file on first call and its directory is watched,
+ * so next calls return the same script until file is changed.
+ *
+ * @param file_name - name of script's file
+ * @return cached script or NULL if scripts are not cached or file
+ *   couldn't be read
+ * @sideeffect increase count of script's users. Use
+ *   py_watch_release_script() to decrease it
+ */
+py_cached_script_t*
+py_watch_acquire_script (const wchar_t *file_name)
+{
+  py_cached_script_t *cached;
+  unsigned long hash;
+  py_script_t *script;
+  char *mbfile_name, *real_name, *dir;
+  py_arena_mark_t mark;
+
+  if (!watch_started || !(watch_flags & PY_WATCH_SCRIPTS))
+    {
+      return NULL;
+    }
+
+  py_watch_sync ();
+
+  hash = name_hash (file_name);
+
+  if (cache_size)
+    {
+      for (cached = cache[hash & (cache_size - 1)]; cached;
+           cached = cached->next)
+        {
+          if (cached->hash == hash &&
+              !wcscmp (cached->script->file_name, file_name))
+            {
+              ++cached->refs;
+              return cached;
+            }
+        }
+    }
+
+  mark = py_arena_mark ();
+  PY_SCRATCH_WCS2MBS (mbfile_name, file_name);
+
+  if (!mbfile_name)
+    {
+      py_arena_release (mark);
+      return NULL;
+    }
+
+  /* Directory is watched before reading, so no change is missed */
+  real_name = resolve_file (mbfile_name);
+  dir = strdup (mbfile_name);
+  add_watch (dirname (dir));
+  free (dir);
+
+  py_arena_release (mark);
+
+  script = py_script_new_file (file_name);
+
+  if (!script)
+    {
+      SAFE_FREE (real_name);
+      return NULL;
+    }
+
+  MALLOC_ZERO (cached, sizeof (py_cached_script_t));
+  cached->script = script;
+  cached->hash = hash;
+  cached->real_name = real_name;
+  cached->refs = 1;
+
+  cache_insert (cached);
+
+  return cached;
+}
+
+/**
+ * Release script which was got by py_watch_acquire_script()
+ *
+ * @param cached - script to release
+ */
+void
+py_watch_release_script (py_cached_script_t *cached)
+{
+  if (!cached)
+    {
+      return;
+    }
+
+  --cached->refs;
+
+  if (cached->stale && !cached->refs)
+    {
+      free_cached (cached);
+    }
+}
+
+/**
+ * Get count of invalidated scripts and modules
+ *
+ * @return count of invalidations since start
+ */
+unsigned long
+py_watch_invalidations (void)
+{
+  return invalidations;
+}
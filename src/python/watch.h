@@ -0,0 +1,68 @@
+/**
+ * Hot reload of changed scripts and modules
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef PYTHON_IFACE_H
+#  error "Do not include this file directly. Include iface.h instead."
+#endif
+
+/* Flags of watcher */
+enum {
+  PY_WATCH_SCRIPTS = 0x0001, /* Cache compiled files which are run */
+  PY_WATCH_MODULES = 0x0002, /* Forget imported modules when they change */
+
+  PY_WATCH_ALL     = 0x0003  /* All of the above */
+};
+
+/* Compiled script of watched file */
+typedef struct py_cached_script {
+  py_script_t *script;
+  unsigned long hash;      /* Hash of script's file name */
+  char *real_name;         /* Resolved path of script's file */
+
+  int refs;                /* Count of runs which use the script */
+  int stale;               /* File is changed, free script when released */
+
+  struct py_cached_script *next; /* Next script in cache's bucket */
+} py_cached_script_t;
+
+/* Set flags of watcher for next calls of python_init() */
+void
+py_set_watch (int flags);
+
+/* Get flags of watcher */
+int
+py_get_watch (void);
+
+/* Start watching of script directories and sys.path */
+int
+py_watch_init (void);
+
+/* Stop watching and free cached scripts */
+void
+py_watch_done (void);
+
+/* Watch directory for changes of scripts and modules */
+int
+py_watch_add_dir (const wchar_t *dirname);
+
+/* Apply invalidations which were collected by watcher */
+void
+py_watch_sync (void);
+
+/* Get cached compiled script of file */
+py_cached_script_t*
+py_watch_acquire_script (const wchar_t *file_name);
+
+/* Release script which was got by py_watch_acquire_script() */
+void
+py_watch_release_script (py_cached_script_t *cached);
+
+/* Get count of invalidated scripts and modules */
+unsigned long
+py_watch_invalidations (void);
@@ -0,0 +1,726 @@
+/**
+ * Memory soak harness for public entry points of Python bindings
+ *
+ * Every entry point is called many times after a warm-up, and growth of
+ * RSS, heap usage and (in debug builds of Python) total reference count
+ * is divided by count of iterations. Entry point fails if growth per
+ * iteration exceeds the threshold.
+ *
+ * Copyright 2009 Sergey I. Sharybin <g.ulairi@gmail.com>
+ *
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include <stdlib.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "python/iface.h"
+
+/* Default count of iterations */
+#define DEFAULT_ITERATIONS 1000000
+
+/* Default allowed growth of memory in bytes per iteration */
+#define DEFAULT_MAX_BYTES 0.5
+
+/* Default allowed growth of total reference count per iteration */
+#define DEFAULT_MAX_REFS 0.001
+
+/* Growth of RSS which is not counted: RSS changes by whole pages, */
+/* so a single new page must not fail short runs */
+#define RSS_SLACK (64 * 1024)
+
+/* Count of progress checkpoints */
+#define CHECKPOINTS 10
+
+typedef struct {
+  const char *name;
+  void (*op) (void); /* Run one operation */
+  int divisor;       /* Count of iterations is divided by this value */
+} soak_t;
+
+typedef struct {
+  long rss;       /* Resident set size in bytes */
+  long heap;      /* Allocated heap in bytes */
+  long refs;      /* Total reference count (zero in release builds) */
+} snapshot_t;
+
+static long opt_iterations = DEFAULT_ITERATIONS;
+static double opt_max_bytes = DEFAULT_MAX_BYTES;
+static double opt_max_refs = DEFAULT_MAX_REFS;
+static const char *opt_filter = NULL;
+static int opt_verbose = 0;
+
+/* Script which is run by extpy_run_file() */
+static char script_file[4096] = "";
+static int script_is_temporary = 0;
+
+PY_BEGIN_INITTAB(no_modules)
+PY_END_INITTAB
+
+/****
+ * Measurements
+ */
+
+/**
+ * Take snapshot of memory usage
+ *
+ * @param snapshot - snapshot to be filled
+ */
+static void
+take_snapshot (snapshot_t *snapshot)
+{
+  long size, resident = 0;
+  FILE *file;
+
+#if defined (__GLIBC__) && \
+  (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 info = mallinfo2 ();
+#else
+  struct mallinfo info = mallinfo ();
+#endif
+
+  snapshot->heap = info.uordblks + info.hblkhd;
+
+  file = fopen ("/proc/self/statm", "r");
+  if (file)
+    {
+      if (fscanf (file, "%ld %ld", &size, &resident) != 2)
+        {
+          resident = 0;
+        }
+      fclose (file);
+    }
+
+  snapshot->rss = resident * sysconf (_SC_PAGESIZE);
+
+#ifdef Py_REF_DEBUG
+  snapshot->refs = _Py_RefTotal;
+#else
+  snapshot->refs = 0;
+#endif
+}
+
+/****
+ * Fixtures
+ */
+
+/**
+ * Create temporary script for extpy_run_file()
+ *
+ * @return zero on success, non-zero otherwise
+ */
+static int
+create_script_file (void)
+{
+  static const char text[] = "import sys\n"
+    "values = [x * 2 for x in range (10)]\n"
+    "print sum (values)\n";
+  int fd;
+
+  snprintf (script_file, sizeof (script_file), "/tmp/memsoak-XXXXXX");
+  fd = mkstemp (script_file);
+
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  if (write (fd, text, sizeof (text) - 1) != sizeof (text) - 1)
+    {
+      close (fd);
+      unlink (script_file);
+      return -1;
+    }
+
+  close (fd);
+  script_is_temporary = 1;
+
+  return 0;
+}
+
+static py_script_t *fixture_script = NULL;
+static PyObject *fixture_dict = NULL;
+static PyObject *fixture_object = NULL;
+
+/* Fixtures of entry points which call script's functions */
+static PyObject *fixture_globals = NULL;
+static PyObject *fixture_memo_code = NULL;
+static PyObject *fixture_io_code = NULL;
+static py_script_t *fixture_coro_script = NULL;
+static py_sched_t *fixture_sched = NULL;
+static py_equeue_t *fixture_queue = NULL;
+
+/* Count of events which are posted to full queue */
+#define SOAK_EVENT_COUNT 16
+
+static void
+soak_coro_proc (py_coro_t *coro, int event, PyObject *arg, void *data)
+{
+}
+
+PY_METHOD(soak_method)
+PY_METH_END
+
+PY_BEGIN_METHMAP(soak_methods)
+  PY_METHMAP_DEF (L"first", soak_method, METH_VARARGS, L"First method")
+  PY_METHMAP_DEF (L"second", soak_method, METH_VARARGS, L"Second method")
+PY_END_METHMAP
+
+PY_BEGIN_STATIC_METHMAP(soak_static_methods)
+  PY_STATIC_METHMAP_DEF ("first", soak_method, METH_VARARGS, "First method")
+  PY_STATIC_METHMAP_DEF ("second", soak_method, METH_VARARGS,
+                         "Second method")
+PY_END_STATIC_METHMAP
+
+static void
+setup_fixtures (void)
+{
+  py_script_t *script;
+  PyObject *result;
+
+  fixture_script = py_script_new_buffer (L"a = [1, 2, 3]\n"
+                                         L"b = dict (x = a)\n"
+                                         L"print len (b['x'])\n");
+
+  script = py_script_new_buffer (L"class A:\n  pass\n"
+                                 L"A.longField = 314\n"
+                                 L"A.floatField = 3.14\n"
+                                 L"A.stringField = 'Some string field'\n");
+
+  fixture_dict = PyDict_New ();
+  PyDict_SetItemString (fixture_dict, "__builtins__",
+                        py_builtins_get_global ());
+
+  result = py_run_script_at_dict (script, fixture_dict);
+  Py_XDECREF (result);
+  py_script_free (script);
+
+  fixture_object = PyDict_GetItemString (fixture_dict, "A");
+  Py_XINCREF (fixture_object);
+
+  fixture_globals = py_global_dictionary_new ();
+  extpy_dict_set_item_str (fixture_globals, L"path",
+                           PyString_FromString (script_file));
+
+  result = PyRun_String ("def score(id):\n"
+                         "  if id % 2:\n"
+                         "    raise ValueError(id)\n"
+                         "  return id\n"
+                         "def handle(arg, data):\n"
+                         "  pass\n", Py_file_input, fixture_globals,
+                         fixture_globals);
+  Py_XDECREF (result);
+
+  /* Small cache, so results are evicted during soak */
+  py_cache_get (L"soak", 16 * 1024, 0);
+
+  /* Function is defined again with new closure by every run */
+  fixture_memo_code = Py_CompileString ("def make(k):\n"
+                                        "  @memo(cache='soak')\n"
+                                        "  def f(x):\n"
+                                        "    return x + k\n"
+                                        "  return f\n"
+                                        "r = make(seed)(seed)\n", "<memo>",
+                                        Py_file_input);
+
+  /* Buffer which isn't pinned is filled via copy */
+  fixture_io_code = Py_CompileString ("fd = openFile(path)\n"
+                                      "buf = bytearray(64)\n"
+                                      "n = readInto(fd, buf)\n"
+                                      "closeFile(fd)\n", "<io>",
+                                      Py_file_input);
+
+  fixture_coro_script = py_script_new_buffer (L"def main():\n"
+                                              L"  yield None\n"
+                                              L"  yield float('inf')\n");
+  fixture_sched = py_sched_new (soak_coro_proc, NULL);
+
+  fixture_queue = py_equeue_new (SOAK_EVENT_COUNT, 16, SOAK_EVENT_COUNT, 0);
+  py_equeue_set_handler (fixture_queue, 0,
+                         PyDict_GetItemString (fixture_globals, "handle"));
+}
+
+static void
+teardown_fixtures (void)
+{
+  py_script_free (fixture_script);
+  py_script_free (fixture_coro_script);
+  py_sched_free (fixture_sched);
+  py_equeue_free (fixture_queue);
+
+  Py_XDECREF (fixture_memo_code);
+  Py_XDECREF (fixture_io_code);
+  py_global_dictionary_free (fixture_globals);
+
+  Py_XDECREF (fixture_object);
+  PyDict_Clear (fixture_dict);
+  Py_DECREF (fixture_dict);
+}
+
+/****
+ * Operations
+ */
+
+static void
+op_module_new (void)
+{
+  py_module_free (py_module_new (L"SoakModule", L"Soak module",
+                                 soak_methods));
+}
+
+static void
+op_module_new_static (void)
+{
+  py_module_free (py_module_new_static (L"SoakModule", L"Soak module",
+                                        soak_static_methods));
+}
+
+static void
+op_script_new_free (void)
+{
+  py_script_free (py_script_new_buffer (L"a = 1\n"));
+}
+
+static void
+op_run_script (void)
+{
+  extpy_run_free (extpy_run_script (fixture_script));
+}
+
+static void
+op_run_script_at_dict (void)
+{
+  PyObject *result = py_run_script_at_dict (fixture_script, fixture_dict);
+
+  Py_XDECREF (result);
+  py_tracer_truncate_buffer (PY_STDOUT);
+}
+
+static void
+op_run_file (void)
+{
+  wchar_t *file_name;
+
+  MBS2WCS (file_name, script_file);
+  extpy_run_free (extpy_run_file (file_name));
+  free (file_name);
+}
+
+static void
+op_get_attrs (void)
+{
+  extpy_get_long_attr (fixture_object, L"longField");
+  extpy_get_double_attr (fixture_object, L"floatField");
+  free (extpy_get_string_attr (fixture_object, L"stringField"));
+}
+
+static void
+op_get_attrs_mismatch (void)
+{
+  /* Attributes of unexpected types and missing attributes */
+  extpy_get_long_attr (fixture_object, L"stringField");
+  extpy_get_double_attr (fixture_object, L"longField");
+  free (extpy_get_string_attr (fixture_object, L"floatField"));
+  extpy_get_long_attr (fixture_object, L"missingField");
+  PyErr_Clear ();
+}
+
+static void
+op_set_has_attr (void)
+{
+  extpy_set_attr_string (fixture_object, L"soakField", Py_None);
+  extpy_has_attr_string (fixture_object, L"soakField");
+}
+
+static void
+op_dict_set_item_str (void)
+{
+  extpy_dict_set_item_str (fixture_dict, L"soakKey",
+                           PyFloat_FromDouble (3.14));
+}
+
+static void
+op_proc_write (void)
+{
+  py_proc_write (PY_STDOUT, L"Value: %d\n", 314);
+  py_tracer_truncate_buffer (PY_STDOUT);
+}
+
+static void
+op_get_buffer (void)
+{
+  py_proc_write (PY_STDERR, L"Captured output\n");
+  free (py_tracer_get_buffer (PY_STDERR));
+  py_tracer_truncate_buffer (PY_STDERR);
+}
+
+static void
+op_syspath_append (void)
+{
+  py_syspath_append (L"/tmp");
+}
+
+static void
+op_array_buffer (void)
+{
+  static double data[16];
+  PyObject *array, *view;
+  py_buffer_t buffer;
+
+  array = py_array_new_1d (data, PY_ARRAY_FLOAT64, 16, PY_ARRAY_WRITABLE,
+                           NULL, NULL);
+  view = PyMemoryView_FromObject (array);
+
+  if (!py_buffer_get (view, &buffer, PY_ARRAY_WRITABLE))
+    {
+      py_buffer_release (&buffer);
+    }
+
+  Py_DECREF (view);
+  Py_DECREF (array);
+}
+
+typedef struct {
+  long id;
+  char name[16];
+  PyObject *value;
+} soak_record_t;
+
+PY_BEGIN_FIELDS (soak_record_fields)
+PY_FIELD_DEF (soak_record_t, id, PY_FIELD_LONG, 0, NULL)
+PY_FIELD_DEF (soak_record_t, name, PY_FIELD_STRING, 0, NULL)
+PY_FIELD_DEF (soak_record_t, value, PY_FIELD_OBJECT, 0, NULL)
+PY_END_FIELDS
+
+PY_BEGIN_FIELDS (soak_batch_fields)
+PY_FIELD_DEF (soak_record_t, id, PY_FIELD_LONG, 0, NULL)
+PY_END_FIELDS
+
+static void
+op_record_array (void)
+{
+  static PyTypeObject *type = NULL;
+  PyObject *array, *record, *value;
+
+  if (!type)
+    {
+      type = py_record_type_new ("SoakRecord", NULL, soak_record_fields,
+                                 sizeof (soak_record_t));
+    }
+
+  array = py_record_array_new (type, 4);
+  record = PySequence_GetItem (array, 2);
+  value = PyString_FromString ("value");
+
+  PyObject_SetAttrString (record, "name", value);
+  PyObject_SetAttrString (record, "value", value);
+
+  Py_DECREF (value);
+  Py_DECREF (record);
+  Py_DECREF (array);
+}
+
+static void
+op_call_lookup (void)
+{
+  PyObject *result;
+  py_call_t *call;
+
+  call = py_call_lookup (L"posixpath", L"join", 2);
+
+  if (call)
+    {
+      py_call_set_string (call, 0, L"/tmp");
+      py_call_set_string (call, 1, L"soak");
+
+      result = py_call_invoke (call);
+      Py_XDECREF (result);
+
+      py_call_free (call);
+    }
+
+  /* Lookup without name fails */
+  py_call_free (py_call_lookup (L"posixpath", NULL, 2));
+  PyErr_Clear ();
+}
+
+static void
+op_batch_run (void)
+{
+  static soak_record_t records[4];
+  static long results[4];
+  py_batch_t batch = {0};
+  long i;
+
+  for (i = 0; i < 4; ++i)
+    {
+      records[i].id = i;
+    }
+
+  /* Items with odd identifiers fail */
+  batch.callable = PyDict_GetItemString (fixture_globals, "score");
+  batch.records = records;
+  batch.stride = sizeof (soak_record_t);
+  batch.count = 4;
+  batch.fields = soak_batch_fields;
+  batch.out = results;
+  batch.out_type = PY_FIELD_LONG;
+  batch.max_errors = 2;
+
+  py_batch_run (&batch);
+  py_batch_free_errors (&batch);
+  PyErr_Clear ();
+}
+
+static void
+op_sched_spawn (void)
+{
+  /* Coroutine yields infinite sleep on its second step and fails */
+  py_sched_spawn (fixture_sched, fixture_coro_script, "main", NULL);
+
+  while (py_sched_count (fixture_sched))
+    {
+      py_sched_run (fixture_sched);
+    }
+
+  py_tracer_truncate_buffer (PY_STDERR);
+}
+
+static void
+op_io_read_into (void)
+{
+  PyObject *result;
+
+  result = PyEval_EvalCode ((PyCodeObject*)fixture_io_code, fixture_globals,
+                            fixture_globals);
+  Py_XDECREF (result);
+}
+
+static void
+op_equeue (void)
+{
+  long i;
+
+  /* The last event doesn't fit the queue */
+  for (i = 0; i <= SOAK_EVENT_COUNT; ++i)
+    {
+      py_equeue_post (fixture_queue, 0, i, "payload", 7);
+    }
+
+  while (py_equeue_dispatch (fixture_queue))
+    {
+    }
+}
+
+static void
+op_memo (void)
+{
+  static long seed = 0;
+  PyObject *result;
+
+  extpy_dict_set_item_str (fixture_globals, L"seed",
+                           PyInt_FromLong (seed++));
+
+  result = PyEval_EvalCode ((PyCodeObject*)fixture_memo_code,
+                            fixture_globals, fixture_globals);
+  Py_XDECREF (result);
+}
+
+static const soak_t soaks[] = {
+  {"py_module_new",           op_module_new,          10},
+  {"py_module_new_static",    op_module_new_static,   10},
+  {"py_script_new_buffer",    op_script_new_free,     1},
+  {"extpy_run_script",        op_run_script,          10},
+  {"py_run_script_at_dict",   op_run_script_at_dict,  10},
+  {"extpy_run_file",          op_run_file,            100},
+  {"extpy_get_attrs",         op_get_attrs,           1},
+  {"extpy_get_attrs/mismatch", op_get_attrs_mismatch, 1},
+  {"extpy_set_attr_string",   op_set_has_attr,        1},
+  {"extpy_dict_set_item_str", op_dict_set_item_str,   1},
+  {"py_proc_write",           op_proc_write,          10},
+  {"py_tracer_get_buffer",    op_get_buffer,          10},
+  {"py_syspath_append",       op_syspath_append,      10},
+  {"py_array_new",            op_array_buffer,        1},
+  {"py_record_array_new",     op_record_array,        1},
+  {"py_call_lookup",          op_call_lookup,         10},
+  {"py_batch_run",            op_batch_run,           10},
+  {"py_sched_spawn",          op_sched_spawn,         100},
+  {"py_io_read_into",         op_io_read_into,        10},
+  {"py_equeue_post",          op_equeue,              10},
+  {"memo",                    op_memo,                10},
+  {NULL, NULL, 0}
+};
+
+/****
+ * Runner
+ */
+
+/**
+ * Soak entry point and check growth of memory
+ *
+ * @param soak - entry point to be soaked
+ * @return zero if growth is below thresholds, non-zero otherwise
+ */
+static int
+run_soak (const soak_t *soak)
+{
+  long i, iterations = MAX (opt_iterations / soak->divisor, 1);
+  long warmup = MAX (iterations / 10, 100);
+  snapshot_t before, after;
+  double rss_growth, heap_growth, refs_growth;
+  int checkpoint, failed;
+
+  for (i = 0; i < warmup; ++i)
+    {
+      soak->op ();
+    }
+
+  take_snapshot (&before);
+
+  for (checkpoint = 0; checkpoint < CHECKPOINTS; ++checkpoint)
+    {
+      long count = iterations / CHECKPOINTS +
+        (checkpoint < iterations % CHECKPOINTS);
+
+      for (i = 0; i < count; ++i)
+        {
+          soak->op ();
+        }
+
+      if (opt_verbose)
+        {
+          snapshot_t current;
+
+          take_snapshot (&current);
+          fprintf (stderr, "  %s: %3d%% rss %ld KiB heap %ld KiB refs %ld\n",
+                   soak->name, (checkpoint + 1) * 100 / CHECKPOINTS,
+                   current.rss / 1024, current.heap / 1024, current.refs);
+        }
+    }
+
+  take_snapshot (&after);
+
+  rss_growth = (double)MAX (after.rss - before.rss - RSS_SLACK, 0) /
+    iterations;
+  heap_growth = (double)(after.heap - before.heap) / iterations;
+  refs_growth = (double)(after.refs - before.refs) / iterations;
+
+  failed = rss_growth > opt_max_bytes || heap_growth > opt_max_bytes ||
+    refs_growth > opt_max_refs;
+
+  printf ("%-26s %9ld iterations  rss %+8.3f B/it  heap %+8.3f B/it  "
+          "refs %+7.4f /it  %s\n", soak->name, iterations, rss_growth,
+          heap_growth, refs_growth, failed ? "FAIL" : "ok");
+  fflush (stdout);
+
+  return failed;
+}
+
+static void
+usage (const char *progname)
+{
+  fprintf (stderr,
+           "Usage: %s [options] [script.py]\n"
+           "  -n, --iterations=N   base count of iterations (default %d)\n"
+           "  -b, --max-bytes=B    allowed growth per iteration in bytes "
+           "(default %.2f)\n"
+           "  -r, --max-refs=R     allowed growth of reference count per "
+           "iteration (default %.3f)\n"
+           "  -f, --filter=TEXT    soak only entry points containing TEXT\n"
+           "  -v, --verbose        report memory usage at checkpoints\n",
+           progname, DEFAULT_ITERATIONS, DEFAULT_MAX_BYTES,
+           DEFAULT_MAX_REFS);
+}
+
+int
+main (int argc, char **argv)
+{
+  static struct option long_options[] = {
+    {"iterations", required_argument, NULL, 'n'},
+    {"max-bytes",  required_argument, NULL, 'b'},
+    {"max-refs",   required_argument, NULL, 'r'},
+    {"filter",     required_argument, NULL, 'f'},
+    {"verbose",    no_argument,       NULL, 'v'},
+    {"help",       no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  const soak_t *soak;
+  int c, saved, devnull, failures = 0;
+
+  while ((c = getopt_long (argc, argv, "n:b:r:f:vh",
+                           long_options, NULL)) != -1)
+    {
+      switch (c)
+        {
+        case 'n': opt_iterations = MAX (atol (optarg), 1); break;
+        case 'b': opt_max_bytes = atof (optarg); break;
+        case 'r': opt_max_refs = atof (optarg); break;
+        case 'f': opt_filter = optarg; break;
+        case 'v': opt_verbose = 1; break;
+        default:
+          usage (argv[0]);
+          return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+  if (optind < argc)
+    {
+      snprintf (script_file, sizeof (script_file), "%s", argv[optind]);
+    }
+  else if (create_script_file ())
+    {
+      perror ("Unable to create temporary script");
+      return EXIT_FAILURE;
+    }
+
+#ifndef Py_REF_DEBUG
+  printf ("Python is built without Py_REF_DEBUG, "
+          "reference count is not tracked\n");
+#endif
+
+  /* Hide messages of python_init() */
+  fflush (stdout);
+  saved = dup (STDOUT_FILENO);
+  devnull = open ("/dev/null", O_WRONLY);
+  dup2 (devnull, STDOUT_FILENO);
+  close (devnull);
+
+  if (python_init (1, argv, no_modules))
+    {
+      return EXIT_FAILURE;
+    }
+
+  fflush (stdout);
+  dup2 (saved, STDOUT_FILENO);
+  close (saved);
+
+  setup_fixtures ();
+
+  for (soak = soaks; soak->name; ++soak)
+    {
+      if (!opt_filter || strstr (soak->name, opt_filter))
+        {
+          failures += run_soak (soak);
+        }
+    }
+
+  teardown_fixtures ();
+
+  python_done ();
+
+  if (script_is_temporary)
+    {
+      unlink (script_file);
+    }
+
+  if (failures)
+    {
+      printf ("%d entry point(s) exceeded allowed growth\n", failures);
+    }
+
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}